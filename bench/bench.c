@@ -0,0 +1,526 @@
+#include "decode.h"
+#include "flow.h"
+#include "talkers.h"
+#include "timing.h"
+#include "filter.h"
+#include "stats.h"
+#include "rate.h"
+#include "spsc.h"
+#include "packet.h"
+#include "errors.h"
+#include "clock.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+// Defines the report formats
+#define FORMAT_TEXT 0
+#define FORMAT_JSON 1 // One JSON object per stage and line
+#define FORMAT_CSV  2
+
+#define DEFAULT_FRAMES     (1 << 16)
+#define DEFAULT_ITERATIONS 20
+#define DEFAULT_HOSTS      1024
+#define DEFAULT_SEED       1
+#define MERGE_WORKERS      4 // Counter blocks merged per step of the merge stage
+#define BENCH_FILTER       "ip4 and udp and port 5001"
+#define FRAME_GAP_NS       1000 // Capture time between synthetic frames
+#define QUEUE_BATCH        64   // Frames pushed between commits in the queue stage, as a capture wakeup might
+#define BENCH_SAMPLE       16   // One flow in this many decoded in full in the sampled stage
+
+// A kind of frame in the synthetic mix
+typedef struct {
+    const char *name;
+    uint16_t ethertype;
+    uint8_t protocol;    // IP protocol, or the extension header in front of TCP, unused for ARP and netrans
+    unsigned int weight; // Relative share of the mix
+} BENCH_KIND;
+
+// The synthetic frames, stored back to back in one buffer
+typedef struct {
+    uint8_t *data;
+    size_t *offsets;
+    int *lens;
+    unsigned int count;
+} BENCH_FRAMES;
+
+// The result of timing one stage
+typedef struct {
+    const char *stage;
+    unsigned long items;       // Frames or operations processed
+    uint64_t ns;               // Time taken
+    unsigned long allocs;      // Calls to malloc, calloc and realloc
+    unsigned long alloc_bytes; // Bytes requested by those calls
+} BENCH_RESULT;
+
+static BENCH_KIND kinds[] = {
+    {"ip4tcp",  ETH_TYPE_IP4,     IP_PROTOCOL_TCP,     40},
+    {"ip4udp",  ETH_TYPE_IP4,     IP_PROTOCOL_UDP,     25},
+    {"ip4icmp", ETH_TYPE_IP4,     IP_PROTOCOL_ICMP,    5},
+    {"ip6tcp",  ETH_TYPE_IP6,     IP_PROTOCOL_TCP,     10},
+    {"ip6udp",  ETH_TYPE_IP6,     IP_PROTOCOL_UDP,     10},
+    {"arp",     ETH_TYPE_ARP,     0,                   5},
+    {"netrans", ETH_TYPE_NETRANS, 0,                   5},
+    {"vlanudp", ETH_TYPE_VLAN,    IP_PROTOCOL_UDP,     0},
+    {"ip6ext",  ETH_TYPE_IP6,     IP6_EXT_HOP,         0}
+};
+#define NUM_KINDS (int)(sizeof(kinds) / sizeof(kinds[0]))
+
+// Allocation counters fed by the --wrap'd allocator below
+static unsigned long alloc_calls, alloc_bytes;
+static uint64_t rng_state;
+
+static int parse_mix(char *arg);
+static uint32_t rng_next();
+static BENCH_FRAMES *frames_generate(unsigned int count, unsigned int hosts);
+static int frame_build(uint8_t *frame, BENCH_KIND *kind, unsigned int src, unsigned int dst, int len);
+static void count_frame(void *arg, char *frame, int len, int wire_len, uint64_t ts_ns);
+static void bench_begin(BENCH_RESULT *r, const char *stage);
+static void bench_end(BENCH_RESULT *r, unsigned long items);
+static void report(BENCH_RESULT *results, int n, int format);
+static void usage(char *name);
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    ++alloc_calls;
+    alloc_bytes += size;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    ++alloc_calls;
+    alloc_bytes += n * size;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    ++alloc_calls;
+    alloc_bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+// Drives the decode and accounting path over synthetic frames held in memory, with
+// no socket and no terminal, and reports the cost of each stage
+int main(int argc, char *argv[])
+{
+    BENCH_RESULT results[7];
+    BENCH_FRAMES *frames;
+    DECODE_SHARED shared;
+    DECODER dec;
+    PACKET_VIEW view;
+    HOST_TABLE *addrs;
+    FLOW_TABLE *flows;
+    TALKER_TABLE *talkers;
+    NETRANS_TABLE *netrans;
+    HLL_WINDOW *distinct;
+    TIMING *timing;
+    NETMON_STATS stats, totals, workers[MERGE_WORKERS];
+    struct sock_fprog *filter;
+    RATE_QUEUE *rq;
+    SPSC_RING *queue;
+    RATE rates[RATE_WINDOWS];
+    unsigned int count = DEFAULT_FRAMES, iterations = DEFAULT_ITERATIONS, hosts = DEFAULT_HOSTS;
+    unsigned long matched = 0, dequeued = 0, parsed = 0;
+    int format = FORMAT_TEXT, opt, n = 0;
+
+    rng_state = DEFAULT_SEED;
+    while((opt = getopt(argc, argv, "n:i:H:x:s:o:h")) != -1) {
+        switch(opt) {
+            case 'n':
+                count = strtoul(optarg, NULL, 10);
+                break;
+            case 'i':
+                iterations = strtoul(optarg, NULL, 10);
+                break;
+            case 'H':
+                hosts = strtoul(optarg, NULL, 10);
+                break;
+            case 'x':
+                if(parse_mix(optarg) == -1) {
+                    sprintf(error_msg, "Invalid frame mix '%.200s'", optarg);
+                    die(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                rng_state = strtoull(optarg, NULL, 10);
+                break;
+            case 'o':
+                if(strcmp(optarg, "text") == 0) {
+                    format = FORMAT_TEXT;
+                } else if(strcmp(optarg, "json") == 0) {
+                    format = FORMAT_JSON;
+                } else if(strcmp(optarg, "csv") == 0) {
+                    format = FORMAT_CSV;
+                } else {
+                    sprintf(error_msg, "Invalid output format '%.200s'", optarg);
+                    die(EXIT_FAILURE);
+                }
+                break;
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if(count == 0 || iterations == 0 || hosts < 2) {
+        sprintf(error_msg, "Frame, iteration and host counts must be positive, with at least two hosts");
+        die(EXIT_FAILURE);
+    }
+    if(rng_state == 0) rng_state = DEFAULT_SEED;
+
+    frames = frames_generate(count, hosts);
+
+    // Hosts, flows, talkers, netrans sessions, distinct addresses and timing are tracked
+    // as netmon does by default, their tables are allocated up front
+    if(!(addrs = host_table_new(DEFAULT_HOST_MEMORY))) die(EXIT_FAILURE);
+    if(!(flows = flow_table_new(DEFAULT_FLOW_MEMORY, DEFAULT_FLOW_TIMEOUT))) die(EXIT_FAILURE);
+    talkers = talker_table_new();
+    netrans = netrans_table_new(NETRANS_TIMEOUT_SECS);
+    distinct = hll_window_new();
+    timing = timing_new(DEFAULT_BURST_PACKETS, DEFAULT_BURST_USECS);
+
+    // The first pass fills the address registries and flow table from empty, so it carries their growth
+    memset(&stats, 0, sizeof(stats));
+    bench_begin(&results[n], "decode_cold");
+    decode_shared_init(&shared, DEFAULT_EXACT_ADDRS);
+    decoder_init(&dec, &stats, &shared, addrs, flows, talkers, netrans, distinct, timing, 1);
+    for(unsigned int i = 0; i < frames->count; ++i)
+        decode_frame(&dec, (char *)frames->data + frames->offsets[i], frames->lens[i], frames->lens[i],
+                (uint64_t)i * FRAME_GAP_NS);
+    bench_end(&results[n++], frames->count);
+
+    // Later passes only see known addresses, the steady state of a long capture
+    bench_begin(&results[n], "decode_warm");
+    for(unsigned int it = 0; it < iterations; ++it)
+        for(unsigned int i = 0; i < frames->count; ++i)
+            decode_frame(&dec, (char *)frames->data + frames->offsets[i], frames->lens[i], frames->lens[i],
+                    (uint64_t)i * FRAME_GAP_NS);
+    bench_end(&results[n++], (unsigned long)frames->count * iterations);
+
+    // Overloaded, where most frames are only counted
+    decoder_set_sample(&dec, BENCH_SAMPLE);
+    bench_begin(&results[n], "decode_sampled");
+    for(unsigned int it = 0; it < iterations; ++it)
+        for(unsigned int i = 0; i < frames->count; ++i)
+            decode_frame(&dec, (char *)frames->data + frames->offsets[i], frames->lens[i], frames->lens[i],
+                    (uint64_t)i * FRAME_GAP_NS);
+    bench_end(&results[n++], (unsigned long)frames->count * iterations);
+
+    // Dissecting alone, what every frame costs before anything is accounted
+    bench_begin(&results[n], "parse");
+    for(unsigned int it = 0; it < iterations; ++it)
+        for(unsigned int i = 0; i < frames->count; ++i)
+            parsed += decode_parse(&view, (char *)frames->data + frames->offsets[i], frames->lens[i], frames->lens[i],
+                    (uint64_t)i * FRAME_GAP_NS) == 0;
+    bench_end(&results[n++], (unsigned long)frames->count * iterations);
+
+    // The userspace filter used when replaying capture files
+    if(!(filter = filter_compile(BENCH_FILTER, FILTER_ACCEPT))) die(EXIT_FAILURE);
+    bench_begin(&results[n], "filter");
+    for(unsigned int it = 0; it < iterations; ++it)
+        for(unsigned int i = 0; i < frames->count; ++i)
+            matched += filter_match(filter, frames->data + frames->offsets[i], frames->lens[i]);
+    bench_end(&results[n++], (unsigned long)frames->count * iterations);
+
+    // Handing frames from a capture thread to a decode thread, both ends run here in
+    // turn so only the copies and index updates are timed
+    if(!(queue = spsc_ring_new(DEFAULT_SPSC_SLOTS, FILTER_ACCEPT))) die(EXIT_FAILURE);
+    bench_begin(&results[n], "queue");
+    for(unsigned int it = 0; it < iterations; ++it) {
+        for(unsigned int i = 0; i < frames->count; ++i) {
+            spsc_push(queue, (char *)frames->data + frames->offsets[i], frames->lens[i], frames->lens[i],
+                    (uint64_t)i * FRAME_GAP_NS);
+            if(i % QUEUE_BATCH == QUEUE_BATCH - 1) {
+                spsc_commit(queue);
+                while(spsc_drain(queue, count_frame, &dequeued, DEFAULT_SPSC_SLOTS));
+            }
+        }
+        spsc_commit(queue);
+        while(spsc_drain(queue, count_frame, &dequeued, DEFAULT_SPSC_SLOTS));
+    }
+    bench_end(&results[n++], (unsigned long)frames->count * iterations);
+
+    // What the main thread does on every rate tick: merge the worker counters, sample
+    // them into the rate queue and work out every window's rates
+    for(int i = 0; i < MERGE_WORKERS; ++i) workers[i] = stats;
+    rq = rate_queue_new(RATE_TICK_MS);
+    bench_begin(&results[n], "merge_rate");
+    for(unsigned int it = 0; it < iterations * 1000; ++it) {
+        memset(&totals, 0, sizeof(totals));
+        for(int i = 0; i < MERGE_WORKERS; ++i) stats_merge(&totals, &workers[i]);
+        rate_queue_push(rq, &totals, (uint64_t)it * RATE_TICK_MS * 1000000ULL);
+        rate_queue_rates(rq, rates);
+    }
+    bench_end(&results[n++], (unsigned long)iterations * 1000);
+
+    // Keep the work observable so none of it can be optimized away
+    if(stats.packet_total != (unsigned long)frames->count * (iterations * 2 + 1) || matched == (unsigned long)-1 ||
+            dequeued != (unsigned long)frames->count * iterations || parsed != dequeued ||
+            rates[RATE_60S].pps[RATE_ALL] < 0) {
+        sprintf(error_msg, "Decoded %lu frames, expected %lu", stats.packet_total,
+                (unsigned long)frames->count * (iterations * 2 + 1));
+        die(EXIT_FAILURE);
+    }
+
+    report(results, n, format);
+    return EXIT_SUCCESS;
+}
+
+// Parses weights such as "ip4tcp=40,arp=5", kinds not named keep their default
+static int parse_mix(char *arg)
+{
+    char *copy, *item, *save, *eq, *endptr;
+    unsigned long weight;
+    int found, result = 1;
+
+    copy = strdup(arg);
+    for(item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        if(!(eq = strchr(item, '='))) {
+            result = -1;
+            break;
+        }
+        *eq = '\0';
+        weight = strtoul(eq + 1, &endptr, 10);
+        if(*(eq + 1) == '\0' || *endptr != '\0' || weight > 1000000) {
+            result = -1;
+            break;
+        }
+
+        found = 0;
+        for(int i = 0; i < NUM_KINDS; ++i) {
+            if(strcmp(kinds[i].name, item) == 0) {
+                kinds[i].weight = weight;
+                found = 1;
+            }
+        }
+        if(!found) {
+            result = -1;
+            break;
+        }
+    }
+    free(copy);
+
+    weight = 0;
+    for(int i = 0; i < NUM_KINDS; ++i) weight += kinds[i].weight;
+    return weight ? result : -1;
+}
+
+// xorshift64*, so a seed always produces the same mix
+static uint32_t rng_next()
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+// Builds count frames drawn from the weighted mix, between random pairs of hosts,
+// with a mix of small, medium and full sized frames
+static BENCH_FRAMES *frames_generate(unsigned int count, unsigned int hosts)
+{
+    BENCH_FRAMES *frames;
+    unsigned int total = 0, pick, src, dst;
+    int len, kind, r;
+    size_t pos = 0;
+
+    for(int i = 0; i < NUM_KINDS; ++i) total += kinds[i].weight;
+
+    frames = (BENCH_FRAMES *)malloc(sizeof(BENCH_FRAMES));
+    frames->data = (uint8_t *)malloc((size_t)count * 1536);
+    frames->offsets = (size_t *)malloc(count * sizeof(size_t));
+    frames->lens = (int *)malloc(count * sizeof(int));
+    frames->count = count;
+
+    for(unsigned int i = 0; i < count; ++i) {
+        pick = rng_next() % total;
+        for(kind = 0; pick >= kinds[kind].weight; ++kind) pick -= kinds[kind].weight;
+
+        r = rng_next() % 10;
+        len = (r < 5) ? 64 : (r < 7) ? 576 : 1514;
+        src = rng_next() % hosts;
+        do {
+            dst = rng_next() % hosts;
+        } while(dst == src);
+
+        frames->offsets[i] = pos;
+        frames->lens[i] = frame_build(frames->data + pos, &kinds[kind], src, dst, len);
+        pos += (frames->lens[i] + 63) & ~63;
+    }
+
+    return frames;
+}
+
+// Writes one frame of the given kind, returns its length
+static int frame_build(uint8_t *frame, BENCH_KIND *kind, unsigned int src, unsigned int dst, int len)
+{
+    PACKET_ETH_HDR eth;
+    PACKET_VLAN_TAG tag;
+    PACKET_IP4_HDR ip4;
+    PACKET_IP6_HDR ip6;
+    PACKET_IP6_EXT ext;
+    PACKET_ARP_HDR arp;
+    PACKET_NETRANS_HDR netrans;
+    uint8_t *payload, protocol = kind->protocol;
+    uint16_t ports[2], ethertype = kind->ethertype;
+
+    memset(frame, 0, len);
+    memset(&eth, 0, sizeof(eth));
+    eth.eth_mac_src[0] = eth.eth_mac_dest[0] = 0x02;
+    memcpy(eth.eth_mac_src + 2, &src, 4);
+    memcpy(eth.eth_mac_dest + 2, &dst, 4);
+    eth.eth_type = htons(kind->ethertype);
+    memcpy(frame, &eth, sizeof(eth));
+    payload = frame + sizeof(eth);
+
+    // Tagged frames carry IPv4 behind a single 802.1Q tag
+    if(ethertype == ETH_TYPE_VLAN) {
+        tag.vlan_tci = htons(1 + rng_next() % 4094);
+        tag.vlan_type = htons(ETH_TYPE_IP4);
+        memcpy(payload, &tag, sizeof(tag));
+        payload += sizeof(tag);
+        ethertype = ETH_TYPE_IP4;
+    }
+
+    switch(ethertype) {
+        case ETH_TYPE_IP4:
+            memset(&ip4, 0, sizeof(ip4));
+            ip4.ip4_vers_ihl = 0x45;
+            ip4.ip4_tlen = htons(len - (payload - frame));
+            ip4.ip4_ttl = 64;
+            ip4.ip4_protocol = protocol;
+            ip4.ip4_src[0] = ip4.ip4_dest[0] = 10;
+            ip4.ip4_src[1] = src >> 16;
+            ip4.ip4_src[2] = src >> 8;
+            ip4.ip4_src[3] = src;
+            ip4.ip4_dest[1] = dst >> 16;
+            ip4.ip4_dest[2] = dst >> 8;
+            ip4.ip4_dest[3] = dst;
+            memcpy(payload, &ip4, sizeof(ip4));
+            payload += sizeof(ip4);
+            break;
+        case ETH_TYPE_IP6:
+            memset(&ip6, 0, sizeof(ip6));
+            ip6.ip6_junk[0] = 0x60;
+            ip6.ip6_protocol = protocol;
+            ip6.ip6_hop = 64;
+            ip6.ip6_src[0] = ip6.ip6_dest[0] = 0xfd;
+            memcpy(ip6.ip6_src + 12, &src, 4);
+            memcpy(ip6.ip6_dest + 12, &dst, 4);
+            memcpy(payload, &ip6, sizeof(ip6));
+            payload += sizeof(ip6);
+
+            // An empty hop-by-hop header in front of TCP
+            if(protocol == IP6_EXT_HOP) {
+                memset(payload, 0, 8);
+                ext.ip6_ext_next = protocol = IP_PROTOCOL_TCP;
+                ext.ip6_ext_len = 0;
+                memcpy(payload, &ext, sizeof(ext));
+                payload += 8;
+            }
+            break;
+        case ETH_TYPE_ARP:
+            memset(&arp, 0, sizeof(arp));
+            arp.arp_htype = htons(1);
+            arp.arp_ptype = htons(ETH_TYPE_IP4);
+            arp.arp_hlen = 6;
+            arp.arp_plen = 4;
+            arp.arp_oper = htons(rng_next() % 2 ? ARP_OPER_REQUEST : ARP_OPER_REPLY);
+            memcpy(payload, &arp, sizeof(arp));
+            return 64;
+        case ETH_TYPE_NETRANS:
+            netrans.netrans_src = src;
+            netrans.netrans_dest = dst;
+            netrans.netrans_type = NETRANS_TYPE_SEND + rng_next() % 4;
+            memcpy(payload, &netrans, sizeof(netrans));
+            return len;
+    }
+
+    // Transport ports, a few of the flows land on the benchmark filter's port
+    if(protocol == IP_PROTOCOL_TCP || protocol == IP_PROTOCOL_UDP) {
+        ports[0] = htons(1024 + rng_next() % 50000);
+        ports[1] = htons(5000 + rng_next() % 8);
+        memcpy(payload, ports, sizeof(ports));
+    }
+    return len;
+}
+
+// Counts dequeued frames for the queue stage
+static void count_frame(void *arg, char *frame, int len, int wire_len, uint64_t ts_ns)
+{
+    (*(unsigned long *)arg)++;
+}
+
+static void bench_begin(BENCH_RESULT *r, const char *stage)
+{
+    r->stage = stage;
+    r->allocs = alloc_calls;
+    r->alloc_bytes = alloc_bytes;
+    r->ns = monotonic_ns();
+}
+
+static void bench_end(BENCH_RESULT *r, unsigned long items)
+{
+    r->ns = monotonic_ns() - r->ns;
+    r->items = items;
+    r->allocs = alloc_calls - r->allocs;
+    r->alloc_bytes = alloc_bytes - r->alloc_bytes;
+}
+
+static void report(BENCH_RESULT *results, int n, int format)
+{
+    BENCH_RESULT *r;
+    double ns_per_item, per_sec, allocs_per_item;
+
+    if(format == FORMAT_TEXT) {
+        printf("%-14s %10s %10s %14s %8s %12s %12s\n",
+                "stage", "items", "ns/item", "items/sec", "allocs", "alloc_bytes", "allocs/item");
+    } else if(format == FORMAT_CSV) {
+        printf("stage,items,ns_per_item,items_per_sec,allocs,alloc_bytes,allocs_per_item\n");
+    }
+
+    for(int i = 0; i < n; ++i) {
+        r = &results[i];
+        ns_per_item = (double)r->ns / r->items;
+        per_sec = r->ns ? r->items * 1e9 / r->ns : 0.0;
+        allocs_per_item = (double)r->allocs / r->items;
+
+        switch(format) {
+            case FORMAT_TEXT:
+                printf("%-14s %10lu %10.2f %14.0f %8lu %12lu %12.6f\n", r->stage, r->items,
+                        ns_per_item, per_sec, r->allocs, r->alloc_bytes, allocs_per_item);
+                break;
+            case FORMAT_JSON:
+                printf("{\"stage\":\"%s\",\"items\":%lu,\"ns_per_item\":%.2f,\"items_per_sec\":%.0f,"
+                        "\"allocs\":%lu,\"alloc_bytes\":%lu,\"allocs_per_item\":%.6f}\n", r->stage, r->items,
+                        ns_per_item, per_sec, r->allocs, r->alloc_bytes, allocs_per_item);
+                break;
+            case FORMAT_CSV:
+                printf("%s,%lu,%.2f,%.0f,%lu,%lu,%.6f\n", r->stage, r->items,
+                        ns_per_item, per_sec, r->allocs, r->alloc_bytes, allocs_per_item);
+                break;
+        }
+    }
+}
+
+static void usage(char *name)
+{
+    fprintf(stderr, "Usage: %s [-n <frames>] [-i <iterations>] [-H <hosts>] [-x <mix>] [-s <seed>] [-o <format>]\n", name);
+    fprintf(stderr, "%-20s %s\n", "-n <frames>", "Synthetic frames generated (default 65536)");
+    fprintf(stderr, "%-20s %s\n", "-i <iterations>", "Passes over the frames in the warm stages (default 20)");
+    fprintf(stderr, "%-20s %s\n", "-H <hosts>", "Distinct hosts the frames are exchanged between (default 1024)");
+    fprintf(stderr, "%-20s %s\n", "-x <mix>", "Frame mix weights, e.g. \"ip4tcp=40,ip4udp=25,ip4icmp=5,ip6tcp=10,ip6udp=10,arp=5,netrans=5,vlanudp=0,ip6ext=0\"");
+    fprintf(stderr, "%-20s %s\n", "-s <seed>", "Seed of the frame generator (default 1)");
+    fprintf(stderr, "%-20s %s\n", "-o <format>", "Report format, 'text' (default), 'json' (one object per line) or 'csv'");
+}
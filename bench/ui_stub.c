@@ -0,0 +1,45 @@
+#include "ui.h"
+
+// The benchmark drives the decoder without a terminal, so everything it would
+// have displayed is discarded
+
+void ui_init(int fps, ui_totals_source totals, ui_hosts_source hosts, ui_flows_source flows,
+        ui_talkers_source talkers, ui_sessions_source sessions)
+{
+}
+
+void ui_shutdown()
+{
+}
+
+void ui_set_view(int view)
+{
+}
+
+void ui_display_packet(uint8_t *mac_dest, uint8_t *mac_src, const char *type, const char *type_type)
+{
+}
+
+void ui_next_host_rank()
+{
+}
+
+void ui_display_rate(RATE *rates, CAPTURE_STATS *kernel, CAPTURE_STATS *last_second, unsigned int sample)
+{
+}
+
+void ui_display_distinct(HLL_ESTIMATE *distinct)
+{
+}
+
+void ui_display_timing(TIMING_STATS *timing)
+{
+}
+
+void ui_display_queues(SPSC_STATS *queues)
+{
+}
+
+void ui_display_error(const char *error_msg)
+{
+}
@@ -0,0 +1,34 @@
+#ifndef ADDRSET_H_
+#define ADDRSET_H_
+
+#include <stdint.h>
+
+// Defines the kinds of address an ADDR_SET can hold
+#define ADDR_MAC 1
+#define ADDR_IP4 2
+#define ADDR_IP6 3
+
+#define DEFAULT_ADDR_SET_CAPACITY 256 // Initial number of slots, always a power of two
+
+// A binary address, the family is zero for an empty slot
+typedef struct {
+    uint64_t lo;     // First eight bytes of the address, zero padded
+    uint64_t hi;     // Remaining bytes of an IPv6 address
+    uint32_t family; // ADDR_MAC, ADDR_IP4 or ADDR_IP6
+    uint32_t hash;   // Cached hash of the address
+} ADDR_ENTRY;
+
+// An open-addressing hash set of binary addresses using linear probing
+typedef struct {
+    ADDR_ENTRY *slots;
+    unsigned int capacity, len;
+    unsigned int limit; // Most addresses the set will hold, 0 for no limit
+} ADDR_SET;
+
+extern ADDR_SET *addr_set_new(unsigned int capacity, unsigned int limit);
+
+// Adds the address to the set, returns 1 if it was added and 0 if it was already
+// present or the set is full
+extern int addr_set_insert(ADDR_SET *set, uint32_t family, const uint8_t *addr);
+
+#endif
@@ -2,10 +2,41 @@
 #define NETMON_ARGS_H
 
 #include <stdint.h>
+#include <stddef.h>
+
+#define MAX_WORKERS 64
 
 typedef struct {
     char *net_device;
-    uint16_t ether_type;
+    char *filter;             // Filter expression compiled to BPF, NULL to accept everything
+    int capture_backend;      // CAPTURE_RING, CAPTURE_MMSG or CAPTURE_RECV
+    unsigned int block_size;  // Size in bytes of each packet ring block
+    unsigned int block_count; // Number of blocks in the packet ring
+    unsigned int mmsg_batch;  // Frames received by each recvmmsg
+    unsigned int rcvbuf;      // Bytes of each socket's receive buffer, 0 for the system default
+    int fps;                  // Frames per second drawn by the UI
+    int workers;              // Number of capture sockets and decode workers
+    int fanout_mode;          // PACKET_FANOUT mode used to spread frames across workers
+    char *read_file;          // Replay this pcap or pcapng file instead of capturing
+    double replay_speed;      // Multiple of the original replay speed, 0 for as fast as possible
+    char *write_prefix;       // Save accepted frames to pcap files named after this, NULL to not save
+    unsigned int snaplen;     // Bytes of each frame captured and saved
+    unsigned long rotate_bytes; // Start a new pcap file after this many bytes, 0 to never
+    unsigned int rotate_secs; // Start a new pcap file after this many seconds, 0 to never
+    int headless;             // Print structured stats instead of drawing with ncurses
+    unsigned int report_interval_ms; // Milliseconds between headless records
+    int report_format;        // REPORT_JSON or REPORT_CSV
+    char *report_path;        // File headless records are appended to, NULL for stdout
+    char *metrics_address;    // Where OpenMetrics are served, NULL to not serve them
+    char *shm_name;           // Shared memory segment counters are published in, NULL to not publish
+    size_t flow_memory;       // Bytes each worker's flow table may use, 0 to not track flows
+    unsigned int flow_timeout; // Seconds before an idle flow is expired
+    size_t host_memory;       // Bytes each worker's host table may use
+    unsigned int exact_addrs; // Addresses of each kind counted exactly, 0 to only estimate
+    unsigned int burst_packets; // Frames arriving within burst_usecs that make a burst
+    unsigned int burst_usecs;
+    unsigned int queue_slots; // Frames queued between each worker's capture and decode threads, 0 for one thread
+    unsigned int sample_ratio; // One flow in this many decoded in full, 0 to adapt to the load
 } netmon_args_t;
 
 extern netmon_args_t *args_process(int argc, char *argv[]);
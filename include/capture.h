@@ -0,0 +1,88 @@
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/filter.h>
+
+// Defines the available capture backends
+#define CAPTURE_RECV 0 // One recvfrom per frame into a private buffer
+#define CAPTURE_RING 1 // mmap'd TPACKET_V3 block ring, frames read in place
+#define CAPTURE_MMSG 2 // recvmmsg of a batch of frames into preallocated buffers
+
+#define CAPTURE_MAX_BUFFER 65536 // Largest recvfrom or recvmmsg buffer, longer frames still count in full
+#define DEFAULT_MMSG_BATCH 64    // Frames received by each recvmmsg
+#define MAX_MMSG_BATCH 1024
+
+#define DEFAULT_BLOCK_SIZE  (1 << 20) // Size in bytes of each ring block
+#define DEFAULT_BLOCK_COUNT 64        // Number of blocks in the ring
+#define RING_FRAME_SIZE     2048      // Nominal frame slot size for the ring
+#define RING_RETIRE_TIMEOUT 60        // Milliseconds before a partial block is handed over
+
+// Called once for every captured frame with the argument given to capture_dispatch,
+// len is the number of bytes available at frame, wire_len is the length on the wire
+// and ts_ns the capture time in nanoseconds since the epoch
+typedef void (*capture_handler)(void *arg, char *frame, int len, int wire_len, uint64_t ts_ns);
+
+// What the kernel reports about a capture socket, accumulated since it was opened
+typedef struct {
+    unsigned long packets;    // Frames that passed the filter, whether or not they were dropped
+    unsigned long drops;      // Frames dropped for lack of room in the ring or socket buffer
+    unsigned long freezes;    // Times the ring filled and the kernel stopped filling it, ring only
+} CAPTURE_STATS;
+
+typedef struct {
+    int sockfd;               // The raw socket frames are captured from
+    int backend;              // CAPTURE_RECV, CAPTURE_RING or CAPTURE_MMSG
+    char *buffer;             // Receive buffer for the recvfrom backend
+    unsigned int snaplen;     // Bytes asked for of each frame
+    unsigned int buffer_size; // Bytes of each receive buffer, the snaplen up to CAPTURE_MAX_BUFFER
+    uint8_t *ring;            // The mmap'd block ring
+    size_t ring_len;          // Total length of the mapping
+    unsigned int block_size;  // Size of each block in bytes
+    unsigned int block_count; // Number of blocks in the ring
+    unsigned int block_pos;   // The next block to be handed to userspace
+    struct mmsghdr *msgs;     // One header per frame of a recvmmsg batch
+    struct iovec *iovs;       // Their buffers, buffer_size bytes each
+    char *batch_buffer;       // Backs every buffer of the batch
+    char *batch_control;      // Room for each frame's timestamp and auxiliary data
+    unsigned int batch;       // Frames received by each recvmmsg
+    CAPTURE_STATS kernel;     // Only touched by capture_read_stats
+} CAPTURE;
+
+// Opens a raw socket bound to device_name that hands over at most snaplen bytes of each
+// frame, along with its length on the wire. Returns NULL and sets error_msg on failure
+extern CAPTURE *capture_open(char *device_name, unsigned int snaplen);
+
+// Attaches a classic BPF program so unwanted frames never leave the kernel
+extern int capture_attach_filter(CAPTURE *cap, struct sock_fprog *prog);
+
+// Switches the capture over to a mmap'd TPACKET_V3 ring
+extern int capture_ring_setup(CAPTURE *cap, unsigned int block_size, unsigned int block_count);
+
+// Switches the capture over to recvmmsg, receiving up to batch frames a call
+extern int capture_mmsg_setup(CAPTURE *cap, unsigned int batch);
+
+// Sets the socket's receive buffer to bytes, beyond the system limit if privileged
+extern int capture_set_rcvbuf(CAPTURE *cap, unsigned int bytes);
+
+// Most bytes of a frame the backend hands over, the snaplen unless a receive buffer
+// or ring block is smaller
+extern unsigned int capture_snaplen(CAPTURE *cap);
+
+// Adds what the kernel counted since the last call to cap->kernel. The kernel resets
+// its counters when read, so a capture must only be read from one thread
+extern void capture_read_stats(CAPTURE *cap);
+
+// Percentage of the ring's blocks waiting for userspace, 0 for the socket backends.
+// Safe to call from another thread, only the blocks' status words are read
+extern unsigned int capture_ring_fill(CAPTURE *cap);
+
+// Joins a PACKET_FANOUT group so the kernel spreads frames across its sockets,
+// mode is one of PACKET_FANOUT_HASH, PACKET_FANOUT_CPU or PACKET_FANOUT_LB
+extern int capture_join_fanout(CAPTURE *cap, int group, int mode);
+
+// Hands any waiting frames to handler without blocking, returns the number of frames
+extern int capture_dispatch(CAPTURE *cap, capture_handler handler, void *arg);
+
+#endif
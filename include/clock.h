@@ -0,0 +1,12 @@
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include <stdint.h>
+
+// Nanoseconds since some fixed point, for timing intervals that the wall clock stepping must not upset
+extern uint64_t monotonic_ns();
+
+// Nanoseconds since the epoch, as capture timestamps and records are
+extern uint64_t realtime_ns();
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef DECODE_H_
+#define DECODE_H_
+
+#include "stats.h"
+#include "addrset.h"
+#include "hosts.h"
+#include "flow.h"
+#include "talkers.h"
+#include "netrans.h"
+#include "hll.h"
+#include "timing.h"
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define DEFAULT_EXACT_ADDRS 65536 // Addresses of each kind counted exactly before the sets stop growing
+
+// Exact address registries shared by every decoder, capped so hostile traffic cannot
+// grow them without bound
+typedef struct {
+    pthread_mutex_t lock; // Guards both sets
+    ADDR_SET *ip_addrs;   // The set of all IP addresses seen, NULL if not counted
+    ADDR_SET *mac_addrs;  // The set of all MAC addresses seen, NULL if not counted
+} DECODE_SHARED;
+
+// A frame dissected in place by decode_parse. Nothing is copied out of the frame or
+// formatted, the pointers and offsets are into it and only valid while the frame is
+typedef struct {
+    char *frame;
+    int len;                 // Bytes captured
+    int wire_len;            // Bytes on the wire
+    uint64_t ts_ns;          // Capture time
+    uint8_t *mac_dest, *mac_src;
+    uint8_t *ip_src, *ip_dst; // NULL unless an IP header was captured
+    int l3;                  // Offset of the header the ethertype names
+    int l4;                  // Offset of what follows it and any IPv6 extension headers, may be past len
+    uint16_t ethertype;      // Behind any VLAN tags
+    uint16_t op;             // ARP operation or netrans type
+    uint16_t sport, dport;   // TCP and UDP ports, 0 when not captured or a later fragment
+    uint8_t vlan_tags;       // VLAN tags met, walked or not
+    uint8_t family;          // ADDR_IP4 or ADDR_IP6 for IP, 0 otherwise
+    uint8_t protocol;        // IP protocol behind any extension headers
+    uint8_t fragment;        // A later IP fragment, which carries no transport header
+    uint8_t truncated;       // Captured too short for the header its ethertype names
+    uint8_t malformed;       // The header contradicts itself, as an IPv4 header under 20 bytes does
+    uint8_t ether_slot;      // Where decode.c's tables keep the ethertype's counters
+    uint8_t ip_slot;         // And the IP protocol's
+} PACKET_VIEW;
+
+// The state of a single decode thread, which counts into its own statistics and
+// only consults the shared registries for addresses it is not tracking itself
+typedef struct {
+    NETMON_STATS *stats;   // Counters only this decoder writes
+    HOST_TABLE *hosts;     // Traffic of the addresses this decoder has seen lately
+    DECODE_SHARED *shared;
+    int ip_addrs_full;     // The shared IP set is full or not kept, so the lock is not taken for it
+    int mac_addrs_full;    // Likewise for the shared MAC set
+    HLL_WINDOW *distinct;  // Estimates of the addresses seen, NULL if not estimated
+    FLOW_TABLE *flows;     // Conversations this decoder has seen, NULL if not tracked
+    TALKER_TABLE *talkers; // Heaviest hosts this decoder has seen, NULL if not tracked
+    NETRANS_TABLE *netrans; // Netrans transfers this decoder has seen, NULL if not tracked
+    TIMING *timing;        // Gaps between frames and bursts, NULL if not timed
+    int display;           // Hand packets, new addresses and errors to the UI
+    unsigned int sample;   // One flow in sample is decoded in full, set by the main thread
+    unsigned int weight;   // Frames the one being decoded stands for, 0 if it is only counted
+} DECODER;
+
+// Counts at most limit addresses of each kind, none when limit is 0
+extern void decode_shared_init(DECODE_SHARED *shared, unsigned int limit);
+extern void decoder_init(DECODER *d, NETMON_STATS *stats, DECODE_SHARED *shared, HOST_TABLE *hosts, FLOW_TABLE *flows,
+        TALKER_TABLE *talkers, NETRANS_TABLE *netrans, HLL_WINDOW *distinct, TIMING *timing, int display);
+
+// Decodes one flow in ratio in full from the next frame on, ratio is a power of two.
+// The rest are only counted, the hosts, flows, talkers, netrans sessions and packet
+// lines are left to the sample, scaled up where they are counts. May be called from any thread
+extern void decoder_set_sample(DECODER *d, unsigned int ratio);
+
+// Dissects one ethernet frame of len captured bytes into v without touching any state.
+// Returns -1 for a frame shorter than an ethernet header, which is not counted
+extern int decode_parse(PACKET_VIEW *v, char *frame, int len, int wire_len, uint64_t ts_ns);
+
+// Accounts a parsed frame, updating the statistics, hosts, flows, talkers, netrans
+// sessions and timing and handing new packets to the UI
+extern void decode_view(DECODER *d, PACKET_VIEW *v);
+
+// Parses and accounts one frame
+extern void decode_frame(DECODER *d, char *frame, int len, int wire_len, uint64_t ts_ns);
+
+#endif
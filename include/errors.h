@@ -3,7 +3,7 @@
 
 #define MAX_ERROR 255   // The maximum length of an error message
 
-char error_msg[MAX_ERROR];
+extern char error_msg[MAX_ERROR];
 
 extern void warn();
 extern void die(int exit_code);
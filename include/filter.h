@@ -0,0 +1,28 @@
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include <stdint.h>
+#include <linux/filter.h>
+
+#define MAX_FILTER_INSNS 512 // Longest classic BPF program the compiler will emit
+#define FILTER_ACCEPT 0x40000 // Most bytes of an accepted frame handed to userspace
+
+// Compiles a filter expression into a classic BPF program for SO_ATTACH_FILTER.
+// The grammar, with 'and' binding tighter than 'or':
+//
+//   expr      := term ('or' term)*
+//   term      := factor ('and' factor)*
+//   factor    := 'not' factor | '(' expr ')' | primitive
+//   primitive := 'ip4' | 'ip6' | 'arp' | 'netrans' | 'ether' <hex-type>
+//              | 'tcp' | 'udp' | 'icmp' | 'igmp' | ['src' | 'dst'] 'port' <number>
+//
+// '&&', '||' and '!' may be used in place of 'and', 'or' and 'not'. Accepted frames
+// are cut to snaplen bytes, and a NULL expression accepts every frame. Returns NULL
+// and sets error_msg if the expression is invalid.
+extern struct sock_fprog *filter_compile(const char *expr, uint32_t snaplen);
+
+// Runs a program in userspace, for frames that never passed through a socket.
+// Only the instructions filter_compile emits are supported, returns nonzero on a match
+extern int filter_match(struct sock_fprog *prog, const uint8_t *frame, uint32_t len);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef FLOW_H_
+#define FLOW_H_
+
+#include "table.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define DEFAULT_FLOW_MEMORY (16 << 20)     // Bytes a flow table may use, entries and index together
+#define DEFAULT_FLOW_TIMEOUT 60            // Seconds a flow may be idle before it is expired
+#define FLOW_TOP_MAX 64                    // Flows published by each table for display
+#define FLOW_PUBLISH_MS 250                // How often a table expires idle flows and publishes
+
+// A conversation, addresses are in network order and IPv4 addresses use the first four bytes
+typedef struct {
+    uint8_t src[16];
+    uint8_t dst[16];
+    uint16_t sport;  // Source port, zero for protocols without ports
+    uint16_t dport;  // Destination port
+    uint8_t family;  // ADDR_IP4 or ADDR_IP6
+    uint8_t proto;   // IP protocol number
+    uint8_t pad[2];  // Always zero so keys compare with memcmp
+} FLOW_KEY;
+
+typedef struct {
+    TABLE_LINK link;    // Cached hash and neighbours in the table's LRU list
+    FLOW_KEY key;
+    unsigned long packets;
+    unsigned long bytes;
+    uint64_t first_ns;  // Capture time of the first packet
+    uint64_t last_ns;   // Capture time of the latest packet
+} FLOW_ENTRY;
+
+// The busiest flows of one or more tables, sorted by bytes
+typedef struct {
+    FLOW_ENTRY flows[FLOW_TOP_MAX];
+    int len;
+    unsigned long active;   // Flows currently tracked
+    unsigned long evicted;  // Flows pushed out by the memory cap
+    unsigned long expired;  // Flows removed after going idle
+} FLOW_SUMMARY;
+
+// A fixed size flow table owned by a single decode thread. Everything is allocated
+// up front, when the pool is full the least recently seen flow is evicted. Other
+// threads only read the summary the owner publishes now and then
+typedef struct {
+    TABLE table;            // The flows, most recently seen at the head
+    uint64_t timeout_ns;    // Idle time before a flow is expired
+    unsigned long expired;
+    uint64_t published_ns;  // Monotonic time of the last publish
+
+    pthread_mutex_t lock;   // Guards the published summary
+    FLOW_SUMMARY published;
+} FLOW_TABLE;
+
+// Creates a table using at most max_bytes, returns NULL and sets error_msg if
+// that cannot hold a single flow
+extern FLOW_TABLE *flow_table_new(size_t max_bytes, unsigned int timeout_secs);
+
+// Accounts packets totalling bytes to a flow, creating the flow if it is new. A sampled
+// packet stands for several
+extern void flow_table_update(FLOW_TABLE *ft, FLOW_KEY *key, unsigned int packets, unsigned long bytes,
+        uint64_t ts_ns);
+
+// Expires flows idle since before now_ns less the timeout and publishes the busiest
+// flows, at most once every FLOW_PUBLISH_MS unless force is set
+extern void flow_table_publish(FLOW_TABLE *ft, uint64_t now_ns, int force);
+
+// Merges a table's published summary into sum, flows seen by several tables are added together
+extern void flow_summary_merge(FLOW_SUMMARY *sum, FLOW_TABLE *ft);
+
+// Orders a merged summary by bytes, busiest first
+extern void flow_summary_sort(FLOW_SUMMARY *sum);
+
+#endif
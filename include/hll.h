@@ -0,0 +1,56 @@
+#ifndef HLL_H_
+#define HLL_H_
+
+#include <stdint.h>
+
+#define HLL_PRECISION 12                    // Index bits, a standard error of about 1.6%
+#define HLL_REGISTERS (1 << HLL_PRECISION)  // One byte each, 4 KiB per sketch
+#define HLL_WINDOW_SLOTS 6                  // Sub-windows making up the sliding window
+#define HLL_SLOT_SECS 10                    // Length of each sub-window, the window covers a minute
+
+// Defines what each sketch of an HLL_WINDOW counts
+#define HLL_MAC     0 // Source and destination MAC addresses
+#define HLL_IP4_SRC 1
+#define HLL_IP4_DST 2
+#define HLL_IP6_SRC 3
+#define HLL_IP6_DST 4
+#define HLL_KINDS   5
+
+// A HyperLogLog sketch, each register holds the longest run of leading zeros seen
+// among the hashes that index it
+typedef struct {
+    uint8_t registers[HLL_REGISTERS];
+} HLL;
+
+// The distinct addresses seen by a single decode thread, since it started and over
+// the last HLL_WINDOW_SLOTS sub-windows of capture time. A sub-window is folded into
+// the running total when it is reused, so an address costs a single register update.
+// Other threads read the registers while the owner writes them, each byte is
+// accessed atomically
+typedef struct {
+    HLL total[HLL_KINDS];                       // Sub-windows that have been reused
+    HLL slots[HLL_WINDOW_SLOTS][HLL_KINDS];
+    uint64_t epochs[HLL_WINDOW_SLOTS];          // Sub-window each slot holds, 0 while unused
+    uint64_t epoch;                             // Sub-window being written
+    int slot;                                   // Slot being written
+} HLL_WINDOW;
+
+// Estimated distinct counts of each kind
+typedef struct {
+    double total[HLL_KINDS];  // Since capture started
+    double window[HLL_KINDS]; // Over the sliding window
+} HLL_ESTIMATE;
+
+extern HLL_WINDOW *hll_window_new();
+
+// Counts an address of len bytes seen at capture time ts_ns
+extern void hll_window_add(HLL_WINDOW *hw, int kind, const uint8_t *addr, int len, uint64_t ts_ns);
+
+// Merges a window's registers into sketches of the union of several windows. The
+// sliding window ends at now_ns, or at the newest sub-window written when now_ns is 0
+extern void hll_window_merge(HLL *total, HLL *window, HLL_WINDOW *hw, uint64_t now_ns);
+
+// Estimates every kind from merged sketches
+extern void hll_estimate(HLL_ESTIMATE *est, HLL *total, HLL *window);
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef HOSTS_H_
+#define HOSTS_H_
+
+#include "table.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define DEFAULT_HOST_MEMORY (8 << 20)     // Bytes a host table may use, entries and index together
+#define HOST_TOP_MAX 64                   // Hosts of each kind and rank published by each table
+#define HOST_PUBLISH_MS 250               // How often a table publishes its hosts
+
+// Defines the kinds of host, each has its own pane
+#define HOST_MAC   0
+#define HOST_IP    1
+#define HOST_KINDS 2
+
+// Defines what hosts are ranked by
+#define HOST_BY_BYTES   0 // Bytes sent and received
+#define HOST_BY_PACKETS 1 // Packets sent and received
+#define HOST_BY_RECENT  2 // Most recently seen first
+#define HOST_RANKS      3
+
+// A MAC uses the first six bytes of addr and an IP the first four or sixteen
+typedef struct {
+    uint8_t addr[16];
+    uint8_t family;  // ADDR_MAC, ADDR_IP4 or ADDR_IP6
+    uint8_t pad[7];  // Always zero so keys compare with memcmp
+} HOST_KEY;
+
+typedef struct {
+    TABLE_LINK link;    // Cached hash and neighbours in the table's LRU list
+    HOST_KEY key;
+    unsigned long tx_packets;
+    unsigned long rx_packets;
+    unsigned long tx_bytes;
+    unsigned long rx_bytes;
+    uint64_t first_ns;  // Capture time of the first packet
+    uint64_t last_ns;   // Capture time of the latest packet
+} HOST_ENTRY;
+
+// The top hosts of one or more tables for each kind and rank, in rank order once sorted
+typedef struct {
+    HOST_ENTRY top[HOST_KINDS][HOST_RANKS][HOST_TOP_MAX];
+    int len[HOST_KINDS][HOST_RANKS];
+    unsigned long active;   // Hosts currently tracked
+    unsigned long evicted;  // Hosts pushed out by the memory cap
+} HOST_SUMMARY;
+
+// The traffic of every MAC and IP address a single decode thread has seen lately.
+// Everything is allocated up front and entries never move, when the pool is full the
+// least recently seen host is evicted. Other threads only read the summary the owner
+// publishes now and then
+typedef struct {
+    TABLE table;            // The hosts, most recently seen at the head
+    uint64_t published_ns;  // Monotonic time of the last publish
+    int dirty;              // Updated since the last publish
+
+    pthread_mutex_t lock;   // Guards the published summary
+    HOST_SUMMARY published;
+} HOST_TABLE;
+
+// Creates a table using at most max_bytes, returns NULL and sets error_msg if
+// that cannot hold a single host
+extern HOST_TABLE *host_table_new(size_t max_bytes);
+
+// Accounts packets totalling bytes sent by the address, or received when rx is set,
+// creating its entry if it has none. Returns 1 if the entry is new. A sampled packet
+// stands for several
+extern int host_table_update(HOST_TABLE *ht, uint8_t family, const uint8_t *addr, int rx,
+        unsigned int packets, unsigned long bytes, uint64_t ts_ns);
+
+// Publishes the top hosts of each kind and rank, at most once every HOST_PUBLISH_MS
+// unless force is set
+extern void host_table_publish(HOST_TABLE *ht, int force);
+
+// Merges a table's published summary into sum, hosts seen by several tables are added together
+extern void host_summary_merge(HOST_SUMMARY *sum, HOST_TABLE *ht);
+
+// Orders each kind of a merged summary by each rank
+extern void host_summary_sort(HOST_SUMMARY *sum);
+
+#endif
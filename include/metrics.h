@@ -0,0 +1,53 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include "stats.h"
+#include "flow.h"
+#include "hosts.h"
+#include "netrans.h"
+#include "hll.h"
+#include "rate.h"
+#include "timing.h"
+#include "spsc.h"
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define METRICS_BUFFER_SIZE 32768  // Room for a single snapshot in OpenMetrics text
+#define METRICS_REQUEST_SIZE 4096  // Longest request read, headers included
+#define METRICS_TIMEOUT_MS 1000    // Longest a scraper may take to send its request or read the reply
+#define METRICS_BACKLOG 16
+
+// Serves OpenMetrics text over HTTP from a thread of its own. The main thread formats
+// a snapshot every interval and swaps it in, a scrape only copies the latest snapshot,
+// so neither waits on the other or touches the live counters
+typedef struct {
+    int listenfd;
+    int stopfd;               // eventfd signalled to stop the server thread
+    char *path;               // Unix socket to remove on close, NULL when listening on TCP
+    pthread_t thread;
+    pthread_mutex_t lock;     // Guards published and published_len
+    char *published;          // The snapshot served to scrapers
+    size_t published_len;
+    char *building;           // The next snapshot, only touched by metrics_publish
+    char request[METRICS_REQUEST_SIZE];  // Only touched by the server thread
+    char response[METRICS_BUFFER_SIZE + 256];
+} METRICS;
+
+// Listens on address, a unix socket path if it holds a '/', otherwise [host:]port
+// with the host defaulting to localhost, and starts serving. Returns NULL and sets
+// error_msg on failure
+extern METRICS *metrics_open(const char *address);
+
+// Formats a snapshot of the running totals and the sliding window rates[RATE_WINDOWS]
+// and hands it to the server. kernel is NULL when replaying, queues is NULL when frames
+// are decoded where they are captured and flows is NULL when they are not tracked.
+// sample is the ratio frames are decoded in full at
+extern void metrics_publish(METRICS *m, NETMON_STATS *totals, unsigned long ip_addrs, unsigned long mac_addrs,
+        HLL_ESTIMATE *distinct, TIMING_STATS *timing, RATE *rates, NETRANS_SUMMARY *sessions,
+        CAPTURE_STATS *kernel, SPSC_STATS *queues, FLOW_SUMMARY *flows, HOST_SUMMARY *hosts, unsigned int sample);
+
+// Stops the server thread and closes the listening socket
+extern void metrics_close(METRICS *m);
+
+#endif
@@ -1,11 +1,11 @@
 #ifndef NETMON_H_
 #define NETMON_H_
 
-#include <stdint.h>
+#include "args.h"
 
-// Opens a raw socket and returns its file descriptor
-extern int netmon_init(char *device_name);
+// Opens the capture socket and initializes the netmon structure
+extern int netmon_init(netmon_args_t *args);
 
-extern int netmon_mainloop(int sockfd, uint16_t mask);
+extern int netmon_mainloop();
 
 #endif
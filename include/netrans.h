@@ -0,0 +1,97 @@
+#ifndef NETRANS_H_
+#define NETRANS_H_
+
+#include "packet.h"
+#include "table.h"
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define NETRANS_SESSIONS 256        // Sessions each table tracks, the least recently seen is evicted
+#define NETRANS_TOP_MAX 32          // Sessions published by each table for display
+#define NETRANS_PUBLISH_MS 250      // How often a table expires idle sessions and publishes
+#define NETRANS_TIMEOUT_SECS 60     // Seconds a session may be idle before it is expired
+#define NETRANS_SEEN_BITS 1024      // Chunk numbers below the highest checked for duplicates
+#define NETRANS_WINDOW 64           // Chunks awaiting an ACK timed per session
+
+// Both ends of a session, an end is a MAC address and the netrans address behind it.
+// The lower end comes first so both directions share a key
+typedef struct {
+    uint8_t mac[2][6];
+    uint8_t id[2];
+    uint8_t pad[2]; // Zero, keeps the key a multiple of eight bytes for hashing
+} NETRANS_KEY;
+
+// What is known about a transfer. Chunks are numbered by the sender, an ACK carries
+// the number of the chunk it acknowledges
+typedef struct {
+    NETRANS_KEY key;
+    uint32_t hash;             // Cached hash of the key
+    uint8_t sender;            // End the chunks come from, set by the first chunk
+    unsigned long frames;      // Every frame of the session, both ways
+    unsigned long bytes;       // Their length on the wire
+    unsigned long chunks;
+    unsigned long chunk_bytes; // Wire length of the chunks
+    unsigned long goodput;     // Payload bytes of chunks seen for the first time
+    unsigned long duplicates;  // Chunks seen before
+    unsigned long reordered;   // Chunks that arrived after a later one
+    unsigned long acks;
+    unsigned long acked;       // ACKs matched to a chunk sent once, for latency
+    uint64_t ack_total_ns;     // Sum of the matched ACK latencies
+    uint64_t ack_max_ns;
+    uint64_t first_ns;         // Capture time of the first frame
+    uint64_t last_ns;          // Capture time of the latest frame
+    uint64_t chunk_first_ns;   // Capture time of the first chunk
+    uint64_t chunk_last_ns;    // Capture time of the latest chunk
+} NETRANS_SESSION;
+
+// A session and the state needed to order its chunks and time their ACKs
+typedef struct {
+    TABLE_LINK link;                         // Cached hash and neighbours in the table's LRU list
+    NETRANS_SESSION s;
+    uint32_t highest;                        // Highest chunk number seen
+    int numbered;                            // A numbered chunk has been seen
+    uint64_t seen[NETRANS_SEEN_BITS / 64];   // Chunks seen, by number modulo NETRANS_SEEN_BITS
+    uint64_t sent_ns[NETRANS_WINDOW];        // When chunks awaiting an ACK were sent, 0 once acked
+    uint32_t sent_seq[NETRANS_WINDOW];       // Which chunk each slot holds
+} NETRANS_ENTRY;
+
+// The busiest sessions of one or more tables, sorted by bytes
+typedef struct {
+    NETRANS_SESSION sessions[NETRANS_TOP_MAX];
+    int len;
+    unsigned long active;   // Sessions currently tracked
+    unsigned long evicted;  // Sessions pushed out by newer ones
+    unsigned long expired;  // Sessions removed after going idle
+} NETRANS_SUMMARY;
+
+// A fixed size session table owned by a single decode thread, laid out as a flow
+// table. Other threads only read the summary the owner publishes now and then
+typedef struct {
+    TABLE table;            // NETRANS_SESSIONS sessions, most recently seen at the head
+    uint64_t timeout_ns;
+    unsigned long expired;
+    uint64_t published_ns;  // Monotonic time of the last publish
+
+    pthread_mutex_t lock;   // Guards the published summary
+    NETRANS_SUMMARY published;
+} NETRANS_TABLE;
+
+extern NETRANS_TABLE *netrans_table_new(unsigned int timeout_secs);
+
+// Accounts a netrans frame to its session. payload holds the len captured bytes
+// after the header and wire_len is the whole frame's length on the wire
+extern void netrans_table_update(NETRANS_TABLE *nt, uint8_t *mac_src, uint8_t *mac_dest, PACKET_NETRANS_HDR *hdr,
+        uint8_t *payload, int len, unsigned int wire_len, uint64_t ts_ns);
+
+// Expires sessions idle since before now_ns less the timeout and publishes the
+// busiest, at most once every NETRANS_PUBLISH_MS unless force is set
+extern void netrans_table_publish(NETRANS_TABLE *nt, uint64_t now_ns, int force);
+
+// Merges a table's published summary into sum, sessions seen by several tables are added together
+extern void netrans_summary_merge(NETRANS_SUMMARY *sum, NETRANS_TABLE *nt);
+
+// Orders a merged summary by bytes, busiest first
+extern void netrans_summary_sort(NETRANS_SUMMARY *sum);
+
+#endif
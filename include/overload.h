@@ -0,0 +1,31 @@
+#ifndef OVERLOAD_H_
+#define OVERLOAD_H_
+
+#include "capture.h"
+
+#define MAX_SAMPLE_RATIO     1024 // Fewest frames of which one is decoded in full
+#define OVERLOAD_DROP_PCT    1    // Kernel drops in a tick, per hundred frames, that mean overload
+#define OVERLOAD_FILL_PCT    75   // Ring or queue occupancy that means overload
+#define OVERLOAD_CALM_PCT    25   // Occupancy below which a tick without drops is calm
+#define OVERLOAD_HOLD_TICKS  5    // Ticks the backlog gets to drain before the ratio doubles again
+#define OVERLOAD_CALM_TICKS  50   // Calm ticks in a row before the ratio halves
+
+// Picks the sampling ratio once every rate tick. The ratio doubles while the kernel
+// drops frames or the capture backs up and halves after a stretch without either,
+// so decoding degrades in steps that can be shown rather than through random drops
+typedef struct {
+    unsigned int ratio;     // One frame in ratio is decoded in full, always a power of two
+    int fixed;              // The ratio was given and never changes
+    unsigned int hold;      // Ticks until the ratio may double again
+    unsigned int calm;      // Calm ticks in a row
+    CAPTURE_STATS last;     // The kernel's totals at the previous tick
+} OVERLOAD;
+
+// A ratio of 0 adapts to the load, anything else is kept fixed
+extern void overload_init(OVERLOAD *o, unsigned int ratio);
+
+// Takes the kernel's running totals, NULL when replaying, and the fullest ring or queue
+// as a percentage, and returns the ratio for the next tick
+extern unsigned int overload_update(OVERLOAD *o, CAPTURE_STATS *kernel, unsigned int fill_pct);
+
+#endif
@@ -8,6 +8,9 @@
 #define ETH_TYPE_ARP 0x0806
 #define ETH_TYPE_IP6 0x86DD
 #define ETH_TYPE_NETRANS 0x0929
+#define ETH_TYPE_VLAN 0x8100      // 802.1Q customer tag
+#define ETH_TYPE_QINQ 0x88A8      // 802.1ad service tag, outermost of a QinQ stack
+#define ETH_TYPE_QINQ_OLD 0x9100  // Service tag used before 802.1ad
 
 // Ethernet packet header
 typedef struct __attribute__((packed)) {
@@ -16,6 +19,12 @@ typedef struct __attribute__((packed)) {
     uint16_t eth_type;        // The type of the payload
 } PACKET_ETH_HDR;
 
+// Follows the ethernet header, or another tag, when the ethertype is a VLAN tag's
+typedef struct __attribute__((packed)) {
+    uint16_t vlan_tci;  // Priority, drop eligibility and VLAN id
+    uint16_t vlan_type; // The type of the payload, which may be another tag
+} PACKET_VLAN_TAG;
+
 // Defines the operation types of an ARP packet
 #define ARP_OPER_REQUEST 0x0001
 #define ARP_OPER_REPLY   0x0002
@@ -36,6 +45,16 @@ typedef struct __attribute__((packed)) {
 #define IP_PROTOCOL_UDP     0x11
 #define IP_PROTOCOL_IP6ICMP 0x3A
 
+// Defines the IPv6 extension headers that can sit between the fixed header and the payload
+#define IP6_EXT_HOP      0x00 // Hop-by-hop options
+#define IP6_EXT_ROUTING  0x2B
+#define IP6_EXT_FRAGMENT 0x2C
+#define IP6_EXT_AH       0x33 // Authentication header, its length is in 4 byte units
+#define IP6_EXT_DEST     0x3C // Destination options
+#define IP6_EXT_MOBILITY 0x87
+#define IP6_EXT_HIP      0x8B
+#define IP6_EXT_SHIM6    0x8C
+
 // IPv4 packet header
 typedef struct __attribute__((packed)) {
     uint8_t  ip4_vers_ihl;
@@ -55,10 +74,23 @@ typedef struct __attribute__((packed)) {
     uint8_t ip6_junk[6];
     uint8_t ip6_protocol;
     uint8_t ip6_hop;
-    uint16_t ip6_src[8];
-    uint16_t ip6_dest[8];
+    uint8_t ip6_src[16];
+    uint8_t ip6_dest[16];
 } PACKET_IP6_HDR;
 
+// The start shared by every IPv6 extension header but the fragment header, whose length is fixed
+typedef struct __attribute__((packed)) {
+    uint8_t ip6_ext_next; // The type of the next header
+    uint8_t ip6_ext_len;  // Length in 8 byte units, not counting the first 8 bytes
+} PACKET_IP6_EXT;
+
+typedef struct __attribute__((packed)) {
+    uint8_t  ip6_frag_next;
+    uint8_t  ip6_frag_reserved;
+    uint16_t ip6_frag_offset; // Offset in 8 byte units in the top 13 bits
+    uint32_t ip6_frag_id;
+} PACKET_IP6_FRAG;
+
 // Defines the types of netrans packets
 #define NETRANS_TYPE_SEND     0x01
 #define NETRANS_TYPE_RECEIVE  0x02
@@ -72,4 +104,10 @@ typedef struct __attribute__((packed)) {
     uint8_t netrans_type;
 } PACKET_NETRANS_HDR;
 
+// Follows the header of CHUNK and ACK packets. A chunk carries its own number, an
+// ACK the number of the chunk it acknowledges
+typedef struct __attribute__((packed)) {
+    uint32_t netrans_seq;
+} PACKET_NETRANS_SEQ;
+
 #endif
@@ -0,0 +1,49 @@
+#ifndef PCAPFILE_H_
+#define PCAPFILE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Defines the capture file formats that can be read
+#define PCAP_FORMAT_PCAP   1
+#define PCAP_FORMAT_PCAPNG 2
+
+#define PCAP_MAGIC_USEC 0xa1b2c3d4 // Classic pcap, microsecond timestamps
+#define PCAP_MAGIC_NSEC 0xa1b23c4d // Classic pcap, nanosecond timestamps
+#define PCAP_FILE_HDR_LEN 24       // Length of the classic pcap file header
+#define PCAP_REC_HDR_LEN 16        // Length of a classic pcap record header
+
+#define PCAP_LINKTYPE_ETHERNET 1
+#define PCAP_MAX_IFACES 16 // pcapng interfaces tracked per section
+
+// A single frame in the capture file, data points into the mapping
+typedef struct {
+    uint8_t *data;    // The captured bytes
+    uint32_t caplen;  // Number of bytes captured
+    uint32_t wirelen; // Length of the frame on the wire
+    uint64_t ts_ns;   // Capture time in nanoseconds since the epoch
+} PCAP_RECORD;
+
+// A capture file mapped into memory and read in place
+typedef struct {
+    uint8_t *map;    // The whole file
+    size_t len;      // Length of the file
+    size_t pos;      // Offset of the next block or record
+    int format;      // PCAP_FORMAT_PCAP or PCAP_FORMAT_PCAPNG
+    int swapped;     // Nonzero when the file's byte order differs from ours
+    int nsec;        // pcap timestamps are in nanoseconds rather than microseconds
+    int num_ifaces;                          // pcapng interfaces in the current section
+    uint16_t linktype[PCAP_MAX_IFACES];      // Link type of each interface
+    uint32_t snaplen[PCAP_MAX_IFACES];       // Snapshot length of each interface
+    uint64_t ticks_per_sec[PCAP_MAX_IFACES]; // Timestamp resolution of each interface
+    uint64_t last_ts;                        // Timestamp of the previous record
+} PCAP_FILE;
+
+// Maps a pcap or pcapng file, returns NULL and sets error_msg on failure
+extern PCAP_FILE *pcap_file_open(const char *path);
+
+// Reads the next ethernet frame, returns 1 on success, 0 at the end of the file
+// and -1 with error_msg set if the file is malformed
+extern int pcap_file_next(PCAP_FILE *pf, PCAP_RECORD *rec);
+
+#endif
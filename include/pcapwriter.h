@@ -0,0 +1,67 @@
+#ifndef PCAPWRITER_H_
+#define PCAPWRITER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define DEFAULT_SNAPLEN 262144         // Bytes of each frame written, as tcpdump
+#define WRITER_BATCH_SIZE (1 << 20)    // Size of each batch buffer handed to the writer thread
+#define WRITER_BATCH_COUNT 32          // Batch buffers shared by all producers
+#define WRITER_FLUSH_MS 500            // Longest a partly filled batch is held back
+#define WRITER_IOV_MAX 16              // Most vectors passed to a single writev
+
+// A buffer of pcap records filled by one producer, then written out in one go
+typedef struct PCAP_BATCH {
+    struct PCAP_BATCH *next; // Next batch in the free list or the write queue
+    uint8_t *data;           // Records, each a pcap record header and the captured bytes
+    size_t len;              // Bytes used
+    unsigned long frames;    // Records in the batch
+    uint64_t opened_ns;      // Monotonic time the first record was added
+} PCAP_BATCH;
+
+// Writes batches to a series of pcap files on a background thread, so capture never
+// waits on the disk. Producers drop frames when every batch is queued or in flight
+typedef struct {
+    char *prefix;                 // Output file name, or prefix when rotating
+    unsigned int snaplen;         // Bytes kept from each frame
+    unsigned long rotate_bytes;   // Start a new file once this many bytes are written, 0 to never
+    unsigned int rotate_secs;     // Start a new file after this many seconds, 0 to never
+    int fd;                       // The file being written
+    unsigned int file_index;      // Sequence number of the current file
+    unsigned long file_bytes;     // Bytes written to the current file
+    uint64_t file_opened_ns;      // Monotonic time the current file was opened
+    int failed;                   // Set once a write fails, later batches are discarded
+    int closing;                  // Set when the writer thread should drain the queue and exit
+    pthread_t thread;
+    pthread_mutex_t lock;         // Guards the free list and the write queue
+    pthread_cond_t ready;         // Signalled when a batch is queued or the writer is closing
+    PCAP_BATCH *free;             // Empty batches
+    PCAP_BATCH *queue;            // Filled batches waiting to be written, oldest first
+    PCAP_BATCH *queue_tail;
+    PCAP_BATCH *batches;          // All batches, for freeing
+    unsigned long written;        // Frames written to disk
+    unsigned long dropped;        // Frames dropped because no batch was free
+} PCAP_WRITER;
+
+// Opens the first output file and starts the writer thread, returns NULL and sets
+// error_msg on failure. Without rotation the file is named <prefix>, otherwise
+// <prefix>-NNNNN.pcap
+extern PCAP_WRITER *pcap_writer_open(const char *prefix, unsigned int snaplen,
+        unsigned long rotate_bytes, unsigned int rotate_secs);
+
+// Appends a frame to the producer's batch, *batch starts out NULL and belongs to a
+// single producer thread. Queues the batch once full, returns -1 if the frame was dropped
+extern int pcap_writer_write(PCAP_WRITER *pw, PCAP_BATCH **batch, const uint8_t *frame,
+        uint32_t len, uint32_t wire_len, uint64_t ts_ns);
+
+// Queues the producer's batch if it has been held longer than WRITER_FLUSH_MS, or
+// at all when force is set
+extern void pcap_writer_flush(PCAP_WRITER *pw, PCAP_BATCH **batch, int force);
+
+// Writes everything queued, stops the writer thread, closes the file and frees the
+// writer, handing back how many frames were written and dropped in all. Every
+// producer must have flushed its batch first
+extern void pcap_writer_close(PCAP_WRITER *pw, unsigned long *written, unsigned long *dropped);
+
+#endif
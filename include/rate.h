@@ -1,21 +1,65 @@
 #ifndef RATE_H_
 #define RATE_H_
 
-#include <time.h>
+#include "stats.h"
 
+#include <stdint.h>
+
+#define RATE_TICK_MS 100 // How often the counters are sampled, the shortest window
+
+// Defines the sliding windows rates are measured over
+#define RATE_100MS   0
+#define RATE_1S      1
+#define RATE_10S     2
+#define RATE_60S     3
+#define RATE_WINDOWS 4
+
+// Defines the traffic each rate covers
+#define RATE_ALL     0 // Every accepted frame
+#define RATE_ARP     1
+#define RATE_IP4     2
+#define RATE_IP6     3
+#define RATE_NETRANS 4
+#define RATE_IGMP    5
+#define RATE_ICMP    6
+#define RATE_TCP     7
+#define RATE_UDP     8
+#define RATE_CLASSES 9
+
+// The running totals of every class at the end of a tick
 typedef struct {
-    unsigned long byte_count; // The total byte count for the current block
-    time_t start_time;        // The start time for the current block
+    uint64_t ns;                          // Monotonic time the totals were sampled
+    unsigned long packets[RATE_CLASSES];
+    unsigned long bytes[RATE_CLASSES];
 } TIME_BLOCK;
 
+// A ring of blocks, one per tick, reaching back over the longest window. The decoder
+// only adds to running totals, so a window's rate is the difference between the newest
+// block and the one a window earlier, over the time that actually passed between them
 typedef struct {
-    TIME_BLOCK **blocks;
-    int capacity, pos;
+    TIME_BLOCK *blocks;
+    int capacity, pos, len; // pos is the next block written
+    unsigned int tick_ms;
 } RATE_QUEUE;
 
-extern RATE_QUEUE *rate_queue_new(int size);
-extern TIME_BLOCK *time_block_new();
-extern void time_block_init(TIME_BLOCK *tb, time_t start_time);
-extern TIME_BLOCK *time_block_next(RATE_QUEUE *q);
+// The rates of every class over one window
+typedef struct {
+    double bps[RATE_CLASSES]; // Bits per second
+    double pps[RATE_CLASSES]; // Packets per second
+} RATE;
+
+// Window lengths in milliseconds and their labels, indexed by RATE_100MS and so on
+extern const unsigned int rate_window_ms[RATE_WINDOWS];
+extern const char *rate_window_names[RATE_WINDOWS];
+
+// Creates a queue sampled every tick_ms milliseconds
+extern RATE_QUEUE *rate_queue_new(unsigned int tick_ms);
+
+// Closes a block with the merged totals sampled at monotonic time now_ns
+extern void rate_queue_push(RATE_QUEUE *q, NETMON_STATS *totals, uint64_t now_ns);
+
+// Fills rates[RATE_WINDOWS] with every window ending at the newest block, a window
+// longer than the queue's history covers all of it
+extern void rate_queue_rates(RATE_QUEUE *q, RATE *rates);
 
 #endif
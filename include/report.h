@@ -0,0 +1,53 @@
+#ifndef REPORT_H_
+#define REPORT_H_
+
+#include "stats.h"
+#include "flow.h"
+#include "hosts.h"
+#include "netrans.h"
+#include "hll.h"
+#include "rate.h"
+#include "timing.h"
+#include "spsc.h"
+
+#include <stdint.h>
+
+// Defines the headless report formats
+#define REPORT_JSON 0 // One JSON object per line
+#define REPORT_CSV  1 // A header row, then one row per interval
+
+#define DEFAULT_REPORT_INTERVAL_MS 1000
+#define REPORT_BUFFER_SIZE 16384 // Room for a single interval's record
+#define REPORT_TOP_FLOWS 10      // Busiest flows listed in each JSON record
+#define REPORT_TOP_SESSIONS 10   // Busiest netrans sessions listed in each JSON record
+#define REPORT_TOP_HOSTS 10      // Addresses of each kind with the most bytes listed in each JSON record
+
+// Periodic structured output of the counters for headless runs. Each interval is
+// formatted into a buffer and written with a single write
+typedef struct {
+    int fd;                       // Where records are written
+    int format;                   // REPORT_JSON or REPORT_CSV
+    NETMON_STATS last;            // Totals at the previous record
+    unsigned long last_ip_addrs;  // Distinct IP addresses at the previous record
+    unsigned long last_mac_addrs; // Distinct MAC addresses at the previous record
+    CAPTURE_STATS last_kernel;    // The capture sockets' totals at the previous record
+    uint64_t last_ns;             // Monotonic time of the previous record
+    char buffer[REPORT_BUFFER_SIZE];
+} REPORT;
+
+// Opens path for appending, or stdout when path is NULL, and writes the CSV
+// header unless the file already has one. Returns NULL and sets error_msg on failure
+extern REPORT *report_open(const char *path, int format);
+
+// Writes one record covering everything since the previous one, along with the
+// sliding window rates[RATE_WINDOWS], the netrans sessions and the hosts. kernel is NULL when
+// replaying rather than capturing, queues is NULL when frames are decoded where they
+// are captured and flows is NULL when they are not tracked. sample is the ratio frames
+// are decoded in full at. Returns -1 and sets error_msg if the write fails
+extern int report_write(REPORT *r, NETMON_STATS *totals, unsigned long ip_addrs, unsigned long mac_addrs,
+        HLL_ESTIMATE *distinct, TIMING_STATS *timing, RATE *rates, NETRANS_SUMMARY *sessions,
+        CAPTURE_STATS *kernel, SPSC_STATS *queues, FLOW_SUMMARY *flows, HOST_SUMMARY *hosts, unsigned int sample);
+
+extern void report_close(REPORT *r);
+
+#endif
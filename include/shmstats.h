@@ -0,0 +1,83 @@
+#ifndef SHMSTATS_H_
+#define SHMSTATS_H_
+
+// The layout of the shared-memory stats segment and the functions to publish and read it.
+// Readers only need this header and shmstats.c, every field has a fixed size so a
+// reader built separately agrees on the layout as long as the version matches
+
+#include <stdint.h>
+
+#define SHM_STATS_MAGIC   0x54534d4eU // "NMST" in little-endian
+#define SHM_STATS_VERSION 3
+#define DEFAULT_SHM_NAME  "/netmon"
+#define SHM_READ_TRIES    1000        // Attempts a read makes before giving up on a busy writer
+
+// Defines the layout's own indices, kept in step with rate.h and hll.h
+#define SHM_ETHERTYPES    4 // ip4, ip6, arp, netrans
+#define SHM_PROTOCOLS     4 // icmp, igmp, tcp, udp
+#define SHM_RATE_WINDOWS  4 // 100ms, 1s, 10s, 60s
+#define SHM_RATE_CLASSES  9 // all, arp, ip4, ip6, netrans, igmp, icmp, tcp, udp
+#define SHM_KINDS         5 // mac, ip4_src, ip4_dst, ip6_src, ip6_dst
+
+// Everything after seq is written between its two increments
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;         // sizeof(SHM_STATS) as built by the writer
+    uint32_t pid;          // The writer's process
+    uint64_t seq;          // Odd while the writer is part way through an update
+    uint64_t updated_ns;   // Realtime clock at the last update
+    uint64_t updates;      // Updates so far
+
+    uint64_t packets;      // Frames accepted
+    uint64_t bytes;        // Bytes accepted, as seen on the wire
+    uint64_t ethertype_packets[SHM_ETHERTYPES];
+    uint64_t ethertype_bytes[SHM_ETHERTYPES];
+    uint64_t protocol_packets[SHM_PROTOCOLS];
+    uint64_t protocol_bytes[SHM_PROTOCOLS];
+    uint64_t arp_request, arp_reply;
+    uint64_t netrans_send, netrans_receive, netrans_ack, netrans_chunk;
+    uint64_t kernel_packets;  // What the kernel counted on the capture sockets, zero when replaying
+    uint64_t kernel_drops;
+    uint64_t kernel_freezes;
+    uint64_t shed;            // Frames only counted, left out of the sample while overloaded
+    uint64_t sample_ratio;    // One flow in this many is decoded in full
+
+    uint64_t ip_addrs;     // Addresses in the exact lists
+    uint64_t mac_addrs;
+    double distinct[SHM_KINDS];        // Estimated distinct addresses since capture started
+    double distinct_window[SHM_KINDS]; // And over the last minute
+
+    double bps[SHM_RATE_WINDOWS][SHM_RATE_CLASSES]; // Bits per second over each sliding window
+    double pps[SHM_RATE_WINDOWS][SHM_RATE_CLASSES]; // Packets per second
+} SHM_STATS;
+
+// The writer's side of the segment. body is filled in private memory and copied into
+// the segment whole, so the seqlock is only held for a single copy
+typedef struct {
+    char *name;
+    SHM_STATS *seg;        // The mapped segment
+    SHM_STATS body;        // The next update
+} SHM_WRITER;
+
+// Creates the segment, readable by everyone, replacing any left by an earlier run.
+// Returns NULL and sets error_msg on failure
+extern SHM_WRITER *shm_stats_create(const char *name);
+
+// Copies body into the segment under the seqlock, the writer never waits for readers
+extern void shm_stats_publish(SHM_WRITER *w);
+
+// Removes the segment, readers still holding it see the last update
+extern void shm_stats_destroy(SHM_WRITER *w);
+
+// Maps an existing segment read-only. Returns NULL and sets error_msg if there is none or
+// its layout does not match
+extern SHM_STATS *shm_stats_attach(const char *name);
+
+// Copies a consistent update into copy, retrying while the writer is part way through one.
+// Returns -1 if the writer stayed busy for SHM_READ_TRIES attempts
+extern int shm_stats_read(SHM_STATS *seg, SHM_STATS *copy);
+
+extern void shm_stats_detach(SHM_STATS *seg);
+
+#endif
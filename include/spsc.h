@@ -0,0 +1,90 @@
+#ifndef SPSC_H_
+#define SPSC_H_
+
+#include "capture.h"
+
+#include <stdint.h>
+
+#define SPSC_LINE 64                  // Cache line size, the ring's two ends never share one
+#define SPSC_FRAME_BYTES 2048         // Data bytes set aside per slot, each frame takes only its own length
+#define DEFAULT_SPSC_SLOTS 4096       // Frames queued between a worker's capture and decode threads
+#define MAX_SPSC_SLOTS (1 << 20)
+
+// A captured frame waiting to be decoded, its bytes are in the ring's data
+typedef struct {
+    uint64_t ts_ns;
+    uint64_t offset;   // Where the frame starts in data, counted from the ring's creation
+    uint32_t len;      // Bytes captured
+    uint32_t wire_len; // Length on the wire
+} SPSC_SLOT;
+
+// A bounded single-producer single-consumer queue of frames in preallocated slots,
+// with the frames' bytes laid end to end in a data ring alongside. Each end keeps its
+// index and a cached copy of the other's on its own cache line, and only reads the
+// other's line when its cached copy says the ring is full or empty. The producer
+// publishes its index once per batch, as does the consumer. The data ring holds at
+// least two frames of the snaplen, so no frame is ever cut short on the way through
+typedef struct {
+    // Written only by the producer
+    uint32_t head __attribute__((aligned(SPSC_LINE))); // Next slot published to the consumer
+    uint32_t next;                                     // Next slot written, published by spsc_commit
+    uint32_t tail_cache;                               // The consumer's index when last read
+    uint64_t data_next;                                // Where the next frame's bytes go in data
+    unsigned long overflows;                           // Times a push found the ring full and waited
+    unsigned long high_water;                          // Most slots ever in use at a commit
+    int closed;                                        // Nothing more will be pushed
+
+    // Written only by the consumer
+    uint32_t tail __attribute__((aligned(SPSC_LINE))); // Next slot the consumer reads
+    uint32_t head_cache;                               // The producer's index when last read
+
+    // Written by both, only when the consumer is about to sleep or the producer wakes it
+    int waiting __attribute__((aligned(SPSC_LINE)));
+
+    SPSC_SLOT *slots __attribute__((aligned(SPSC_LINE)));
+    uint32_t size;     // Number of slots, a power of two
+    uint32_t mask;
+    uint8_t *data;     // The frames' bytes, each starting on a cache line
+    size_t data_size;  // Bytes in data, a power of two
+    uint32_t max_len;  // Longest frame kept, the snaplen
+    int eventfd;       // Readable once the producer wakes a waiting consumer
+} SPSC_RING;
+
+// How full the queues of one or more workers are and have been
+typedef struct {
+    unsigned long slots;      // Slots in each queue
+    unsigned long depth;      // Frames waiting across the queues when sampled
+    unsigned long high_water; // Most slots ever in use in any one queue
+    unsigned long overflows;  // Times a capture thread found its queue full and waited
+} SPSC_STATS;
+
+// Allocates a ring of size slots, a power of two, for frames of up to snaplen bytes.
+// Returns NULL and sets error_msg on failure
+extern SPSC_RING *spsc_ring_new(uint32_t size, uint32_t snaplen);
+
+// Producer: copies a frame into the next free slot, not visible until spsc_commit. A
+// ring without a free slot or room for the bytes counts an overflow and waits for the
+// consumer, so the capture falls behind and frames wait in the kernel instead of
+// being dropped here
+extern void spsc_push(SPSC_RING *r, char *frame, int len, int wire_len, uint64_t ts_ns);
+
+// Producer: publishes every frame pushed so far and wakes the consumer if it is waiting
+extern void spsc_commit(SPSC_RING *r);
+
+// Producer: publishes the last frames and tells the consumer nothing more will come
+extern void spsc_close(SPSC_RING *r);
+
+// Consumer: hands at most max frames to handler, oldest first, and returns how many
+extern unsigned int spsc_drain(SPSC_RING *r, capture_handler handler, void *arg, unsigned int max);
+
+// Consumer: returns 1 if frames are waiting or the ring is closed, otherwise asks to
+// be woken and returns 0, after which the consumer may sleep until eventfd is readable
+extern int spsc_arm(SPSC_RING *r);
+
+// Consumer: whether the producer has closed the ring, frames pushed before are still drained
+extern int spsc_closed(SPSC_RING *r);
+
+// Adds a ring's occupancy and overflows into sum, safe from any thread
+extern void spsc_stats_merge(SPSC_STATS *sum, SPSC_RING *r);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+// Packet counters kept by the decoder
+typedef struct {
+    unsigned long arp_total;     // ARP packet total
+    unsigned long ip4_total;     // IPv4 packet total
+    unsigned long ip6_total;     // IPv6 packet total
+    unsigned long netrans_total; // Custom netrans protocol total
+    unsigned long reply_total;   // ARP reply packet total
+    unsigned long request_total; // ARP request packet total
+    unsigned long igmp_total;    // IGMP packet total
+    unsigned long icmp_total;    // ICMP packet total
+    unsigned long tcp_total;     // TCP packet total
+    unsigned long udp_total;     // UDP packet total
+    unsigned long send_total;    // netrans send total
+    unsigned long receive_total; // netrans receive total
+    unsigned long ack_total;     // netrans ack total
+    unsigned long chunk_total;   // netrans chunk total
+    unsigned long vlan_total;    // Frames carrying one or more VLAN tags
+    unsigned long shed_total;    // Frames only counted, left out of the sample while overloaded
+    unsigned long packet_total;  // Frames accepted
+    unsigned long byte_total;    // Bytes accepted, as seen on the wire
+    unsigned long arp_bytes;     // Bytes of each ethertype and IP protocol, for their rates
+    unsigned long ip4_bytes;
+    unsigned long ip6_bytes;
+    unsigned long netrans_bytes;
+    unsigned long igmp_bytes;
+    unsigned long icmp_bytes;
+    unsigned long tcp_bytes;
+    unsigned long udp_bytes;
+} NETMON_STATS;
+
+// Each counter block has a single writer, so a relaxed load and store is all an
+// increment needs for readers on other threads to never see a torn value
+#define STAT_ADD(counter, n) __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+#define STAT_INC(counter) STAT_ADD(counter, 1)
+
+// The counter offset bytes into a NETMON_STATS, for tables of counters
+#define STAT_FIELD(stats, offset) (*(unsigned long *)((char *)(stats) + (offset)))
+
+// Adds every counter of src into dst
+extern void stats_merge(NETMON_STATS *dst, NETMON_STATS *src);
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef TABLE_H_
+#define TABLE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TABLE_NONE 0xffffffffU // Terminates LRU lists and marks empty index slots
+
+// Orders two entries as qsort does, negative when a ranks above b
+typedef int (*table_compare)(const void *a, const void *b);
+
+// Every entry starts with its link, the key lies at a fixed offset behind it
+typedef struct {
+    uint32_t hash;      // Cached hash of the key
+    uint32_t prev;      // Neighbour towards the most recently used entry
+    uint32_t next;      // Neighbour towards the least recently used entry, or the next free one
+} TABLE_LINK;
+
+// An index slot, entries stay put in the pool while slots move on deletion
+typedef struct {
+    uint32_t hash;
+    uint32_t entry;     // Position in the pool, TABLE_NONE if empty
+} TABLE_SLOT;
+
+// A fixed size hash table of entry_size byte entries owned by a single thread.
+// Everything is allocated up front and entries never move, when the pool is full the
+// least recently used entry is evicted. Keys are compared with memcmp
+typedef struct {
+    char *pool;             // Every entry, in use or on the free list
+    TABLE_SLOT *slots;      // Open-addressing index into the pool, linear probing
+    size_t entry_size;
+    size_t key_offset;      // Where the key lies in an entry
+    size_t key_size;        // A multiple of eight bytes
+    uint32_t capacity;      // Entries in the pool
+    uint32_t mask;          // Index slots minus one, twice the pool
+    uint32_t len;           // Entries in use
+    uint32_t free;          // Head of the free list, linked through next
+    uint32_t head;          // Most recently used entry
+    uint32_t tail;          // Least recently used entry
+    unsigned long evicted;  // Entries pushed out to make room
+} TABLE;
+
+// The highest ranking of a stream of entries, copied into an array of max entries of
+// size bytes in no particular order. The lowest is remembered once the array is full,
+// so most entries are turned away with a single comparison
+typedef struct {
+    char *items;
+    int *len;           // Entries held, kept by the owner of the array
+    int max;
+    int min;            // The lowest ranking entry while full
+    size_t size;
+    table_compare compare;
+} TABLE_TOP;
+
+// The entry at a pool position
+#define TABLE_ENTRY(t, e) ((void *)((t)->pool + (size_t)(e) * (t)->entry_size))
+#define TABLE_LINK_AT(t, e) ((TABLE_LINK *)TABLE_ENTRY(t, e))
+
+// The largest power of two count of entry_size byte entries that fits in max_bytes
+// along with an index of twice as many slots, 0 if not even one does
+extern uint32_t table_capacity(size_t max_bytes, size_t entry_size);
+
+// Allocates a pool of capacity entries, a power of two, and its index
+extern void table_init(TABLE *t, uint32_t capacity, size_t entry_size, size_t key_offset, size_t key_size);
+
+// Returns the entry holding key and makes it the most recently used. A new key takes
+// a free entry, or the least recently used one, zeroed but for its link and key, and
+// sets *added
+extern void *table_get(TABLE *t, const void *key, int *added);
+
+// Returns an entry to the free list, shifting later slots of its probe run back so no
+// tombstones are needed
+extern void table_remove(TABLE *t, uint32_t e);
+
+// Keeps the max highest ranking entries of size bytes in items, which already holds *len
+extern void table_top_init(TABLE_TOP *top, void *items, int *len, int max, size_t size, table_compare compare);
+
+// Copies item in if there is room or it ranks above the lowest held
+extern void table_top_insert(TABLE_TOP *top, const void *item);
+
+// Finds the lowest entry again after the owner raised one in place
+extern void table_top_rescan(TABLE_TOP *top);
+
+#endif
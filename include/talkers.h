@@ -0,0 +1,110 @@
+#ifndef TALKERS_H_
+#define TALKERS_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define TALKER_CM_ROWS 4        // Count-Min rows, an estimate is the least of one cell in each
+#define TALKER_CM_WIDTH 1024    // Cells per row, estimates are over by at most e/1024 of the traffic, 98% of the time
+#define TALKER_COUNTERS 64      // Heaviest talkers kept per kind and rank
+#define TALKER_TOP_MAX 16       // Talkers published per kind and rank for display
+#define TALKER_PUBLISH_MS 250   // How often a table publishes its heaviest talkers
+#define TALKER_EMPTY 0xffff     // Marks empty index slots
+
+// Defines what a talker is keyed on
+#define TALKER_SRC_MAC 0 // Source MAC address
+#define TALKER_SRC_IP  1 // Source IP address
+#define TALKER_IP_PAIR 2 // Source and destination IP addresses
+#define TALKER_KINDS   3
+
+// Defines what talkers are ranked by
+#define TALKER_BY_BYTES   0
+#define TALKER_BY_PACKETS 1
+#define TALKER_RANKS      2
+
+// A MAC uses the first six bytes of addr, an IP the first four or sixteen and a
+// pair keeps the destination in the second half
+typedef struct {
+    uint8_t addr[32];
+    uint8_t family;  // ADDR_MAC, ADDR_IP4 or ADDR_IP6
+    uint8_t pad[7];  // Always zero so keys compare with memcmp
+} TALKER_KEY;
+
+// A talker among the heaviest. count never underestimates and overestimates by at
+// most error, the sketch's estimate of what it sent before it was admitted
+typedef struct {
+    TALKER_KEY key;
+    uint32_t hash;       // Cached hash of the key
+    uint32_t heap;       // Position in its heap
+    unsigned long count; // Weight ranked on, bytes or packets, kept in the heap while counting
+    unsigned long error;
+    unsigned long other; // The other weight, estimated on admission and counted since
+} TALKER;
+
+// A heap node carries its counter's count so sifting never leaves the heap array
+typedef struct {
+    unsigned long count;
+    uint32_t counter;
+} TALKER_HEAP_NODE;
+
+// The TALKER_COUNTERS heaviest talkers of a kind by one rank, in a min-heap on count
+// with a hash index over their keys. A known talker gains weight and sinks, which is
+// usually nowhere since heavy hitters sit at the leaves. Anyone else only gets in
+// when the sketch's estimate beats the lightest
+typedef struct {
+    TALKER counters[TALKER_COUNTERS];
+    TALKER_HEAP_NODE heap[TALKER_COUNTERS + 1]; // Counters ordered by count, lightest first, then unused nodes
+    uint16_t slots[TALKER_COUNTERS * 2];        // Open-addressing index into counters, linear probing
+    uint32_t len;                               // Counters in use
+} TALKER_HEAP;
+
+// A cell counts both weights of every talker hashed to it
+typedef struct {
+    unsigned long weight[TALKER_RANKS];
+} TALKER_CELL;
+
+// A Count-Min sketch of every talker of a kind, by bytes and packets at once, and the
+// heaviest talkers it has seen by each. An update adds to one cell a row whatever the
+// traffic, so it costs the same for a scan as for a handful of hosts
+typedef struct {
+    TALKER_CELL cells[TALKER_CM_ROWS][TALKER_CM_WIDTH];
+    TALKER_HEAP heaps[TALKER_RANKS];
+} TALKER_SKETCH;
+
+// The heaviest talkers of one or more tables, sorted by count
+typedef struct {
+    TALKER top[TALKER_KINDS][TALKER_RANKS][TALKER_TOP_MAX];
+    int len[TALKER_KINDS][TALKER_RANKS];
+    unsigned long total[TALKER_KINDS][TALKER_RANKS]; // Weight seen by each sketch
+} TALKER_SUMMARY;
+
+// A sketch for each kind, owned by a single decode thread. Memory is fixed
+// at creation however many hosts are seen, other threads only read the summary the
+// owner publishes now and then
+typedef struct {
+    TALKER_SKETCH sketches[TALKER_KINDS];
+    unsigned long total[TALKER_KINDS][TALKER_RANKS];
+    int dirty;              // Updated since the last publish
+    uint64_t published_ns;  // Monotonic time of the last publish
+
+    pthread_mutex_t lock;   // Guards the published summary
+    TALKER_SUMMARY published;
+} TALKER_TABLE;
+
+extern TALKER_TABLE *talker_table_new();
+
+// Accounts packets totalling bytes to a talker of the given kind, by bytes and by packets
+extern void talker_table_update(TALKER_TABLE *tt, int kind, TALKER_KEY *key, unsigned int packets,
+        unsigned long bytes);
+
+// Publishes the heaviest talkers of every kind and rank, at most once every TALKER_PUBLISH_MS
+// unless force is set
+extern void talker_table_publish(TALKER_TABLE *tt, int force);
+
+// Merges a table's published summary into sum, talkers seen by several tables are added together
+extern void talker_summary_merge(TALKER_SUMMARY *sum, TALKER_TABLE *tt);
+
+// Orders a merged summary, heaviest first
+extern void talker_summary_sort(TALKER_SUMMARY *sum);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef TIMING_H_
+#define TIMING_H_
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS 5                                  // Linear sub-buckets per power of two, as bits
+#define HIST_SUBS (1 << HIST_SUB_BITS)                   // Values within 1/32 share a bucket
+#define HIST_BUCKETS ((65 - HIST_SUB_BITS) * HIST_SUBS)  // Enough for any 64 bit value
+
+#define DEFAULT_BURST_PACKETS 32  // Frames that make a burst...
+#define DEFAULT_BURST_USECS 100   // ...when they arrive within this many microseconds
+#define MAX_BURST_PACKETS 4096
+
+// Defines which frames an inter-arrival histogram covers
+#define TIMING_ALL     0 // Every frame
+#define TIMING_ARP     1
+#define TIMING_IP4     2
+#define TIMING_IP6     3
+#define TIMING_NETRANS 4
+#define TIMING_CLASSES 5
+
+// A log-linear histogram of nanosecond values. Below 2 * HIST_SUBS every value has
+// its own bucket, above that each power of two is split into HIST_SUBS buckets, so
+// memory is fixed and any value is known to within about 3%
+typedef struct {
+    unsigned long counts[HIST_BUCKETS];
+    uint64_t max; // Largest value recorded, exactly
+} HISTOGRAM;
+
+// The gaps between frames seen by a single decode thread, timed by the kernel, and
+// the bursts among them. Only the owner writes, every counter is stored atomically
+// so other threads can read them without a lock
+typedef struct {
+    HISTOGRAM gaps[TIMING_CLASSES];
+    uint64_t last_ns[TIMING_CLASSES]; // Time of the previous frame of each class, 0 before the first
+
+    // A ring of the last burst_packets arrival times, a burst is underway while the
+    // oldest is within burst_ns of the newest
+    uint64_t *arrivals;
+    unsigned int burst_packets;
+    unsigned int burst_usecs;
+    unsigned int pos;
+    uint64_t burst_ns;
+    unsigned long seq;           // Frames seen
+    unsigned long counted;       // The last frame counted in a burst, by seq
+    unsigned long run;           // Frames in the burst underway, 0 outside one
+    unsigned long bursts;        // Bursts so far
+    unsigned long burst_frames;  // Frames that arrived within a burst
+    unsigned long burst_max;     // Frames in the largest burst
+} TIMING;
+
+// The histograms and burst counters of one or more decode threads. Each thread only
+// times the frames it decodes, so with several the gaps are between a thread's frames
+typedef struct {
+    HISTOGRAM gaps[TIMING_CLASSES];
+    unsigned int workers;    // Threads merged
+    unsigned int burst_packets, burst_usecs;
+    unsigned long bursts, burst_frames, burst_max;
+} TIMING_SUMMARY;
+
+// Percentiles of one histogram in nanoseconds
+typedef struct {
+    unsigned long samples;
+    uint64_t p50, p99, p999, max;
+} TIMING_PERCENTILES;
+
+// What the display and the headless records show
+typedef struct {
+    TIMING_PERCENTILES gaps[TIMING_CLASSES];
+    unsigned int workers;                    // Threads each timing only their own frames
+    unsigned int burst_packets, burst_usecs; // What counts as a burst
+    unsigned long bursts, burst_frames, burst_max;
+} TIMING_STATS;
+
+// A burst is burst_packets frames arriving within burst_usecs microseconds
+extern TIMING *timing_new(unsigned int burst_packets, unsigned int burst_usecs);
+
+// Records the gap since the previous frame, and the previous frame of the same
+// class, for a frame captured at ts_ns. cls is TIMING_ALL for frames of no class
+extern void timing_update(TIMING *t, int cls, uint64_t ts_ns);
+
+// Adds a thread's histograms and burst counters into sum, the largest burst is the
+// largest any thread saw
+extern void timing_summary_merge(TIMING_SUMMARY *sum, TIMING *t);
+
+// Percentiles of the gaps recorded between two summaries of the same threads, prev
+// may be NULL for everything since the start. Burst counters are running totals
+extern void timing_stats(TIMING_STATS *stats, TIMING_SUMMARY *now, TIMING_SUMMARY *prev);
+
+#endif
@@ -1,15 +1,62 @@
 #ifndef UI_H_
 #define UI_H_
 
-extern void ui_init();
-extern void ui_display_packet(char *mac_dest, char *mac_src, char *type, char *type_type);
-extern void ui_display_mac_addr(char *addr);
-extern void ui_display_ip_addr(char *addr);
-extern void ui_display_ether_types(int arp, int ip4, int ip6, int netrans);
-extern void ui_display_ip_types(int tcp, int udp, int igmp, int icmp);
-extern void ui_display_arp_types(int reply, int request);
-extern void ui_display_netrans_types(int send_total, int receive_total, int ack_total, int chunk_total);
-extern void ui_display_rate(int volume);
+#include "stats.h"
+#include "flow.h"
+#include "hosts.h"
+#include "talkers.h"
+#include "netrans.h"
+#include "hll.h"
+#include "rate.h"
+#include "timing.h"
+#include "spsc.h"
+
+#include <stdint.h>
+
+// Default number of frames drawn per second by the render thread
+#define DEFAULT_UI_FPS 20
+#define MAX_UI_FPS 60
+
+// Defines what the main window shows
+#define UI_VIEW_PACKETS 0 // A log of decoded packets
+#define UI_VIEW_FLOWS   1 // The busiest flows
+#define UI_VIEW_TALKERS_BYTES   2 // The heaviest talkers by bytes
+#define UI_VIEW_TALKERS_PACKETS 3 // The heaviest talkers by packets
+#define UI_VIEW_SESSIONS 4 // The busiest netrans sessions
+
+// Called by the render thread every frame to fetch the current packet counters
+typedef void (*ui_totals_source)(NETMON_STATS *totals);
+
+// Called by the render thread every frame while the flow view is shown, NULL if
+// flows are not tracked
+typedef void (*ui_flows_source)(FLOW_SUMMARY *flows);
+
+// Called by the render thread every frame for the MAC and IP address panes
+typedef void (*ui_hosts_source)(HOST_SUMMARY *hosts);
+
+// Called by the render thread every frame while a talker view is shown
+typedef void (*ui_talkers_source)(TALKER_SUMMARY *talkers);
+
+// Called by the render thread every frame while the session view is shown
+typedef void (*ui_sessions_source)(NETRANS_SUMMARY *sessions);
+
+// The ui_display functions only queue their arguments, the render thread draws
+// everything queued since the previous frame with a single screen update. Packet
+// type strings are kept by reference and must be string literals
+extern void ui_init(int fps, ui_totals_source totals, ui_hosts_source hosts, ui_flows_source flows,
+        ui_talkers_source talkers, ui_sessions_source sessions);
+extern void ui_shutdown();
+extern void ui_set_view(int view);
+// Orders the address panes by the next of bytes, packets and last seen
+extern void ui_next_host_rank();
+extern void ui_display_packet(uint8_t *mac_dest, uint8_t *mac_src, const char *type, const char *type_type);
+// kernel holds the capture sockets' totals and last_second what they added over the
+// last second, both are NULL when there are no sockets to ask. sample is the ratio
+// frames are decoded in full at
+extern void ui_display_rate(RATE *rates, CAPTURE_STATS *kernel, CAPTURE_STATS *last_second, unsigned int sample);
+extern void ui_display_distinct(HLL_ESTIMATE *distinct);
+extern void ui_display_timing(TIMING_STATS *timing);
+extern void ui_display_queues(SPSC_STATS *queues);
 extern void ui_display_error(const char *error_msg);
 
 #endif
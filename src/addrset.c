@@ -0,0 +1,95 @@
+#include "addrset.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void addr_key(ADDR_ENTRY *e, uint32_t family, const uint8_t *addr);
+static void addr_set_grow(ADDR_SET *set);
+
+ADDR_SET *addr_set_new(unsigned int capacity, unsigned int limit)
+{
+    ADDR_SET *set;
+    unsigned int n;
+
+    // Round the capacity up to a power of two so probing can mask instead of divide
+    for(n = 1; n < capacity; n <<= 1);
+
+    set = (ADDR_SET *)malloc(sizeof(ADDR_SET));
+    set->slots = (ADDR_ENTRY *)calloc(n, sizeof(ADDR_ENTRY));
+    set->capacity = n;
+    set->len = 0;
+    set->limit = limit;
+    return set;
+}
+
+// Adds the address to the set, returns 1 if it was added and 0 if it was already
+// present or the set is full
+int addr_set_insert(ADDR_SET *set, uint32_t family, const uint8_t *addr)
+{
+    ADDR_ENTRY key, *slot;
+    unsigned int i, mask;
+
+    addr_key(&key, family, addr);
+
+    mask = set->capacity - 1;
+    for(i = key.hash & mask;; i = (i + 1) & mask) {
+        slot = &set->slots[i];
+        if(slot->family == 0) break;
+        if(slot->hash == key.hash && slot->lo == key.lo && slot->hi == key.hi && slot->family == key.family)
+            return 0;
+    }
+    if(set->limit && set->len == set->limit) return 0;
+
+    *slot = key;
+    set->len++;
+
+    // Keep the load factor at or below one half so probe sequences stay short
+    if(set->len * 2 > set->capacity) addr_set_grow(set);
+    return 1;
+}
+
+// Packs an address into its two word form and hashes it
+static void addr_key(ADDR_ENTRY *e, uint32_t family, const uint8_t *addr)
+{
+    uint64_t h;
+
+    e->lo = e->hi = 0;
+    switch(family) {
+        case ADDR_MAC:
+            memcpy(&e->lo, addr, 6);
+            break;
+        case ADDR_IP4:
+            memcpy(&e->lo, addr, 4);
+            break;
+        case ADDR_IP6:
+            memcpy(&e->lo, addr, 8);
+            memcpy(&e->hi, addr + 8, 8);
+            break;
+    }
+    e->family = family;
+
+    // A multiply and xor-shift mix, cheap and good enough for table indexing
+    h = (e->lo ^ (e->hi * 0x9e3779b97f4a7c15ULL) ^ family) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+    e->hash = (uint32_t)h;
+}
+
+static void addr_set_grow(ADDR_SET *set)
+{
+    ADDR_ENTRY *old;
+    unsigned int old_capacity, mask, j;
+
+    old = set->slots;
+    old_capacity = set->capacity;
+    set->capacity *= 2;
+    set->slots = (ADDR_ENTRY *)calloc(set->capacity, sizeof(ADDR_ENTRY));
+
+    mask = set->capacity - 1;
+    for(unsigned int i = 0; i < old_capacity; ++i) {
+        if(old[i].family == 0) continue;
+        for(j = old[i].hash & mask; set->slots[j].family != 0; j = (j + 1) & mask);
+        set->slots[j] = old[i];
+    }
+
+    free(old);
+}
@@ -2,31 +2,116 @@
 #include "packet.h"
 #include "args.h"
 #include "errors.h"
+#include "capture.h"
+#include "ui.h"
+#include "pcapwriter.h"
+#include "report.h"
+#include "flow.h"
+#include "hosts.h"
+#include "decode.h"
+#include "timing.h"
+#include "spsc.h"
+#include "overload.h"
 
 #include <unistd.h>
+#include <getopt.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <linux/if_packet.h>
 
 #define MAX_ARG_DESCRIPTION 100
-#define NUM_ARGS 3
+#define NUM_ARGS 31
+
+// Long options without a short form
+#define OPT_HEADLESS 256
+#define OPT_INTERVAL 257
+#define OPT_FORMAT   258
+#define OPT_OUTPUT   259
+#define OPT_FLOW_MEMORY  260
+#define OPT_FLOW_TIMEOUT 261
+#define OPT_EXACT_ADDRS  262
+#define OPT_BURST        263
+#define OPT_QUEUE        264
+#define OPT_BATCH        265
+#define OPT_METRICS      266
+#define OPT_SHM          267
+#define OPT_RCVBUF       268
+#define OPT_SAMPLE       269
+#define OPT_HOST_MEMORY  270
 
 static char arguments[][2][MAX_ARG_DESCRIPTION] = {
     {"-h", "Print out usage information"},
     {"-t <ethertype>", "Monitor packets of a specific ethertype, can be hexidecimal, 'ip4', 'ip6', 'arp', or 'netrans'"},
-    {"-d <network-device>", "The name of the network device to monitor"}
+    {"-f <filter>", "Only capture frames matching the expression, e.g. \"ip4 and udp and port 5001\""},
+    {"-d <network-device>", "The name of the network device to monitor"},
+    {"-c <backend>", "Capture backend, 'ring' (mmap'd TPACKET_V3, default), 'mmsg' (recvmmsg) or 'recv'"},
+    {"-b <block-kb>", "Size of each packet ring block in KiB, a power of two of whole pages (default 1024)"},
+    {"-n <block-count>", "Number of blocks in the packet ring (default 64)"},
+    {"-F <fps>", "Frames per second drawn by the display, from 1 to 60 (default 20)"},
+    {"-j <workers>", "Capture with this many sockets and decode threads in a fanout group (default 1)"},
+    {"-m <fanout-mode>", "How frames are spread across workers, 'hash' (default), 'cpu', or 'lb'"},
+    {"-r <file>", "Replay a pcap or pcapng file instead of capturing from a device"},
+    {"-p <pace>", "Replay pacing, 'max' (default), 'real' for original timing, or a speed multiplier"},
+    {"-w <prefix>", "Save accepted frames to pcap files named after prefix"},
+    {"-s <snaplen>", "Bytes of each frame captured and saved, at most 64 KiB with mmsg or recv (default 262144)"},
+    {"-C <megabytes>", "Start a new pcap file once the current one holds this many million bytes"},
+    {"-G <seconds>", "Start a new pcap file every this many seconds"},
+    {"--headless", "Print stats every interval instead of drawing the display, stop with SIGINT or SIGTERM"},
+    {"--interval <seconds>", "Seconds between headless records, may be fractional (default 1)"},
+    {"--format <format>", "Headless record format, 'json' (one object per line, default) or 'csv'"},
+    {"--output <file>", "Append headless records to file instead of stdout"},
+    {"--flow-memory <MiB>", "Memory each worker may use to track flows, 0 to not track them (default 16)"},
+    {"--flow-timeout <secs>", "Seconds a flow may be idle before it is forgotten (default 60)"},
+    {"--host-memory <MiB>", "Memory each worker may use to account traffic per MAC and IP address (default 8)"},
+    {"--exact-addrs <count>", "Addresses of each kind counted exactly, 0 to only estimate them (default 65536)"},
+    {"--burst <count>/<us>", "Count a burst when this many frames arrive within this many microseconds (default 32/100)"},
+    {"--queue <frames>", "Frames queued from each capture to decode thread, a power of two, 0 for one (default 4096)"},
+    {"--batch <frames>", "Frames received by each recvmmsg with the mmsg backend, from 1 to 1024 (default 64)"},
+    {"--rcvbuf <KiB>", "Receive buffer of each mmsg or recv capture socket (default the system's)"},
+    {"--sample <ratio>", "Decode one flow in ratio in full, a power of two, or 'auto' to sample when overloaded (default)"},
+    {"--metrics <address>", "Serve OpenMetrics on [host:]port (host defaults to localhost) or a unix socket path"},
+    {"--shm <name>", "Publish counters and rates in shared memory for netmon-stat, e.g. /netmon"}
+};
+
+static struct option long_options[] = {
+    {"headless", no_argument, NULL, OPT_HEADLESS},
+    {"interval", required_argument, NULL, OPT_INTERVAL},
+    {"format", required_argument, NULL, OPT_FORMAT},
+    {"output", required_argument, NULL, OPT_OUTPUT},
+    {"flow-memory", required_argument, NULL, OPT_FLOW_MEMORY},
+    {"flow-timeout", required_argument, NULL, OPT_FLOW_TIMEOUT},
+    {"host-memory", required_argument, NULL, OPT_HOST_MEMORY},
+    {"exact-addrs", required_argument, NULL, OPT_EXACT_ADDRS},
+    {"burst", required_argument, NULL, OPT_BURST},
+    {"queue", required_argument, NULL, OPT_QUEUE},
+    {"batch", required_argument, NULL, OPT_BATCH},
+    {"rcvbuf", required_argument, NULL, OPT_RCVBUF},
+    {"sample", required_argument, NULL, OPT_SAMPLE},
+    {"metrics", required_argument, NULL, OPT_METRICS},
+    {"shm", required_argument, NULL, OPT_SHM},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
 };
 
 static netmon_args_t *args_init();
 static int parse_ethertype(netmon_args_t *args, char *arg);
+static void add_filter(netmon_args_t *args, char *expr);
+static int parse_backend(netmon_args_t *args, char *arg);
+static int parse_fanout_mode(netmon_args_t *args, char *arg);
+static int parse_pace(netmon_args_t *args, char *arg);
+static int parse_interval(netmon_args_t *args, char *arg);
+static int parse_burst(netmon_args_t *args, char *arg);
+static int parse_count(unsigned int *value, char *arg);
 static void usage(char *name);
 
 netmon_args_t *args_process(int argc, char *argv[])
 {
     netmon_args_t *args = args_init();
+    unsigned int count;
     int opt;
 
-    while((opt = getopt(argc, argv, "d:t:h")) != -1) {
+    while((opt = getopt_long(argc, argv, "d:t:f:c:b:n:F:j:m:r:p:w:s:C:G:h", long_options, NULL)) != -1) {
         switch(opt) {
             case 'd':
                 args->net_device = strdup(optarg);
@@ -37,6 +122,180 @@ netmon_args_t *args_process(int argc, char *argv[])
                     return NULL;
                 }
                 break;
+            case 'f':
+                add_filter(args, optarg);
+                break;
+            case 'c':
+                if(parse_backend(args, optarg) == -1) {
+                    sprintf(error_msg, "Invalid capture backend '%s'", optarg);
+                    return NULL;
+                }
+                break;
+            case 'b':
+                // The kernel wants whole pages in a power of two, anything else would only
+                // make the ring refuse and fall back to another backend
+                if(parse_count(&args->block_size, optarg) == -1 || args->block_size > (1 << 21) ||
+                        (args->block_size & (args->block_size - 1)) ||
+                        (args->block_size * 1024UL) % sysconf(_SC_PAGESIZE) != 0) {
+                    sprintf(error_msg, "Invalid ring block size '%s', must be a power of two multiple of %ld KiB",
+                            optarg, sysconf(_SC_PAGESIZE) / 1024);
+                    return NULL;
+                }
+                args->block_size *= 1024;
+                break;
+            case 'n':
+                if(parse_count(&args->block_count, optarg) == -1) {
+                    sprintf(error_msg, "Invalid ring block count '%s'", optarg);
+                    return NULL;
+                }
+                break;
+            case 'F':
+                if(parse_count((unsigned int *)&args->fps, optarg) == -1 || args->fps > MAX_UI_FPS) {
+                    sprintf(error_msg, "Invalid frame rate '%s'", optarg);
+                    return NULL;
+                }
+                break;
+            case 'j':
+                if(parse_count((unsigned int *)&args->workers, optarg) == -1 || args->workers > MAX_WORKERS) {
+                    sprintf(error_msg, "Invalid worker count '%s'", optarg);
+                    return NULL;
+                }
+                break;
+            case 'm':
+                if(parse_fanout_mode(args, optarg) == -1) {
+                    sprintf(error_msg, "Invalid fanout mode '%s'", optarg);
+                    return NULL;
+                }
+                break;
+            case 'r':
+                args->read_file = strdup(optarg);
+                break;
+            case 'p':
+                if(parse_pace(args, optarg) == -1) {
+                    sprintf(error_msg, "Invalid replay pacing '%s'", optarg);
+                    return NULL;
+                }
+                break;
+            case 'w':
+                args->write_prefix = strdup(optarg);
+                break;
+            case 's':
+                if(parse_count(&args->snaplen, optarg) == -1 || args->snaplen > DEFAULT_SNAPLEN) {
+                    sprintf(error_msg, "Invalid snapshot length '%s'", optarg);
+                    return NULL;
+                }
+                break;
+            case 'C':
+                if(parse_count(&count, optarg) == -1) {
+                    sprintf(error_msg, "Invalid rotation size '%s'", optarg);
+                    return NULL;
+                }
+                args->rotate_bytes = count * 1000000UL;
+                break;
+            case 'G':
+                if(parse_count(&args->rotate_secs, optarg) == -1) {
+                    sprintf(error_msg, "Invalid rotation interval '%s'", optarg);
+                    return NULL;
+                }
+                break;
+            case OPT_HEADLESS:
+                args->headless = 1;
+                break;
+            case OPT_INTERVAL:
+                if(parse_interval(args, optarg) == -1) {
+                    sprintf(error_msg, "Invalid report interval '%s'", optarg);
+                    return NULL;
+                }
+                break;
+            case OPT_FORMAT:
+                if(strcmp(optarg, "json") == 0) {
+                    args->report_format = REPORT_JSON;
+                } else if(strcmp(optarg, "csv") == 0) {
+                    args->report_format = REPORT_CSV;
+                } else {
+                    sprintf(error_msg, "Invalid report format '%s'", optarg);
+                    return NULL;
+                }
+                break;
+            case OPT_OUTPUT:
+                args->report_path = strdup(optarg);
+                break;
+            case OPT_FLOW_MEMORY:
+                // Zero is allowed here and turns tracking off
+                if(strcmp(optarg, "0") == 0) {
+                    args->flow_memory = 0;
+                } else if(parse_count(&count, optarg) == -1 || count > 4096) {
+                    sprintf(error_msg, "Invalid flow memory '%s'", optarg);
+                    return NULL;
+                } else {
+                    args->flow_memory = (size_t)count << 20;
+                }
+                break;
+            case OPT_FLOW_TIMEOUT:
+                if(parse_count(&args->flow_timeout, optarg) == -1) {
+                    sprintf(error_msg, "Invalid flow timeout '%s'", optarg);
+                    return NULL;
+                }
+                break;
+            case OPT_HOST_MEMORY:
+                if(parse_count(&count, optarg) == -1 || count > 4096) {
+                    sprintf(error_msg, "Invalid host memory '%s'", optarg);
+                    return NULL;
+                }
+                args->host_memory = (size_t)count << 20;
+                break;
+            case OPT_EXACT_ADDRS:
+                if(strcmp(optarg, "0") == 0) {
+                    args->exact_addrs = 0;
+                } else if(parse_count(&args->exact_addrs, optarg) == -1) {
+                    sprintf(error_msg, "Invalid exact address count '%s'", optarg);
+                    return NULL;
+                }
+                break;
+            case OPT_BURST:
+                if(parse_burst(args, optarg) == -1) {
+                    sprintf(error_msg, "Invalid burst '%s'", optarg);
+                    return NULL;
+                }
+                break;
+            case OPT_QUEUE:
+                if(strcmp(optarg, "0") == 0) {
+                    args->queue_slots = 0;
+                } else if(parse_count(&args->queue_slots, optarg) == -1 || args->queue_slots < 2 ||
+                        args->queue_slots > MAX_SPSC_SLOTS || (args->queue_slots & (args->queue_slots - 1))) {
+                    sprintf(error_msg, "Invalid queue size '%s'", optarg);
+                    return NULL;
+                }
+                break;
+            case OPT_BATCH:
+                if(parse_count(&args->mmsg_batch, optarg) == -1 || args->mmsg_batch > MAX_MMSG_BATCH) {
+                    sprintf(error_msg, "Invalid receive batch '%s'", optarg);
+                    return NULL;
+                }
+                break;
+            case OPT_RCVBUF:
+                if(parse_count(&args->rcvbuf, optarg) == -1 || args->rcvbuf > (1 << 20)) {
+                    sprintf(error_msg, "Invalid receive buffer size '%s'", optarg);
+                    return NULL;
+                }
+                args->rcvbuf *= 1024;
+                break;
+            case OPT_SAMPLE:
+                if(strcmp(optarg, "auto") == 0) {
+                    args->sample_ratio = 0;
+                } else if(parse_count(&args->sample_ratio, optarg) == -1 || args->sample_ratio > MAX_SAMPLE_RATIO ||
+                        (args->sample_ratio & (args->sample_ratio - 1))) {
+                    sprintf(error_msg, "Invalid sampling ratio '%s', must be 'auto' or a power of two up to %d",
+                            optarg, MAX_SAMPLE_RATIO);
+                    return NULL;
+                }
+                break;
+            case OPT_METRICS:
+                args->metrics_address = strdup(optarg);
+                break;
+            case OPT_SHM:
+                args->shm_name = strdup(optarg);
+                break;
             case 'h':
                 usage(argv[0]);
                 exit(EXIT_SUCCESS);
@@ -54,40 +313,175 @@ static netmon_args_t *args_init()
 
     args = (netmon_args_t *)malloc(sizeof(netmon_args_t));
     args->net_device = NULL;
-    args->ether_type = 0;
+    args->filter = NULL;
+    args->capture_backend = CAPTURE_RING;
+    args->block_size = DEFAULT_BLOCK_SIZE;
+    args->block_count = DEFAULT_BLOCK_COUNT;
+    args->mmsg_batch = DEFAULT_MMSG_BATCH;
+    args->rcvbuf = 0;
+    args->fps = DEFAULT_UI_FPS;
+    args->workers = 1;
+    args->fanout_mode = PACKET_FANOUT_HASH;
+    args->read_file = NULL;
+    args->replay_speed = 0;
+    args->write_prefix = NULL;
+    args->snaplen = DEFAULT_SNAPLEN;
+    args->rotate_bytes = 0;
+    args->rotate_secs = 0;
+    args->headless = 0;
+    args->report_interval_ms = DEFAULT_REPORT_INTERVAL_MS;
+    args->report_format = REPORT_JSON;
+    args->report_path = NULL;
+    args->metrics_address = NULL;
+    args->shm_name = NULL;
+    args->flow_memory = DEFAULT_FLOW_MEMORY;
+    args->flow_timeout = DEFAULT_FLOW_TIMEOUT;
+    args->host_memory = DEFAULT_HOST_MEMORY;
+    args->exact_addrs = DEFAULT_EXACT_ADDRS;
+    args->burst_packets = DEFAULT_BURST_PACKETS;
+    args->burst_usecs = DEFAULT_BURST_USECS;
+    args->queue_slots = DEFAULT_SPSC_SLOTS;
+    args->sample_ratio = 0;
     return args;
 }
 
+// The ethertype option is shorthand for an 'ether' filter expression
 static int parse_ethertype(netmon_args_t *args, char *arg)
 {
     char *endptr;
+    char expr[16];
     uint16_t type;
 
     type = strtol(arg, &endptr, 16);
 
-    if(*endptr == '\0') {
-        args->ether_type = type;
-    } else {
+    if(*endptr != '\0') {
         if(strcmp(arg, "ip4") == 0) {
-            args->ether_type = ETH_TYPE_IP4;
+            type = ETH_TYPE_IP4;
         } else if(strcmp(arg, "ip6") == 0) {
-            args->ether_type = ETH_TYPE_IP6;
+            type = ETH_TYPE_IP6;
         } else if(strcmp(arg, "arp") == 0) {
-            args->ether_type = ETH_TYPE_ARP;
+            type = ETH_TYPE_ARP;
         } else if(strcmp(arg, "netrans") == 0) {
-            args->ether_type = ETH_TYPE_NETRANS;
+            type = ETH_TYPE_NETRANS;
         } else {
             return -1;
         }
     }
 
+    sprintf(expr, "ether %04x", type);
+    add_filter(args, expr);
+    return 1;
+}
+
+// Every filter given must match
+static void add_filter(netmon_args_t *args, char *expr)
+{
+    char *combined;
+
+    if(!args->filter) {
+        args->filter = strdup(expr);
+        return;
+    }
+
+    combined = (char *)malloc(strlen(args->filter) + strlen(expr) + 12);
+    sprintf(combined, "(%s) and (%s)", args->filter, expr);
+    free(args->filter);
+    args->filter = combined;
+}
+
+static int parse_backend(netmon_args_t *args, char *arg)
+{
+    if(strcmp(arg, "ring") == 0) {
+        args->capture_backend = CAPTURE_RING;
+    } else if(strcmp(arg, "mmsg") == 0) {
+        args->capture_backend = CAPTURE_MMSG;
+    } else if(strcmp(arg, "recv") == 0) {
+        args->capture_backend = CAPTURE_RECV;
+    } else {
+        return -1;
+    }
+
+    return 1;
+}
+
+static int parse_fanout_mode(netmon_args_t *args, char *arg)
+{
+    if(strcmp(arg, "hash") == 0) {
+        args->fanout_mode = PACKET_FANOUT_HASH;
+    } else if(strcmp(arg, "cpu") == 0) {
+        args->fanout_mode = PACKET_FANOUT_CPU;
+    } else if(strcmp(arg, "lb") == 0) {
+        args->fanout_mode = PACKET_FANOUT_LB;
+    } else {
+        return -1;
+    }
+
+    return 1;
+}
+
+static int parse_pace(netmon_args_t *args, char *arg)
+{
+    char *endptr;
+    double speed;
+
+    if(strcmp(arg, "max") == 0) {
+        args->replay_speed = 0;
+    } else if(strcmp(arg, "real") == 0) {
+        args->replay_speed = 1;
+    } else {
+        speed = strtod(arg, &endptr);
+        if(*arg == '\0' || *endptr != '\0' || !(speed > 0)) return -1;
+        args->replay_speed = speed;
+    }
+
+    return 1;
+}
+
+// Intervals are given in seconds and kept in milliseconds, at least one
+static int parse_interval(netmon_args_t *args, char *arg)
+{
+    char *endptr;
+    double secs;
+
+    secs = strtod(arg, &endptr);
+    if(*arg == '\0' || *endptr != '\0' || !(secs >= 0.001) || secs > 86400) return -1;
+    args->report_interval_ms = secs * 1000 + 0.5;
+    return 1;
+}
+
+// A burst is given as frames/microseconds, at least two frames
+static int parse_burst(netmon_args_t *args, char *arg)
+{
+    char packets[16], *usecs;
+
+    if(!(usecs = strchr(arg, '/')) || usecs - arg >= (int)sizeof(packets)) return -1;
+    memcpy(packets, arg, usecs - arg);
+    packets[usecs - arg] = '\0';
+    if(parse_count(&args->burst_packets, packets) == -1 || parse_count(&args->burst_usecs, usecs + 1) == -1 ||
+            args->burst_packets < 2 || args->burst_packets > MAX_BURST_PACKETS) return -1;
+    return 1;
+}
+
+// Parses a strictly positive decimal integer
+static int parse_count(unsigned int *value, char *arg)
+{
+    char *endptr;
+    long n;
+
+    n = strtol(arg, &endptr, 10);
+    if(*arg == '\0' || *endptr != '\0' || n <= 0 || n > 0x7fffffff) return -1;
+    *value = n;
     return 1;
 }
 
 static void usage(char *name)
 {
-    fprintf(stderr, "Usage: %s [-d <network device>] [-t <ethertype>]\n", name);
+    fprintf(stderr, "Usage: %s [-d <network device>] [-t <ethertype>] [-f <filter>] [-c <backend>] [-b <block-kb>] [-n <block-count>] [-F <fps>] [-j <workers>] [-m <fanout-mode>] [-r <file> [-p <pace>]]\n"
+           "       [-s <snaplen>] [-w <prefix> [-C <megabytes>] [-G <seconds>]]\n"
+           "       [--headless [--interval <seconds>] [--format <format>] [--output <file>]]\n"
+           "       [--flow-memory <MiB>] [--flow-timeout <secs>] [--host-memory <MiB>] [--exact-addrs <count>] [--burst <count>/<us>]\n"
+           "       [--queue <frames>] [--batch <frames>] [--rcvbuf <KiB>] [--sample <ratio>] [--metrics <address>] [--shm <name>]\n", name);
     for(int i = 0; i < NUM_ARGS; ++i) {
-        fprintf(stderr, "%-20s %s\n", arguments[i][0], arguments[i][1]);
+        fprintf(stderr, "%-22s %s\n", arguments[i][0], arguments[i][1]);
     }
 }
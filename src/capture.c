@@ -0,0 +1,375 @@
+// recvmmsg is a GNU extension
+#define _GNU_SOURCE
+
+#include "capture.h"
+#include "errors.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+
+// Needed to check for device index
+#include <sys/ioctl.h>
+#include <net/if.h>
+
+#define DEFAULT_NET_DEVICE "eth0"
+
+// Room for the kernel's timestamp and the packet's auxiliary data alongside each frame
+#define CONTROL_LEN (CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(struct tpacket_auxdata)))
+
+static int dispatch_recv(CAPTURE *cap, capture_handler handler, void *arg);
+static int dispatch_ring(CAPTURE *cap, capture_handler handler, void *arg);
+static int dispatch_mmsg(CAPTURE *cap, capture_handler handler, void *arg);
+static uint64_t recv_control(struct msghdr *msg, int *wire_len);
+static void ring_release(CAPTURE *cap, int attached);
+
+// Opens a raw socket bound to device_name that hands over at most snaplen bytes of each
+// frame, along with its length on the wire. Returns NULL and sets error_msg on failure
+CAPTURE *capture_open(char *device_name, unsigned int snaplen)
+{
+    CAPTURE *cap;
+    int sockfd;
+    struct ifreq ifr;
+    struct sockaddr_ll sockaddr;
+    int on = 1;
+
+    // Open a raw socket
+    sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+
+    if(sockfd == -1) {
+        sprintf(error_msg, "Unable to open raw socket (root privelidges required)");
+        return NULL;
+    }
+
+    if(!device_name) device_name = DEFAULT_NET_DEVICE;
+
+    // Ensure device_name is really a network device name and determine device index
+    memset(&ifr, 0, sizeof(struct ifreq));
+    strncpy(ifr.ifr_name, device_name, IFNAMSIZ - 1);
+    if(ioctl(sockfd, SIOCGIFINDEX, &ifr) < 0) {
+        sprintf(error_msg, "Improper device name");
+        close(sockfd);
+        return NULL;
+    }
+
+    // Bind address to socket
+    memset(&sockaddr, 0, sizeof(struct sockaddr_ll));
+    sockaddr.sll_family = AF_PACKET;
+    sockaddr.sll_protocol = htons(ETH_P_ALL);
+    sockaddr.sll_ifindex = ifr.ifr_ifindex;
+    if(bind(sockfd, (struct sockaddr *)(&sockaddr), sizeof(struct sockaddr_ll)) == -1) {
+        sprintf(error_msg, "Unable to bind address to socket");
+        close(sockfd);
+        return NULL;
+    }
+
+    // Have the kernel stamp each frame as it arrives, the ring carries its own stamps
+    // but recvfrom would otherwise be timed when userspace gets around to it
+    setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    // And report each frame's length before truncation, MSG_TRUNC alone would give
+    // the length after any filter has cut it down to the snaplen
+    setsockopt(sockfd, SOL_PACKET, PACKET_AUXDATA, &on, sizeof(on));
+
+    cap = (CAPTURE *)malloc(sizeof(CAPTURE));
+    memset(cap, 0, sizeof(CAPTURE));
+    cap->sockfd = sockfd;
+    cap->backend = CAPTURE_RECV;
+    cap->snaplen = snaplen;
+    cap->buffer_size = snaplen < CAPTURE_MAX_BUFFER ? snaplen : CAPTURE_MAX_BUFFER;
+    cap->buffer = (char *)malloc(cap->buffer_size);
+    return cap;
+}
+
+// Attaches a classic BPF program so unwanted frames never leave the kernel
+int capture_attach_filter(CAPTURE *cap, struct sock_fprog *prog)
+{
+    if(setsockopt(cap->sockfd, SOL_SOCKET, SO_ATTACH_FILTER, prog, sizeof(struct sock_fprog)) == -1) {
+        sprintf(error_msg, "Unable to attach filter to socket");
+        return -1;
+    }
+
+    // Frames queued between bind and attach were never filtered, throw them away
+    while(recv(cap->sockfd, cap->buffer, cap->buffer_size, MSG_DONTWAIT) > 0);
+    return 1;
+}
+
+// Switches the capture over to a mmap'd TPACKET_V3 ring
+int capture_ring_setup(CAPTURE *cap, unsigned int block_size, unsigned int block_count)
+{
+    struct tpacket_req3 req;
+    int version = TPACKET_V3;
+    long page_size;
+
+    // The kernel wants page sized, power of two blocks that hold whole frame slots
+    page_size = sysconf(_SC_PAGESIZE);
+    if(block_size < page_size || block_size % page_size != 0 ||
+            (block_size & (block_size - 1)) != 0 || block_count == 0) {
+        sprintf(error_msg, "Ring block size must be a power of two multiple of %ld bytes", page_size);
+        return -1;
+    }
+
+    if(setsockopt(cap->sockfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+        sprintf(error_msg, "Unable to select TPACKET_V3");
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(struct tpacket_req3));
+    req.tp_block_size = block_size;
+    req.tp_block_nr = block_count;
+    req.tp_frame_size = RING_FRAME_SIZE;
+    req.tp_frame_nr = (block_size / RING_FRAME_SIZE) * block_count;
+    req.tp_retire_blk_tov = RING_RETIRE_TIMEOUT;
+    if(setsockopt(cap->sockfd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+        sprintf(error_msg, "Unable to allocate a %u x %u byte packet ring", block_count, block_size);
+        ring_release(cap, 0);
+        return -1;
+    }
+
+    cap->ring_len = (size_t)block_size * block_count;
+    cap->ring = mmap(NULL, cap->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED, cap->sockfd, 0);
+    if(cap->ring == MAP_FAILED) {
+        cap->ring = NULL;
+        sprintf(error_msg, "Unable to map packet ring");
+        ring_release(cap, 1);
+        return -1;
+    }
+
+    cap->block_size = block_size;
+    cap->block_count = block_count;
+    cap->block_pos = 0;
+    cap->backend = CAPTURE_RING;
+    return 1;
+}
+
+// Switches the capture over to recvmmsg, receiving up to batch frames a call. Every
+// header, buffer and control block is allocated here and reused for each batch
+int capture_mmsg_setup(CAPTURE *cap, unsigned int batch)
+{
+    size_t control_len = CONTROL_LEN;
+
+    if(batch == 0 || batch > MAX_MMSG_BATCH) {
+        sprintf(error_msg, "Receive batch must be from 1 to %d frames", MAX_MMSG_BATCH);
+        return -1;
+    }
+
+    cap->msgs = (struct mmsghdr *)calloc(batch, sizeof(struct mmsghdr));
+    cap->iovs = (struct iovec *)calloc(batch, sizeof(struct iovec));
+    cap->batch_buffer = (char *)malloc((size_t)batch * cap->buffer_size);
+    cap->batch_control = (char *)calloc(batch, control_len);
+    if(!cap->msgs || !cap->iovs || !cap->batch_buffer || !cap->batch_control) {
+        // Free what was allocated, so a failed setup leaves the capture as it was
+        free(cap->msgs);
+        free(cap->iovs);
+        free(cap->batch_buffer);
+        free(cap->batch_control);
+        cap->msgs = NULL;
+        cap->iovs = NULL;
+        cap->batch_buffer = NULL;
+        cap->batch_control = NULL;
+        sprintf(error_msg, "Unable to allocate a receive batch of %u frames", batch);
+        return -1;
+    }
+
+    for(unsigned int i = 0; i < batch; ++i) {
+        cap->iovs[i].iov_base = cap->batch_buffer + (size_t)i * cap->buffer_size;
+        cap->iovs[i].iov_len = cap->buffer_size;
+        cap->msgs[i].msg_hdr.msg_iov = &cap->iovs[i];
+        cap->msgs[i].msg_hdr.msg_iovlen = 1;
+        cap->msgs[i].msg_hdr.msg_control = cap->batch_control + i * control_len;
+    }
+
+    cap->batch = batch;
+    cap->backend = CAPTURE_MMSG;
+    return 1;
+}
+
+// Sets the socket's receive buffer to bytes, beyond the system limit if privileged
+int capture_set_rcvbuf(CAPTURE *cap, unsigned int bytes)
+{
+    int size = bytes;
+
+    // SO_RCVBUFFORCE ignores rmem_max but needs CAP_NET_ADMIN, which capture already has
+    if(setsockopt(cap->sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == -1 &&
+            setsockopt(cap->sockfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == -1) {
+        sprintf(error_msg, "Unable to set a %u byte receive buffer", bytes);
+        return -1;
+    }
+    return 1;
+}
+
+// The kernel cuts a frame that would overflow a ring block to fit, the socket
+// backends to their buffer
+unsigned int capture_snaplen(CAPTURE *cap)
+{
+    if(cap->backend == CAPTURE_RING) return cap->snaplen < cap->block_size ? cap->snaplen : cap->block_size;
+    return cap->buffer_size;
+}
+
+// Adds what the kernel counted since the last call to cap->kernel, reading the
+// statistics resets them. A ring socket reports in the TPACKET_V3 layout, which
+// adds the number of times the ring filled up
+void capture_read_stats(CAPTURE *cap)
+{
+    struct tpacket_stats_v3 stats;
+    socklen_t len;
+
+    memset(&stats, 0, sizeof(struct tpacket_stats_v3));
+    len = cap->backend == CAPTURE_RING ? sizeof(struct tpacket_stats_v3) : sizeof(struct tpacket_stats);
+    if(getsockopt(cap->sockfd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == -1) return;
+
+    // tp_packets counts the dropped frames too
+    cap->kernel.packets += stats.tp_packets;
+    cap->kernel.drops += stats.tp_drops;
+    cap->kernel.freezes += stats.tp_freeze_q_cnt;
+}
+
+// Counts the blocks the kernel has handed over and the capture thread has not yet
+// given back, the blocks and their status words stay mapped for the socket's lifetime
+unsigned int capture_ring_fill(CAPTURE *cap)
+{
+    struct tpacket_block_desc *bd;
+    unsigned int waiting = 0;
+
+    if(cap->backend != CAPTURE_RING) return 0;
+    for(unsigned int i = 0; i < cap->block_count; ++i) {
+        bd = (struct tpacket_block_desc *)(cap->ring + (size_t)i * cap->block_size);
+        if(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_RELAXED) & TP_STATUS_USER) waiting++;
+    }
+    return waiting * 100 / cap->block_count;
+}
+
+// Joins a PACKET_FANOUT group so the kernel spreads frames across its sockets,
+// mode is one of PACKET_FANOUT_HASH, PACKET_FANOUT_CPU or PACKET_FANOUT_LB
+int capture_join_fanout(CAPTURE *cap, int group, int mode)
+{
+    int arg;
+
+    // Hashing needs whole datagrams, so have the kernel defragment before it picks a socket
+    if(mode == PACKET_FANOUT_HASH) mode |= PACKET_FANOUT_FLAG_DEFRAG;
+    arg = (group & 0xffff) | (mode << 16);
+    if(setsockopt(cap->sockfd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) == -1) {
+        sprintf(error_msg, "Unable to join packet fanout group %d", group);
+        return -1;
+    }
+    return 1;
+}
+
+// Hands any waiting frames to handler without blocking, returns the number of frames
+int capture_dispatch(CAPTURE *cap, capture_handler handler, void *arg)
+{
+    if(cap->backend == CAPTURE_RING) return dispatch_ring(cap, handler, arg);
+    if(cap->backend == CAPTURE_MMSG) return dispatch_mmsg(cap, handler, arg);
+    return dispatch_recv(cap, handler, arg);
+}
+
+static int dispatch_recv(CAPTURE *cap, capture_handler handler, void *arg)
+{
+    char control[CONTROL_LEN];
+    struct msghdr msg;
+    struct iovec iov;
+    uint64_t ts;
+    int len, wire_len;
+
+    iov.iov_base = cap->buffer;
+    iov.iov_len = cap->buffer_size;
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    // MSG_TRUNC returns the full length even when only the snaplen was copied
+    len = recvmsg(cap->sockfd, &msg, MSG_DONTWAIT | MSG_TRUNC);
+    if(len <= 0) return 0;
+    wire_len = len;
+    ts = recv_control(&msg, &wire_len);
+    handler(arg, cap->buffer, len < (int)cap->buffer_size ? len : (int)cap->buffer_size, wire_len, ts);
+    return 1;
+}
+
+// One syscall fills the whole batch, the kernel sets each frame's length and shrinks
+// its control length, so the control lengths are reset before every call
+static int dispatch_mmsg(CAPTURE *cap, capture_handler handler, void *arg)
+{
+    uint64_t ts;
+    int n, len, wire_len;
+
+    for(unsigned int i = 0; i < cap->batch; ++i)
+        cap->msgs[i].msg_hdr.msg_controllen = CONTROL_LEN;
+
+    n = recvmmsg(cap->sockfd, cap->msgs, cap->batch, MSG_DONTWAIT | MSG_TRUNC, NULL);
+    if(n <= 0) return 0;
+    for(int i = 0; i < n; ++i) {
+        wire_len = len = cap->msgs[i].msg_len;
+        ts = recv_control(&cap->msgs[i].msg_hdr, &wire_len);
+        handler(arg, (char *)cap->iovs[i].iov_base, len < (int)cap->buffer_size ? len : (int)cap->buffer_size,
+                wire_len, ts);
+    }
+    return n;
+}
+
+// The kernel's receive timestamp and the frame's length on the wire come back as control
+// messages. The clock is only read if the socket would not give a timestamp, and
+// wire_len is left alone without the auxiliary data
+static uint64_t recv_control(struct msghdr *msg, int *wire_len)
+{
+    struct timespec ts = { 0, 0 };
+    struct tpacket_auxdata aux;
+    struct cmsghdr *cmsg;
+
+    for(cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(struct timespec));
+        } else if(cmsg->cmsg_level == SOL_PACKET && cmsg->cmsg_type == PACKET_AUXDATA) {
+            memcpy(&aux, CMSG_DATA(cmsg), sizeof(struct tpacket_auxdata));
+            *wire_len = aux.tp_len;
+        }
+    }
+    if(!ts.tv_sec) clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Walks every frame of the next block in place, then gives the block back to the kernel
+static int dispatch_ring(CAPTURE *cap, capture_handler handler, void *arg)
+{
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr *hdr;
+    int num_pkts;
+
+    bd = (struct tpacket_block_desc *)(cap->ring + (size_t)cap->block_pos * cap->block_size);
+    if(!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) return 0;
+
+    num_pkts = bd->hdr.bh1.num_pkts;
+    hdr = (struct tpacket3_hdr *)((uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt);
+    for(int i = 0; i < num_pkts; ++i) {
+        handler(arg, (char *)hdr + hdr->tp_mac, hdr->tp_snaplen, hdr->tp_len,
+                (uint64_t)hdr->tp_sec * 1000000000ULL + hdr->tp_nsec);
+        hdr = (struct tpacket3_hdr *)((uint8_t *)hdr + hdr->tp_next_offset);
+    }
+
+    __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    if(++cap->block_pos >= cap->block_count) cap->block_pos = 0;
+    return num_pkts;
+}
+
+// Undoes a ring setup that failed part way, so the socket can be read with the other
+// backends. A ring left attached would take every frame while nothing reads it
+static void ring_release(CAPTURE *cap, int attached)
+{
+    struct tpacket_req3 req;
+    int version = TPACKET_V1;
+
+    if(attached) {
+        memset(&req, 0, sizeof(struct tpacket_req3));
+        setsockopt(cap->sockfd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+    }
+    setsockopt(cap->sockfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));
+}
@@ -0,0 +1,490 @@
+#include "decode.h"
+#include "errors.h"
+#include "packet.h"
+#include "ui.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+
+#define MAX_VLAN_TAGS 2    // Tags walked before a frame counts as unknown, enough for QinQ
+#define MAX_IP6_EXT_HDRS 8 // Extension headers walked before the payload counts as unknown
+
+// Fills in the view from the header at its l3 offset, which is at least min_len bytes
+typedef void (*ether_parser)(PACKET_VIEW *v);
+
+// Accounts what the parser found
+typedef void (*ether_handler)(DECODER *d, PACKET_VIEW *v);
+
+// Defines the slots of the ethertype table, every ethertype without a dissector is in
+// the first. A tag slot walks to the ethertype behind it rather than dissecting
+#define ETHER_UNKNOWN 0
+#define ETHER_VLAN    1
+#define ETHER_IP4     2
+#define ETHER_IP6     3
+#define ETHER_ARP     4
+#define ETHER_NETRANS 5
+
+typedef struct {
+    ether_parser parse;
+    ether_handler account;
+    size_t packets, bytes; // Where its counters live in NETMON_STATS
+    int timing;            // The class its gaps are timed in
+    int min_len;           // Header bytes the parser reads
+} ETHER_DISSECTOR;
+
+// Defines the slots of the IP protocol tables. An extension slot, IPv6 only, walks to
+// the header behind it rather than counting
+#define IP_UNKNOWN   0
+#define IP_EXTENSION 1
+#define IP_ICMP      2
+#define IP_IGMP      3
+#define IP_TCP       4
+#define IP_UDP       5
+
+typedef struct {
+    const char *name;      // As shown in the packet list
+    size_t packets, bytes;
+} IP_DISSECTOR;
+
+// The operations of ARP and netrans, indexed by their number
+typedef struct {
+    const char *name;      // NULL for numbers without one
+    size_t packets;
+} TYPE_DISSECTOR;
+
+static void parse_ip4(PACKET_VIEW *v);
+static void parse_ip6(PACKET_VIEW *v);
+static void parse_arp(PACKET_VIEW *v);
+static void parse_netrans(PACKET_VIEW *v);
+static void parse_ports(PACKET_VIEW *v);
+static void account_ip(DECODER *d, PACKET_VIEW *v);
+static void account_arp(DECODER *d, PACKET_VIEW *v);
+static void account_netrans(DECODER *d, PACKET_VIEW *v);
+
+// A new ethertype is a slot here and an entry in ether_slots
+static const ETHER_DISSECTOR ether_dissectors[] = {
+    [ETHER_UNKNOWN] = { NULL, NULL, 0, 0, TIMING_ALL, 0 },
+    [ETHER_VLAN]    = { NULL, NULL, 0, 0, TIMING_ALL, sizeof(PACKET_VLAN_TAG) },
+    [ETHER_IP4]     = { parse_ip4, account_ip, offsetof(NETMON_STATS, ip4_total), offsetof(NETMON_STATS, ip4_bytes),
+                        TIMING_IP4, sizeof(PACKET_IP4_HDR) },
+    [ETHER_IP6]     = { parse_ip6, account_ip, offsetof(NETMON_STATS, ip6_total), offsetof(NETMON_STATS, ip6_bytes),
+                        TIMING_IP6, sizeof(PACKET_IP6_HDR) },
+    [ETHER_ARP]     = { parse_arp, account_arp, offsetof(NETMON_STATS, arp_total), offsetof(NETMON_STATS, arp_bytes),
+                        TIMING_ARP, sizeof(PACKET_ARP_HDR) },
+    [ETHER_NETRANS] = { parse_netrans, account_netrans, offsetof(NETMON_STATS, netrans_total),
+                        offsetof(NETMON_STATS, netrans_bytes), TIMING_NETRANS, sizeof(PACKET_NETRANS_HDR) }
+};
+
+// Every ethertype has a byte, so finding a frame's dissector is a single load
+static const uint8_t ether_slots[65536] = {
+    [ETH_TYPE_IP4] = ETHER_IP4,
+    [ETH_TYPE_IP6] = ETHER_IP6,
+    [ETH_TYPE_ARP] = ETHER_ARP,
+    [ETH_TYPE_NETRANS] = ETHER_NETRANS,
+    [ETH_TYPE_VLAN] = ETHER_VLAN,
+    [ETH_TYPE_QINQ] = ETHER_VLAN,
+    [ETH_TYPE_QINQ_OLD] = ETHER_VLAN
+};
+
+static const IP_DISSECTOR ip_dissectors[] = {
+    [IP_UNKNOWN]   = { "UNKNOWN", 0, 0 },
+    [IP_EXTENSION] = { "UNKNOWN", 0, 0 },
+    [IP_ICMP]      = { "ICMP", offsetof(NETMON_STATS, icmp_total), offsetof(NETMON_STATS, icmp_bytes) },
+    [IP_IGMP]      = { "IGMP", offsetof(NETMON_STATS, igmp_total), offsetof(NETMON_STATS, igmp_bytes) },
+    [IP_TCP]       = { "TCP", offsetof(NETMON_STATS, tcp_total), offsetof(NETMON_STATS, tcp_bytes) },
+    [IP_UDP]       = { "UDP", offsetof(NETMON_STATS, udp_total), offsetof(NETMON_STATS, udp_bytes) }
+};
+
+static const uint8_t ip4_slots[256] = {
+    [IP_PROTOCOL_ICMP] = IP_ICMP,
+    [IP_PROTOCOL_IGMP] = IP_IGMP,
+    [IP_PROTOCOL_TCP] = IP_TCP,
+    [IP_PROTOCOL_UDP] = IP_UDP
+};
+
+// ICMPv6 counts as ICMP
+static const uint8_t ip6_slots[256] = {
+    [IP_PROTOCOL_IP6ICMP] = IP_ICMP,
+    [IP_PROTOCOL_IGMP] = IP_IGMP,
+    [IP_PROTOCOL_TCP] = IP_TCP,
+    [IP_PROTOCOL_UDP] = IP_UDP,
+    [IP6_EXT_HOP] = IP_EXTENSION,
+    [IP6_EXT_ROUTING] = IP_EXTENSION,
+    [IP6_EXT_FRAGMENT] = IP_EXTENSION,
+    [IP6_EXT_AH] = IP_EXTENSION,
+    [IP6_EXT_DEST] = IP_EXTENSION,
+    [IP6_EXT_MOBILITY] = IP_EXTENSION,
+    [IP6_EXT_HIP] = IP_EXTENSION,
+    [IP6_EXT_SHIM6] = IP_EXTENSION
+};
+
+static const TYPE_DISSECTOR arp_opers[] = {
+    [ARP_OPER_REQUEST] = { "REQUEST", offsetof(NETMON_STATS, request_total) },
+    [ARP_OPER_REPLY]   = { "REPLY", offsetof(NETMON_STATS, reply_total) }
+};
+#define NUM_ARP_OPERS (sizeof(arp_opers) / sizeof(arp_opers[0]))
+
+static const TYPE_DISSECTOR netrans_types[] = {
+    [NETRANS_TYPE_SEND]    = { "SEND", offsetof(NETMON_STATS, send_total) },
+    [NETRANS_TYPE_RECEIVE] = { "RECEIVE", offsetof(NETMON_STATS, receive_total) },
+    [NETRANS_TYPE_ACK]     = { "ACK", offsetof(NETMON_STATS, ack_total) },
+    [NETRANS_TYPE_CHUNK]   = { "CHUNK", offsetof(NETMON_STATS, chunk_total) }
+};
+#define NUM_NETRANS_TYPES (sizeof(netrans_types) / sizeof(netrans_types[0]))
+
+static unsigned int sample_weight(DECODER *d, PACKET_VIEW *v);
+static uint64_t endpoint_hash(const uint8_t *addr, int len, uint16_t port);
+static void count_host(DECODER *d, PACKET_VIEW *v, uint8_t family, uint8_t *addr, int rx);
+static void count_ip_talkers(DECODER *d, PACKET_VIEW *v, int addr_len);
+static void display_packet(DECODER *d, PACKET_VIEW *v, const char *type, const char *type_type);
+static void display_error(DECODER *d, const char *format, unsigned int value);
+
+void decode_shared_init(DECODE_SHARED *shared, unsigned int limit)
+{
+    pthread_mutex_init(&shared->lock, NULL);
+    shared->ip_addrs = limit ? addr_set_new(DEFAULT_ADDR_SET_CAPACITY, limit) : NULL;
+    shared->mac_addrs = limit ? addr_set_new(DEFAULT_ADDR_SET_CAPACITY, limit) : NULL;
+}
+
+// Once a shared set is full the decoder stops taking the lock for addresses it cannot add
+void decoder_init(DECODER *d, NETMON_STATS *stats, DECODE_SHARED *shared, HOST_TABLE *hosts, FLOW_TABLE *flows,
+        TALKER_TABLE *talkers, NETRANS_TABLE *netrans, HLL_WINDOW *distinct, TIMING *timing, int display)
+{
+    d->stats = stats;
+    d->hosts = hosts;
+    d->flows = flows;
+    d->talkers = talkers;
+    d->netrans = netrans;
+    d->distinct = distinct;
+    d->timing = timing;
+    d->display = display;
+    d->sample = 1;
+    d->ip_addrs_full = shared->ip_addrs == NULL;
+    d->mac_addrs_full = shared->mac_addrs == NULL;
+    d->shared = shared;
+}
+
+void decoder_set_sample(DECODER *d, unsigned int ratio)
+{
+    __atomic_store_n(&d->sample, ratio, __ATOMIC_RELAXED);
+}
+
+void decode_frame(DECODER *d, char *frame, int len, int wire_len, uint64_t ts_ns)
+{
+    PACKET_VIEW v;
+
+    if(decode_parse(&v, frame, len, wire_len, ts_ns) == 0) decode_view(d, &v);
+}
+
+// Walks any VLAN tags to the ethertype they carry, then has that ethertype's parser read
+// its header in place. A header the capture cut short, or one that makes no sense, is
+// marked but not read past
+int decode_parse(PACKET_VIEW *v, char *frame, int len, int wire_len, uint64_t ts_ns)
+{
+    PACKET_ETH_HDR *eth = (PACKET_ETH_HDR *)frame;
+    PACKET_VLAN_TAG *tag;
+    const ETHER_DISSECTOR *e;
+    int slot;
+
+    if(len < (int)sizeof(PACKET_ETH_HDR)) return -1;
+    memset(v, 0, sizeof(PACKET_VIEW));
+    v->frame = frame;
+    v->len = len;
+    v->wire_len = wire_len;
+    v->ts_ns = ts_ns;
+    v->mac_dest = eth->eth_mac_dest;
+    v->mac_src = eth->eth_mac_src;
+    v->ethertype = ntohs(eth->eth_type);
+    v->l3 = sizeof(PACKET_ETH_HDR);
+
+    slot = ether_slots[v->ethertype];
+    while(slot == ETHER_VLAN) {
+        if(v->vlan_tags++ == MAX_VLAN_TAGS || len - v->l3 < (int)sizeof(PACKET_VLAN_TAG)) {
+            slot = ETHER_UNKNOWN;
+            break;
+        }
+        tag = (PACKET_VLAN_TAG *)(frame + v->l3);
+        v->ethertype = ntohs(tag->vlan_type);
+        v->l3 += sizeof(PACKET_VLAN_TAG);
+        slot = ether_slots[v->ethertype];
+    }
+
+    v->ether_slot = slot;
+    e = &ether_dissectors[slot];
+    if(len - v->l3 < e->min_len) {
+        v->truncated = 1;
+    } else if(e->parse) {
+        e->parse(v);
+    }
+    return 0;
+}
+
+// The header length is checked before anything behind it is read, a header that is
+// not IPv4, shorter than the fixed part or longer than was captured is only marked
+static void parse_ip4(PACKET_VIEW *v)
+{
+    PACKET_IP4_HDR *ip4 = (PACKET_IP4_HDR *)(v->frame + v->l3);
+    int hdr_len = (ip4->ip4_vers_ihl & 0x0f) * 4;
+
+    if((ip4->ip4_vers_ihl >> 4) != 4 || hdr_len < (int)sizeof(PACKET_IP4_HDR)) {
+        v->malformed = 1;
+        return;
+    }
+    if(v->len - v->l3 < hdr_len) {
+        v->truncated = 1;
+        return;
+    }
+
+    v->family = ADDR_IP4;
+    v->protocol = ip4->ip4_protocol;
+    v->ip_slot = ip4_slots[v->protocol];
+    v->ip_src = ip4->ip4_src;
+    v->ip_dst = ip4->ip4_dest;
+    v->l4 = v->l3 + hdr_len;
+    v->fragment = (ntohs(ip4->ip4_flags_frag) & 0x1fff) != 0;
+    parse_ports(v);
+}
+
+// Walks the extension headers after the fixed IPv6 header, leaving protocol as the
+// first header that is not one and l4 where it starts. A later fragment carries no
+// transport header. A chain longer than MAX_IP6_EXT_HDRS, or cut off by the capture,
+// stops at the extension header
+static void parse_ip6(PACKET_VIEW *v)
+{
+    PACKET_IP6_HDR *ip6 = (PACKET_IP6_HDR *)(v->frame + v->l3);
+    PACKET_IP6_EXT *ext;
+    PACKET_IP6_FRAG *frag;
+
+    v->family = ADDR_IP6;
+    v->protocol = ip6->ip6_protocol;
+    v->ip_src = ip6->ip6_src;
+    v->ip_dst = ip6->ip6_dest;
+    v->l4 = v->l3 + sizeof(PACKET_IP6_HDR);
+    for(int i = 0; i < MAX_IP6_EXT_HDRS && ip6_slots[v->protocol] == IP_EXTENSION; ++i) {
+        if(v->len - v->l4 < 8) break;
+        if(v->protocol == IP6_EXT_FRAGMENT) {
+            frag = (PACKET_IP6_FRAG *)(v->frame + v->l4);
+            if(ntohs(frag->ip6_frag_offset) & 0xfff8) v->fragment = 1;
+            v->protocol = frag->ip6_frag_next;
+            v->l4 += sizeof(PACKET_IP6_FRAG);
+        } else {
+            ext = (PACKET_IP6_EXT *)(v->frame + v->l4);
+            v->l4 += v->protocol == IP6_EXT_AH ? (ext->ip6_ext_len + 2) * 4 : (ext->ip6_ext_len + 1) * 8;
+            v->protocol = ext->ip6_ext_next;
+        }
+    }
+    v->ip_slot = ip6_slots[v->protocol];
+    parse_ports(v);
+}
+
+// TCP and UDP both start with the source and destination ports, only the first
+// fragment carries them
+static void parse_ports(PACKET_VIEW *v)
+{
+    uint16_t ports[2];
+
+    if(v->fragment || (v->protocol != IP_PROTOCOL_TCP && v->protocol != IP_PROTOCOL_UDP)) return;
+    if(v->len - v->l4 < (int)sizeof(ports)) return;
+    memcpy(ports, v->frame + v->l4, sizeof(ports));
+    v->sport = ntohs(ports[0]);
+    v->dport = ntohs(ports[1]);
+}
+
+static void parse_arp(PACKET_VIEW *v)
+{
+    v->op = ntohs(((PACKET_ARP_HDR *)(v->frame + v->l3))->arp_oper);
+}
+
+static void parse_netrans(PACKET_VIEW *v)
+{
+    v->op = ((PACKET_NETRANS_HDR *)(v->frame + v->l3))->netrans_type;
+    v->l4 = v->l3 + sizeof(PACKET_NETRANS_HDR);
+}
+
+// Every frame counts towards the totals, the distinct estimates and the timing, the
+// ethertype's handler accounts the rest unless the header was cut short or malformed.
+// Only frames in the sample reach the tables keyed by address and the display
+void decode_view(DECODER *d, PACKET_VIEW *v)
+{
+    const ETHER_DISSECTOR *e = &ether_dissectors[v->ether_slot];
+    TALKER_KEY talker;
+
+    STAT_INC(d->stats->packet_total);
+    STAT_ADD(d->stats->byte_total, v->wire_len);
+    if(v->vlan_tags) STAT_INC(d->stats->vlan_total);
+    if(!(d->weight = sample_weight(d, v))) STAT_INC(d->stats->shed_total);
+
+    if(d->distinct) {
+        hll_window_add(d->distinct, HLL_MAC, v->mac_src, 6, v->ts_ns);
+        hll_window_add(d->distinct, HLL_MAC, v->mac_dest, 6, v->ts_ns);
+    }
+    if(d->weight) {
+        count_host(d, v, ADDR_MAC, v->mac_src, 0);
+        count_host(d, v, ADDR_MAC, v->mac_dest, 1);
+    }
+    if(d->talkers && d->weight) {
+        memset(&talker, 0, sizeof(TALKER_KEY));
+        memcpy(talker.addr, v->mac_src, 6);
+        talker.family = ADDR_MAC;
+        talker_table_update(d->talkers, TALKER_SRC_MAC, &talker, d->weight, (unsigned long)v->wire_len * d->weight);
+    }
+
+    if(d->timing) timing_update(d->timing, e->timing, v->ts_ns);
+    if(!e->account) {
+        display_error(d, "Unkown ethernet type: %04x", v->ethertype);
+        return;
+    }
+
+    STAT_INC(STAT_FIELD(d->stats, e->packets));
+    STAT_ADD(STAT_FIELD(d->stats, e->bytes), v->wire_len);
+    if(v->truncated) {
+        display_error(d, "Truncated header of ethernet type %04x", v->ethertype);
+        return;
+    }
+    if(v->malformed) {
+        display_error(d, "Malformed header of ethernet type %04x", v->ethertype);
+        return;
+    }
+    e->account(d, v);
+}
+
+// IPv4 and IPv6 differ only in the length of their addresses. Unknown protocols are
+// only shown, a chain of extension headers too long to walk is not even that
+static void account_ip(DECODER *d, PACKET_VIEW *v)
+{
+    const IP_DISSECTOR *p = &ip_dissectors[v->ip_slot];
+    FLOW_KEY key;
+    int ip4 = v->family == ADDR_IP4, addr_len = ip4 ? 4 : 16;
+
+    if(v->ip_slot > IP_EXTENSION) {
+        STAT_INC(STAT_FIELD(d->stats, p->packets));
+        STAT_ADD(STAT_FIELD(d->stats, p->bytes), v->wire_len);
+    }
+    if(d->distinct) {
+        hll_window_add(d->distinct, ip4 ? HLL_IP4_SRC : HLL_IP6_SRC, v->ip_src, addr_len, v->ts_ns);
+        hll_window_add(d->distinct, ip4 ? HLL_IP4_DST : HLL_IP6_DST, v->ip_dst, addr_len, v->ts_ns);
+    }
+    if(!d->weight) return;
+
+    display_packet(d, v, ip4 ? "IPv4" : "IPv6", p->name);
+    if(v->ip_slot == IP_UNKNOWN)
+        display_error(d, ip4 ? "Unkown IPv4 protocol: %02x" : "Unkown IPv6 protocol: %02x", v->protocol);
+    count_host(d, v, v->family, v->ip_src, 0);
+    count_host(d, v, v->family, v->ip_dst, 1);
+    if(d->talkers) count_ip_talkers(d, v, addr_len);
+
+    if(d->flows) {
+        memset(&key, 0, sizeof(FLOW_KEY));
+        memcpy(key.src, v->ip_src, addr_len);
+        memcpy(key.dst, v->ip_dst, addr_len);
+        key.family = v->family;
+        key.proto = v->protocol;
+        key.sport = v->sport;
+        key.dport = v->dport;
+        flow_table_update(d->flows, &key, d->weight, (unsigned long)v->wire_len * d->weight, v->ts_ns);
+    }
+}
+
+static void account_arp(DECODER *d, PACKET_VIEW *v)
+{
+    if(v->op < NUM_ARP_OPERS && arp_opers[v->op].name) {
+        display_packet(d, v, "ARP", arp_opers[v->op].name);
+        STAT_INC(STAT_FIELD(d->stats, arp_opers[v->op].packets));
+    } else {
+        display_packet(d, v, "ARP", "UNKNOWN");
+        display_error(d, "Unkown ARP operation: %04x", v->op);
+    }
+}
+
+static void account_netrans(DECODER *d, PACKET_VIEW *v)
+{
+    if(v->op < NUM_NETRANS_TYPES && netrans_types[v->op].name) {
+        display_packet(d, v, "NETRANS", netrans_types[v->op].name);
+        STAT_INC(STAT_FIELD(d->stats, netrans_types[v->op].packets));
+    } else {
+        display_packet(d, v, "NETRANS", "UNKNOWN");
+        display_error(d, "Unkown NETRANS operation: %02x", v->op);
+    }
+
+    if(d->netrans && d->weight)
+        netrans_table_update(d->netrans, v->mac_src, v->mac_dest, (PACKET_NETRANS_HDR *)(v->frame + v->l3),
+                (uint8_t *)v->frame + v->l4, v->len - v->l4, v->wire_len, v->ts_ns);
+}
+
+// Both directions of a conversation hash alike, so the sample holds whole flows and
+// what is known about one is exact, scaled by the ratio it was sampled at
+static unsigned int sample_weight(DECODER *d, PACKET_VIEW *v)
+{
+    unsigned int ratio = __atomic_load_n(&d->sample, __ATOMIC_RELAXED);
+    uint64_t h;
+
+    if(ratio == 1) return 1;
+    if(v->ip_src) {
+        h = endpoint_hash(v->ip_src, v->family == ADDR_IP4 ? 4 : 16, v->sport) ^
+                endpoint_hash(v->ip_dst, v->family == ADDR_IP4 ? 4 : 16, v->dport);
+    } else {
+        h = endpoint_hash(v->mac_src, 6, 0) ^ endpoint_hash(v->mac_dest, 6, 0);
+    }
+    h *= 0x9e3779b97f4a7c15ULL;
+    return ((h >> 32) & (ratio - 1)) == 0 ? ratio : 0;
+}
+
+// FNV-1a over the address, seeded with the port
+static uint64_t endpoint_hash(const uint8_t *addr, int len, uint16_t port)
+{
+    uint64_t h = 0xcbf29ce484222325ULL ^ port;
+
+    for(int i = 0; i < len; ++i) h = (h ^ addr[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+// The decoder's own table finds almost every address, the shared sets are only
+// consulted for addresses it has no entry for, new or evicted since
+static void count_host(DECODER *d, PACKET_VIEW *v, uint8_t family, uint8_t *addr, int rx)
+{
+    ADDR_SET *set;
+    int *full;
+
+    if(!host_table_update(d->hosts, family, addr, rx, d->weight, (unsigned long)v->wire_len * d->weight, v->ts_ns))
+        return;
+    set = family == ADDR_MAC ? d->shared->mac_addrs : d->shared->ip_addrs;
+    full = family == ADDR_MAC ? &d->mac_addrs_full : &d->ip_addrs_full;
+    if(*full) return;
+    pthread_mutex_lock(&d->shared->lock);
+    addr_set_insert(set, family, addr);
+    *full = set->limit && set->len == set->limit;
+    pthread_mutex_unlock(&d->shared->lock);
+}
+
+// Accounts the packet to its source address and to its address pair
+static void count_ip_talkers(DECODER *d, PACKET_VIEW *v, int addr_len)
+{
+    TALKER_KEY key;
+
+    memset(&key, 0, sizeof(TALKER_KEY));
+    memcpy(key.addr, v->ip_src, addr_len);
+    key.family = v->family;
+    talker_table_update(d->talkers, TALKER_SRC_IP, &key, d->weight, (unsigned long)v->wire_len * d->weight);
+    memcpy(key.addr + 16, v->ip_dst, addr_len);
+    talker_table_update(d->talkers, TALKER_IP_PAIR, &key, d->weight, (unsigned long)v->wire_len * d->weight);
+}
+
+// Without a display nothing is queued, a headless decoder only counts. Frames left out
+// of the sample are not shown either
+static void display_packet(DECODER *d, PACKET_VIEW *v, const char *type, const char *type_type)
+{
+    if(d->display && d->weight) ui_display_packet(v->mac_dest, v->mac_src, type, type_type);
+}
+
+static void display_error(DECODER *d, const char *format, unsigned int value)
+{
+    char msg[MAX_ERROR];
+
+    if(!d->display || !d->weight) return;
+    sprintf(msg, format, value);
+    ui_display_error(msg);
+}
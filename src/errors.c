@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+char error_msg[MAX_ERROR];
+
 void warn()
 {
     fprintf(stderr, "Warning: %s.\n", error_msg);
@@ -0,0 +1,458 @@
+#include "filter.h"
+#include "packet.h"
+#include "errors.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_TOKEN 32
+#define MAX_LABELS (MAX_FILTER_INSNS * 2)
+
+// Offsets into an untagged ethernet frame
+#define OFF_ETH_TYPE  12
+#define OFF_IP4_VIHL  14
+#define OFF_IP4_FRAG  20
+#define OFF_IP4_PROTO 23
+#define OFF_IP6_NEXT  20
+#define OFF_IP4_L4    14 // Added to the IPv4 header length loaded into X
+#define OFF_IP6_L4    54
+
+#define NODE_AND   0
+#define NODE_OR    1
+#define NODE_NOT   2
+#define NODE_ETHER 3
+#define NODE_PROTO 4
+#define NODE_PORT  5
+
+#define PORT_SRC 0x1
+#define PORT_DST 0x2
+
+typedef struct FILTER_NODE {
+    int type;   // One of the NODE types
+    int value;  // Ethertype, IPv4 protocol, or port
+    int value6; // IPv6 next header for NODE_PROTO
+    int dir;    // PORT_SRC and/or PORT_DST for NODE_PORT
+    struct FILTER_NODE *left, *right;
+} FILTER_NODE;
+
+// An instruction whose jump targets are still label numbers
+typedef struct {
+    uint16_t code;
+    uint32_t k;
+    int jt, jf;
+} FILTER_INSN;
+
+typedef struct {
+    const char *pos;           // Next unread character of the expression
+    char token[MAX_TOKEN + 1]; // The current token, empty at the end of input
+    FILTER_INSN insns[MAX_FILTER_INSNS];
+    int len;
+    int labels[MAX_LABELS];    // Instruction index of each placed label
+    int num_labels;
+    int error;
+} FILTER_COMPILER;
+
+static FILTER_COMPILER fc;
+
+static void next_token();
+static int accept(const char *word);
+static FILTER_NODE *node_new(int type, FILTER_NODE *left, FILTER_NODE *right);
+static void node_free(FILTER_NODE *node);
+static FILTER_NODE *parse_expr();
+static FILTER_NODE *parse_term();
+static FILTER_NODE *parse_factor();
+static FILTER_NODE *parse_primitive();
+static int new_label();
+static void place_label(int label);
+static void emit(uint16_t code, uint32_t k);
+static void emit_jump(uint16_t code, uint32_t k, int jt, int jf);
+static void compile_node(FILTER_NODE *node, int on_true, int on_false);
+static void compile_port(FILTER_NODE *node, uint16_t mode, uint32_t offset, int on_true, int on_false);
+
+// Compiles a filter expression into a classic BPF program for SO_ATTACH_FILTER. The
+// kernel truncates an accepted frame to the program's return value, which is snaplen
+struct sock_fprog *filter_compile(const char *expr, uint32_t snaplen)
+{
+    struct sock_fprog *prog;
+    FILTER_NODE *root = NULL;
+    int accept_label, reject_label, target;
+
+    memset(&fc, 0, sizeof(FILTER_COMPILER));
+    if(expr) {
+        fc.pos = expr;
+        next_token();
+
+        root = parse_expr();
+        if(!fc.error && fc.token[0] != '\0') {
+            snprintf(error_msg, MAX_ERROR, "Unexpected '%s' in filter expression", fc.token);
+            fc.error = 1;
+        }
+        if(fc.error) {
+            node_free(root);
+            return NULL;
+        }
+    }
+
+    // Without an expression the program accepts everything and only applies the snaplen
+    accept_label = new_label();
+    reject_label = new_label();
+    if(root) compile_node(root, accept_label, reject_label);
+    node_free(root);
+    place_label(accept_label);
+    emit(BPF_RET | BPF_K, snaplen < FILTER_ACCEPT ? snaplen : FILTER_ACCEPT);
+    place_label(reject_label);
+    emit(BPF_RET | BPF_K, 0);
+    if(fc.error) return NULL;
+
+    prog = (struct sock_fprog *)malloc(sizeof(struct sock_fprog));
+    prog->len = fc.len;
+    prog->filter = (struct sock_filter *)malloc(fc.len * sizeof(struct sock_filter));
+
+    // Resolve labels into the relative offsets classic BPF expects, conditional jumps only reach 255 ahead
+    for(int i = 0; i < fc.len; ++i) {
+        prog->filter[i].code = fc.insns[i].code;
+        prog->filter[i].k = fc.insns[i].k;
+        prog->filter[i].jt = prog->filter[i].jf = 0;
+        if(BPF_CLASS(fc.insns[i].code) != BPF_JMP) continue;
+
+        target = fc.labels[fc.insns[i].jt] - (i + 1);
+        if(target > 255) goto too_long;
+        prog->filter[i].jt = target;
+        target = fc.labels[fc.insns[i].jf] - (i + 1);
+        if(target > 255) goto too_long;
+        prog->filter[i].jf = target;
+    }
+    return prog;
+
+too_long:
+    snprintf(error_msg, MAX_ERROR, "Filter expression is too long");
+    free(prog->filter);
+    free(prog);
+    return NULL;
+}
+
+// Runs a program in userspace, for frames that never passed through a socket
+int filter_match(struct sock_fprog *prog, const uint8_t *frame, uint32_t len)
+{
+    struct sock_filter *insn;
+    uint32_t a = 0, x = 0, offset;
+
+    for(int pc = 0; pc < prog->len; ++pc) {
+        insn = &prog->filter[pc];
+        switch(insn->code) {
+            case BPF_LD | BPF_B | BPF_ABS:
+            case BPF_LD | BPF_H | BPF_ABS:
+            case BPF_LD | BPF_B | BPF_IND:
+            case BPF_LD | BPF_H | BPF_IND:
+                // Like the kernel, a load past the end of the frame rejects it
+                offset = insn->k + (BPF_MODE(insn->code) == BPF_IND ? x : 0);
+                if(BPF_SIZE(insn->code) == BPF_H) {
+                    if(offset + 2 > len) return 0;
+                    a = frame[offset] << 8 | frame[offset + 1];
+                } else {
+                    if(offset + 1 > len) return 0;
+                    a = frame[offset];
+                }
+                break;
+            case BPF_LDX | BPF_B | BPF_MSH:
+                if(insn->k + 1 > len) return 0;
+                x = (frame[insn->k] & 0xf) << 2;
+                break;
+            case BPF_JMP | BPF_JEQ | BPF_K:
+                pc += (a == insn->k) ? insn->jt : insn->jf;
+                break;
+            case BPF_JMP | BPF_JSET | BPF_K:
+                pc += (a & insn->k) ? insn->jt : insn->jf;
+                break;
+            case BPF_RET | BPF_K:
+                return insn->k != 0;
+            default:
+                return 0;
+        }
+    }
+
+    return 0;
+}
+
+// Splits the expression into words, parentheses and the symbolic operators
+static void next_token()
+{
+    int n = 0;
+
+    while(isspace((unsigned char)*fc.pos)) fc.pos++;
+
+    if(*fc.pos == '(' || *fc.pos == ')' || *fc.pos == '!') {
+        fc.token[n++] = *fc.pos++;
+    } else if((fc.pos[0] == '&' && fc.pos[1] == '&') || (fc.pos[0] == '|' && fc.pos[1] == '|')) {
+        fc.token[n++] = *fc.pos++;
+        fc.token[n++] = *fc.pos++;
+    } else {
+        while(*fc.pos && !isspace((unsigned char)*fc.pos) && !strchr("()!&|", *fc.pos)) {
+            if(n < MAX_TOKEN) fc.token[n++] = tolower((unsigned char)*fc.pos);
+            fc.pos++;
+        }
+        if(n == 0 && *fc.pos) fc.token[n++] = *fc.pos++;
+    }
+
+    fc.token[n] = '\0';
+}
+
+// Consumes the current token if it is word
+static int accept(const char *word)
+{
+    if(strcmp(fc.token, word) != 0) return 0;
+    next_token();
+    return 1;
+}
+
+static FILTER_NODE *node_new(int type, FILTER_NODE *left, FILTER_NODE *right)
+{
+    FILTER_NODE *node;
+
+    node = (FILTER_NODE *)malloc(sizeof(FILTER_NODE));
+    memset(node, 0, sizeof(FILTER_NODE));
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
+static void node_free(FILTER_NODE *node)
+{
+    if(!node) return;
+    node_free(node->left);
+    node_free(node->right);
+    free(node);
+}
+
+static FILTER_NODE *parse_expr()
+{
+    FILTER_NODE *node;
+
+    node = parse_term();
+    while(!fc.error && (accept("or") || accept("||")))
+        node = node_new(NODE_OR, node, parse_term());
+    return node;
+}
+
+static FILTER_NODE *parse_term()
+{
+    FILTER_NODE *node;
+
+    node = parse_factor();
+    while(!fc.error && (accept("and") || accept("&&")))
+        node = node_new(NODE_AND, node, parse_factor());
+    return node;
+}
+
+static FILTER_NODE *parse_factor()
+{
+    FILTER_NODE *node;
+
+    if(fc.error) return NULL;
+    if(accept("not") || accept("!")) return node_new(NODE_NOT, parse_factor(), NULL);
+    if(accept("(")) {
+        node = parse_expr();
+        if(!fc.error && !accept(")")) {
+            snprintf(error_msg, MAX_ERROR, "Missing ')' in filter expression");
+            fc.error = 1;
+        }
+        return node;
+    }
+    return parse_primitive();
+}
+
+static FILTER_NODE *parse_primitive()
+{
+    FILTER_NODE *node;
+    char *endptr;
+    long n;
+    int dir = PORT_SRC | PORT_DST;
+
+    node = node_new(NODE_ETHER, NULL, NULL);
+    if(accept("ip4")) {
+        node->value = ETH_TYPE_IP4;
+    } else if(accept("ip6")) {
+        node->value = ETH_TYPE_IP6;
+    } else if(accept("arp")) {
+        node->value = ETH_TYPE_ARP;
+    } else if(accept("netrans")) {
+        node->value = ETH_TYPE_NETRANS;
+    } else if(accept("ether")) {
+        n = strtol(fc.token, &endptr, 16);
+        if(fc.token[0] == '\0' || *endptr != '\0' || n < 0 || n > 0xffff) goto invalid;
+        node->value = n;
+        next_token();
+    } else if(accept("tcp")) {
+        node->type = NODE_PROTO;
+        node->value = node->value6 = IP_PROTOCOL_TCP;
+    } else if(accept("udp")) {
+        node->type = NODE_PROTO;
+        node->value = node->value6 = IP_PROTOCOL_UDP;
+    } else if(accept("igmp")) {
+        node->type = NODE_PROTO;
+        node->value = node->value6 = IP_PROTOCOL_IGMP;
+    } else if(accept("icmp")) {
+        node->type = NODE_PROTO;
+        node->value = IP_PROTOCOL_ICMP;
+        node->value6 = IP_PROTOCOL_IP6ICMP;
+    } else {
+        if(accept("src")) {
+            dir = PORT_SRC;
+        } else if(accept("dst")) {
+            dir = PORT_DST;
+        }
+        if(!accept("port")) goto invalid;
+        n = strtol(fc.token, &endptr, 10);
+        if(fc.token[0] == '\0' || *endptr != '\0' || n < 0 || n > 0xffff) goto invalid;
+        node->type = NODE_PORT;
+        node->value = n;
+        node->dir = dir;
+        next_token();
+    }
+    return node;
+
+invalid:
+    if(fc.token[0] == '\0') {
+        snprintf(error_msg, MAX_ERROR, "Unexpected end of filter expression");
+    } else {
+        snprintf(error_msg, MAX_ERROR, "Unexpected '%s' in filter expression", fc.token);
+    }
+    fc.error = 1;
+    free(node);
+    return NULL;
+}
+
+static int new_label()
+{
+    if(fc.num_labels == MAX_LABELS) {
+        snprintf(error_msg, MAX_ERROR, "Filter expression is too long");
+        fc.error = 1;
+        return 0;
+    }
+    return fc.num_labels++;
+}
+
+static void place_label(int label)
+{
+    fc.labels[label] = fc.len;
+}
+
+static void emit(uint16_t code, uint32_t k)
+{
+    emit_jump(code, k, 0, 0);
+}
+
+static void emit_jump(uint16_t code, uint32_t k, int jt, int jf)
+{
+    if(fc.len == MAX_FILTER_INSNS) {
+        snprintf(error_msg, MAX_ERROR, "Filter expression is too long");
+        fc.error = 1;
+        return;
+    }
+    fc.insns[fc.len].code = code;
+    fc.insns[fc.len].k = k;
+    fc.insns[fc.len].jt = jt;
+    fc.insns[fc.len].jf = jf;
+    fc.len++;
+}
+
+// Emits code that falls through to on_true or on_false depending on node
+static void compile_node(FILTER_NODE *node, int on_true, int on_false)
+{
+    int next, ip6, udp;
+
+    if(fc.error) return;
+    switch(node->type) {
+        case NODE_AND:
+            next = new_label();
+            compile_node(node->left, next, on_false);
+            place_label(next);
+            compile_node(node->right, on_true, on_false);
+            break;
+        case NODE_OR:
+            next = new_label();
+            compile_node(node->left, on_true, next);
+            place_label(next);
+            compile_node(node->right, on_true, on_false);
+            break;
+        case NODE_NOT:
+            compile_node(node->left, on_false, on_true);
+            break;
+        case NODE_ETHER:
+            emit(BPF_LD | BPF_H | BPF_ABS, OFF_ETH_TYPE);
+            emit_jump(BPF_JMP | BPF_JEQ | BPF_K, node->value, on_true, on_false);
+            break;
+        case NODE_PROTO:
+            next = new_label();
+            ip6 = new_label();
+            emit(BPF_LD | BPF_H | BPF_ABS, OFF_ETH_TYPE);
+            emit_jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_IP4, next, ip6);
+            place_label(next);
+            emit(BPF_LD | BPF_B | BPF_ABS, OFF_IP4_PROTO);
+            emit_jump(BPF_JMP | BPF_JEQ | BPF_K, node->value, on_true, on_false);
+            place_label(ip6);
+            next = new_label();
+            emit_jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_IP6, next, on_false);
+            place_label(next);
+            emit(BPF_LD | BPF_B | BPF_ABS, OFF_IP6_NEXT);
+            emit_jump(BPF_JMP | BPF_JEQ | BPF_K, node->value6, on_true, on_false);
+            break;
+        case NODE_PORT:
+            next = new_label();
+            ip6 = new_label();
+            emit(BPF_LD | BPF_H | BPF_ABS, OFF_ETH_TYPE);
+            emit_jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_IP4, next, ip6);
+
+            // IPv4, only the first fragment carries the ports and the header length varies
+            place_label(next);
+            next = new_label();
+            udp = new_label();
+            emit(BPF_LD | BPF_B | BPF_ABS, OFF_IP4_PROTO);
+            emit_jump(BPF_JMP | BPF_JEQ | BPF_K, IP_PROTOCOL_TCP, next, udp);
+            place_label(udp);
+            emit_jump(BPF_JMP | BPF_JEQ | BPF_K, IP_PROTOCOL_UDP, next, on_false);
+            place_label(next);
+            next = new_label();
+            emit(BPF_LD | BPF_H | BPF_ABS, OFF_IP4_FRAG);
+            emit_jump(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, on_false, next);
+            place_label(next);
+            emit(BPF_LDX | BPF_B | BPF_MSH, OFF_IP4_VIHL);
+            compile_port(node, BPF_IND, OFF_IP4_L4, on_true, on_false);
+
+            // IPv6 without extension headers
+            place_label(ip6);
+            next = new_label();
+            emit_jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_IP6, next, on_false);
+            place_label(next);
+            next = new_label();
+            udp = new_label();
+            emit(BPF_LD | BPF_B | BPF_ABS, OFF_IP6_NEXT);
+            emit_jump(BPF_JMP | BPF_JEQ | BPF_K, IP_PROTOCOL_TCP, next, udp);
+            place_label(udp);
+            emit_jump(BPF_JMP | BPF_JEQ | BPF_K, IP_PROTOCOL_UDP, next, on_false);
+            place_label(next);
+            compile_port(node, BPF_ABS, OFF_IP6_L4, on_true, on_false);
+            break;
+    }
+}
+
+// Compares the source and/or destination port of the transport header at offset,
+// mode is BPF_ABS or BPF_IND when the offset is relative to the X register
+static void compile_port(FILTER_NODE *node, uint16_t mode, uint32_t offset, int on_true, int on_false)
+{
+    int next;
+
+    if(node->dir & PORT_SRC) {
+        next = (node->dir & PORT_DST) ? new_label() : on_false;
+        emit(BPF_LD | BPF_H | mode, offset);
+        emit_jump(BPF_JMP | BPF_JEQ | BPF_K, node->value, on_true, next);
+        if(next == on_false) return;
+        place_label(next);
+    }
+    emit(BPF_LD | BPF_H | mode, offset + 2);
+    emit_jump(BPF_JMP | BPF_JEQ | BPF_K, node->value, on_true, on_false);
+}
@@ -0,0 +1,122 @@
+#include "flow.h"
+#include "table.h"
+#include "errors.h"
+#include "clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int compare_bytes(const void *a, const void *b);
+
+// Sizes the pool so it and its index fit in max_bytes
+FLOW_TABLE *flow_table_new(size_t max_bytes, unsigned int timeout_secs)
+{
+    FLOW_TABLE *ft;
+    uint32_t capacity;
+
+    if(!(capacity = table_capacity(max_bytes, sizeof(FLOW_ENTRY)))) {
+        snprintf(error_msg, MAX_ERROR, "Flow table memory of %zu bytes is too small", max_bytes);
+        return NULL;
+    }
+
+    ft = (FLOW_TABLE *)malloc(sizeof(FLOW_TABLE));
+    memset(ft, 0, sizeof(FLOW_TABLE));
+    table_init(&ft->table, capacity, sizeof(FLOW_ENTRY), offsetof(FLOW_ENTRY, key), sizeof(FLOW_KEY));
+    ft->timeout_ns = timeout_secs * 1000000000ULL;
+    pthread_mutex_init(&ft->lock, NULL);
+    return ft;
+}
+
+// Accounts a packet to its flow, creating the flow if it is new
+void flow_table_update(FLOW_TABLE *ft, FLOW_KEY *key, unsigned int packets, unsigned long bytes,
+        uint64_t ts_ns)
+{
+    FLOW_ENTRY *entry;
+    int added;
+
+    entry = (FLOW_ENTRY *)table_get(&ft->table, key, &added);
+    if(added) entry->first_ns = ts_ns;
+    entry->packets += packets;
+    entry->bytes += bytes;
+    entry->last_ns = ts_ns;
+}
+
+// Expires idle flows from the cold end of the LRU list and publishes the busiest flows
+void flow_table_publish(FLOW_TABLE *ft, uint64_t now_ns, int force)
+{
+    FLOW_SUMMARY sel;
+    FLOW_ENTRY *entry;
+    TABLE_TOP top;
+    TABLE *t = &ft->table;
+    uint64_t mono;
+
+    mono = monotonic_ns();
+    if(!force && mono - ft->published_ns < FLOW_PUBLISH_MS * 1000000ULL) return;
+    ft->published_ns = mono;
+
+    while(t->tail != TABLE_NONE && ((FLOW_ENTRY *)TABLE_ENTRY(t, t->tail))->last_ns + ft->timeout_ns < now_ns) {
+        table_remove(t, t->tail);
+        ft->expired++;
+    }
+
+    sel.len = 0;
+    table_top_init(&top, sel.flows, &sel.len, FLOW_TOP_MAX, sizeof(FLOW_ENTRY), compare_bytes);
+    for(uint32_t e = t->head; e != TABLE_NONE; e = entry->link.next) {
+        entry = (FLOW_ENTRY *)TABLE_ENTRY(t, e);
+        table_top_insert(&top, entry);
+    }
+
+    pthread_mutex_lock(&ft->lock);
+    memcpy(ft->published.flows, sel.flows, sel.len * sizeof(FLOW_ENTRY));
+    ft->published.len = sel.len;
+    ft->published.active = t->len;
+    ft->published.evicted = t->evicted;
+    ft->published.expired = ft->expired;
+    pthread_mutex_unlock(&ft->lock);
+}
+
+// Flows seen by several tables, as with a load balancing fanout, are added together
+void flow_summary_merge(FLOW_SUMMARY *sum, FLOW_TABLE *ft)
+{
+    FLOW_ENTRY *src, *dst;
+    TABLE_TOP top;
+    int j;
+
+    pthread_mutex_lock(&ft->lock);
+    sum->active += ft->published.active;
+    sum->evicted += ft->published.evicted;
+    sum->expired += ft->published.expired;
+    table_top_init(&top, sum->flows, &sum->len, FLOW_TOP_MAX, sizeof(FLOW_ENTRY), compare_bytes);
+    for(int i = 0; i < ft->published.len; ++i) {
+        src = &ft->published.flows[i];
+        for(j = 0; j < sum->len; ++j)
+            if(sum->flows[j].link.hash == src->link.hash && memcmp(&sum->flows[j].key, &src->key, sizeof(FLOW_KEY)) == 0)
+                break;
+
+        if(j == sum->len) {
+            table_top_insert(&top, src);
+            continue;
+        }
+        dst = &sum->flows[j];
+        dst->packets += src->packets;
+        dst->bytes += src->bytes;
+        if(src->first_ns < dst->first_ns) dst->first_ns = src->first_ns;
+        if(src->last_ns > dst->last_ns) dst->last_ns = src->last_ns;
+        table_top_rescan(&top);
+    }
+    pthread_mutex_unlock(&ft->lock);
+}
+
+void flow_summary_sort(FLOW_SUMMARY *sum)
+{
+    qsort(sum->flows, sum->len, sizeof(FLOW_ENTRY), compare_bytes);
+}
+
+static int compare_bytes(const void *a, const void *b)
+{
+    const FLOW_ENTRY *fa = a, *fb = b;
+
+    if(fa->bytes == fb->bytes) return 0;
+    return (fa->bytes < fb->bytes) ? 1 : -1;
+}
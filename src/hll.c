@@ -0,0 +1,147 @@
+#include "hll.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define SLOT_NS (HLL_SLOT_SECS * 1000000000ULL)
+
+static void hll_rotate(HLL_WINDOW *hw, uint64_t epoch);
+static void hll_merge(HLL *dst, HLL *src);
+static double hll_count(HLL *hll);
+static uint64_t hll_hash(const uint8_t *addr, int len);
+static uint64_t mix(uint64_t h);
+
+HLL_WINDOW *hll_window_new()
+{
+    HLL_WINDOW *hw;
+
+    hw = (HLL_WINDOW *)malloc(sizeof(HLL_WINDOW));
+    memset(hw, 0, sizeof(HLL_WINDOW));
+    return hw;
+}
+
+// The top bits of the hash pick a register, the rest give the run of zeros
+void hll_window_add(HLL_WINDOW *hw, int kind, const uint8_t *addr, int len, uint64_t ts_ns)
+{
+    uint64_t epoch, h;
+    uint8_t *reg, rank;
+
+    // Epochs start at one so a zero marks an unused slot, late frames count towards the current one
+    epoch = ts_ns / SLOT_NS + 1;
+    if(epoch > hw->epoch) hll_rotate(hw, epoch);
+
+    h = hll_hash(addr, len);
+    reg = &hw->slots[hw->slot][kind].registers[h >> (64 - HLL_PRECISION)];
+    rank = __builtin_clzll((h << HLL_PRECISION) | (1ULL << (HLL_PRECISION - 1))) + 1;
+    if(rank > *reg) __atomic_store_n(reg, rank, __ATOMIC_RELAXED);
+}
+
+// Slots are read before the total, a slot being reused was folded into the total
+// before it was cleared, so a reader that misses an address in one finds it in the other
+void hll_window_merge(HLL *total, HLL *window, HLL_WINDOW *hw, uint64_t now_ns)
+{
+    uint64_t now, epoch;
+    int current;
+
+    now = now_ns ? now_ns / SLOT_NS + 1 : __atomic_load_n(&hw->epoch, __ATOMIC_ACQUIRE);
+    for(int s = 0; s < HLL_WINDOW_SLOTS; ++s) {
+        if(!(epoch = __atomic_load_n(&hw->epochs[s], __ATOMIC_ACQUIRE))) continue;
+        current = epoch <= now && epoch + HLL_WINDOW_SLOTS > now;
+        for(int k = 0; k < HLL_KINDS; ++k) {
+            hll_merge(&total[k], &hw->slots[s][k]);
+            if(current) hll_merge(&window[k], &hw->slots[s][k]);
+        }
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    for(int k = 0; k < HLL_KINDS; ++k) hll_merge(&total[k], &hw->total[k]);
+}
+
+void hll_estimate(HLL_ESTIMATE *est, HLL *total, HLL *window)
+{
+    for(int k = 0; k < HLL_KINDS; ++k) {
+        est->total[k] = hll_count(&total[k]);
+        est->window[k] = hll_count(&window[k]);
+    }
+}
+
+// Reuses the slot for a new sub-window, folding what it held into the total first
+static void hll_rotate(HLL_WINDOW *hw, uint64_t epoch)
+{
+    uint8_t *src, *dst;
+    int slot;
+
+    slot = epoch % HLL_WINDOW_SLOTS;
+    if(hw->epochs[slot]) {
+        for(int k = 0; k < HLL_KINDS; ++k) {
+            src = hw->slots[slot][k].registers;
+            dst = hw->total[k].registers;
+            for(int i = 0; i < HLL_REGISTERS; ++i)
+                if(src[i] > dst[i]) __atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+        }
+
+        // Readers that see a cleared register must also see the total it went to
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&hw->epochs[slot], 0, __ATOMIC_RELAXED);
+        for(int k = 0; k < HLL_KINDS; ++k)
+            for(int i = 0; i < HLL_REGISTERS; ++i)
+                __atomic_store_n(&hw->slots[slot][k].registers[i], 0, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&hw->epochs[slot], epoch, __ATOMIC_RELEASE);
+    __atomic_store_n(&hw->epoch, epoch, __ATOMIC_RELEASE);
+    hw->slot = slot;
+}
+
+static void hll_merge(HLL *dst, HLL *src)
+{
+    uint8_t v;
+
+    for(int i = 0; i < HLL_REGISTERS; ++i) {
+        v = __atomic_load_n(&src->registers[i], __ATOMIC_RELAXED);
+        if(v > dst->registers[i]) dst->registers[i] = v;
+    }
+}
+
+// The raw HyperLogLog estimate, switching to linear counting while many registers
+// are still empty, where the raw estimate is biased
+static double hll_count(HLL *hll)
+{
+    double sum = 0, m = HLL_REGISTERS, estimate;
+    int zeros = 0;
+
+    for(int i = 0; i < HLL_REGISTERS; ++i) {
+        sum += ldexp(1.0, -hll->registers[i]);
+        if(hll->registers[i] == 0) zeros++;
+    }
+
+    estimate = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+    if(estimate <= 2.5 * m && zeros) estimate = m * log(m / zeros);
+    return estimate;
+}
+
+// IPv6 addresses are mixed a word at a time, the length keeps kinds of address apart
+static uint64_t hll_hash(const uint8_t *addr, int len)
+{
+    uint64_t lo = 0, hi = 0, h;
+
+    memcpy(&lo, addr, len < 8 ? len : 8);
+    h = lo ^ len;
+    if(len > 8) {
+        memcpy(&hi, addr + 8, len - 8);
+        h = mix(h) ^ hi;
+    }
+    return mix(h);
+}
+
+// The splitmix64 finalizer, every input bit affects every output bit
+static uint64_t mix(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
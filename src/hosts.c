@@ -0,0 +1,179 @@
+#include "hosts.h"
+#include "table.h"
+#include "addrset.h"
+#include "errors.h"
+#include "clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void host_key(HOST_KEY *key, uint8_t family, const uint8_t *addr);
+static uint64_t rank_value(HOST_ENTRY *e, int rank);
+static int compare_bytes(const void *a, const void *b);
+static int compare_packets(const void *a, const void *b);
+static int compare_recent(const void *a, const void *b);
+
+// Each rank is kept in the order its comparison sorts by
+static const table_compare rank_compare[HOST_RANKS] = { compare_bytes, compare_packets, compare_recent };
+
+// Sizes the pool so it and its index fit in max_bytes
+HOST_TABLE *host_table_new(size_t max_bytes)
+{
+    HOST_TABLE *ht;
+    uint32_t capacity;
+
+    if(!(capacity = table_capacity(max_bytes, sizeof(HOST_ENTRY)))) {
+        snprintf(error_msg, MAX_ERROR, "Host table memory of %zu bytes is too small", max_bytes);
+        return NULL;
+    }
+
+    ht = (HOST_TABLE *)malloc(sizeof(HOST_TABLE));
+    memset(ht, 0, sizeof(HOST_TABLE));
+    table_init(&ht->table, capacity, sizeof(HOST_ENTRY), offsetof(HOST_ENTRY, key), sizeof(HOST_KEY));
+    pthread_mutex_init(&ht->lock, NULL);
+    return ht;
+}
+
+// Accounts packets to the address, taking the pool entry of the least recently seen
+// host when there is no free one
+int host_table_update(HOST_TABLE *ht, uint8_t family, const uint8_t *addr, int rx,
+        unsigned int packets, unsigned long bytes, uint64_t ts_ns)
+{
+    HOST_KEY key;
+    HOST_ENTRY *entry;
+    int added;
+
+    host_key(&key, family, addr);
+    entry = (HOST_ENTRY *)table_get(&ht->table, &key, &added);
+    if(added) entry->first_ns = ts_ns;
+    if(rx) {
+        entry->rx_packets += packets;
+        entry->rx_bytes += bytes;
+    } else {
+        entry->tx_packets += packets;
+        entry->tx_bytes += bytes;
+    }
+    entry->last_ns = ts_ns;
+    ht->dirty = 1;
+    return added;
+}
+
+// The most recent hosts are the head of the LRU list, so they are the first kept by recency
+void host_table_publish(HOST_TABLE *ht, int force)
+{
+    HOST_SUMMARY sel;
+    HOST_ENTRY *entry;
+    TABLE_TOP top[HOST_KINDS][HOST_RANKS];
+    TABLE *t = &ht->table;
+    uint64_t mono;
+    int kind;
+
+    mono = monotonic_ns();
+    if(!ht->dirty || (!force && mono - ht->published_ns < HOST_PUBLISH_MS * 1000000ULL)) return;
+    ht->published_ns = mono;
+    ht->dirty = 0;
+
+    memset(sel.len, 0, sizeof(sel.len));
+    for(int k = 0; k < HOST_KINDS; ++k)
+        for(int r = 0; r < HOST_RANKS; ++r)
+            table_top_init(&top[k][r], sel.top[k][r], &sel.len[k][r], HOST_TOP_MAX, sizeof(HOST_ENTRY), rank_compare[r]);
+    for(uint32_t e = t->head; e != TABLE_NONE; e = entry->link.next) {
+        entry = (HOST_ENTRY *)TABLE_ENTRY(t, e);
+        kind = entry->key.family == ADDR_MAC ? HOST_MAC : HOST_IP;
+        for(int r = 0; r < HOST_RANKS; ++r) table_top_insert(&top[kind][r], entry);
+    }
+
+    pthread_mutex_lock(&ht->lock);
+    for(int k = 0; k < HOST_KINDS; ++k) {
+        for(int r = 0; r < HOST_RANKS; ++r) {
+            memcpy(ht->published.top[k][r], sel.top[k][r], sel.len[k][r] * sizeof(HOST_ENTRY));
+            ht->published.len[k][r] = sel.len[k][r];
+        }
+    }
+    ht->published.active = t->len;
+    ht->published.evicted = t->evicted;
+    pthread_mutex_unlock(&ht->lock);
+}
+
+// Hosts seen by several tables, as every host is with a hash fanout, are added together
+void host_summary_merge(HOST_SUMMARY *sum, HOST_TABLE *ht)
+{
+    HOST_ENTRY *src, *dst;
+    TABLE_TOP top;
+    int j;
+
+    pthread_mutex_lock(&ht->lock);
+    sum->active += ht->published.active;
+    sum->evicted += ht->published.evicted;
+    for(int k = 0; k < HOST_KINDS; ++k) {
+        for(int r = 0; r < HOST_RANKS; ++r) {
+            table_top_init(&top, sum->top[k][r], &sum->len[k][r], HOST_TOP_MAX, sizeof(HOST_ENTRY), rank_compare[r]);
+            for(int i = 0; i < ht->published.len[k][r]; ++i) {
+                src = &ht->published.top[k][r][i];
+                for(j = 0; j < sum->len[k][r]; ++j)
+                    if(sum->top[k][r][j].link.hash == src->link.hash &&
+                            memcmp(&sum->top[k][r][j].key, &src->key, sizeof(HOST_KEY)) == 0) break;
+
+                if(j == sum->len[k][r]) {
+                    table_top_insert(&top, src);
+                    continue;
+                }
+                dst = &sum->top[k][r][j];
+                dst->tx_packets += src->tx_packets;
+                dst->rx_packets += src->rx_packets;
+                dst->tx_bytes += src->tx_bytes;
+                dst->rx_bytes += src->rx_bytes;
+                if(src->first_ns < dst->first_ns) dst->first_ns = src->first_ns;
+                if(src->last_ns > dst->last_ns) dst->last_ns = src->last_ns;
+                table_top_rescan(&top);
+            }
+        }
+    }
+    pthread_mutex_unlock(&ht->lock);
+}
+
+void host_summary_sort(HOST_SUMMARY *sum)
+{
+    for(int k = 0; k < HOST_KINDS; ++k)
+        for(int r = 0; r < HOST_RANKS; ++r)
+            qsort(sum->top[k][r], sum->len[k][r], sizeof(HOST_ENTRY), rank_compare[r]);
+}
+
+static void host_key(HOST_KEY *key, uint8_t family, const uint8_t *addr)
+{
+    memset(key, 0, sizeof(HOST_KEY));
+    memcpy(key->addr, addr, family == ADDR_IP6 ? 16 : family == ADDR_IP4 ? 4 : 6);
+    key->family = family;
+}
+
+static uint64_t rank_value(HOST_ENTRY *e, int rank)
+{
+    if(rank == HOST_BY_BYTES) return e->tx_bytes + e->rx_bytes;
+    if(rank == HOST_BY_PACKETS) return e->tx_packets + e->rx_packets;
+    return e->last_ns;
+}
+
+static int compare_bytes(const void *a, const void *b)
+{
+    uint64_t va = rank_value((HOST_ENTRY *)a, HOST_BY_BYTES), vb = rank_value((HOST_ENTRY *)b, HOST_BY_BYTES);
+
+    if(va == vb) return 0;
+    return (va < vb) ? 1 : -1;
+}
+
+static int compare_packets(const void *a, const void *b)
+{
+    uint64_t va = rank_value((HOST_ENTRY *)a, HOST_BY_PACKETS), vb = rank_value((HOST_ENTRY *)b, HOST_BY_PACKETS);
+
+    if(va == vb) return 0;
+    return (va < vb) ? 1 : -1;
+}
+
+static int compare_recent(const void *a, const void *b)
+{
+    uint64_t va = rank_value((HOST_ENTRY *)a, HOST_BY_RECENT), vb = rank_value((HOST_ENTRY *)b, HOST_BY_RECENT);
+
+    if(va == vb) return 0;
+    return (va < vb) ? 1 : -1;
+}
@@ -6,7 +6,6 @@
 
 int main(int argc, char *argv[])
 {
-    int sockfd;
     netmon_args_t *args;
 
     args = args_process(argc, argv);
@@ -15,9 +14,9 @@ int main(int argc, char *argv[])
         die(EXIT_FAILURE);
     }
 
-    if((sockfd = netmon_init(args->net_device)) == -1) die(EXIT_FAILURE);
+    if(netmon_init(args) == -1) die(EXIT_FAILURE);
 
-    netmon_mainloop(sockfd, args->ether_type);
+    if(netmon_mainloop() == -1) die(EXIT_FAILURE);
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,430 @@
+#include "metrics.h"
+#include "errors.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define DEFAULT_METRICS_HOST "localhost"
+#define METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+static int listen_unix(METRICS *m, const char *path);
+static int listen_tcp(METRICS *m, const char *address);
+static void *server_thread(void *arg);
+static void serve(METRICS *m, int fd);
+static int send_all(int fd, const char *buffer, size_t len);
+static int family(char *buffer, int len, const char *name, const char *type, const char *help);
+static int append(char *buffer, int len, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+// Listens on address, a unix socket path if it holds a '/', otherwise [host:]port
+METRICS *metrics_open(const char *address)
+{
+    METRICS *m;
+
+    m = (METRICS *)malloc(sizeof(METRICS));
+    memset(m, 0, sizeof(METRICS));
+    m->listenfd = -1;
+    m->published = (char *)malloc(METRICS_BUFFER_SIZE);
+    m->building = (char *)malloc(METRICS_BUFFER_SIZE);
+    m->published_len = sprintf(m->published, "# EOF\n");
+
+    if((m->stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) {
+        sprintf(error_msg, "Unable to create metrics stop event");
+        m->listenfd = -1;
+    } else if((strchr(address, '/') ? listen_unix(m, address) : listen_tcp(m, address)) == -1) {
+        close(m->stopfd);
+        m->listenfd = -1;
+    }
+    if(m->listenfd == -1) {
+        free(m->path);
+        free(m->published);
+        free(m->building);
+        free(m);
+        return NULL;
+    }
+
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_create(&m->thread, NULL, server_thread, m);
+    return m;
+}
+
+// A stale socket left by an earlier run is replaced, anything else at path is not
+static int listen_unix(METRICS *m, const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        snprintf(error_msg, MAX_ERROR, "Metrics socket path '%.200s' is too long", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+    if((m->listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1 ||
+            bind(m->listenfd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) == -1) {
+        snprintf(error_msg, MAX_ERROR, "Unable to bind metrics socket '%.200s': %s", path, strerror(errno));
+        if(m->listenfd != -1) close(m->listenfd);
+        return -1;
+    }
+    if(listen(m->listenfd, METRICS_BACKLOG) == -1) {
+        snprintf(error_msg, MAX_ERROR, "Unable to listen on metrics socket '%.200s'", path);
+        close(m->listenfd);
+        unlink(path);
+        return -1;
+    }
+    m->path = strdup(path);
+    return 1;
+}
+
+// The host defaults to localhost, so metrics are only exposed further when asked for
+static int listen_tcp(METRICS *m, const char *address)
+{
+    struct addrinfo hints, *res, *ai;
+    char host[256];
+    const char *port, *colon;
+    char *end;
+    long number;
+    int on = 1, result;
+
+    // An IPv6 host may hold colons of its own, the port follows the last one
+    if((colon = strrchr(address, ':'))) {
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - address), address);
+        port = colon + 1;
+    } else {
+        snprintf(host, sizeof(host), "%s", DEFAULT_METRICS_HOST);
+        port = address;
+    }
+    if(host[0] == '[' && host[strlen(host) - 1] == ']') {
+        memmove(host, host + 1, strlen(host));
+        host[strlen(host) - 1] = '\0';
+    }
+
+    // getaddrinfo takes any number as a port and wraps it
+    number = strtol(port, &end, 10);
+    if(*port == '\0' || *end != '\0' || number < 1 || number > 65535) {
+        snprintf(error_msg, MAX_ERROR, "Invalid metrics port in '%.200s'", address);
+        return -1;
+    }
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    if((result = getaddrinfo(host[0] ? host : NULL, port, &hints, &res)) != 0) {
+        snprintf(error_msg, MAX_ERROR, "Invalid metrics address '%.200s': %s", address, gai_strerror(result));
+        return -1;
+    }
+
+    for(ai = res; ai; ai = ai->ai_next) {
+        if((m->listenfd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol)) == -1) continue;
+        setsockopt(m->listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if(bind(m->listenfd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(m->listenfd, METRICS_BACKLOG) == 0) break;
+        close(m->listenfd);
+        m->listenfd = -1;
+    }
+    freeaddrinfo(res);
+
+    if(m->listenfd == -1) {
+        snprintf(error_msg, MAX_ERROR, "Unable to listen for metrics on '%.200s': %s", address, strerror(errno));
+        return -1;
+    }
+    return 1;
+}
+
+// Formats into the spare buffer, then swaps it with the one being served. The lock
+// is only held for the swap, and by a scrape for as long as it takes to copy
+void metrics_publish(METRICS *m, NETMON_STATS *totals, unsigned long ip_addrs, unsigned long mac_addrs,
+        HLL_ESTIMATE *distinct, TIMING_STATS *timing, RATE *rates, NETRANS_SUMMARY *sessions,
+        CAPTURE_STATS *kernel, SPSC_STATS *queues, FLOW_SUMMARY *flows, HOST_SUMMARY *hosts, unsigned int sample)
+{
+    static const char *ethertypes[] = { "ip4", "ip6", "arp", "netrans" };
+    static const char *protocols[] = { "icmp", "igmp", "tcp", "udp" };
+    static const char *netrans_types[] = { "send", "receive", "ack", "chunk" };
+    static const char *kinds[HLL_KINDS] = { "mac", "ip4_src", "ip4_dst", "ip6_src", "ip6_dst" };
+    static const char *rate_classes[RATE_CLASSES] = { "all", "arp", "ip4", "ip6", "netrans", "igmp", "icmp", "tcp", "udp" };
+    static const char *timing_classes[TIMING_CLASSES] = { "all", "arp", "ip4", "ip6", "netrans" };
+    unsigned long ethertype_packets[] = { totals->ip4_total, totals->ip6_total, totals->arp_total, totals->netrans_total };
+    unsigned long ethertype_bytes[] = { totals->ip4_bytes, totals->ip6_bytes, totals->arp_bytes, totals->netrans_bytes };
+    unsigned long protocol_packets[] = { totals->icmp_total, totals->igmp_total, totals->tcp_total, totals->udp_total };
+    unsigned long protocol_bytes[] = { totals->icmp_bytes, totals->igmp_bytes, totals->tcp_bytes, totals->udp_bytes };
+    unsigned long netrans_packets[] = { totals->send_total, totals->receive_total, totals->ack_total, totals->chunk_total };
+    TIMING_PERCENTILES *p;
+    struct timespec now;
+    char *b = m->building, *swap;
+    int len = 0;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    len = family(b, len, "netmon_packets", "counter", "Frames accepted");
+    len = append(b, len, "netmon_packets_total %lu\n", totals->packet_total);
+    len = family(b, len, "netmon_bytes", "counter", "Bytes accepted, as seen on the wire");
+    len = append(b, len, "netmon_bytes_total %lu\n", totals->byte_total);
+
+    len = family(b, len, "netmon_vlan_tagged_packets", "counter", "Frames carrying one or more VLAN tags");
+    len = append(b, len, "netmon_vlan_tagged_packets_total %lu\n", totals->vlan_total);
+
+    len = family(b, len, "netmon_shed_packets", "counter", "Frames only counted, left out of the sample while overloaded");
+    len = append(b, len, "netmon_shed_packets_total %lu\n", totals->shed_total);
+    len = family(b, len, "netmon_sample_ratio", "gauge", "One flow in this many is decoded in full");
+    len = append(b, len, "netmon_sample_ratio %u\n", sample);
+
+    len = family(b, len, "netmon_ethertype_packets", "counter", "Frames of each ethertype");
+    for(int i = 0; i < 4; ++i)
+        len = append(b, len, "netmon_ethertype_packets_total{ethertype=\"%s\"} %lu\n", ethertypes[i], ethertype_packets[i]);
+    len = family(b, len, "netmon_ethertype_bytes", "counter", "Bytes of each ethertype");
+    for(int i = 0; i < 4; ++i)
+        len = append(b, len, "netmon_ethertype_bytes_total{ethertype=\"%s\"} %lu\n", ethertypes[i], ethertype_bytes[i]);
+    len = family(b, len, "netmon_ip_protocol_packets", "counter", "IP packets of each protocol");
+    for(int i = 0; i < 4; ++i)
+        len = append(b, len, "netmon_ip_protocol_packets_total{protocol=\"%s\"} %lu\n", protocols[i], protocol_packets[i]);
+    len = family(b, len, "netmon_ip_protocol_bytes", "counter", "Bytes of IP packets of each protocol");
+    for(int i = 0; i < 4; ++i)
+        len = append(b, len, "netmon_ip_protocol_bytes_total{protocol=\"%s\"} %lu\n", protocols[i], protocol_bytes[i]);
+    len = family(b, len, "netmon_arp_packets", "counter", "ARP packets of each operation");
+    len = append(b, len, "netmon_arp_packets_total{operation=\"request\"} %lu\n", totals->request_total);
+    len = append(b, len, "netmon_arp_packets_total{operation=\"reply\"} %lu\n", totals->reply_total);
+    len = family(b, len, "netmon_netrans_packets", "counter", "Netrans frames of each type");
+    for(int i = 0; i < 4; ++i)
+        len = append(b, len, "netmon_netrans_packets_total{type=\"%s\"} %lu\n", netrans_types[i], netrans_packets[i]);
+
+    len = family(b, len, "netmon_addresses", "gauge", "Addresses held in the exact lists");
+    len = append(b, len, "netmon_addresses{kind=\"ip\"} %lu\nnetmon_addresses{kind=\"mac\"} %lu\n", ip_addrs, mac_addrs);
+    len = family(b, len, "netmon_distinct_addresses", "gauge",
+            "Estimated distinct addresses since capture started and over the last minute");
+    for(int k = 0; k < HLL_KINDS; ++k)
+        len = append(b, len, "netmon_distinct_addresses{kind=\"%s\",span=\"total\"} %.0f\n"
+                "netmon_distinct_addresses{kind=\"%s\",span=\"window\"} %.0f\n",
+                kinds[k], distinct->total[k], kinds[k], distinct->window[k]);
+
+    len = family(b, len, "netmon_rate_bits_per_second", "gauge", "Bits per second over each sliding window");
+    for(int w = 0; w < RATE_WINDOWS; ++w)
+        for(int c = 0; c < RATE_CLASSES; ++c)
+            len = append(b, len, "netmon_rate_bits_per_second{window=\"%s\",class=\"%s\"} %.0f\n",
+                    rate_window_names[w], rate_classes[c], rates[w].bps[c]);
+    len = family(b, len, "netmon_rate_packets_per_second", "gauge", "Packets per second over each sliding window");
+    for(int w = 0; w < RATE_WINDOWS; ++w)
+        for(int c = 0; c < RATE_CLASSES; ++c)
+            len = append(b, len, "netmon_rate_packets_per_second{window=\"%s\",class=\"%s\"} %.1f\n",
+                    rate_window_names[w], rate_classes[c], rates[w].pps[c]);
+
+    // The percentiles cover the frames since the previous snapshot. Each worker times
+    // only its own frames, so with several these are gaps within a worker's share
+    len = family(b, len, "netmon_timing_workers", "gauge", "Workers whose gaps and bursts are merged, each timing only its own frames");
+    len = append(b, len, "netmon_timing_workers %u\n", timing->workers);
+    len = family(b, len, "netmon_gap_nanoseconds", "gauge", "Percentiles of the time between consecutive frames of a worker");
+    for(int c = 0; c < TIMING_CLASSES; ++c) {
+        p = &timing->gaps[c];
+        len = append(b, len, "netmon_gap_nanoseconds{class=\"%s\",quantile=\"0.5\"} %lu\n"
+                "netmon_gap_nanoseconds{class=\"%s\",quantile=\"0.99\"} %lu\n"
+                "netmon_gap_nanoseconds{class=\"%s\",quantile=\"0.999\"} %lu\n"
+                "netmon_gap_nanoseconds{class=\"%s\",quantile=\"1\"} %lu\n",
+                timing_classes[c], (unsigned long)p->p50, timing_classes[c], (unsigned long)p->p99,
+                timing_classes[c], (unsigned long)p->p999, timing_classes[c], (unsigned long)p->max);
+    }
+    len = family(b, len, "netmon_gap_samples", "gauge", "Gaps the percentiles were taken over");
+    for(int c = 0; c < TIMING_CLASSES; ++c)
+        len = append(b, len, "netmon_gap_samples{class=\"%s\"} %lu\n", timing_classes[c], timing->gaps[c].samples);
+    len = family(b, len, "netmon_bursts", "counter", "Runs of frames arriving at a worker closer together than the burst threshold");
+    len = append(b, len, "netmon_bursts_total %lu\n", timing->bursts);
+    len = family(b, len, "netmon_burst_frames", "counter", "Frames that arrived within a burst");
+    len = append(b, len, "netmon_burst_frames_total %lu\n", timing->burst_frames);
+    len = family(b, len, "netmon_burst_largest_frames", "gauge", "Frames in the largest burst");
+    len = append(b, len, "netmon_burst_largest_frames %lu\n", timing->burst_max);
+
+    len = family(b, len, "netmon_sessions_active", "gauge", "Netrans sessions being tracked");
+    len = append(b, len, "netmon_sessions_active %lu\n", sessions->active);
+    len = family(b, len, "netmon_sessions_evicted", "counter", "Netrans sessions pushed out by newer ones");
+    len = append(b, len, "netmon_sessions_evicted_total %lu\n", sessions->evicted);
+    len = family(b, len, "netmon_sessions_expired", "counter", "Netrans sessions removed after going idle");
+    len = append(b, len, "netmon_sessions_expired_total %lu\n", sessions->expired);
+
+    len = family(b, len, "netmon_hosts_active", "gauge", "MAC and IP addresses being tracked, summed over workers");
+    len = append(b, len, "netmon_hosts_active %lu\n", hosts->active);
+    len = family(b, len, "netmon_hosts_evicted", "counter", "Addresses pushed out by newer ones");
+    len = append(b, len, "netmon_hosts_evicted_total %lu\n", hosts->evicted);
+
+    if(flows) {
+        len = family(b, len, "netmon_flows_active", "gauge", "Flows being tracked");
+        len = append(b, len, "netmon_flows_active %lu\n", flows->active);
+        len = family(b, len, "netmon_flows_evicted", "counter", "Flows pushed out by newer ones");
+        len = append(b, len, "netmon_flows_evicted_total %lu\n", flows->evicted);
+        len = family(b, len, "netmon_flows_expired", "counter", "Flows removed after going idle");
+        len = append(b, len, "netmon_flows_expired_total %lu\n", flows->expired);
+    }
+
+    if(kernel) {
+        len = family(b, len, "netmon_kernel_packets", "counter", "Frames the kernel passed to the capture sockets");
+        len = append(b, len, "netmon_kernel_packets_total %lu\n", kernel->packets);
+        len = family(b, len, "netmon_kernel_drops", "counter", "Frames the kernel dropped for lack of buffer");
+        len = append(b, len, "netmon_kernel_drops_total %lu\n", kernel->drops);
+        len = family(b, len, "netmon_kernel_freezes", "counter", "Times a packet ring filled up");
+        len = append(b, len, "netmon_kernel_freezes_total %lu\n", kernel->freezes);
+    }
+
+    if(queues) {
+        len = family(b, len, "netmon_queue_slots", "gauge", "Frames each capture to decode queue holds");
+        len = append(b, len, "netmon_queue_slots %lu\n", queues->slots);
+        len = family(b, len, "netmon_queue_depth", "gauge", "Frames waiting to be decoded");
+        len = append(b, len, "netmon_queue_depth %lu\n", queues->depth);
+        len = family(b, len, "netmon_queue_high_water", "gauge", "Most frames ever waiting in any one queue");
+        len = append(b, len, "netmon_queue_high_water %lu\n", queues->high_water);
+        len = family(b, len, "netmon_queue_overflows", "counter", "Times a capture thread found its queue full");
+        len = append(b, len, "netmon_queue_overflows_total %lu\n", queues->overflows);
+    }
+
+    len = family(b, len, "netmon_snapshot_timestamp_seconds", "gauge", "When this snapshot was taken");
+    len = append(b, len, "netmon_snapshot_timestamp_seconds %ld.%03ld\n", (long)now.tv_sec, now.tv_nsec / 1000000);
+    len = append(b, len, "# EOF\n");
+
+    pthread_mutex_lock(&m->lock);
+    swap = m->published;
+    m->published = m->building;
+    m->published_len = len;
+    pthread_mutex_unlock(&m->lock);
+    m->building = swap;
+}
+
+void metrics_close(METRICS *m)
+{
+    uint64_t stop = 1;
+
+    if(write(m->stopfd, &stop, sizeof(stop)) == sizeof(stop)) pthread_join(m->thread, NULL);
+    close(m->stopfd);
+    close(m->listenfd);
+    if(m->path) unlink(m->path);
+    pthread_mutex_destroy(&m->lock);
+    free(m->path);
+    free(m->published);
+    free(m->building);
+    free(m);
+}
+
+// Answers one scrape at a time, a scraper that stalls is cut off after METRICS_TIMEOUT_MS
+static void *server_thread(void *arg)
+{
+    METRICS *m;
+    struct epoll_event ev, events[2];
+    struct timeval timeout = { METRICS_TIMEOUT_MS / 1000, (METRICS_TIMEOUT_MS % 1000) * 1000 };
+    int epfd, fd, nfds;
+
+    m = (METRICS *)arg;
+    if((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) return NULL;
+    ev.events = EPOLLIN;
+    ev.data.fd = m->listenfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, m->listenfd, &ev);
+    ev.data.fd = m->stopfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, m->stopfd, &ev);
+
+    for(;;) {
+        nfds = epoll_wait(epfd, events, 2, -1);
+        if(nfds == -1) {
+            if(errno == EINTR) continue;
+            break;
+        }
+
+        for(int i = 0; i < nfds; ++i) {
+            if(events[i].data.fd == m->stopfd) goto stop;
+            if((fd = accept(m->listenfd, NULL, NULL)) == -1) continue;
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            serve(m, fd);
+            close(fd);
+        }
+    }
+
+stop:
+    close(epfd);
+    return NULL;
+}
+
+// Reads the request head, then replies and closes. Only GET /metrics is served
+static void serve(METRICS *m, int fd)
+{
+    const char *status = "200 OK";
+    size_t len = 0, body_len;
+    ssize_t n;
+    int head;
+
+    for(;;) {
+        n = recv(fd, m->request + len, METRICS_REQUEST_SIZE - 1 - len, 0);
+        if(n == -1 && errno == EINTR) continue;
+        if(n <= 0) return;
+        len += n;
+        m->request[len] = '\0';
+        if(strstr(m->request, "\r\n\r\n") || strstr(m->request, "\n\n")) break;
+        if(len == METRICS_REQUEST_SIZE - 1) return;
+    }
+
+    if(strncmp(m->request, "GET ", 4) != 0) {
+        status = "405 Method Not Allowed";
+    } else if(strncmp(m->request + 4, "/metrics", 8) != 0 ||
+            (m->request[12] != ' ' && m->request[12] != '?')) {
+        status = "404 Not Found";
+    }
+
+    head = snprintf(m->response, sizeof(m->response),
+            "HTTP/1.1 %s\r\nContent-Type: %s\r\nConnection: close\r\nContent-Length: ", status,
+            status[0] == '2' ? METRICS_CONTENT_TYPE : "text/plain");
+    if(status[0] != '2') {
+        head += snprintf(m->response + head, sizeof(m->response) - head, "%zu\r\n\r\n%s\n",
+                strlen(status) + 1, status);
+        send_all(fd, m->response, head);
+        return;
+    }
+
+    // The snapshot is copied out so a slow scraper never holds up the next publish
+    pthread_mutex_lock(&m->lock);
+    body_len = m->published_len;
+    head += snprintf(m->response + head, sizeof(m->response) - head, "%zu\r\n\r\n", body_len);
+    memcpy(m->response + head, m->published, body_len);
+    pthread_mutex_unlock(&m->lock);
+    send_all(fd, m->response, head + body_len);
+}
+
+// A scraper that goes away mid-reply must not raise SIGPIPE
+static int send_all(int fd, const char *buffer, size_t len)
+{
+    ssize_t n;
+    size_t off = 0;
+
+    while(off < len) {
+        if((n = send(fd, buffer + off, len - off, MSG_NOSIGNAL)) == -1) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        off += n;
+    }
+    return 1;
+}
+
+static int family(char *buffer, int len, const char *name, const char *type, const char *help)
+{
+    return append(buffer, len, "# TYPE %s %s\n# HELP %s %s.\n", name, type, name, help);
+}
+
+// A snapshot that would not fit is cut short rather than overrun the buffer
+static int append(char *buffer, int len, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buffer + len, METRICS_BUFFER_SIZE - len, fmt, ap);
+    va_end(ap);
+    if(n < 0) return len;
+    return len + n < METRICS_BUFFER_SIZE ? len + n : METRICS_BUFFER_SIZE - 1;
+}
@@ -3,383 +3,924 @@
 #include "ui.h"
 #include "packet.h"
 #include "rate.h"
+#include "capture.h"
+#include "stats.h"
+#include "decode.h"
+#include "hosts.h"
+#include "flow.h"
+#include "talkers.h"
+#include "netrans.h"
+#include "hll.h"
+#include "timing.h"
+#include "filter.h"
+#include "pcapfile.h"
+#include "pcapwriter.h"
+#include "report.h"
+#include "spsc.h"
+#include "metrics.h"
+#include "shmstats.h"
+#include "overload.h"
+#include "clock.h"
 
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/socket.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
 #include <arpa/inet.h>
-#include <linux/if_packet.h>
-#include <net/ethernet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <time.h>
 
-// Needed to check for device index
-#include <sys/ioctl.h>
-#include <net/if.h>
-
-#define DEFAULT_NET_DEVICE "eth0"
-
-// The length in seconds of each time block
-#define TIME_BLOCK_LENGTH 1
-#define TIME_BLOCK_AMOUNT 1
-
-#define MACLENGTH 17 // The length of a mac address (with colons)
-#define IP4LENGTH 15 // The length of an IPv4 address (with periods)
-#define IP6LENGTH 39 // The length of an IPv4 address (with periods)
-
-// The base amount for dynamic arrays
-#define CHUNK 8
-
-typedef struct __attribute__((packed)) {
-    RATE_QUEUE *rq;    // A circular queue for maintaining the rate
-    TIME_BLOCK *tb;    // The current block in the rate queue
-    int arp_total;     // ARP packet total
-    int ip4_total;     // IPv4 packet total
-    int ip6_total;     // IPv6 packet total
-    int netrans_total; // Custom netrans protocol total
-    int reply_total;   // ARP reply packet total
-    int request_total; // ARP request packet total
-    int igmp_total;    // IGMP packet total
-    int icmp_total;    // ICMP packet total
-    int tcp_total;     // TCP packet total
-    int udp_total;     // UDP packet total
-    int send_total;    // netrans send total
-    int receive_total; // netrans receive total
-    int ack_total;     // netrans ack total
-    int chunk_total;   // netrans chunk total
-    int total_bytes;   // The total number of bytes seen
-    time_t total_time; // The total length of time for rate
-    char **ip_addrs;   // The list of all IP addresses seen
-    int ip_len;
-    int ip_capacity;
-    char **mac_addrs;  // The list of all MAC addresses seen
-    int mac_len;
-    int mac_capacity;
+#define MAX_EVENTS 4       // Events handled per epoll_wait
+#define DISPATCH_BUDGET 64 // Capture dispatches per wakeup before checking other events
+#define CACHE_LINE 64
+#define REPLAY_SLEEP_NS 100000000ULL // Longest a paced replay sleeps before checking for a stop
+#define WORKER_TICK_MS 250           // How often a worker with pending work wakes up without traffic
+#define DECODE_BATCH 256             // Queued frames decoded between publishes
+#define REPLAY_PUBLISH_FRAMES 1024   // Frames a replay decodes between flow publishes
+#define DISTINCT_TICKS 10            // Rate ticks between refreshes of the distinct address and timing displays
+#define KERNEL_TICKS (1000 / RATE_TICK_MS) // Rate ticks in the second kernel drops are shown over
+
+// A decode worker and the capture socket it owns. The counters sit on their own
+// cache lines so a worker never shares a written line with another thread
+typedef struct {
+    NETMON_STATS stats __attribute__((aligned(CACHE_LINE))); // Only written by this worker
+    CAPTURE *cap __attribute__((aligned(CACHE_LINE)));       // The worker's capture socket
+    PCAP_FILE *replay;                                        // Or the capture file it reads
+    PCAP_BATCH *batch;                                        // Frames on their way to the writer
+    int epfd;                                                 // Waits on cap and the stop event
+    pthread_t thread;                                         // Decodes, and captures unless queued
+    SPSC_RING *queue;      // Frames the capture thread hands to the decode thread, NULL to do both in one
+    int queue_epfd;        // Waits on the queue's wakeup event
+    pthread_t capture;     // Fills the queue
+    DECODER dec;         // Decodes into stats
+    HOST_TABLE *hosts;   // Traffic of the addresses this worker has seen lately
+    FLOW_TABLE *flows;   // Conversations this worker has seen, NULL if not tracked
+    TALKER_TABLE *talkers; // Heaviest hosts this worker has seen
+    NETRANS_TABLE *netrans; // Netrans transfers this worker has seen
+    HLL_WINDOW *distinct;  // Estimates of the addresses this worker has seen
+    TIMING *timing;        // Gaps between the frames this worker has seen
+} NETMON_WORKER;
+
+typedef struct {
+    NETMON_WORKER *workers;    // One per capture socket in the fanout group
+    int num_workers;
+    int stopfd;                // eventfd signalled to stop the workers
+    int stopping;              // Set before stopfd is signalled, polled while replaying
+    int donefd;                // eventfd signalled when a replay reaches the end of its file
+    struct sock_fprog *filter; // Applied in userspace to replayed frames
+    double speed;              // Replay speed relative to the original timestamps, 0 for maximum
+    double elapsed;            // Seconds the replay took
+    PCAP_WRITER *writer;       // Saves accepted frames to disk, NULL if not writing
+    int headless;              // Report to a file or stdout instead of drawing with ncurses
+    unsigned int interval_ms;  // Milliseconds between headless records
+    REPORT *report;            // Where headless records go
+    METRICS *metrics;          // Serves the latest snapshot to scrapers, NULL if not serving
+    SHM_WRITER *shm;           // Shared memory the totals are published in every tick, NULL if not
+    int sigfd;                 // signalfd for SIGINT and SIGTERM in headless mode
+    int fps;                   // Frame rate of the UI render thread
+    RATE_QUEUE *rq;            // Merged totals sampled every rate tick
+    unsigned long ticks;       // Rate ticks so far
+    OVERLOAD overload;         // Picks the sampling ratio from the drops and backlog every tick
+    unsigned int sample;       // The ratio the decoders were last given
+    DECODE_SHARED addrs;       // Every address seen by any worker
 } NETMON;
 
 static NETMON netmon;
 
-static int skip_packet(char *packet_bytes, uint16_t mask);
-static void process_packet(char *packet_bytes, int len, uint16_t mask);
-static void process_ip4_packet(char *packet_bytes, char *mac_dest, char *mac_src);
-static void process_ip6_packet(char *packet_bytes, char *mac_dest, char *mac_src);
-static void process_arp_packet(char *packet_bytes, char *mac_dest, char *mac_src);
-static void process_netrans_packet(char *packet_bytes, char *mac_dest, char *mac_src);
-
-static void ip4_to_string(unsigned char *ip, char *buffer);
-static void ip6_to_string(unsigned short *ip, char *buffer);
-static void mac_to_string(unsigned char *ma, char *buffer);
-static void insert_ip_addr(char *addr);
-static void insert_mac_addr(char *addr);
-
-// Opens a raw socket and returns its file descriptor
-int netmon_init(char *device_name)
+static int watch_fd(int epfd, int fd);
+static int rate_timer_new(unsigned int interval_ms);
+static int signal_fd_new();
+static int read_timer(int timerfd);
+static void update_rate();
+static int report_tick(int timerfd);
+static void update_sample(CAPTURE_STATS *kernel);
+static void publish_shm(NETMON_STATS *totals, RATE *rates, HLL_ESTIMATE *distinct, CAPTURE_STATS *kernel);
+static int handle_key();
+static void snapshot_totals(NETMON_STATS *totals);
+static void snapshot_hosts(HOST_SUMMARY *hosts);
+static void snapshot_flows(FLOW_SUMMARY *flows);
+static void snapshot_talkers(TALKER_SUMMARY *talkers);
+static void snapshot_sessions(NETRANS_SUMMARY *sessions);
+static void snapshot_distinct(HLL_ESTIMATE *distinct);
+static void snapshot_timing(TIMING_STATS *timing);
+static void snapshot_addrs(unsigned long *ip_addrs, unsigned long *mac_addrs);
+static int snapshot_queues(SPSC_STATS *queues);
+static int snapshot_kernel(CAPTURE_STATS *kernel);
+static void kernel_last_second(CAPTURE_STATS *kernel, CAPTURE_STATS *second);
+static void publish_metrics(NETMON_STATS *totals, HLL_ESTIMATE *distinct, TIMING_STATS *timing, RATE *rates,
+        CAPTURE_STATS *kernel, SPSC_STATS *queues);
+static int worker_init(NETMON_WORKER *w, netmon_args_t *args);
+static int worker_pending(NETMON_WORKER *w);
+static void worker_publish(NETMON_WORKER *w, int force);
+static void *worker_thread(void *arg);
+static void *capture_thread(void *arg);
+static void *decode_thread(void *arg);
+static void queue_frame(void *arg, char *frame, int len, int wire_len, uint64_t ts_ns);
+static void *replay_thread(void *arg);
+static int pace_until(uint64_t target_ns);
+static void handle_frame(void *arg, char *frame, int len, int wire_len, uint64_t ts_ns);
+
+// Opens one capture socket per worker, filtered in the kernel, and initializes the netmon structure
+int netmon_init(netmon_args_t *args)
 {
-    int sockfd;
-    struct ifreq ifr;
-    struct sockaddr_ll sockaddr;
+    NETMON_WORKER *w;
+    struct sock_fprog *filter = NULL;
+    unsigned int snaplen = 0;
+    int group;
 
-    // Open a raw socket
-    sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    // Compile the filter once, every socket gets its own copy in the kernel. A snaplen
+    // shorter than the largest frame needs a program even without an expression, it is
+    // the filter's return value that has the kernel copy only the headers
+    if((args->filter || args->snaplen < FILTER_ACCEPT) &&
+            !(filter = filter_compile(args->filter, args->snaplen))) return -1;
 
-    if(sockfd == -1) {
-        sprintf(error_msg, "Unable to open raw socket (root privelidges required)");
+    // Initialize the netmon structure
+    memset(&netmon, 0, sizeof(NETMON));
+    netmon.fps = args->fps;
+    netmon.num_workers = args->workers;
+    netmon.workers = (NETMON_WORKER *)aligned_alloc(CACHE_LINE, netmon.num_workers * sizeof(NETMON_WORKER));
+    memset(netmon.workers, 0, netmon.num_workers * sizeof(NETMON_WORKER));
+    netmon.rq = rate_queue_new(RATE_TICK_MS);
+    decode_shared_init(&netmon.addrs, args->exact_addrs);
+    overload_init(&netmon.overload, args->sample_ratio);
+    netmon.sample = netmon.overload.ratio;
+
+    if((netmon.stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1 ||
+            (netmon.donefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) {
+        sprintf(error_msg, "Unable to create stop event");
         return -1;
     }
 
-    if(!device_name) device_name = strdup(DEFAULT_NET_DEVICE);
+    // Signals are blocked before any thread starts so only the signalfd sees them
+    if(args->headless) {
+        netmon.headless = 1;
+        netmon.interval_ms = args->report_interval_ms;
+        if((netmon.sigfd = signal_fd_new()) == -1) return -1;
+        if(!(netmon.report = report_open(args->report_path, args->report_format))) return -1;
+    }
 
-    // Ensure device_name is really a network device name and determine device index
-    memset(&ifr, 0, sizeof(struct ifreq));
-    strcpy(ifr.ifr_name, device_name);
-    if(ioctl(sockfd, SIOCGIFINDEX, &ifr) < 0) {
-        sprintf(error_msg, "Improper device name");
-        return -1;
+    if(args->metrics_address && !(netmon.metrics = metrics_open(args->metrics_address))) return -1;
+    if(args->shm_name && !(netmon.shm = shm_stats_create(args->shm_name))) return -1;
+
+    // A replay has a single worker reading the file, filtered in userspace
+    if(args->read_file) {
+        w = &netmon.workers[0];
+        netmon.num_workers = 1;
+        netmon.filter = filter;
+        netmon.speed = args->replay_speed;
+        if(!(w->replay = pcap_file_open(args->read_file))) return -1;
+        if(args->write_prefix && !(netmon.writer = pcap_writer_open(args->write_prefix, args->snaplen,
+                        args->rotate_bytes, args->rotate_secs))) return -1;
+        return worker_init(w, args);
     }
 
-    // Bind address to socket
-    memset(&sockaddr, 0, sizeof(struct sockaddr_ll));
-    sockaddr.sll_family = AF_PACKET;
-    sockaddr.sll_protocol = htons(ETH_P_ALL);
-    sockaddr.sll_ifindex = ifr.ifr_ifindex;
-    if(bind(sockfd, (struct sockaddr *)(&sockaddr), sizeof(struct sockaddr_ll)) == -1) {
-        sprintf(error_msg, "Unable to bind address to socket");
-        return -1;
+    // Every socket of a multi-worker capture joins the same fanout group
+    group = getpid() & 0xffff;
+    for(int i = 0; i < netmon.num_workers; ++i) {
+        w = &netmon.workers[i];
+        if(!(w->cap = capture_open(args->net_device, args->snaplen))) return -1;
+        if(filter && capture_attach_filter(w->cap, filter) == -1) return -1;
+
+        // Prefer the mmap'd ring, falling back to batched recvmmsg if the kernel refuses it
+        if(args->capture_backend == CAPTURE_RING &&
+                capture_ring_setup(w->cap, args->block_size, args->block_count) == -1) {
+            warn();
+            sprintf(error_msg, "Falling back to recvmmsg capture");
+            warn();
+            if(capture_mmsg_setup(w->cap, args->mmsg_batch) == -1) return -1;
+        } else if(args->capture_backend == CAPTURE_MMSG &&
+                capture_mmsg_setup(w->cap, args->mmsg_batch) == -1) {
+            return -1;
+        }
+        // The ring's size is set by its blocks, only the socket backends queue in the receive buffer
+        if(args->rcvbuf && w->cap->backend != CAPTURE_RING && capture_set_rcvbuf(w->cap, args->rcvbuf) == -1) return -1;
+
+        if(netmon.num_workers > 1 && capture_join_fanout(w->cap, group, args->fanout_mode) == -1) return -1;
+
+        if((w->epfd = epoll_create1(0)) == -1) {
+            sprintf(error_msg, "Unable to create epoll instance");
+            return -1;
+        }
+        if(watch_fd(w->epfd, w->cap->sockfd) == -1 || watch_fd(w->epfd, netmon.stopfd) == -1) return -1;
+
+        // Capturing and decoding in separate threads keeps a slow decode from stalling the socket
+        if(args->queue_slots) {
+            if(!(w->queue = spsc_ring_new(args->queue_slots, args->snaplen))) return -1;
+            if((w->queue_epfd = epoll_create1(0)) == -1) {
+                sprintf(error_msg, "Unable to create epoll instance");
+                return -1;
+            }
+            if(watch_fd(w->queue_epfd, w->queue->eventfd) == -1) return -1;
+        }
+
+        if(worker_init(w, args) == -1) return -1;
     }
 
-    // Initialize the netmon structure
-    memset(&netmon, 0, sizeof(NETMON));
-    netmon.rq = rate_queue_new(TIME_BLOCK_AMOUNT);
-    netmon.tb = time_block_next(netmon.rq);
-    netmon.ip_capacity = CHUNK;
-    netmon.ip_addrs = (char **)malloc(netmon.ip_capacity * sizeof(char *));
-    netmon.mac_capacity = CHUNK;
-    netmon.mac_addrs = (char **)malloc(netmon.mac_capacity * sizeof(char *));
+    // Files are written once every backend is settled, their header gives the most a
+    // frame may hold, which a socket buffer or ring block may have cut below the snaplen
+    if(args->write_prefix) {
+        for(int i = 0; i < netmon.num_workers; ++i)
+            if(capture_snaplen(netmon.workers[i].cap) > snaplen) snaplen = capture_snaplen(netmon.workers[i].cap);
+        if(!(netmon.writer = pcap_writer_open(args->write_prefix, snaplen, args->rotate_bytes, args->rotate_secs)))
+            return -1;
+    }
 
-    return sockfd;
+    return 1;
 }
 
-int netmon_mainloop(int sockfd, uint16_t mask)
+// Gives a worker its decoder, its host table, its talker sketches, its netrans sessions
+// and, unless disabled, its own flow table
+static int worker_init(NETMON_WORKER *w, netmon_args_t *args)
 {
-    struct sockaddr_ll from;
-    unsigned int addrlen;
-    int len;
-    char buffer[4096];
-    time_t current_time;
+    if(!(w->hosts = host_table_new(args->host_memory))) return -1;
+    if(args->flow_memory && !(w->flows = flow_table_new(args->flow_memory, args->flow_timeout))) return -1;
+    w->talkers = talker_table_new();
+    w->netrans = netrans_table_new(NETRANS_TIMEOUT_SECS);
+    w->distinct = hll_window_new();
+    w->timing = timing_new(args->burst_packets, args->burst_usecs);
+    decoder_init(&w->dec, &w->stats, &netmon.addrs, w->hosts, w->flows, w->talkers, w->netrans, w->distinct, w->timing, !netmon.headless);
+    decoder_set_sample(&w->dec, netmon.sample);
+    return 1;
+}
+
+// Starts the workers, then sleeps in epoll until the rate timer fires, a key is
+// pressed, a headless run is signalled or a replay finishes
+int netmon_mainloop()
+{
+    struct epoll_event events[MAX_EVENTS];
+    NETMON_STATS totals;
+    NETMON_WORKER *w;
+    uint64_t stop = 1;
+    unsigned long written, dropped;
+    int epfd, timerfd, reportfd = -1, nfds, result = 1;
+
+    if((epfd = epoll_create1(0)) == -1) {
+        sprintf(error_msg, "Unable to create epoll instance");
+        return -1;
+    }
+    if((timerfd = rate_timer_new(RATE_TICK_MS)) == -1) return -1;
+    if(watch_fd(epfd, timerfd) == -1 || watch_fd(epfd, netmon.donefd) == -1 ||
+            watch_fd(epfd, netmon.headless ? netmon.sigfd : STDIN_FILENO) == -1) return -1;
 
-    ui_init();
-    time_block_init(netmon.tb, time(NULL));
+    // Headless records are written on their own timer, the rates are still sampled every tick
+    if(netmon.headless && ((reportfd = rate_timer_new(netmon.interval_ms)) == -1 || watch_fd(epfd, reportfd) == -1))
+        return -1;
+
+    if(!netmon.headless)
+        ui_init(netmon.fps, snapshot_totals, snapshot_hosts, netmon.workers[0].flows ? snapshot_flows : NULL,
+                snapshot_talkers, snapshot_sessions);
+    update_rate();
+
+    for(int i = 0; i < netmon.num_workers; ++i) {
+        w = &netmon.workers[i];
+        if(w->replay) {
+            pthread_create(&w->thread, NULL, replay_thread, w);
+        } else if(w->queue) {
+            pthread_create(&w->thread, NULL, decode_thread, w);
+            pthread_create(&w->capture, NULL, capture_thread, w);
+        } else {
+            pthread_create(&w->thread, NULL, worker_thread, w);
+        }
+    }
 
     for(;;) {
+        nfds = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if(nfds == -1) {
+            if(errno == EINTR) continue;
+            break;
+        }
 
-        // Process a packet if there is one
-        len = recvfrom(sockfd, buffer, 4096, MSG_DONTWAIT, (struct sockaddr *)(&from), &addrlen);
-        if(len > 0) {
-            if(!skip_packet(buffer, mask)) {
-                process_packet(buffer, len, mask);
-                netmon.tb->byte_count += len;
+        for(int i = 0; i < nfds; ++i) {
+            if(events[i].data.fd == timerfd) {
+                if(read_timer(timerfd)) update_rate();
+            } else if(events[i].data.fd == reportfd) {
+                if(read_timer(reportfd) && report_tick(reportfd) == -1) {
+                    result = -1;
+                    goto quit;
+                }
+            } else if(events[i].data.fd == STDIN_FILENO) {
+                if(handle_key() == -1) goto quit;
+            } else if(events[i].data.fd == netmon.donefd || events[i].data.fd == netmon.sigfd) {
+                goto quit;
             }
         }
+    }
 
+quit:
+    // The event stays readable, so every worker sees it
+    __atomic_store_n(&netmon.stopping, 1, __ATOMIC_RELAXED);
+    if(write(netmon.stopfd, &stop, sizeof(stop)) != sizeof(stop)) return -1;
+    for(int i = 0; i < netmon.num_workers; ++i) {
+        if(netmon.workers[i].queue) pthread_join(netmon.workers[i].capture, NULL);
+        pthread_join(netmon.workers[i].thread, NULL);
+    }
 
-        // Update volume / rate
-        current_time = time(NULL) - netmon.tb->start_time;
-        if(current_time >= TIME_BLOCK_LENGTH) {
-            netmon.total_bytes += netmon.tb->byte_count;
-            ui_display_rate(netmon.total_bytes);
-            netmon.tb = time_block_next(netmon.rq);
-            netmon.total_bytes -= netmon.tb->byte_count;
-            time_block_init(netmon.tb, time(NULL));
-        }
+    // A last record covers whatever arrived since the previous tick
+    if(!netmon.headless) {
+        ui_shutdown();
+    } else {
+        if(result == 1 && report_tick(-1) == -1) result = -1;
+        report_close(netmon.report);
+    }
+    if(netmon.metrics) metrics_close(netmon.metrics);
+    if(netmon.shm) shm_stats_destroy(netmon.shm);
+    close(timerfd);
+    if(reportfd != -1) close(reportfd);
+    close(epfd);
+
+    // Summaries go to stderr, stdout may be carrying headless records
+    if(netmon.workers[0].replay) {
+        snapshot_totals(&totals);
+        fprintf(stderr, "%lu packets in %.3f seconds, %.0f packets/sec\n", totals.packet_total, netmon.elapsed,
+                netmon.elapsed > 0 ? totals.packet_total / netmon.elapsed : 0.0);
+    }
 
-        // Update packet numbers
-        ui_display_ether_types(netmon.arp_total, netmon.ip4_total, netmon.ip6_total, netmon.netrans_total);
-        ui_display_ip_types(netmon.tcp_total, netmon.udp_total, netmon.igmp_total, netmon.icmp_total);
-        ui_display_arp_types(netmon.reply_total, netmon.request_total);
-        ui_display_netrans_types(netmon.send_total, netmon.receive_total, netmon.ack_total, netmon.chunk_total);
+    // Every worker has handed over its last batch
+    if(netmon.writer) {
+        pcap_writer_close(netmon.writer, &written, &dropped);
+        netmon.writer = NULL;
+        fprintf(stderr, "%lu frames written, %lu dropped by the writer\n", written, dropped);
     }
+    return result;
+}
 
+// Adds fd to the epoll interest list for reading
+static int watch_fd(int epfd, int fd)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        sprintf(error_msg, "Unable to watch file descriptor %d", fd);
+        return -1;
+    }
     return 1;
 }
 
-static int skip_packet(char *packet_bytes, uint16_t mask)
+// Creates a timer that fires once every interval_ms milliseconds
+static int rate_timer_new(unsigned int interval_ms)
 {
-    PACKET_ETH_HDR *eth_hdr;
-    uint16_t type;
+    struct itimerspec its;
+    int timerfd;
 
-    eth_hdr = (PACKET_ETH_HDR *)packet_bytes;
-    type = ntohs(eth_hdr->eth_type);
-    return (mask != 0) && (mask != type);
+    if((timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+        sprintf(error_msg, "Unable to create rate timer");
+        return -1;
+    }
+
+    memset(&its, 0, sizeof(struct itimerspec));
+    its.it_value.tv_sec = interval_ms / 1000;
+    its.it_value.tv_nsec = (interval_ms % 1000) * 1000000L;
+    its.it_interval = its.it_value;
+    timerfd_settime(timerfd, 0, &its, NULL);
+    return timerfd;
 }
 
-static void process_packet(char *packet_bytes, int len, uint16_t mask)
+// Blocks SIGINT and SIGTERM and returns a descriptor that becomes readable when one arrives
+static int signal_fd_new()
 {
-    PACKET_ETH_HDR eth_hdr;
-    char mac_src[MACLENGTH + 1];
-    char mac_dest[MACLENGTH + 1];
-    uint16_t type;
+    sigset_t mask;
+    int sigfd;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if(pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0 ||
+            (sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+        sprintf(error_msg, "Unable to create signal descriptor");
+        return -1;
+    }
+    return sigfd;
+}
 
-    memcpy(&eth_hdr, packet_bytes, sizeof(PACKET_ETH_HDR));
-    mac_to_string(eth_hdr.eth_mac_src, mac_src);
-    mac_to_string(eth_hdr.eth_mac_dest, mac_dest);
-    insert_mac_addr(mac_src);
-    insert_mac_addr(mac_dest);
+// Returns 0 if the timer has not actually expired
+static int read_timer(int timerfd)
+{
+    uint64_t expirations;
 
-    type = ntohs(eth_hdr.eth_type);
-    switch(type) {
-        case ETH_TYPE_IP4:
-            process_ip4_packet(packet_bytes + sizeof(PACKET_ETH_HDR), mac_dest, mac_src);
-            break;
-        case ETH_TYPE_IP6:
-            process_ip6_packet(packet_bytes + sizeof(PACKET_ETH_HDR), mac_dest, mac_src);
-            break;
-        case ETH_TYPE_ARP:
-            process_arp_packet(packet_bytes + sizeof(PACKET_ETH_HDR), mac_dest, mac_src);
-            break;
-        case ETH_TYPE_NETRANS:
-            process_netrans_packet(packet_bytes + sizeof(PACKET_ETH_HDR), mac_dest, mac_src);
-            break;
-        default:
-            sprintf(error_msg, "Unkown ethernet type: %04x", ntohs(eth_hdr.eth_type));
-            ui_display_error(error_msg);
-            break;
+    return read(timerfd, &expirations, sizeof(expirations)) == sizeof(expirations);
+}
+
+// Samples the merged totals into the rate queue, adjusts the decoders' sampling and
+// shows the new rates
+static void update_rate()
+{
+    NETMON_STATS totals;
+    HLL_ESTIMATE distinct;
+    TIMING_STATS timing;
+    SPSC_STATS queues;
+    CAPTURE_STATS kernel, second;
+    RATE rates[RATE_WINDOWS];
+    int queued, refresh, captured;
+
+    // The workers only keep running totals, each block is a snapshot of them
+    snapshot_totals(&totals);
+    rate_queue_push(netmon.rq, &totals, monotonic_ns());
+    captured = snapshot_kernel(&kernel);
+    update_sample(captured ? &kernel : NULL);
+    if(netmon.headless && !netmon.shm) return;
+    rate_queue_rates(netmon.rq, rates);
+
+    // Merging every worker's sketches costs more than a tick's worth of rates
+    if((refresh = netmon.ticks++ % DISTINCT_TICKS == 0)) snapshot_distinct(&distinct);
+    if(netmon.shm) publish_shm(&totals, rates, refresh ? &distinct : NULL, &kernel);
+    if(netmon.headless) return;
+
+    if(captured) kernel_last_second(&kernel, &second);
+    ui_display_rate(rates, captured ? &kernel : NULL, captured ? &second : NULL, netmon.sample);
+    if(refresh) {
+        ui_display_distinct(&distinct);
+        snapshot_timing(&timing);
+        ui_display_timing(&timing);
+        if((queued = snapshot_queues(&queues))) ui_display_queues(&queues);
+        if(netmon.metrics)
+            publish_metrics(&totals, &distinct, &timing, rates, captured ? &kernel : NULL, queued ? &queues : NULL);
     }
 }
 
-static void process_ip4_packet(char *packet_bytes, char *mac_dest, char *mac_src)
+// Hands the decoders the ratio picked from the tick's drops and the fullest ring or
+// queue, a worker's ring and queue back up when its decoder cannot keep up
+static void update_sample(CAPTURE_STATS *kernel)
 {
-    PACKET_IP4_HDR ip4_hdr;
-    char ip4_src[IP4LENGTH + 1];
-    char ip4_dest[IP4LENGTH + 1];
+    NETMON_WORKER *w;
+    SPSC_STATS queue;
+    unsigned int fill = 0, f, ratio;
+
+    for(int i = 0; i < netmon.num_workers; ++i) {
+        w = &netmon.workers[i];
+        if(w->cap && (f = capture_ring_fill(w->cap)) > fill) fill = f;
+        if(w->queue) {
+            memset(&queue, 0, sizeof(SPSC_STATS));
+            spsc_stats_merge(&queue, w->queue);
+            if((f = queue.depth * 100 / queue.slots) > fill) fill = f;
+        }
+    }
 
-    memcpy(&ip4_hdr, packet_bytes, sizeof(PACKET_IP4_HDR));
-    netmon.ip4_total++;
-    switch(ip4_hdr.ip4_protocol) {
-        case IP_PROTOCOL_ICMP:
-            ui_display_packet(mac_dest, mac_src, "IPv4", "ICMP");
-            netmon.icmp_total++;
-            break;
-        case IP_PROTOCOL_IGMP:
-            ui_display_packet(mac_dest, mac_src, "IPv4", "IGMP");
-            netmon.igmp_total++;
-            break;
-        case IP_PROTOCOL_TCP:
-            ui_display_packet(mac_dest, mac_src, "IPv4", "TCP");
-            netmon.tcp_total++;
-            break;
-        case IP_PROTOCOL_UDP:
-            ui_display_packet(mac_dest, mac_src, "IPv4", "UDP");
-            netmon.udp_total++;
-            break;
-        default:
-            ui_display_packet(mac_dest, mac_src, "IPv4", "UNKNOWN");
-            sprintf(error_msg, "Unkown IPv4 protocol: %02x", ip4_hdr.ip4_protocol);
-            ui_display_error(error_msg);
-            break;
+    if((ratio = overload_update(&netmon.overload, kernel, fill)) != netmon.sample) {
+        for(int i = 0; i < netmon.num_workers; ++i)
+            decoder_set_sample(&netmon.workers[i].dec, ratio);
+        netmon.sample = ratio;
     }
+}
 
-    ip4_to_string(ip4_hdr.ip4_src, ip4_src);
-    ip4_to_string(ip4_hdr.ip4_dest, ip4_dest);
-    insert_ip_addr(ip4_src);
-    insert_ip_addr(ip4_dest);
+// Writes a headless record, timerfd is -1 for the final record at shutdown
+static int report_tick(int timerfd)
+{
+    NETMON_STATS totals;
+    FLOW_SUMMARY flows;
+    HOST_SUMMARY hosts;
+    NETRANS_SUMMARY sessions;
+    HLL_ESTIMATE distinct;
+    TIMING_STATS timing;
+    SPSC_STATS queues;
+    CAPTURE_STATS kernel;
+    RATE rates[RATE_WINDOWS];
+    unsigned long ip_addrs, mac_addrs;
+    int queued, captured;
+
+    // The final record's windows end at shutdown rather than the last tick
+    if(timerfd == -1) update_rate();
+
+    snapshot_totals(&totals);
+    snapshot_addrs(&ip_addrs, &mac_addrs);
+    snapshot_distinct(&distinct);
+    snapshot_timing(&timing);
+    rate_queue_rates(netmon.rq, rates);
+    snapshot_sessions(&sessions);
+    queued = snapshot_queues(&queues);
+    captured = snapshot_kernel(&kernel);
+    if(netmon.workers[0].flows) snapshot_flows(&flows);
+    snapshot_hosts(&hosts);
+    if(netmon.metrics)
+        metrics_publish(netmon.metrics, &totals, ip_addrs, mac_addrs, &distinct, &timing, rates, &sessions,
+                captured ? &kernel : NULL, queued ? &queues : NULL, netmon.workers[0].flows ? &flows : NULL,
+                &hosts, netmon.sample);
+    return report_write(netmon.report, &totals, ip_addrs, mac_addrs, &distinct, &timing, rates, &sessions,
+            captured ? &kernel : NULL, queued ? &queues : NULL, netmon.workers[0].flows ? &flows : NULL,
+            &hosts, netmon.sample);
 }
 
-static void process_ip6_packet(char *packet_bytes, char *mac_dest, char *mac_src)
+// Fills the segment from the tick's totals and rates, the distinct counts are kept
+// from the last refresh when distinct is NULL
+static void publish_shm(NETMON_STATS *totals, RATE *rates, HLL_ESTIMATE *distinct, CAPTURE_STATS *kernel)
 {
-    PACKET_IP6_HDR ip6_hdr;
-    char ip6_src[IP6LENGTH + 1];
-    char ip6_dest[IP6LENGTH + 1];
+    SHM_STATS *b = &netmon.shm->body;
+    unsigned long ip_addrs, mac_addrs;
+
+    _Static_assert(SHM_RATE_WINDOWS == RATE_WINDOWS && SHM_RATE_CLASSES == RATE_CLASSES && SHM_KINDS == HLL_KINDS,
+            "shared memory layout out of step with the rates and sketches");
+
+    b->packets = totals->packet_total;
+    b->bytes = totals->byte_total;
+    b->ethertype_packets[0] = totals->ip4_total;
+    b->ethertype_packets[1] = totals->ip6_total;
+    b->ethertype_packets[2] = totals->arp_total;
+    b->ethertype_packets[3] = totals->netrans_total;
+    b->ethertype_bytes[0] = totals->ip4_bytes;
+    b->ethertype_bytes[1] = totals->ip6_bytes;
+    b->ethertype_bytes[2] = totals->arp_bytes;
+    b->ethertype_bytes[3] = totals->netrans_bytes;
+    b->protocol_packets[0] = totals->icmp_total;
+    b->protocol_packets[1] = totals->igmp_total;
+    b->protocol_packets[2] = totals->tcp_total;
+    b->protocol_packets[3] = totals->udp_total;
+    b->protocol_bytes[0] = totals->icmp_bytes;
+    b->protocol_bytes[1] = totals->igmp_bytes;
+    b->protocol_bytes[2] = totals->tcp_bytes;
+    b->protocol_bytes[3] = totals->udp_bytes;
+    b->arp_request = totals->request_total;
+    b->arp_reply = totals->reply_total;
+    b->netrans_send = totals->send_total;
+    b->netrans_receive = totals->receive_total;
+    b->netrans_ack = totals->ack_total;
+    b->netrans_chunk = totals->chunk_total;
+    b->kernel_packets = kernel->packets;
+    b->kernel_drops = kernel->drops;
+    b->kernel_freezes = kernel->freezes;
+    b->shed = totals->shed_total;
+    b->sample_ratio = netmon.sample;
+
+    snapshot_addrs(&ip_addrs, &mac_addrs);
+    b->ip_addrs = ip_addrs;
+    b->mac_addrs = mac_addrs;
+    if(distinct) {
+        memcpy(b->distinct, distinct->total, sizeof(b->distinct));
+        memcpy(b->distinct_window, distinct->window, sizeof(b->distinct_window));
+    }
+    for(int w = 0; w < RATE_WINDOWS; ++w) {
+        memcpy(b->bps[w], rates[w].bps, sizeof(b->bps[w]));
+        memcpy(b->pps[w], rates[w].pps, sizeof(b->pps[w]));
+    }
+    shm_stats_publish(netmon.shm);
+}
 
-    memcpy(&ip6_hdr, packet_bytes, sizeof(PACKET_IP6_HDR));
-    netmon.ip6_total++;
-    switch(ip6_hdr.ip6_protocol) {
-        case IP_PROTOCOL_IGMP:
-            ui_display_packet(mac_dest, mac_src, "IPv6", "IGMP");
-            netmon.igmp_total++;
-            break;
-        case IP_PROTOCOL_TCP:
-            ui_display_packet(mac_dest, mac_src, "IPv6", "TCP");
-            netmon.tcp_total++;
-            break;
-        case IP_PROTOCOL_UDP:
-            ui_display_packet(mac_dest, mac_src, "IPv6", "UDP");
-            netmon.udp_total++;
-            break;
-        case IP_PROTOCOL_IP6ICMP:
-            ui_display_packet(mac_dest, mac_src, "IPv6", "ICMP");
-            netmon.icmp_total++;
-            break;
-        default:
-            ui_display_packet(mac_dest, mac_src, "IPv6", "UNKNOWN");
-            sprintf(error_msg, "Unkown IPv6 protocol: %02x", ip6_hdr.ip6_protocol);
-            ui_display_error(error_msg);
-            break;
+// Completes what the display just took with the snapshots it does not need every second.
+// The gap percentiles are shared with the display, a second snapshot would split their interval
+static void publish_metrics(NETMON_STATS *totals, HLL_ESTIMATE *distinct, TIMING_STATS *timing, RATE *rates,
+        CAPTURE_STATS *kernel, SPSC_STATS *queues)
+{
+    FLOW_SUMMARY flows;
+    HOST_SUMMARY hosts;
+    NETRANS_SUMMARY sessions;
+    unsigned long ip_addrs, mac_addrs;
+
+    snapshot_addrs(&ip_addrs, &mac_addrs);
+    snapshot_sessions(&sessions);
+    if(netmon.workers[0].flows) snapshot_flows(&flows);
+    snapshot_hosts(&hosts);
+    metrics_publish(netmon.metrics, totals, ip_addrs, mac_addrs, distinct, timing, rates, &sessions, kernel,
+            queues, netmon.workers[0].flows ? &flows : NULL, &hosts, netmon.sample);
+}
+
+// Reads pending keystrokes, returns -1 when the user asked to quit
+static int handle_key()
+{
+    char keys[16];
+    int len;
+
+    len = read(STDIN_FILENO, keys, sizeof(keys));
+    if(len == 0) return -1;
+    for(int i = 0; i < len; ++i) {
+        switch(keys[i]) {
+            case 'q':
+            case 'Q':
+                return -1;
+            case 'f':
+            case 'F':
+                ui_set_view(UI_VIEW_FLOWS);
+                break;
+            case 'p':
+            case 'P':
+                ui_set_view(UI_VIEW_PACKETS);
+                break;
+            case 't':
+            case 'T':
+                ui_set_view(UI_VIEW_TALKERS_BYTES);
+                break;
+            case 'n':
+            case 'N':
+                ui_set_view(UI_VIEW_TALKERS_PACKETS);
+                break;
+            case 's':
+            case 'S':
+                ui_set_view(UI_VIEW_SESSIONS);
+                break;
+            case 'h':
+            case 'H':
+                ui_next_host_rank();
+                break;
+        }
     }
+    return 1;
+}
 
-    ip6_to_string(ip6_hdr.ip6_src, ip6_src);
-    ip6_to_string(ip6_hdr.ip6_dest, ip6_dest);
-    insert_ip_addr(ip6_src);
-    insert_ip_addr(ip6_dest);
+// Merges the per-worker counter blocks, only done when the totals are displayed
+static void snapshot_totals(NETMON_STATS *totals)
+{
+    memset(totals, 0, sizeof(NETMON_STATS));
+    for(int i = 0; i < netmon.num_workers; ++i)
+        stats_merge(totals, &netmon.workers[i].stats);
 }
 
-static void process_arp_packet(char *packet_bytes, char *mac_dest, char *mac_src)
+// Merges what each worker last published about its hosts
+static void snapshot_hosts(HOST_SUMMARY *hosts)
 {
-    PACKET_ARP_HDR arp_hdr;
+    memset(hosts, 0, sizeof(HOST_SUMMARY));
+    for(int i = 0; i < netmon.num_workers; ++i)
+        host_summary_merge(hosts, netmon.workers[i].hosts);
+    host_summary_sort(hosts);
+}
 
-    memcpy(&arp_hdr, packet_bytes, sizeof(PACKET_ARP_HDR));
-    netmon.arp_total++;
-    switch(ntohs(arp_hdr.arp_oper)) {
-        case ARP_OPER_REQUEST:
-            ui_display_packet(mac_dest, mac_src, "ARP", "REQUEST");
-            netmon.request_total++;
-            break;
-        case ARP_OPER_REPLY:
-            ui_display_packet(mac_dest, mac_src, "ARP", "REPLY");
-            netmon.reply_total++;
-            break;
-        default:
-            ui_display_packet(mac_dest, mac_src, "ARP", "UNKNOWN");
-            sprintf(error_msg, "Unkown ARP operation: %04x", ntohs(arp_hdr.arp_oper));
-            ui_display_error(error_msg);
-            break;
+// Merges what each worker last published about its busiest flows
+static void snapshot_flows(FLOW_SUMMARY *flows)
+{
+    memset(flows, 0, sizeof(FLOW_SUMMARY));
+    for(int i = 0; i < netmon.num_workers; ++i)
+        if(netmon.workers[i].flows) flow_summary_merge(flows, netmon.workers[i].flows);
+    flow_summary_sort(flows);
+}
+
+// Percentiles of the gaps since the previous snapshot, which is taken once a second
+// for the display or once a record when headless
+static void snapshot_timing(TIMING_STATS *timing)
+{
+    static TIMING_SUMMARY now, prev;
+    static int taken;
+
+    memset(&now, 0, sizeof(TIMING_SUMMARY));
+    for(int i = 0; i < netmon.num_workers; ++i)
+        timing_summary_merge(&now, netmon.workers[i].timing);
+    timing_stats(timing, &now, taken ? &prev : NULL);
+    prev = now;
+    taken = 1;
+}
+
+// Unions every worker's sketches, a replay's window ends at the newest frame rather than now
+static void snapshot_distinct(HLL_ESTIMATE *distinct)
+{
+    static HLL total[HLL_KINDS], window[HLL_KINDS];
+
+    memset(total, 0, sizeof(total));
+    memset(window, 0, sizeof(window));
+    for(int i = 0; i < netmon.num_workers; ++i)
+        hll_window_merge(total, window, netmon.workers[i].distinct, netmon.workers[i].replay ? 0 : realtime_ns());
+    hll_estimate(distinct, total, window);
+}
+
+// Sizes of the exact address sets, zero when they are not kept
+static void snapshot_addrs(unsigned long *ip_addrs, unsigned long *mac_addrs)
+{
+    *ip_addrs = *mac_addrs = 0;
+    if(!netmon.addrs.ip_addrs) return;
+    pthread_mutex_lock(&netmon.addrs.lock);
+    *ip_addrs = netmon.addrs.ip_addrs->len;
+    *mac_addrs = netmon.addrs.mac_addrs->len;
+    pthread_mutex_unlock(&netmon.addrs.lock);
+}
+
+static void snapshot_talkers(TALKER_SUMMARY *talkers)
+{
+    memset(talkers, 0, sizeof(TALKER_SUMMARY));
+    for(int i = 0; i < netmon.num_workers; ++i)
+        talker_summary_merge(talkers, netmon.workers[i].talkers);
+    talker_summary_sort(talkers);
+}
+
+// Merges the queues between capture and decode threads, returns 0 if there are none
+static int snapshot_queues(SPSC_STATS *queues)
+{
+    memset(queues, 0, sizeof(SPSC_STATS));
+    if(!netmon.workers[0].queue) return 0;
+    for(int i = 0; i < netmon.num_workers; ++i)
+        spsc_stats_merge(queues, netmon.workers[i].queue);
+    return 1;
+}
+
+// Sums what the kernel counted on every capture socket, returns 0 when replaying
+// as there are no sockets to ask
+static int snapshot_kernel(CAPTURE_STATS *kernel)
+{
+    memset(kernel, 0, sizeof(CAPTURE_STATS));
+    if(!netmon.workers[0].cap) return 0;
+    for(int i = 0; i < netmon.num_workers; ++i) {
+        capture_read_stats(netmon.workers[i].cap);
+        kernel->packets += netmon.workers[i].cap->kernel.packets;
+        kernel->drops += netmon.workers[i].cap->kernel.drops;
+        kernel->freezes += netmon.workers[i].cap->kernel.freezes;
     }
+    return 1;
 }
 
-static void process_netrans_packet(char *packet_bytes, char *mac_dest, char *mac_src)
+// What the kernel added over the last second, from the totals of every tick in it
+static void kernel_last_second(CAPTURE_STATS *kernel, CAPTURE_STATS *second)
 {
-    PACKET_NETRANS_HDR netrans_hdr;
+    static CAPTURE_STATS history[KERNEL_TICKS];
+    static int pos;
+
+    second->packets = kernel->packets - history[pos].packets;
+    second->drops = kernel->drops - history[pos].drops;
+    second->freezes = kernel->freezes - history[pos].freezes;
+    history[pos] = *kernel;
+    pos = (pos + 1) % KERNEL_TICKS;
+}
 
-    memcpy(&netrans_hdr, packet_bytes, sizeof(PACKET_NETRANS_HDR));
-    netmon.netrans_total++;
-    switch(netrans_hdr.netrans_type) {
-        case NETRANS_TYPE_SEND:
-            ui_display_packet(mac_dest, mac_src, "NETRANS", "SEND");
-            netmon.send_total++;
-            break;
-        case NETRANS_TYPE_RECEIVE:
-            ui_display_packet(mac_dest, mac_src, "NETRANS", "RECEIVE");
-            netmon.receive_total++;
-            break;
-        case NETRANS_TYPE_ACK:
-            ui_display_packet(mac_dest, mac_src, "NETRANS", "ACK");
-            netmon.ack_total++;
-            break;
-        case NETRANS_TYPE_CHUNK:
-            ui_display_packet(mac_dest, mac_src, "NETRANS", "CHUNK");
-            netmon.chunk_total++;
-            break;
-        default:
-            ui_display_packet(mac_dest, mac_src, "NETRANS", "UNKNOWN");
-            sprintf(error_msg, "Unkown NETRANS operation: %02x", netrans_hdr.netrans_type);
-            ui_display_error(error_msg);
+static void snapshot_sessions(NETRANS_SUMMARY *sessions)
+{
+    memset(sessions, 0, sizeof(NETRANS_SUMMARY));
+    for(int i = 0; i < netmon.num_workers; ++i)
+        netrans_summary_merge(sessions, netmon.workers[i].netrans);
+    netrans_summary_sort(sessions);
+}
+
+// Wake up now and then while frames are waiting for the writer, flows or sessions
+// may go idle or talkers and hosts have not been published
+static int worker_pending(NETMON_WORKER *w)
+{
+    return w->batch || (w->flows && w->flows->table.len) || w->netrans->table.len || w->talkers->dirty || w->hosts->dirty;
+}
+
+// Hands the writer its batch and publishes the tables, at most once a publish interval
+// unless forced
+static void worker_publish(NETMON_WORKER *w, int force)
+{
+    if(netmon.writer) pcap_writer_flush(netmon.writer, &w->batch, force);
+    if(w->flows) flow_table_publish(w->flows, realtime_ns(), force);
+    netrans_table_publish(w->netrans, realtime_ns(), force);
+    talker_table_publish(w->talkers, force);
+    host_table_publish(w->hosts, force);
+}
+
+static void *worker_thread(void *arg)
+{
+    NETMON_WORKER *w;
+    struct epoll_event events[MAX_EVENTS];
+    int nfds;
+
+    w = (NETMON_WORKER *)arg;
+    for(;;) {
+        nfds = epoll_wait(w->epfd, events, MAX_EVENTS, worker_pending(w) ? WORKER_TICK_MS : -1);
+        if(nfds == -1) {
+            if(errno == EINTR) continue;
             break;
+        }
+
+        for(int i = 0; i < nfds; ++i) {
+            if(events[i].data.fd == netmon.stopfd) goto stop;
+
+            // Drain a bounded amount so a stop request is never starved
+            for(int n = 0; n < DISPATCH_BUDGET; ++n)
+                if(capture_dispatch(w->cap, handle_frame, w) == 0) break;
+        }
+        worker_publish(w, 0);
     }
 
+stop:
+    worker_publish(w, 1);
+    return NULL;
 }
 
-static void ip6_to_string(unsigned short *ip, char *buffer)
+// Only moves frames from the socket into the queue, publishing them once per wakeup
+// so the decoder is woken at most that often, and the socket is read however long
+// decoding takes
+static void *capture_thread(void *arg)
 {
-    sprintf(buffer, "%01x:%01x:%01x:%01x:%01x:%01x:%01x:%01x",
-            ntohs(ip[0]), ntohs(ip[1]), ntohs(ip[2]), ntohs(ip[3]), ntohs(ip[4]), ntohs(ip[5]), ntohs(ip[6]), ntohs(ip[7]));
-    buffer[IP6LENGTH] = '\0';
+    NETMON_WORKER *w;
+    struct epoll_event events[MAX_EVENTS];
+    int nfds;
+
+    w = (NETMON_WORKER *)arg;
+    for(;;) {
+        nfds = epoll_wait(w->epfd, events, MAX_EVENTS, -1);
+        if(nfds == -1) {
+            if(errno == EINTR) continue;
+            break;
+        }
+
+        for(int i = 0; i < nfds; ++i) {
+            if(events[i].data.fd == netmon.stopfd) goto stop;
+
+            for(int n = 0; n < DISPATCH_BUDGET; ++n)
+                if(capture_dispatch(w->cap, queue_frame, w) == 0) break;
+        }
+        spsc_commit(w->queue);
+    }
+
+stop:
+    spsc_close(w->queue);
+    return NULL;
 }
 
-static void ip4_to_string(unsigned char *ip, char *buffer)
+// Decodes queued frames in batches until the capture thread closes the queue and it
+// has been drained, sleeping on the queue's event while it is empty
+static void *decode_thread(void *arg)
 {
-    sprintf(buffer, "%d.%d.%d.%d",
-            ip[0], ip[1], ip[2], ip[3]);
-    buffer[IP4LENGTH] = '\0';
+    NETMON_WORKER *w;
+    struct epoll_event events[MAX_EVENTS];
+    uint64_t wakeups;
+    int nfds, closed;
+
+    w = (NETMON_WORKER *)arg;
+    for(;;) {
+        // Checked first, whatever was pushed before the queue closed is drained below
+        closed = spsc_closed(w->queue);
+        if(spsc_drain(w->queue, handle_frame, w, DECODE_BATCH) == 0) {
+            if(closed) break;
+            if(!spsc_arm(w->queue)) {
+                nfds = epoll_wait(w->queue_epfd, events, MAX_EVENTS, worker_pending(w) ? WORKER_TICK_MS : -1);
+                if(nfds > 0 && read(w->queue->eventfd, &wakeups, sizeof(wakeups)) != sizeof(wakeups)) continue;
+            }
+        }
+        worker_publish(w, 0);
+    }
+
+    worker_publish(w, 1);
+    return NULL;
 }
 
-static void mac_to_string(unsigned char *ma, char *buffer)
+// Feeds every frame of the capture file through the decoder, paced by its timestamps
+static void *replay_thread(void *arg)
 {
-    sprintf(buffer, "%02x:%02x:%02x:%02x:%02x:%02x",
-            ma[0], ma[1], ma[2], ma[3], ma[4], ma[5]);
-    buffer[MACLENGTH] = '\0';
+    NETMON_WORKER *w;
+    PCAP_RECORD rec;
+    uint64_t start, first_ts = 0, done = 1;
+    unsigned long frames = 0;
+    int result;
+
+    w = (NETMON_WORKER *)arg;
+    start = monotonic_ns();
+    while((result = pcap_file_next(w->replay, &rec)) == 1) {
+        if(__atomic_load_n(&netmon.stopping, __ATOMIC_RELAXED)) break;
+
+        if(netmon.speed > 0) {
+            if(first_ts == 0) first_ts = rec.ts_ns;
+            if(rec.ts_ns > first_ts && pace_until(start + (rec.ts_ns - first_ts) / netmon.speed) == -1) break;
+        }
+
+        if(netmon.filter && !filter_match(netmon.filter, rec.data, rec.caplen)) continue;
+        handle_frame(w, (char *)rec.data, rec.caplen, rec.wirelen, rec.ts_ns);
+        if(netmon.writer && netmon.speed > 0) pcap_writer_flush(netmon.writer, &w->batch, 0);
+
+        // Flows and sessions age by the file's clock rather than ours
+        if(netmon.speed > 0 || ++frames % REPLAY_PUBLISH_FRAMES == 0) {
+            if(w->flows) flow_table_publish(w->flows, rec.ts_ns, 0);
+            netrans_table_publish(w->netrans, rec.ts_ns, 0);
+            talker_table_publish(w->talkers, 0);
+            host_table_publish(w->hosts, 0);
+        }
+    }
+    netmon.elapsed = (monotonic_ns() - start) / 1e9;
+    if(netmon.writer) pcap_writer_flush(netmon.writer, &w->batch, 1);
+    if(w->flows) flow_table_publish(w->flows, w->replay->last_ts, 1);
+    netrans_table_publish(w->netrans, w->replay->last_ts, 1);
+    talker_table_publish(w->talkers, 1);
+    host_table_publish(w->hosts, 1);
+
+    if(result == -1) ui_display_error(error_msg);
+    if(write(netmon.donefd, &done, sizeof(done)) != sizeof(done)) return NULL;
+    return NULL;
 }
 
-static void insert_ip_addr(char *addr)
+// Sleeps until the monotonic clock reaches target_ns, waking regularly to notice a
+// stop request, returns -1 if the replay was stopped
+static int pace_until(uint64_t target_ns)
 {
-    for(int i = 0; i < netmon.ip_len; ++i)
-        if(strcmp(netmon.ip_addrs[i], addr) == 0) return;
-    if(netmon.ip_len >= netmon.ip_capacity - 1) {
-        netmon.ip_capacity *= 2;
-        netmon.ip_addrs = (char **)realloc(netmon.ip_addrs, netmon.ip_capacity * sizeof(char *));
+    struct timespec ts;
+    uint64_t now, wake;
+
+    while((now = monotonic_ns()) < target_ns) {
+        if(__atomic_load_n(&netmon.stopping, __ATOMIC_RELAXED)) return -1;
+        wake = (target_ns - now > REPLAY_SLEEP_NS) ? now + REPLAY_SLEEP_NS : target_ns;
+        ts.tv_sec = wake / 1000000000ULL;
+        ts.tv_nsec = wake % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
     }
-    netmon.ip_addrs[netmon.ip_len++] = strdup(addr);
-    ui_display_ip_addr(addr);
+    return 1;
 }
 
-static void insert_mac_addr(char *addr)
+// Copies a captured frame into the worker's queue for its decode thread
+static void queue_frame(void *arg, char *frame, int len, int wire_len, uint64_t ts_ns)
 {
-    for(int i = 0; i < netmon.mac_len; ++i)
-        if(strcmp(netmon.mac_addrs[i], addr) == 0) return;
-    if(netmon.mac_len >= netmon.mac_capacity - 1) {
-        netmon.mac_capacity *= 2;
-        netmon.mac_addrs = (char **)realloc(netmon.mac_addrs, netmon.mac_capacity * sizeof(char *));
-    }
-    netmon.mac_addrs[netmon.mac_len++] = strdup(addr);
-    ui_display_mac_addr(addr);
+    spsc_push(((NETMON_WORKER *)arg)->queue, frame, len, wire_len, ts_ns);
+}
+
+// Accounts for a single captured frame, which may live inside the packet ring or the queue
+static void handle_frame(void *arg, char *frame, int len, int wire_len, uint64_t ts_ns)
+{
+    NETMON_WORKER *w;
+
+    w = (NETMON_WORKER *)arg;
+    if(len < (int)sizeof(PACKET_ETH_HDR)) return;
+    decode_frame(&w->dec, frame, len, wire_len, ts_ns);
+
+    // Copied into a batch here, before a ring block goes back to the kernel
+    if(netmon.writer) pcap_writer_write(netmon.writer, &w->batch, (uint8_t *)frame, len, wire_len, ts_ns);
 }
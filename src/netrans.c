@@ -0,0 +1,226 @@
+#include "netrans.h"
+#include "table.h"
+#include "clock.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#define SEEN_MASK (NETRANS_SEEN_BITS - 1)
+
+static void chunk_numbered(NETRANS_ENTRY *e, uint32_t seq, unsigned int payload, uint64_t ts_ns);
+static void ack_numbered(NETRANS_ENTRY *e, uint32_t seq, uint64_t ts_ns);
+static int compare_bytes(const void *a, const void *b);
+
+#define SEEN_TEST(e, n) ((e)->seen[((n) & SEEN_MASK) / 64] & (1ULL << ((n) % 64)))
+#define SEEN_SET(e, n) ((e)->seen[((n) & SEEN_MASK) / 64] |= (1ULL << ((n) % 64)))
+#define SEEN_CLEAR(e, n) ((e)->seen[((n) & SEEN_MASK) / 64] &= ~(1ULL << ((n) % 64)))
+
+NETRANS_TABLE *netrans_table_new(unsigned int timeout_secs)
+{
+    NETRANS_TABLE *nt;
+
+    nt = (NETRANS_TABLE *)malloc(sizeof(NETRANS_TABLE));
+    memset(nt, 0, sizeof(NETRANS_TABLE));
+    table_init(&nt->table, NETRANS_SESSIONS, sizeof(NETRANS_ENTRY), offsetof(NETRANS_ENTRY, s.key), sizeof(NETRANS_KEY));
+    nt->timeout_ns = timeout_secs * 1000000000ULL;
+    pthread_mutex_init(&nt->lock, NULL);
+    return nt;
+}
+
+// The chunk number is only read when the frame was captured far enough to hold it,
+// shorter chunks and ACKs are counted but cannot be ordered or timed
+void netrans_table_update(NETRANS_TABLE *nt, uint8_t *mac_src, uint8_t *mac_dest, PACKET_NETRANS_HDR *hdr,
+        uint8_t *payload, int len, unsigned int wire_len, uint64_t ts_ns)
+{
+    NETRANS_KEY key;
+    NETRANS_ENTRY *entry;
+    NETRANS_SESSION *s;
+    PACKET_NETRANS_SEQ seq;
+    int cmp, from, added;
+
+    // Ends are ordered by MAC address, then netrans address
+    cmp = memcmp(mac_src, mac_dest, 6);
+    if(!cmp) cmp = (int)hdr->netrans_src - (int)hdr->netrans_dest;
+    from = cmp > 0;
+    memset(&key, 0, sizeof(NETRANS_KEY));
+    memcpy(key.mac[from], mac_src, 6);
+    memcpy(key.mac[!from], mac_dest, 6);
+    key.id[from] = hdr->netrans_src;
+    key.id[!from] = hdr->netrans_dest;
+
+    entry = (NETRANS_ENTRY *)table_get(&nt->table, &key, &added);
+    s = &entry->s;
+    if(added) {
+        s->hash = entry->link.hash;
+        s->first_ns = ts_ns;
+    }
+    s->frames++;
+    s->bytes += wire_len;
+    s->last_ns = ts_ns;
+
+    if(len >= (int)sizeof(PACKET_NETRANS_SEQ)) memcpy(&seq, payload, sizeof(PACKET_NETRANS_SEQ));
+    switch(hdr->netrans_type) {
+        case NETRANS_TYPE_CHUNK:
+            if(!s->chunks) {
+                s->sender = from;
+                s->chunk_first_ns = ts_ns;
+            }
+            s->chunks++;
+            s->chunk_bytes += wire_len;
+            s->chunk_last_ns = ts_ns;
+            if(from == s->sender && len >= (int)sizeof(PACKET_NETRANS_SEQ))
+                chunk_numbered(entry, ntohl(seq.netrans_seq), len - sizeof(PACKET_NETRANS_SEQ), ts_ns);
+            break;
+        case NETRANS_TYPE_ACK:
+            s->acks++;
+            if(s->chunks && from != s->sender && len >= (int)sizeof(PACKET_NETRANS_SEQ))
+                ack_numbered(entry, ntohl(seq.netrans_seq), ts_ns);
+            break;
+    }
+}
+
+// Expires idle sessions from the cold end of the LRU list and publishes the busiest sessions
+void netrans_table_publish(NETRANS_TABLE *nt, uint64_t now_ns, int force)
+{
+    NETRANS_SUMMARY sel;
+    NETRANS_ENTRY *entry;
+    TABLE_TOP top;
+    TABLE *t = &nt->table;
+    uint64_t mono;
+
+    mono = monotonic_ns();
+    if(!force && mono - nt->published_ns < NETRANS_PUBLISH_MS * 1000000ULL) return;
+    nt->published_ns = mono;
+
+    while(t->tail != TABLE_NONE && ((NETRANS_ENTRY *)TABLE_ENTRY(t, t->tail))->s.last_ns + nt->timeout_ns < now_ns) {
+        table_remove(t, t->tail);
+        nt->expired++;
+    }
+
+    sel.len = 0;
+    table_top_init(&top, sel.sessions, &sel.len, NETRANS_TOP_MAX, sizeof(NETRANS_SESSION), compare_bytes);
+    for(uint32_t e = t->head; e != TABLE_NONE; e = entry->link.next) {
+        entry = (NETRANS_ENTRY *)TABLE_ENTRY(t, e);
+        table_top_insert(&top, &entry->s);
+    }
+
+    pthread_mutex_lock(&nt->lock);
+    memcpy(nt->published.sessions, sel.sessions, sel.len * sizeof(NETRANS_SESSION));
+    nt->published.len = sel.len;
+    nt->published.active = t->len;
+    nt->published.evicted = t->evicted;
+    nt->published.expired = nt->expired;
+    pthread_mutex_unlock(&nt->lock);
+}
+
+// A session split across tables by a load balancing fanout is added together, its
+// chunks were only ordered within each table
+void netrans_summary_merge(NETRANS_SUMMARY *sum, NETRANS_TABLE *nt)
+{
+    NETRANS_SESSION *src, *dst;
+    TABLE_TOP top;
+    int j;
+
+    pthread_mutex_lock(&nt->lock);
+    sum->active += nt->published.active;
+    sum->evicted += nt->published.evicted;
+    sum->expired += nt->published.expired;
+    table_top_init(&top, sum->sessions, &sum->len, NETRANS_TOP_MAX, sizeof(NETRANS_SESSION), compare_bytes);
+    for(int i = 0; i < nt->published.len; ++i) {
+        src = &nt->published.sessions[i];
+        for(j = 0; j < sum->len; ++j)
+            if(sum->sessions[j].hash == src->hash && memcmp(&sum->sessions[j].key, &src->key, sizeof(NETRANS_KEY)) == 0)
+                break;
+
+        if(j == sum->len) {
+            table_top_insert(&top, src);
+            continue;
+        }
+        dst = &sum->sessions[j];
+        dst->frames += src->frames;
+        dst->bytes += src->bytes;
+        dst->chunk_bytes += src->chunk_bytes;
+        dst->goodput += src->goodput;
+        dst->duplicates += src->duplicates;
+        dst->reordered += src->reordered;
+        dst->acks += src->acks;
+        dst->acked += src->acked;
+        dst->ack_total_ns += src->ack_total_ns;
+        if(src->ack_max_ns > dst->ack_max_ns) dst->ack_max_ns = src->ack_max_ns;
+        if(src->first_ns < dst->first_ns) dst->first_ns = src->first_ns;
+        if(src->last_ns > dst->last_ns) dst->last_ns = src->last_ns;
+        if(src->chunks) {
+            if(!dst->chunks || src->chunk_first_ns < dst->chunk_first_ns) dst->chunk_first_ns = src->chunk_first_ns;
+            if(src->chunk_last_ns > dst->chunk_last_ns) dst->chunk_last_ns = src->chunk_last_ns;
+            if(!dst->chunks) dst->sender = src->sender;
+        }
+        dst->chunks += src->chunks;
+        table_top_rescan(&top);
+    }
+    pthread_mutex_unlock(&nt->lock);
+}
+
+void netrans_summary_sort(NETRANS_SUMMARY *sum)
+{
+    qsort(sum->sessions, sum->len, sizeof(NETRANS_SESSION), compare_bytes);
+}
+
+// Chunk numbers are compared with serial arithmetic so a long transfer may wrap. The
+// seen bitmap covers the NETRANS_SEEN_BITS numbers up to the highest, anything older
+// is assumed to be late rather than repeated
+static void chunk_numbered(NETRANS_ENTRY *e, uint32_t seq, unsigned int payload, uint64_t ts_ns)
+{
+    int32_t ahead;
+
+    if(!e->numbered) {
+        e->numbered = 1;
+        e->highest = seq;
+    }
+
+    ahead = (int32_t)(seq - e->highest);
+    if(ahead > 0) {
+        if(ahead >= NETRANS_SEEN_BITS) {
+            memset(e->seen, 0, sizeof(e->seen));
+        } else {
+            for(uint32_t n = e->highest + 1; n != seq; ++n) SEEN_CLEAR(e, n);
+        }
+        e->highest = seq;
+    } else if(ahead > -NETRANS_SEEN_BITS && SEEN_TEST(e, seq)) {
+        // Karn's rule, the ACK could be for either copy so the chunk is no longer timed
+        e->s.duplicates++;
+        if(e->sent_seq[seq % NETRANS_WINDOW] == seq) e->sent_ns[seq % NETRANS_WINDOW] = 0;
+        return;
+    } else if(ahead < 0) {
+        e->s.reordered++;
+    }
+
+    if(ahead > -NETRANS_SEEN_BITS) SEEN_SET(e, seq);
+    e->s.goodput += payload;
+    e->sent_seq[seq % NETRANS_WINDOW] = seq;
+    e->sent_ns[seq % NETRANS_WINDOW] = ts_ns;
+}
+
+// Only the first ACK of a chunk sent once is timed, later chunks in the same slot
+// replace ones that were never acknowledged
+static void ack_numbered(NETRANS_ENTRY *e, uint32_t seq, uint64_t ts_ns)
+{
+    uint64_t sent, latency;
+
+    sent = e->sent_ns[seq % NETRANS_WINDOW];
+    if(!sent || e->sent_seq[seq % NETRANS_WINDOW] != seq) return;
+    e->sent_ns[seq % NETRANS_WINDOW] = 0;
+
+    latency = ts_ns > sent ? ts_ns - sent : 0;
+    e->s.acked++;
+    e->s.ack_total_ns += latency;
+    if(latency > e->s.ack_max_ns) e->s.ack_max_ns = latency;
+}
+
+static int compare_bytes(const void *a, const void *b)
+{
+    const NETRANS_SESSION *sa = a, *sb = b;
+
+    if(sa->bytes == sb->bytes) return 0;
+    return (sa->bytes < sb->bytes) ? 1 : -1;
+}
@@ -0,0 +1,41 @@
+#include "overload.h"
+
+#include <string.h>
+
+void overload_init(OVERLOAD *o, unsigned int ratio)
+{
+    memset(o, 0, sizeof(OVERLOAD));
+    o->ratio = ratio ? ratio : 1;
+    o->fixed = ratio != 0;
+}
+
+// Drops show up a tick or two after the backlog that caused them, the hold keeps
+// those from doubling the ratio again before the last change has had an effect
+unsigned int overload_update(OVERLOAD *o, CAPTURE_STATS *kernel, unsigned int fill_pct)
+{
+    unsigned long packets = 0, drops = 0;
+    int hot;
+
+    if(o->fixed) return o->ratio;
+    if(kernel) {
+        packets = kernel->packets - o->last.packets;
+        drops = kernel->drops - o->last.drops;
+        o->last = *kernel;
+    }
+
+    hot = fill_pct >= OVERLOAD_FILL_PCT || (drops && drops * 100 >= packets * OVERLOAD_DROP_PCT);
+    if(o->hold) o->hold--;
+    if(hot) {
+        o->calm = 0;
+        if(!o->hold && o->ratio < MAX_SAMPLE_RATIO) {
+            o->ratio *= 2;
+            o->hold = OVERLOAD_HOLD_TICKS;
+        }
+    } else if(drops || fill_pct >= OVERLOAD_CALM_PCT) {
+        o->calm = 0;
+    } else if(++o->calm == OVERLOAD_CALM_TICKS) {
+        o->calm = 0;
+        if(o->ratio > 1) o->ratio /= 2;
+    }
+    return o->ratio;
+}
@@ -0,0 +1,242 @@
+#include "pcapfile.h"
+#include "errors.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PCAPNG_SHB 0x0A0D0D0A // Section header block
+#define PCAPNG_IDB 0x00000001 // Interface description block
+#define PCAPNG_SPB 0x00000003 // Simple packet block
+#define PCAPNG_EPB 0x00000006 // Enhanced packet block
+#define PCAPNG_BYTE_ORDER 0x1A2B3C4D
+#define PCAPNG_OPT_TSRESOL 9
+
+static uint16_t rd16(PCAP_FILE *pf, uint8_t *p);
+static uint32_t rd32(PCAP_FILE *pf, uint8_t *p);
+static int next_pcap(PCAP_FILE *pf, PCAP_RECORD *rec);
+static int next_pcapng(PCAP_FILE *pf, PCAP_RECORD *rec);
+static int read_section(PCAP_FILE *pf, uint8_t *block, uint32_t len);
+static int read_interface(PCAP_FILE *pf, uint8_t *block, uint32_t len);
+
+// Maps a pcap or pcapng file, returns NULL and sets error_msg on failure
+PCAP_FILE *pcap_file_open(const char *path)
+{
+    PCAP_FILE *pf;
+    struct stat st;
+    uint32_t magic;
+    int fd;
+
+    if((fd = open(path, O_RDONLY)) == -1) {
+        snprintf(error_msg, MAX_ERROR, "Unable to open capture file '%s'", path);
+        return NULL;
+    }
+    if(fstat(fd, &st) == -1 || st.st_size < PCAP_FILE_HDR_LEN) {
+        snprintf(error_msg, MAX_ERROR, "'%s' is not a capture file", path);
+        close(fd);
+        return NULL;
+    }
+
+    pf = (PCAP_FILE *)malloc(sizeof(PCAP_FILE));
+    memset(pf, 0, sizeof(PCAP_FILE));
+    pf->len = st.st_size;
+    pf->map = mmap(NULL, pf->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(pf->map == MAP_FAILED) {
+        snprintf(error_msg, MAX_ERROR, "Unable to map capture file '%s'", path);
+        free(pf);
+        return NULL;
+    }
+    madvise(pf->map, pf->len, MADV_SEQUENTIAL);
+
+    memcpy(&magic, pf->map, sizeof(magic));
+    if(magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC ||
+            magic == __builtin_bswap32(PCAP_MAGIC_USEC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC)) {
+        pf->format = PCAP_FORMAT_PCAP;
+        pf->swapped = (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC);
+        pf->nsec = (rd32(pf, pf->map) == PCAP_MAGIC_NSEC);
+        if(rd32(pf, pf->map + 20) != PCAP_LINKTYPE_ETHERNET) {
+            snprintf(error_msg, MAX_ERROR, "'%s' does not contain ethernet frames", path);
+            munmap(pf->map, pf->len);
+            free(pf);
+            return NULL;
+        }
+        pf->pos = PCAP_FILE_HDR_LEN;
+    } else if(magic == PCAPNG_SHB) {
+        pf->format = PCAP_FORMAT_PCAPNG;
+        pf->pos = 0;
+    } else {
+        snprintf(error_msg, MAX_ERROR, "'%s' is not a pcap or pcapng file", path);
+        munmap(pf->map, pf->len);
+        free(pf);
+        return NULL;
+    }
+
+    return pf;
+}
+
+// Reads the next ethernet frame, returns 1 on success, 0 at the end of the file
+// and -1 with error_msg set if the file is malformed
+int pcap_file_next(PCAP_FILE *pf, PCAP_RECORD *rec)
+{
+    if(pf->format == PCAP_FORMAT_PCAP) return next_pcap(pf, rec);
+    return next_pcapng(pf, rec);
+}
+
+static uint16_t rd16(PCAP_FILE *pf, uint8_t *p)
+{
+    uint16_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return pf->swapped ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t rd32(PCAP_FILE *pf, uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return pf->swapped ? __builtin_bswap32(v) : v;
+}
+
+static int next_pcap(PCAP_FILE *pf, PCAP_RECORD *rec)
+{
+    uint8_t *p;
+
+    if(pf->pos == pf->len) return 0;
+    if(pf->len - pf->pos < PCAP_REC_HDR_LEN) goto truncated;
+
+    p = pf->map + pf->pos;
+    rec->caplen = rd32(pf, p + 8);
+    rec->wirelen = rd32(pf, p + 12);
+    if(pf->len - pf->pos - PCAP_REC_HDR_LEN < rec->caplen) goto truncated;
+
+    rec->ts_ns = (uint64_t)rd32(pf, p) * 1000000000ULL + rd32(pf, p + 4) * (pf->nsec ? 1ULL : 1000ULL);
+    rec->data = p + PCAP_REC_HDR_LEN;
+    pf->last_ts = rec->ts_ns;
+    pf->pos += PCAP_REC_HDR_LEN + rec->caplen;
+    return 1;
+
+truncated:
+    snprintf(error_msg, MAX_ERROR, "Capture file is truncated");
+    return -1;
+}
+
+// Walks blocks until an enhanced or simple packet block from an ethernet interface turns up
+static int next_pcapng(PCAP_FILE *pf, PCAP_RECORD *rec)
+{
+    uint8_t *block;
+    uint32_t type, len, iface;
+    uint64_t ts;
+
+    while(pf->pos < pf->len) {
+        if(pf->len - pf->pos < 12) goto malformed;
+        block = pf->map + pf->pos;
+
+        // The byte order is only known once the section header has been read
+        memcpy(&type, block, sizeof(type));
+        if(type == PCAPNG_SHB && read_section(pf, block, pf->len - pf->pos) == -1) goto malformed;
+
+        type = rd32(pf, block);
+        len = rd32(pf, block + 4);
+        if(len < 12 || len % 4 != 0 || len > pf->len - pf->pos) goto malformed;
+        pf->pos += len;
+
+        switch(type) {
+            case PCAPNG_IDB:
+                if(read_interface(pf, block, len) == -1) goto malformed;
+                break;
+            case PCAPNG_EPB:
+                if(len < 32) goto malformed;
+                iface = rd32(pf, block + 8);
+                if(iface >= pf->num_ifaces || pf->linktype[iface] != PCAP_LINKTYPE_ETHERNET) break;
+                rec->caplen = rd32(pf, block + 20);
+                rec->wirelen = rd32(pf, block + 24);
+                if(rec->caplen > len - 32) goto malformed;
+                ts = (uint64_t)rd32(pf, block + 12) << 32 | rd32(pf, block + 16);
+                rec->ts_ns = ts / pf->ticks_per_sec[iface] * 1000000000ULL +
+                        ts % pf->ticks_per_sec[iface] * 1000000000ULL / pf->ticks_per_sec[iface];
+                rec->data = block + 28;
+                pf->last_ts = rec->ts_ns;
+                return 1;
+            case PCAPNG_SPB:
+                if(len < 16 || pf->num_ifaces == 0 || pf->linktype[0] != PCAP_LINKTYPE_ETHERNET) break;
+                rec->wirelen = rd32(pf, block + 8);
+                rec->caplen = rec->wirelen;
+                if(pf->snaplen[0] && rec->caplen > pf->snaplen[0]) rec->caplen = pf->snaplen[0];
+                if(rec->caplen > len - 16) rec->caplen = len - 16;
+
+                // Simple packet blocks carry no timestamp, reuse the previous one
+                rec->ts_ns = pf->last_ts;
+                rec->data = block + 12;
+                return 1;
+            default:
+                break;
+        }
+    }
+
+    return 0;
+
+malformed:
+    snprintf(error_msg, MAX_ERROR, "Capture file is malformed");
+    return -1;
+}
+
+// A new section resets the byte order and the interface list
+static int read_section(PCAP_FILE *pf, uint8_t *block, uint32_t len)
+{
+    uint32_t magic;
+
+    if(len < 28) return -1;
+    memcpy(&magic, block + 8, sizeof(magic));
+    if(magic == PCAPNG_BYTE_ORDER) {
+        pf->swapped = 0;
+    } else if(magic == __builtin_bswap32(PCAPNG_BYTE_ORDER)) {
+        pf->swapped = 1;
+    } else {
+        return -1;
+    }
+    pf->num_ifaces = 0;
+    return 1;
+}
+
+static int read_interface(PCAP_FILE *pf, uint8_t *block, uint32_t len)
+{
+    uint8_t *opt, *end;
+    uint16_t code, opt_len;
+    uint64_t ticks;
+    int i;
+
+    if(len < 20) return -1;
+    if(pf->num_ifaces == PCAP_MAX_IFACES) return 1;
+
+    i = pf->num_ifaces++;
+    pf->linktype[i] = rd16(pf, block + 8);
+    pf->snaplen[i] = rd32(pf, block + 12);
+    pf->ticks_per_sec[i] = 1000000;
+
+    // Only the timestamp resolution option matters to us
+    opt = block + 16;
+    end = block + len - 4;
+    while(opt + 4 <= end) {
+        code = rd16(pf, opt);
+        opt_len = rd16(pf, opt + 2);
+        if(code == 0 || opt + 4 + opt_len > end) break;
+        if(code == PCAPNG_OPT_TSRESOL && opt_len >= 1) {
+            ticks = 1;
+            if(opt[4] & 0x80) {
+                for(int n = 0; n < (opt[4] & 0x7f) && n < 63; ++n) ticks *= 2;
+            } else {
+                for(int n = 0; n < opt[4] && n < 19; ++n) ticks *= 10;
+            }
+            pf->ticks_per_sec[i] = ticks;
+        }
+        opt += 4 + ((opt_len + 3) & ~3);
+    }
+
+    return 1;
+}
@@ -0,0 +1,308 @@
+#include "pcapwriter.h"
+#include "pcapfile.h"
+#include "errors.h"
+#include "ui.h"
+#include "clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+static void *writer_thread(void *arg);
+static void write_batches(PCAP_WRITER *pw, PCAP_BATCH *head);
+static size_t split_point(PCAP_WRITER *pw, PCAP_BATCH *b, size_t off, size_t pending);
+static int write_iov(PCAP_WRITER *pw, struct iovec *iov, int count, char *error);
+static int open_file(PCAP_WRITER *pw, char *error);
+static int rotate_due(PCAP_WRITER *pw);
+static void queue_batch(PCAP_WRITER *pw, PCAP_BATCH *batch);
+
+// Opens the first output file and starts the writer thread, returns NULL and sets
+// error_msg on failure
+PCAP_WRITER *pcap_writer_open(const char *prefix, unsigned int snaplen,
+        unsigned long rotate_bytes, unsigned int rotate_secs)
+{
+    PCAP_WRITER *pw;
+
+    pw = (PCAP_WRITER *)malloc(sizeof(PCAP_WRITER));
+    memset(pw, 0, sizeof(PCAP_WRITER));
+    pw->prefix = strdup(prefix);
+    pw->snaplen = snaplen;
+    pw->rotate_bytes = rotate_bytes;
+    pw->rotate_secs = rotate_secs;
+    pw->fd = -1;
+    if(open_file(pw, error_msg) == -1) {
+        free(pw->prefix);
+        free(pw);
+        return NULL;
+    }
+
+    // Every batch is allocated up front, the capture path never calls malloc
+    pw->batches = (PCAP_BATCH *)malloc(WRITER_BATCH_COUNT * sizeof(PCAP_BATCH));
+    for(int i = 0; i < WRITER_BATCH_COUNT; ++i) {
+        pw->batches[i].data = (uint8_t *)malloc(WRITER_BATCH_SIZE);
+        pw->batches[i].next = pw->free;
+        pw->free = &pw->batches[i];
+    }
+
+    pthread_mutex_init(&pw->lock, NULL);
+    pthread_cond_init(&pw->ready, NULL);
+    pthread_create(&pw->thread, NULL, writer_thread, pw);
+    return pw;
+}
+
+// Appends a frame to the producer's batch, queueing it once full. Returns -1 if
+// no batch was free and the frame was dropped
+int pcap_writer_write(PCAP_WRITER *pw, PCAP_BATCH **batch, const uint8_t *frame,
+        uint32_t len, uint32_t wire_len, uint64_t ts_ns)
+{
+    PCAP_BATCH *b;
+    uint32_t hdr[4];
+
+    if(len > pw->snaplen) len = pw->snaplen;
+
+    b = *batch;
+    if(b && b->len + PCAP_REC_HDR_LEN + len > WRITER_BATCH_SIZE) {
+        queue_batch(pw, b);
+        b = *batch = NULL;
+    }
+    if(!b) {
+        pthread_mutex_lock(&pw->lock);
+        if((b = pw->free)) pw->free = b->next;
+        pthread_mutex_unlock(&pw->lock);
+        if(!b) {
+            __atomic_add_fetch(&pw->dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        b->len = 0;
+        b->frames = 0;
+        b->opened_ns = monotonic_ns();
+        *batch = b;
+    }
+
+    hdr[0] = ts_ns / 1000000000ULL;
+    hdr[1] = ts_ns % 1000000000ULL;
+    hdr[2] = len;
+    hdr[3] = wire_len;
+    memcpy(b->data + b->len, hdr, PCAP_REC_HDR_LEN);
+    memcpy(b->data + b->len + PCAP_REC_HDR_LEN, frame, len);
+    b->len += PCAP_REC_HDR_LEN + len;
+    ++b->frames;
+    return 1;
+}
+
+// Queues the producer's batch once it has been held for WRITER_FLUSH_MS, so quiet
+// links still reach the disk promptly
+void pcap_writer_flush(PCAP_WRITER *pw, PCAP_BATCH **batch, int force)
+{
+    if(!*batch) return;
+    if(!force && monotonic_ns() - (*batch)->opened_ns < WRITER_FLUSH_MS * 1000000ULL) return;
+    queue_batch(pw, *batch);
+    *batch = NULL;
+}
+
+// Writes everything queued, stops the writer thread, closes the file and frees the writer
+void pcap_writer_close(PCAP_WRITER *pw, unsigned long *written, unsigned long *dropped)
+{
+    pthread_mutex_lock(&pw->lock);
+    pw->closing = 1;
+    pthread_cond_signal(&pw->ready);
+    pthread_mutex_unlock(&pw->lock);
+    pthread_join(pw->thread, NULL);
+
+    if(pw->fd != -1) close(pw->fd);
+    for(int i = 0; i < WRITER_BATCH_COUNT; ++i) free(pw->batches[i].data);
+    free(pw->batches);
+    pthread_mutex_destroy(&pw->lock);
+    pthread_cond_destroy(&pw->ready);
+    *written = pw->written;
+    *dropped = pw->dropped;
+    free(pw->prefix);
+    free(pw);
+}
+
+static void queue_batch(PCAP_WRITER *pw, PCAP_BATCH *batch)
+{
+    batch->next = NULL;
+    pthread_mutex_lock(&pw->lock);
+    if(pw->queue_tail) {
+        pw->queue_tail->next = batch;
+    } else {
+        pw->queue = batch;
+    }
+    pw->queue_tail = batch;
+    pthread_cond_signal(&pw->ready);
+    pthread_mutex_unlock(&pw->lock);
+}
+
+// Takes everything queued at once, writes it out, then returns the batches to the free list
+static void *writer_thread(void *arg)
+{
+    PCAP_WRITER *pw;
+    PCAP_BATCH *head, *b;
+
+    pw = (PCAP_WRITER *)arg;
+    pthread_mutex_lock(&pw->lock);
+    for(;;) {
+        while(!pw->queue && !pw->closing) pthread_cond_wait(&pw->ready, &pw->lock);
+        if(!pw->queue) break;
+
+        head = pw->queue;
+        pw->queue = pw->queue_tail = NULL;
+        pthread_mutex_unlock(&pw->lock);
+
+        write_batches(pw, head);
+
+        pthread_mutex_lock(&pw->lock);
+        while(head) {
+            b = head->next;
+            head->next = pw->free;
+            pw->free = head;
+            head = b;
+        }
+    }
+    pthread_mutex_unlock(&pw->lock);
+    return NULL;
+}
+
+// Writes a list of batches with as few writev calls as rotation allows, splitting
+// a batch at a record boundary where it crosses a size rotation
+static void write_batches(PCAP_WRITER *pw, PCAP_BATCH *head)
+{
+    struct iovec iov[WRITER_IOV_MAX];
+    char error[MAX_ERROR];
+    PCAP_BATCH *b;
+    size_t off, end, pending;
+    unsigned long frames = 0;
+    int n = 0;
+
+    for(b = head; b; b = b->next) frames += b->frames;
+    if(pw->failed) goto dropped;
+    if(rotate_due(pw) && open_file(pw, error) == -1) goto failed;
+
+    pending = pw->file_bytes;
+    for(b = head; b; b = b->next) {
+        for(off = 0; off < b->len; off = end) {
+            if((end = split_point(pw, b, off, pending)) == off) {
+                // The file is full, finish it and carry on in the next one
+                if(write_iov(pw, iov, n, error) == -1 || open_file(pw, error) == -1) goto failed;
+                n = 0;
+                pending = pw->file_bytes;
+                continue;
+            }
+            if(n == WRITER_IOV_MAX) {
+                if(write_iov(pw, iov, n, error) == -1) goto failed;
+                n = 0;
+            }
+            iov[n].iov_base = b->data + off;
+            iov[n++].iov_len = end - off;
+            pending += end - off;
+        }
+    }
+    if(write_iov(pw, iov, n, error) == -1) goto failed;
+
+    __atomic_add_fetch(&pw->written, frames, __ATOMIC_RELAXED);
+    return;
+
+    // Once the disk fails every later frame is dropped, including any of this list already written
+failed:
+    pw->failed = 1;
+    ui_display_error(error);
+dropped:
+    __atomic_add_fetch(&pw->dropped, frames, __ATOMIC_RELAXED);
+}
+
+// Returns the end of the records from off that still fit in the current file, which
+// always takes at least one record
+static size_t split_point(PCAP_WRITER *pw, PCAP_BATCH *b, size_t off, size_t pending)
+{
+    size_t end;
+    uint32_t caplen;
+
+    if(!pw->rotate_bytes) return b->len;
+
+    for(end = off; end < b->len; end += PCAP_REC_HDR_LEN + caplen) {
+        memcpy(&caplen, b->data + end + 8, sizeof(caplen));
+        if(pending + (end - off) + PCAP_REC_HDR_LEN + caplen > pw->rotate_bytes &&
+                (pending > PCAP_FILE_HDR_LEN || end > off)) break;
+    }
+    return end;
+}
+
+// Carries on after short writes until every vector is out, returns -1 and sets error on failure
+static int write_iov(PCAP_WRITER *pw, struct iovec *iov, int count, char *error)
+{
+    ssize_t n;
+
+    while(count > 0) {
+        if((n = writev(pw->fd, iov, count)) == -1) {
+            if(errno == EINTR) continue;
+            snprintf(error, MAX_ERROR, "Unable to write capture file: %s", strerror(errno));
+            return -1;
+        }
+        pw->file_bytes += n;
+        while(count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if(count > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 1;
+}
+
+// Time based rotation, a file is only rotated once it holds at least one record
+static int rotate_due(PCAP_WRITER *pw)
+{
+    if(pw->file_bytes <= PCAP_FILE_HDR_LEN) return 0;
+    if(pw->rotate_secs && monotonic_ns() - pw->file_opened_ns >= pw->rotate_secs * 1000000000ULL) return 1;
+    return 0;
+}
+
+// Closes the current file and starts the next one with a fresh pcap header. The writer
+// thread has its own error buffer, error_msg belongs to the main thread
+static int open_file(PCAP_WRITER *pw, char *error)
+{
+    char path[4096];
+    uint8_t hdr[PCAP_FILE_HDR_LEN];
+    uint32_t magic = PCAP_MAGIC_NSEC, zero = 0, snaplen = pw->snaplen, linktype = PCAP_LINKTYPE_ETHERNET;
+    uint16_t major = 2, minor = 4;
+
+    if(pw->fd != -1) {
+        close(pw->fd);
+        ++pw->file_index;
+    }
+
+    if(pw->rotate_bytes || pw->rotate_secs) {
+        snprintf(path, sizeof(path), "%s-%05u.pcap", pw->prefix, pw->file_index);
+    } else {
+        snprintf(path, sizeof(path), "%s", pw->prefix);
+    }
+    if((pw->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        snprintf(error, MAX_ERROR, "Unable to create capture file '%.200s'", path);
+        return -1;
+    }
+
+    // Written in our own byte order, readers tell from the magic
+    memcpy(hdr, &magic, 4);
+    memcpy(hdr + 4, &major, 2);
+    memcpy(hdr + 6, &minor, 2);
+    memcpy(hdr + 8, &zero, 4);
+    memcpy(hdr + 12, &zero, 4);
+    memcpy(hdr + 16, &snaplen, 4);
+    memcpy(hdr + 20, &linktype, 4);
+    if(write(pw->fd, hdr, PCAP_FILE_HDR_LEN) != PCAP_FILE_HDR_LEN) {
+        snprintf(error, MAX_ERROR, "Unable to write capture file '%.200s'", path);
+        return -1;
+    }
+
+    pw->file_bytes = PCAP_FILE_HDR_LEN;
+    pw->file_opened_ns = monotonic_ns();
+    return 1;
+}
@@ -2,39 +2,81 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 
-RATE_QUEUE *rate_queue_new(int size)
+const unsigned int rate_window_ms[RATE_WINDOWS] = { 100, 1000, 10000, 60000 };
+const char *rate_window_names[RATE_WINDOWS] = { "100ms", "1s", "10s", "60s" };
+
+// Where each class's totals live in NETMON_STATS
+static const size_t packet_fields[RATE_CLASSES] = {
+    offsetof(NETMON_STATS, packet_total), offsetof(NETMON_STATS, arp_total),
+    offsetof(NETMON_STATS, ip4_total), offsetof(NETMON_STATS, ip6_total),
+    offsetof(NETMON_STATS, netrans_total), offsetof(NETMON_STATS, igmp_total),
+    offsetof(NETMON_STATS, icmp_total), offsetof(NETMON_STATS, tcp_total),
+    offsetof(NETMON_STATS, udp_total)
+};
+static const size_t byte_fields[RATE_CLASSES] = {
+    offsetof(NETMON_STATS, byte_total), offsetof(NETMON_STATS, arp_bytes),
+    offsetof(NETMON_STATS, ip4_bytes), offsetof(NETMON_STATS, ip6_bytes),
+    offsetof(NETMON_STATS, netrans_bytes), offsetof(NETMON_STATS, igmp_bytes),
+    offsetof(NETMON_STATS, icmp_bytes), offsetof(NETMON_STATS, tcp_bytes),
+    offsetof(NETMON_STATS, udp_bytes)
+};
+
+// The queue holds one block more than the longest window has ticks, so the block
+// that window starts at is still there
+RATE_QUEUE *rate_queue_new(unsigned int tick_ms)
 {
     RATE_QUEUE *q;
 
     q = (RATE_QUEUE *)malloc(sizeof(RATE_QUEUE));
-    q->blocks = (TIME_BLOCK **)malloc(size * sizeof(TIME_BLOCK *));
-    for(int i = 0; i < size; ++i) q->blocks[i] = time_block_new();
+    q->tick_ms = tick_ms;
+    q->capacity = rate_window_ms[RATE_WINDOWS - 1] / tick_ms + 1;
+    q->blocks = (TIME_BLOCK *)malloc(q->capacity * sizeof(TIME_BLOCK));
+    memset(q->blocks, 0, q->capacity * sizeof(TIME_BLOCK));
     q->pos = 0;
-    q->capacity = size;
+    q->len = 0;
     return q;
 }
 
-TIME_BLOCK *time_block_new()
+void rate_queue_push(RATE_QUEUE *q, NETMON_STATS *totals, uint64_t now_ns)
 {
     TIME_BLOCK *tb;
 
-    tb = (TIME_BLOCK *)malloc(sizeof(TIME_BLOCK));
-    memset(tb, 0, sizeof(TIME_BLOCK));
-    return tb;
-}
+    tb = &q->blocks[q->pos];
+    tb->ns = now_ns;
+    for(int c = 0; c < RATE_CLASSES; ++c) {
+        tb->packets[c] = *(unsigned long *)((char *)totals + packet_fields[c]);
+        tb->bytes[c] = *(unsigned long *)((char *)totals + byte_fields[c]);
+    }
 
-void time_block_init(TIME_BLOCK *tb, time_t start_time)
-{
-    memset(tb, 0, sizeof(TIME_BLOCK));
-    tb->start_time = start_time;
+    if(++q->pos == q->capacity) q->pos = 0;
+    if(q->len < q->capacity) q->len++;
 }
 
-TIME_BLOCK *time_block_next(RATE_QUEUE *q)
+// Ticks are not exact, a late one makes its window a little longer, so rates are
+// taken over the time the blocks say passed rather than the window's nominal length
+void rate_queue_rates(RATE_QUEUE *q, RATE *rates)
 {
-    TIME_BLOCK *tb;
+    TIME_BLOCK *newest, *start;
+    double secs;
+    int ticks;
+
+    memset(rates, 0, RATE_WINDOWS * sizeof(RATE));
+    if(q->len < 2) return;
+
+    newest = &q->blocks[(q->pos + q->capacity - 1) % q->capacity];
+    for(int w = 0; w < RATE_WINDOWS; ++w) {
+        ticks = rate_window_ms[w] / q->tick_ms;
+        if(ticks < 1) ticks = 1;
+        if(ticks > q->len - 1) ticks = q->len - 1;
+        start = &q->blocks[(q->pos + q->capacity - 1 - ticks) % q->capacity];
+        if(newest->ns <= start->ns) continue;
 
-    tb = q->blocks[q->pos++];
-    if(q->pos >= q->capacity) q->pos = 0;
-    return tb;
+        secs = (newest->ns - start->ns) / 1e9;
+        for(int c = 0; c < RATE_CLASSES; ++c) {
+            rates[w].bps[c] = (newest->bytes[c] - start->bytes[c]) * 8 / secs;
+            rates[w].pps[c] = (newest->packets[c] - start->packets[c]) / secs;
+        }
+    }
 }
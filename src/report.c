@@ -0,0 +1,378 @@
+#include "report.h"
+#include "errors.h"
+#include "addrset.h"
+#include "clock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+static int write_rates(REPORT *r, int len, RATE *rates);
+static int write_timing(REPORT *r, int len, TIMING_STATS *timing);
+static int write_sessions(REPORT *r, int len, NETRANS_SUMMARY *sessions);
+static int write_kernel(REPORT *r, int len, CAPTURE_STATS *kernel);
+static int write_queues(REPORT *r, int len, SPSC_STATS *queues);
+static int write_flows(REPORT *r, int len, FLOW_SUMMARY *flows);
+static int write_hosts(REPORT *r, int len, HOST_SUMMARY *hosts);
+static void format_host(HOST_KEY *key, char *buffer);
+static void format_mac(uint8_t *mac, char *buffer);
+static int write_buffer(REPORT *r, size_t len);
+
+// Opens path for appending, or stdout when path is NULL, and writes the CSV header
+// unless the file already has one
+REPORT *report_open(const char *path, int format)
+{
+    REPORT *r;
+    int len;
+
+    r = (REPORT *)malloc(sizeof(REPORT));
+    memset(r, 0, sizeof(REPORT));
+    r->format = format;
+    r->last_ns = monotonic_ns();
+
+    if(!path) {
+        r->fd = STDOUT_FILENO;
+    } else if((r->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1) {
+        snprintf(error_msg, MAX_ERROR, "Unable to open report file '%.200s'", path);
+        free(r);
+        return NULL;
+    }
+
+    // A file being appended to already has its header
+    if(format == REPORT_CSV && (r->fd == STDOUT_FILENO || lseek(r->fd, 0, SEEK_END) == 0)) {
+        len = snprintf(r->buffer, REPORT_BUFFER_SIZE,
+                "time,interval,packets,bytes,packets_per_sec,bytes_per_sec,"
+                "ip4,ip6,arp,netrans,icmp,igmp,tcp,udp,arp_request,arp_reply,"
+                "netrans_send,netrans_receive,netrans_ack,netrans_chunk,"
+                "ip_addrs,mac_addrs,new_ip_addrs,new_mac_addrs,"
+                "distinct_mac,distinct_ip4_src,distinct_ip4_dst,distinct_ip6_src,distinct_ip6_dst,"
+                "window_mac,window_ip4_src,window_ip4_dst,window_ip6_src,window_ip6_dst,"
+                "flows_active,flows_evicted,flows_expired,"
+                "bps_100ms,pps_100ms,bps_1s,pps_1s,bps_10s,pps_10s,bps_60s,pps_60s,"
+                "arp_bps,arp_pps,ip4_bps,ip4_pps,ip6_bps,ip6_pps,netrans_bps,netrans_pps,"
+                "igmp_bps,igmp_pps,icmp_bps,icmp_pps,tcp_bps,tcp_pps,udp_bps,udp_pps,"
+                "gap_samples,gap_p50_ns,gap_p99_ns,gap_p999_ns,gap_max_ns,"
+                "arp_gap_samples,arp_gap_p50_ns,arp_gap_p99_ns,arp_gap_p999_ns,arp_gap_max_ns,"
+                "ip4_gap_samples,ip4_gap_p50_ns,ip4_gap_p99_ns,ip4_gap_p999_ns,ip4_gap_max_ns,"
+                "ip6_gap_samples,ip6_gap_p50_ns,ip6_gap_p99_ns,ip6_gap_p999_ns,ip6_gap_max_ns,"
+                "netrans_gap_samples,netrans_gap_p50_ns,netrans_gap_p99_ns,netrans_gap_p999_ns,netrans_gap_max_ns,"
+                "bursts,burst_frames,burst_max,sessions_active,sessions_evicted,sessions_expired,"
+                "queue_slots,queue_depth,queue_high_water,queue_overflows,"
+                "kernel_packets,kernel_drops,kernel_freezes,new_kernel_drops,new_kernel_freezes,vlan_tagged,"
+                "shed,sample_ratio,hosts_active,hosts_evicted,timing_workers\n");
+        if(write_buffer(r, len) == -1) {
+            report_close(r);
+            return NULL;
+        }
+    }
+
+    return r;
+}
+
+// Writes one record, the counters are running totals and the rates and new
+// address counts cover the time since the previous record
+int report_write(REPORT *r, NETMON_STATS *totals, unsigned long ip_addrs, unsigned long mac_addrs,
+        HLL_ESTIMATE *distinct, TIMING_STATS *timing, RATE *rates, NETRANS_SUMMARY *sessions,
+        CAPTURE_STATS *kernel, SPSC_STATS *queues, FLOW_SUMMARY *flows, HOST_SUMMARY *hosts, unsigned int sample)
+{
+    TIMING_PERCENTILES *p;
+    struct timespec now;
+    uint64_t now_ns;
+    double interval, pps, bps;
+    int len;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    now_ns = monotonic_ns();
+    interval = (now_ns - r->last_ns) / 1e9;
+    pps = interval > 0 ? (totals->packet_total - r->last.packet_total) / interval : 0.0;
+    bps = interval > 0 ? (totals->byte_total - r->last.byte_total) / interval : 0.0;
+
+    if(r->format == REPORT_JSON) {
+        len = snprintf(r->buffer, REPORT_BUFFER_SIZE,
+                "{\"time\":%ld.%03ld,\"interval\":%.3f,\"packets\":%lu,\"bytes\":%lu,"
+                "\"packets_per_sec\":%.1f,\"bytes_per_sec\":%.1f,"
+                "\"ethertype\":{\"ip4\":%lu,\"ip6\":%lu,\"arp\":%lu,\"netrans\":%lu},\"vlan_tagged\":%lu,"
+                "\"shed\":%lu,\"sample_ratio\":%u,"
+                "\"ip_protocol\":{\"icmp\":%lu,\"igmp\":%lu,\"tcp\":%lu,\"udp\":%lu},"
+                "\"arp\":{\"request\":%lu,\"reply\":%lu},"
+                "\"netrans\":{\"send\":%lu,\"receive\":%lu,\"ack\":%lu,\"chunk\":%lu},"
+                "\"addresses\":{\"ip\":%lu,\"mac\":%lu,\"new_ip\":%lu,\"new_mac\":%lu}",
+                (long)now.tv_sec, now.tv_nsec / 1000000, interval, totals->packet_total, totals->byte_total,
+                pps, bps,
+                totals->ip4_total, totals->ip6_total, totals->arp_total, totals->netrans_total, totals->vlan_total,
+                totals->shed_total, sample,
+                totals->icmp_total, totals->igmp_total, totals->tcp_total, totals->udp_total,
+                totals->request_total, totals->reply_total,
+                totals->send_total, totals->receive_total, totals->ack_total, totals->chunk_total,
+                ip_addrs, mac_addrs, ip_addrs - r->last_ip_addrs, mac_addrs - r->last_mac_addrs);
+        len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len,
+                ",\"distinct\":{\"mac\":%.0f,\"ip4_src\":%.0f,\"ip4_dst\":%.0f,\"ip6_src\":%.0f,\"ip6_dst\":%.0f,"
+                "\"window\":{\"mac\":%.0f,\"ip4_src\":%.0f,\"ip4_dst\":%.0f,\"ip6_src\":%.0f,\"ip6_dst\":%.0f}}",
+                distinct->total[HLL_MAC], distinct->total[HLL_IP4_SRC], distinct->total[HLL_IP4_DST],
+                distinct->total[HLL_IP6_SRC], distinct->total[HLL_IP6_DST],
+                distinct->window[HLL_MAC], distinct->window[HLL_IP4_SRC], distinct->window[HLL_IP4_DST],
+                distinct->window[HLL_IP6_SRC], distinct->window[HLL_IP6_DST]);
+        len = write_rates(r, len, rates);
+        len = write_timing(r, len, timing);
+        len = write_sessions(r, len, sessions);
+        len = write_kernel(r, len, kernel);
+        len = write_queues(r, len, queues);
+        len = write_flows(r, len, flows);
+        len = write_hosts(r, len, hosts);
+        len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "}\n");
+    } else {
+        len = snprintf(r->buffer, REPORT_BUFFER_SIZE,
+                "%ld.%03ld,%.3f,%lu,%lu,%.1f,%.1f,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,",
+                (long)now.tv_sec, now.tv_nsec / 1000000, interval, totals->packet_total, totals->byte_total,
+                pps, bps,
+                totals->ip4_total, totals->ip6_total, totals->arp_total, totals->netrans_total,
+                totals->icmp_total, totals->igmp_total, totals->tcp_total, totals->udp_total,
+                totals->request_total, totals->reply_total,
+                totals->send_total, totals->receive_total, totals->ack_total, totals->chunk_total,
+                ip_addrs, mac_addrs, ip_addrs - r->last_ip_addrs, mac_addrs - r->last_mac_addrs);
+        len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,",
+                distinct->total[HLL_MAC], distinct->total[HLL_IP4_SRC], distinct->total[HLL_IP4_DST],
+                distinct->total[HLL_IP6_SRC], distinct->total[HLL_IP6_DST],
+                distinct->window[HLL_MAC], distinct->window[HLL_IP4_SRC], distinct->window[HLL_IP4_DST],
+                distinct->window[HLL_IP6_SRC], distinct->window[HLL_IP6_DST]);
+        // Flow columns are left empty when flows are not tracked
+        if(flows) {
+            len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "%lu,%lu,%lu,",
+                    flows->active, flows->evicted, flows->expired);
+        } else {
+            len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, ",,,");
+        }
+
+        // Every window for all traffic, then each class over a second
+        for(int w = 0; w < RATE_WINDOWS; ++w)
+            len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "%.0f,%.1f,",
+                    rates[w].bps[RATE_ALL], rates[w].pps[RATE_ALL]);
+        for(int c = RATE_ALL + 1; c < RATE_CLASSES; ++c)
+            len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "%.0f,%.1f,",
+                    rates[RATE_1S].bps[c], rates[RATE_1S].pps[c]);
+
+        for(int c = 0; c < TIMING_CLASSES; ++c) {
+            p = &timing->gaps[c];
+            len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "%lu,%lu,%lu,%lu,%lu,",
+                    p->samples, (unsigned long)p->p50, (unsigned long)p->p99, (unsigned long)p->p999,
+                    (unsigned long)p->max);
+        }
+        len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "%lu,%lu,%lu,%lu,%lu,%lu,",
+                timing->bursts, timing->burst_frames, timing->burst_max,
+                sessions->active, sessions->evicted, sessions->expired);
+
+        // As are the queue columns when frames are decoded where they are captured
+        if(queues) {
+            len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "%lu,%lu,%lu,%lu,",
+                    queues->slots, queues->depth, queues->high_water, queues->overflows);
+        } else {
+            len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, ",,,,");
+        }
+
+        // And the kernel columns when replaying
+        if(kernel) {
+            len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "%lu,%lu,%lu,%lu,%lu,",
+                    kernel->packets, kernel->drops, kernel->freezes,
+                    kernel->drops - r->last_kernel.drops, kernel->freezes - r->last_kernel.freezes);
+        } else {
+            len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, ",,,,,");
+        }
+        len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "%lu,%lu,%u,%lu,%lu,%u\n", totals->vlan_total,
+                totals->shed_total, sample, hosts->active, hosts->evicted, timing->workers);
+    }
+
+    r->last = *totals;
+    r->last_ip_addrs = ip_addrs;
+    r->last_mac_addrs = mac_addrs;
+    if(kernel) r->last_kernel = *kernel;
+    r->last_ns = now_ns;
+    return write_buffer(r, len);
+}
+
+// Appends the rates of every class over every window
+static int write_rates(REPORT *r, int len, RATE *rates)
+{
+    static const char *classes[RATE_CLASSES] = { "all", "arp", "ip4", "ip6", "netrans", "igmp", "icmp", "tcp", "udp" };
+
+    len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, ",\"rates\":{");
+    for(int w = 0; w < RATE_WINDOWS; ++w) {
+        len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "%s\"%s\":{", w ? "," : "", rate_window_names[w]);
+        for(int c = 0; c < RATE_CLASSES; ++c)
+            len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "%s\"%s\":{\"bps\":%.0f,\"pps\":%.1f}",
+                    c ? "," : "", classes[c], rates[w].bps[c], rates[w].pps[c]);
+        len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "}");
+    }
+    len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "}");
+    return len;
+}
+
+// Appends the gap percentiles over the interval, in nanoseconds, and the running burst counts.
+// Each worker times only the frames fanned out to it, workers says how many were merged
+static int write_timing(REPORT *r, int len, TIMING_STATS *timing)
+{
+    static const char *classes[TIMING_CLASSES] = { "all", "arp", "ip4", "ip6", "netrans" };
+    TIMING_PERCENTILES *p;
+
+    len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, ",\"gaps\":{\"workers\":%u", timing->workers);
+    for(int c = 0; c < TIMING_CLASSES; ++c) {
+        p = &timing->gaps[c];
+        len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len,
+                ",\"%s\":{\"samples\":%lu,\"p50\":%lu,\"p99\":%lu,\"p999\":%lu,\"max\":%lu}",
+                classes[c], p->samples, (unsigned long)p->p50, (unsigned long)p->p99,
+                (unsigned long)p->p999, (unsigned long)p->max);
+    }
+    len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len,
+            "},\"bursts\":{\"packets\":%u,\"usecs\":%u,\"count\":%lu,\"frames\":%lu,\"largest\":%lu}",
+            timing->burst_packets, timing->burst_usecs, timing->bursts, timing->burst_frames, timing->burst_max);
+    return len;
+}
+
+// Appends the session totals and the busiest sessions, sender first once a chunk has
+// been seen. Goodput is over the time between the first and latest chunk
+static int write_sessions(REPORT *r, int len, NETRANS_SUMMARY *sessions)
+{
+    char a[18], b[18];
+    NETRANS_SESSION *s;
+    uint64_t span;
+    int first;
+
+    len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len,
+            ",\"sessions\":{\"active\":%lu,\"evicted\":%lu,\"expired\":%lu,\"top\":[",
+            sessions->active, sessions->evicted, sessions->expired);
+    for(int i = 0; i < sessions->len && i < REPORT_TOP_SESSIONS; ++i) {
+        s = &sessions->sessions[i];
+        first = s->chunks ? s->sender : 0;
+        format_mac(s->key.mac[first], a);
+        format_mac(s->key.mac[!first], b);
+        span = s->chunk_last_ns - s->chunk_first_ns;
+        len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len,
+                "%s{\"sender\":\"%s\",\"sender_id\":%u,\"receiver\":\"%s\",\"receiver_id\":%u,"
+                "\"frames\":%lu,\"bytes\":%lu,\"chunks\":%lu,\"chunk_bytes\":%lu,\"goodput\":%lu,"
+                "\"goodput_bps\":%.0f,\"duplicates\":%lu,\"reordered\":%lu,\"acks\":%lu,"
+                "\"ack_samples\":%lu,\"ack_avg_ns\":%lu,\"ack_max_ns\":%lu}",
+                i ? "," : "", a, s->key.id[first], b, s->key.id[!first],
+                s->frames, s->bytes, s->chunks, s->chunk_bytes, s->goodput,
+                span ? s->goodput * 8 / (span / 1e9) : 0.0, s->duplicates, s->reordered, s->acks,
+                s->acked, s->acked ? (unsigned long)(s->ack_total_ns / s->acked) : 0UL, (unsigned long)s->ack_max_ns);
+    }
+    len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "]}");
+    return len;
+}
+
+// Appends what the kernel counted on the capture sockets, frames it dropped never
+// reached any other counter in the record
+static int write_kernel(REPORT *r, int len, CAPTURE_STATS *kernel)
+{
+    if(kernel)
+        len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len,
+                ",\"kernel\":{\"packets\":%lu,\"drops\":%lu,\"freezes\":%lu,\"new_drops\":%lu,\"new_freezes\":%lu}",
+                kernel->packets, kernel->drops, kernel->freezes,
+                kernel->drops - r->last_kernel.drops, kernel->freezes - r->last_kernel.freezes);
+    return len;
+}
+
+// Appends the occupancy of the queues between capture and decode threads, if any
+static int write_queues(REPORT *r, int len, SPSC_STATS *queues)
+{
+    if(queues)
+        len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len,
+                ",\"queue\":{\"slots\":%lu,\"depth\":%lu,\"high_water\":%lu,\"overflows\":%lu}",
+                queues->slots, queues->depth, queues->high_water, queues->overflows);
+    return len;
+}
+
+// Appends the flow totals and the busiest flows
+static int write_flows(REPORT *r, int len, FLOW_SUMMARY *flows)
+{
+    char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+    FLOW_ENTRY *f;
+    int af;
+
+    if(flows) {
+        len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len,
+                ",\"flows\":{\"active\":%lu,\"evicted\":%lu,\"expired\":%lu,\"top\":[",
+                flows->active, flows->evicted, flows->expired);
+        for(int i = 0; i < flows->len && i < REPORT_TOP_FLOWS; ++i) {
+            f = &flows->flows[i];
+            af = f->key.family == ADDR_IP6 ? AF_INET6 : AF_INET;
+            inet_ntop(af, f->key.src, src, sizeof(src));
+            inet_ntop(af, f->key.dst, dst, sizeof(dst));
+            len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len,
+                    "%s{\"proto\":%u,\"src\":\"%s\",\"sport\":%u,\"dst\":\"%s\",\"dport\":%u,"
+                    "\"packets\":%lu,\"bytes\":%lu}",
+                    i ? "," : "", f->key.proto, src, f->key.sport, dst, f->key.dport, f->packets, f->bytes);
+        }
+        len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "]}");
+    }
+    return len;
+}
+
+// Appends the host totals and the addresses of each kind with the most bytes, with
+// the first and last time they were seen
+static int write_hosts(REPORT *r, int len, HOST_SUMMARY *hosts)
+{
+    static const char *kinds[HOST_KINDS] = { "mac", "ip" };
+    char addr[INET6_ADDRSTRLEN];
+    HOST_ENTRY *h;
+
+    len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, ",\"hosts\":{\"active\":%lu,\"evicted\":%lu",
+            hosts->active, hosts->evicted);
+    for(int k = 0; k < HOST_KINDS; ++k) {
+        len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, ",\"%s\":[", kinds[k]);
+        for(int i = 0; i < hosts->len[k][HOST_BY_BYTES] && i < REPORT_TOP_HOSTS; ++i) {
+            h = &hosts->top[k][HOST_BY_BYTES][i];
+            format_host(&h->key, addr);
+            len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len,
+                    "%s{\"addr\":\"%s\",\"tx_packets\":%lu,\"rx_packets\":%lu,\"tx_bytes\":%lu,\"rx_bytes\":%lu,"
+                    "\"first_seen\":%.3f,\"last_seen\":%.3f}",
+                    i ? "," : "", addr, h->tx_packets, h->rx_packets, h->tx_bytes, h->rx_bytes,
+                    h->first_ns / 1e9, h->last_ns / 1e9);
+        }
+        len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "]");
+    }
+    len += snprintf(r->buffer + len, REPORT_BUFFER_SIZE - len, "}");
+    return len;
+}
+
+static void format_host(HOST_KEY *key, char *buffer)
+{
+    if(key->family == ADDR_MAC) {
+        format_mac(key->addr, buffer);
+    } else {
+        inet_ntop(key->family == ADDR_IP6 ? AF_INET6 : AF_INET, key->addr, buffer, INET6_ADDRSTRLEN);
+    }
+}
+
+static void format_mac(uint8_t *mac, char *buffer)
+{
+    sprintf(buffer, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+void report_close(REPORT *r)
+{
+    if(r->fd != STDOUT_FILENO) close(r->fd);
+    free(r);
+}
+
+// A record is written whole or not at all as far as the caller is concerned
+static int write_buffer(REPORT *r, size_t len)
+{
+    ssize_t n;
+    size_t off = 0;
+
+    if(len >= REPORT_BUFFER_SIZE) len = REPORT_BUFFER_SIZE - 1;
+    while(off < len) {
+        if((n = write(r->fd, r->buffer + off, len - off)) == -1) {
+            if(errno == EINTR) continue;
+            snprintf(error_msg, MAX_ERROR, "Unable to write report: %s", strerror(errno));
+            return -1;
+        }
+        off += n;
+    }
+    return 1;
+}
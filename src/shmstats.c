@@ -0,0 +1,144 @@
+#include "shmstats.h"
+#include "errors.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHM_BODY offsetof(SHM_STATS, updated_ns) // Where the part written under the seqlock starts
+
+// Creates the segment, readable by everyone, replacing any left by an earlier run
+SHM_WRITER *shm_stats_create(const char *name)
+{
+    SHM_WRITER *w;
+    int fd;
+
+    if(name[0] != '/' || strchr(name + 1, '/') || strlen(name) > NAME_MAX) {
+        snprintf(error_msg, MAX_ERROR, "Shared memory name '%.150s' must be a '/' followed by a file name", name);
+        return NULL;
+    }
+
+    shm_unlink(name);
+    if((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) == -1) {
+        snprintf(error_msg, MAX_ERROR, "Unable to create shared memory '%.200s': %s", name, strerror(errno));
+        return NULL;
+    }
+    // shm_open's mode is masked by the umask, readers need the segment readable
+    fchmod(fd, 0644);
+
+    w = (SHM_WRITER *)malloc(sizeof(SHM_WRITER));
+    memset(w, 0, sizeof(SHM_WRITER));
+    if(ftruncate(fd, sizeof(SHM_STATS)) == -1 ||
+            (w->seg = mmap(NULL, sizeof(SHM_STATS), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        snprintf(error_msg, MAX_ERROR, "Unable to map shared memory '%.200s'", name);
+        close(fd);
+        shm_unlink(name);
+        free(w);
+        return NULL;
+    }
+    close(fd);
+
+    // A fresh segment is zeroed, the header is written once and never changes
+    w->name = strdup(name);
+    w->seg->version = SHM_STATS_VERSION;
+    w->seg->size = sizeof(SHM_STATS);
+    w->seg->pid = getpid();
+    __atomic_store_n(&w->seg->magic, SHM_STATS_MAGIC, __ATOMIC_RELEASE);
+    return w;
+}
+
+// An odd sequence number tells readers an update is underway, the fences keep the copy
+// between the two increments as far as a reader checking both is concerned
+void shm_stats_publish(SHM_WRITER *w)
+{
+    struct timespec now;
+    uint64_t seq;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    w->body.updated_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    w->body.updates++;
+
+    seq = w->seg->seq;
+    __atomic_store_n(&w->seg->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((char *)w->seg + SHM_BODY, (char *)&w->body + SHM_BODY, sizeof(SHM_STATS) - SHM_BODY);
+    __atomic_store_n(&w->seg->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void shm_stats_destroy(SHM_WRITER *w)
+{
+    munmap(w->seg, sizeof(SHM_STATS));
+    shm_unlink(w->name);
+    free(w->name);
+    free(w);
+}
+
+// Maps an existing segment read-only, a reader can never disturb the writer
+SHM_STATS *shm_stats_attach(const char *name)
+{
+    SHM_STATS *seg;
+    struct stat st;
+    int fd;
+
+    if((fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0)) == -1) {
+        snprintf(error_msg, MAX_ERROR, "Unable to open shared memory '%.200s': %s", name, strerror(errno));
+        return NULL;
+    }
+    if(fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(SHM_STATS)) {
+        snprintf(error_msg, MAX_ERROR, "Shared memory '%.200s' is not a netmon stats segment", name);
+        close(fd);
+        return NULL;
+    }
+    seg = mmap(NULL, sizeof(SHM_STATS), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(seg == MAP_FAILED) {
+        snprintf(error_msg, MAX_ERROR, "Unable to map shared memory '%.200s'", name);
+        return NULL;
+    }
+
+    if(__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != SHM_STATS_MAGIC || seg->version != SHM_STATS_VERSION ||
+            seg->size != sizeof(SHM_STATS)) {
+        snprintf(error_msg, MAX_ERROR, "Shared memory '%.200s' holds stats version %u, expected %u", name,
+                seg->version, SHM_STATS_VERSION);
+        munmap(seg, sizeof(SHM_STATS));
+        return NULL;
+    }
+    return seg;
+}
+
+// The copy is only kept if the sequence number was even and unchanged around it
+int shm_stats_read(SHM_STATS *seg, SHM_STATS *copy)
+{
+    uint64_t before, after;
+
+    for(int i = 0; i < SHM_READ_TRIES; ++i) {
+        before = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+        if(before & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(copy, seg, sizeof(SHM_STATS));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&seg->seq, __ATOMIC_RELAXED);
+        if(before == after) {
+            copy->seq = before;
+            return 1;
+        }
+    }
+    sprintf(error_msg, "Shared memory stats kept changing while being read");
+    return -1;
+}
+
+void shm_stats_detach(SHM_STATS *seg)
+{
+    munmap(seg, sizeof(SHM_STATS));
+}
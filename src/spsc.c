@@ -0,0 +1,185 @@
+#include "spsc.h"
+#include "stats.h"
+#include "errors.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+
+static int has_room(SPSC_RING *r, uint64_t start, int len);
+static void wake(SPSC_RING *r);
+
+// The slots and data are touched up front so the capture path never takes a page fault on them
+SPSC_RING *spsc_ring_new(uint32_t size, uint32_t snaplen)
+{
+    SPSC_RING *r;
+    size_t data_size;
+
+    if(size < 2 || size > MAX_SPSC_SLOTS || (size & (size - 1))) {
+        snprintf(error_msg, MAX_ERROR, "Queue of %u slots is not a power of two from 2 to %u", size, MAX_SPSC_SLOTS);
+        return NULL;
+    }
+
+    // Room for the slots' share of bytes, and never less than two of the longest frames
+    for(data_size = SPSC_LINE; data_size < (size_t)size * SPSC_FRAME_BYTES || data_size < (size_t)snaplen * 2;
+            data_size <<= 1);
+
+    if(!(r = (SPSC_RING *)aligned_alloc(SPSC_LINE, sizeof(SPSC_RING)))) {
+        snprintf(error_msg, MAX_ERROR, "Unable to allocate a queue of %u slots", size);
+        return NULL;
+    }
+    memset(r, 0, sizeof(SPSC_RING));
+    r->slots = (SPSC_SLOT *)aligned_alloc(SPSC_LINE, (size_t)size * sizeof(SPSC_SLOT));
+    r->data = (uint8_t *)aligned_alloc(SPSC_LINE, data_size);
+    if(!r->slots || !r->data) {
+        snprintf(error_msg, MAX_ERROR, "Unable to allocate a queue of %u slots", size);
+        free(r->slots);
+        free(r->data);
+        free(r);
+        return NULL;
+    }
+    memset(r->slots, 0, (size_t)size * sizeof(SPSC_SLOT));
+    memset(r->data, 0, data_size);
+    r->size = size;
+    r->mask = size - 1;
+    r->data_size = data_size;
+    r->max_len = snaplen;
+    if((r->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1) {
+        sprintf(error_msg, "Unable to create queue event");
+        free(r->slots);
+        free(r->data);
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+// Indices run freely and wrap, their difference is the number of slots in use. A frame's
+// bytes never wrap, one that would is placed at the start of data instead. Frames already
+// pushed are published before waiting, the consumer could not free any room otherwise
+void spsc_push(SPSC_RING *r, char *frame, int len, int wire_len, uint64_t ts_ns)
+{
+    SPSC_SLOT *slot;
+    uint64_t start;
+
+    if((uint32_t)len > r->max_len) len = r->max_len;
+    start = r->data_next;
+    if((start & (r->data_size - 1)) + len > r->data_size) start += r->data_size - (start & (r->data_size - 1));
+
+    if(!has_room(r, start, len)) {
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if(!has_room(r, start, len)) {
+            STAT_INC(r->overflows);
+            spsc_commit(r);
+            do {
+                sched_yield();
+                r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+            } while(!has_room(r, start, len));
+        }
+    }
+
+    slot = &r->slots[r->next & r->mask];
+    memcpy(r->data + (start & (r->data_size - 1)), frame, len);
+    slot->offset = start;
+    slot->len = len;
+    slot->wire_len = wire_len;
+    slot->ts_ns = ts_ns;
+    r->data_next = (start + len + SPSC_LINE - 1) & ~(uint64_t)(SPSC_LINE - 1);
+    r->next++;
+}
+
+// The high-water mark is taken against the consumer's current index, read once a batch
+void spsc_commit(SPSC_RING *r)
+{
+    if(r->next == r->head) return;
+    __atomic_store_n(&r->head, r->next, __ATOMIC_RELEASE);
+    r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if(r->next - r->tail_cache > r->high_water)
+        __atomic_store_n(&r->high_water, r->next - r->tail_cache, __ATOMIC_RELAXED);
+    wake(r);
+}
+
+void spsc_close(SPSC_RING *r)
+{
+    uint64_t one = 1;
+
+    spsc_commit(r);
+    __atomic_store_n(&r->closed, 1, __ATOMIC_RELEASE);
+    if(write(r->eventfd, &one, sizeof(one)) != sizeof(one)) return;
+}
+
+// The consumer's index is published once for the whole batch
+unsigned int spsc_drain(SPSC_RING *r, capture_handler handler, void *arg, unsigned int max)
+{
+    SPSC_SLOT *slot;
+    uint32_t tail;
+    unsigned int n = 0;
+
+    tail = r->tail;
+    if(r->head_cache == tail) r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    while(tail != r->head_cache && n < max) {
+        slot = &r->slots[tail & r->mask];
+        handler(arg, (char *)r->data + (slot->offset & (r->data_size - 1)), slot->len, slot->wire_len, slot->ts_ns);
+        tail++;
+        n++;
+    }
+    if(n) __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    return n;
+}
+
+// Either the consumer sees frames published before it armed, or the producer sees it
+// waiting after publishing, the fences on both sides rule out neither seeing the other
+int spsc_arm(SPSC_RING *r)
+{
+    __atomic_store_n(&r->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if(r->head_cache != r->tail || spsc_closed(r)) {
+        __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+    return 0;
+}
+
+int spsc_closed(SPSC_RING *r)
+{
+    return __atomic_load_n(&r->closed, __ATOMIC_ACQUIRE);
+}
+
+// The depth is only a sample, the tail is read first so the head is never behind it
+void spsc_stats_merge(SPSC_STATS *sum, SPSC_RING *r)
+{
+    unsigned long high_water;
+    uint32_t tail, head;
+
+    tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    sum->slots = r->size;
+    sum->depth += head - tail;
+    sum->overflows += __atomic_load_n(&r->overflows, __ATOMIC_RELAXED);
+    high_water = __atomic_load_n(&r->high_water, __ATOMIC_RELAXED);
+    if(high_water > sum->high_water) sum->high_water = high_water;
+}
+
+static void wake(SPSC_RING *r)
+{
+    uint64_t one = 1;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(!__atomic_load_n(&r->waiting, __ATOMIC_RELAXED)) return;
+    __atomic_store_n(&r->waiting, 0, __ATOMIC_RELAXED);
+    if(write(r->eventfd, &one, sizeof(one)) != sizeof(one)) return;
+}
+
+// Whether a slot is free and the bytes from start to the end of the frame would not
+// reach the oldest frame still queued. The consumer never writes the slots, so the
+// oldest one's offset holds still until the producer reuses it
+static int has_room(SPSC_RING *r, uint64_t start, int len)
+{
+    if(r->next - r->tail_cache == r->size) return 0;
+    if(r->next == r->tail_cache) return 1;
+    return start + len - r->slots[r->tail_cache & r->mask].offset <= r->data_size;
+}
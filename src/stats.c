@@ -0,0 +1,14 @@
+#include "stats.h"
+
+#include <stddef.h>
+
+// Adds every counter of src into dst
+void stats_merge(NETMON_STATS *dst, NETMON_STATS *src)
+{
+    unsigned long *d, *s;
+
+    d = (unsigned long *)dst;
+    s = (unsigned long *)src;
+    for(size_t i = 0; i < sizeof(NETMON_STATS) / sizeof(unsigned long); ++i)
+        d[i] += __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+}
@@ -0,0 +1,182 @@
+#include "table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t table_hash(TABLE *t, const void *key);
+static uint32_t table_find(TABLE *t, const void *key, uint32_t hash, uint32_t *slot);
+static void lru_unlink(TABLE *t, uint32_t e);
+static void lru_push(TABLE *t, uint32_t e);
+
+// Keeps the load factor of the index at or below one half
+uint32_t table_capacity(size_t max_bytes, size_t entry_size)
+{
+    size_t capacity;
+
+    for(capacity = 1; (capacity * 2) * entry_size + (capacity * 4) * sizeof(TABLE_SLOT) <= max_bytes; capacity *= 2);
+    if(capacity * entry_size + (capacity * 2) * sizeof(TABLE_SLOT) > max_bytes) return 0;
+    return capacity;
+}
+
+void table_init(TABLE *t, uint32_t capacity, size_t entry_size, size_t key_offset, size_t key_size)
+{
+    size_t slots = (size_t)capacity * 2;
+
+    memset(t, 0, sizeof(TABLE));
+    t->pool = (char *)malloc(capacity * entry_size);
+    t->slots = (TABLE_SLOT *)malloc(slots * sizeof(TABLE_SLOT));
+    t->entry_size = entry_size;
+    t->key_offset = key_offset;
+    t->key_size = key_size;
+    t->capacity = capacity;
+    t->mask = slots - 1;
+    t->head = t->tail = TABLE_NONE;
+
+    for(size_t i = 0; i < slots; ++i) t->slots[i].entry = TABLE_NONE;
+    for(uint32_t i = 0; i < capacity; ++i) TABLE_LINK_AT(t, i)->next = (i + 1 < capacity) ? i + 1 : TABLE_NONE;
+    t->free = 0;
+}
+
+void *table_get(TABLE *t, const void *key, int *added)
+{
+    TABLE_LINK *link;
+    uint32_t hash, e, slot;
+
+    hash = table_hash(t, key);
+    if((e = table_find(t, key, hash, &slot)) != TABLE_NONE) {
+        if(t->head != e) {
+            lru_unlink(t, e);
+            lru_push(t, e);
+        }
+        *added = 0;
+        return TABLE_ENTRY(t, e);
+    }
+
+    // Evicting may move index slots, so the empty one is found again
+    if(t->len == t->capacity) {
+        table_remove(t, t->tail);
+        t->evicted++;
+        table_find(t, key, hash, &slot);
+    }
+
+    e = t->free;
+    link = TABLE_LINK_AT(t, e);
+    t->free = link->next;
+    memset(link, 0, t->entry_size);
+    memcpy((char *)link + t->key_offset, key, t->key_size);
+    link->hash = hash;
+    t->slots[slot].hash = hash;
+    t->slots[slot].entry = e;
+    t->len++;
+    lru_push(t, e);
+    *added = 1;
+    return link;
+}
+
+void table_remove(TABLE *t, uint32_t e)
+{
+    uint32_t i, j, k;
+
+    for(i = TABLE_LINK_AT(t, e)->hash & t->mask; t->slots[i].entry != e; i = (i + 1) & t->mask);
+    for(j = i;;) {
+        j = (j + 1) & t->mask;
+        if(t->slots[j].entry == TABLE_NONE) break;
+
+        // A slot stays put if its home lies cyclically in (i, j]
+        k = t->slots[j].hash & t->mask;
+        if((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) continue;
+        t->slots[i] = t->slots[j];
+        i = j;
+    }
+    t->slots[i].entry = TABLE_NONE;
+
+    lru_unlink(t, e);
+    TABLE_LINK_AT(t, e)->next = t->free;
+    t->free = e;
+    t->len--;
+}
+
+void table_top_init(TABLE_TOP *top, void *items, int *len, int max, size_t size, table_compare compare)
+{
+    top->items = (char *)items;
+    top->len = len;
+    top->max = max;
+    top->size = size;
+    top->compare = compare;
+    table_top_rescan(top);
+}
+
+void table_top_insert(TABLE_TOP *top, const void *item)
+{
+    if(*top->len < top->max) {
+        memcpy(top->items + (size_t)(*top->len)++ * top->size, item, top->size);
+        if(*top->len == top->max) table_top_rescan(top);
+    } else if(top->compare(item, top->items + (size_t)top->min * top->size) < 0) {
+        memcpy(top->items + (size_t)top->min * top->size, item, top->size);
+        table_top_rescan(top);
+    }
+}
+
+void table_top_rescan(TABLE_TOP *top)
+{
+    top->min = 0;
+    for(int i = 1; i < *top->len; ++i)
+        if(top->compare(top->items + (size_t)i * top->size, top->items + (size_t)top->min * top->size) > 0) top->min = i;
+}
+
+// Mixes the key a word at a time
+static uint32_t table_hash(TABLE *t, const void *key)
+{
+    uint64_t word, h = 0;
+
+    for(size_t i = 0; i < t->key_size; i += 8) {
+        memcpy(&word, (const char *)key + i, 8);
+        h = (h ^ word) * 0x9e3779b97f4a7c15ULL;
+    }
+    h ^= h >> 32;
+    return (uint32_t)h;
+}
+
+// Returns the pool position of the key, or TABLE_NONE with *slot set to the empty
+// index slot where it belongs
+static uint32_t table_find(TABLE *t, const void *key, uint32_t hash, uint32_t *slot)
+{
+    TABLE_SLOT *s;
+    uint32_t i;
+
+    for(i = hash & t->mask;; i = (i + 1) & t->mask) {
+        s = &t->slots[i];
+        if(s->entry == TABLE_NONE) break;
+        if(s->hash == hash && memcmp((char *)TABLE_ENTRY(t, s->entry) + t->key_offset, key, t->key_size) == 0)
+            return s->entry;
+    }
+    *slot = i;
+    return TABLE_NONE;
+}
+
+static void lru_unlink(TABLE *t, uint32_t e)
+{
+    TABLE_LINK *link = TABLE_LINK_AT(t, e);
+
+    if(link->prev != TABLE_NONE) {
+        TABLE_LINK_AT(t, link->prev)->next = link->next;
+    } else {
+        t->head = link->next;
+    }
+    if(link->next != TABLE_NONE) {
+        TABLE_LINK_AT(t, link->next)->prev = link->prev;
+    } else {
+        t->tail = link->prev;
+    }
+}
+
+static void lru_push(TABLE *t, uint32_t e)
+{
+    TABLE_LINK *link = TABLE_LINK_AT(t, e);
+
+    link->prev = TABLE_NONE;
+    link->next = t->head;
+    if(t->head != TABLE_NONE) TABLE_LINK_AT(t, t->head)->prev = e;
+    t->head = e;
+    if(t->tail == TABLE_NONE) t->tail = e;
+}
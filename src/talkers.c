@@ -0,0 +1,313 @@
+#include "talkers.h"
+#include "clock.h"
+
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+
+#define SLOT_MASK (TALKER_COUNTERS * 2 - 1)
+#define CELL_MASK (TALKER_CM_WIDTH - 1)
+
+static void sketch_count(TALKER_SKETCH *sk, uint64_t hash, unsigned long *weight, unsigned long *estimate);
+static void heap_update(TALKER_HEAP *hp, TALKER_KEY *key, uint32_t hash, unsigned long weight,
+        unsigned long estimate, unsigned long other, unsigned long other_estimate);
+static uint16_t heap_find(TALKER_HEAP *hp, TALKER_KEY *key, uint32_t hash, uint32_t *slot);
+static void heap_unindex(TALKER_HEAP *hp, uint16_t c);
+static void sift_up(TALKER_HEAP *hp, uint32_t i);
+static void sift_down(TALKER_HEAP *hp, uint32_t i);
+static void heap_move(TALKER_HEAP *hp, uint32_t to, uint32_t from);
+static void heap_place(TALKER_HEAP *hp, uint32_t i, TALKER_HEAP_NODE *node);
+static void top_insert(TALKER *top, int *len, TALKER *t);
+static uint64_t talker_hash(TALKER_KEY *key);
+static int compare_count(const void *a, const void *b);
+
+TALKER_TABLE *talker_table_new()
+{
+    TALKER_TABLE *tt;
+    TALKER_HEAP *hp;
+
+    tt = (TALKER_TABLE *)malloc(sizeof(TALKER_TABLE));
+    memset(tt, 0, sizeof(TALKER_TABLE));
+    pthread_mutex_init(&tt->lock, NULL);
+    for(int k = 0; k < TALKER_KINDS; ++k) {
+        for(int r = 0; r < TALKER_RANKS; ++r) {
+            hp = &tt->sketches[k].heaps[r];
+            memset(hp->slots, 0xff, sizeof(hp->slots));
+
+            // Unused nodes weigh the most so sifting never has to check the heap's length
+            for(int i = 0; i <= TALKER_COUNTERS; ++i) hp->heap[i].count = ULONG_MAX;
+        }
+    }
+    return tt;
+}
+
+// The key is hashed once and both weights are counted in the same cells. Each rank's
+// heap gets the estimate of the other weight for a talker it admits
+void talker_table_update(TALKER_TABLE *tt, int kind, TALKER_KEY *key, unsigned int packets,
+        unsigned long bytes)
+{
+    TALKER_SKETCH *sk = &tt->sketches[kind];
+    unsigned long weight[TALKER_RANKS], estimate[TALKER_RANKS];
+    uint64_t hash;
+
+    hash = talker_hash(key);
+    weight[TALKER_BY_BYTES] = bytes;
+    weight[TALKER_BY_PACKETS] = packets;
+    sketch_count(sk, hash, weight, estimate);
+    heap_update(&sk->heaps[TALKER_BY_BYTES], key, (uint32_t)hash, bytes, estimate[TALKER_BY_BYTES],
+            packets, estimate[TALKER_BY_PACKETS]);
+    heap_update(&sk->heaps[TALKER_BY_PACKETS], key, (uint32_t)hash, packets, estimate[TALKER_BY_PACKETS],
+            bytes, estimate[TALKER_BY_BYTES]);
+    tt->total[kind][TALKER_BY_BYTES] += bytes;
+    tt->total[kind][TALKER_BY_PACKETS] += packets;
+    tt->dirty = 1;
+}
+
+void talker_table_publish(TALKER_TABLE *tt, int force)
+{
+    TALKER sorted[TALKER_COUNTERS];
+    TALKER_HEAP *hp;
+    uint64_t mono;
+    int len;
+
+    if(!tt->dirty) return;
+    mono = monotonic_ns();
+    if(!force && mono - tt->published_ns < TALKER_PUBLISH_MS * 1000000ULL) return;
+    tt->published_ns = mono;
+    tt->dirty = 0;
+
+    for(int k = 0; k < TALKER_KINDS; ++k) {
+        for(int r = 0; r < TALKER_RANKS; ++r) {
+            hp = &tt->sketches[k].heaps[r];
+            for(uint32_t i = 0; i < hp->len; ++i) {
+                sorted[i] = hp->counters[i];
+                sorted[i].count = hp->heap[hp->counters[i].heap].count;
+            }
+            qsort(sorted, hp->len, sizeof(TALKER), compare_count);
+            len = hp->len < TALKER_TOP_MAX ? hp->len : TALKER_TOP_MAX;
+
+            pthread_mutex_lock(&tt->lock);
+            memcpy(tt->published.top[k][r], sorted, len * sizeof(TALKER));
+            tt->published.len[k][r] = len;
+            tt->published.total[k][r] = tt->total[k][r];
+            pthread_mutex_unlock(&tt->lock);
+        }
+    }
+}
+
+// Talkers seen by several tables, as with a fanout that spreads a host's flows, are added together
+void talker_summary_merge(TALKER_SUMMARY *sum, TALKER_TABLE *tt)
+{
+    TALKER *src, *dst;
+    int j;
+
+    pthread_mutex_lock(&tt->lock);
+    for(int k = 0; k < TALKER_KINDS; ++k) {
+        for(int r = 0; r < TALKER_RANKS; ++r) {
+            sum->total[k][r] += tt->published.total[k][r];
+            for(int i = 0; i < tt->published.len[k][r]; ++i) {
+                src = &tt->published.top[k][r][i];
+                for(j = 0; j < sum->len[k][r]; ++j)
+                    if(sum->top[k][r][j].hash == src->hash &&
+                            memcmp(&sum->top[k][r][j].key, &src->key, sizeof(TALKER_KEY)) == 0)
+                        break;
+
+                if(j == sum->len[k][r]) {
+                    top_insert(sum->top[k][r], &sum->len[k][r], src);
+                    continue;
+                }
+                dst = &sum->top[k][r][j];
+                dst->count += src->count;
+                dst->error += src->error;
+                dst->other += src->other;
+            }
+        }
+    }
+    pthread_mutex_unlock(&tt->lock);
+}
+
+void talker_summary_sort(TALKER_SUMMARY *sum)
+{
+    for(int k = 0; k < TALKER_KINDS; ++k)
+        for(int r = 0; r < TALKER_RANKS; ++r)
+            qsort(sum->top[k][r], sum->len[k][r], sizeof(TALKER), compare_count);
+}
+
+// Adds the weights to one cell of each row and returns the least of each across the
+// rows. The rows' cells are picked by double hashing with the two halves of the hash
+static void sketch_count(TALKER_SKETCH *sk, uint64_t hash, unsigned long *weight, unsigned long *estimate)
+{
+    uint32_t h1 = (uint32_t)hash, h2 = (uint32_t)(hash >> 32) | 1;
+    TALKER_CELL *cell;
+
+    estimate[TALKER_BY_BYTES] = estimate[TALKER_BY_PACKETS] = ULONG_MAX;
+    for(int row = 0; row < TALKER_CM_ROWS; ++row) {
+        cell = &sk->cells[row][(h1 + row * h2) & CELL_MASK];
+        for(int r = 0; r < TALKER_RANKS; ++r) {
+            cell->weight[r] += weight[r];
+            if(cell->weight[r] < estimate[r]) estimate[r] = cell->weight[r];
+        }
+    }
+}
+
+// A known talker gains weight and sinks. Anyone else takes a free counter, or replaces
+// the lightest if its estimate is heavier. It starts from the estimate, and all but
+// this update's weight is the bound on its overestimate
+static void heap_update(TALKER_HEAP *hp, TALKER_KEY *key, uint32_t hash, unsigned long weight,
+        unsigned long estimate, unsigned long other, unsigned long other_estimate)
+{
+    TALKER *t;
+    uint32_t slot;
+    uint16_t c;
+
+    // A counter grows by exactly what its cells grow by once admitted, so it never
+    // outweighs the estimate and a talker estimated below the lightest is not held
+    if(hp->len == TALKER_COUNTERS && estimate < hp->heap[0].count) return;
+
+    if((c = heap_find(hp, key, hash, &slot)) != TALKER_EMPTY) {
+        t = &hp->counters[c];
+        hp->heap[t->heap].count += weight;
+        t->other += other;
+        sift_down(hp, t->heap);
+        return;
+    }
+
+    if(hp->len < TALKER_COUNTERS) {
+        c = hp->len;
+        t = &hp->counters[c];
+        t->heap = hp->len;
+        hp->heap[hp->len++].counter = c;
+    } else {
+        if(estimate <= hp->heap[0].count) return;
+        c = hp->heap[0].counter;
+        t = &hp->counters[c];
+        heap_unindex(hp, c);
+        heap_find(hp, key, hash, &slot);
+    }
+    t->key = *key;
+    t->hash = hash;
+    t->error = estimate - weight;
+    t->other = other_estimate;
+    hp->heap[t->heap].count = estimate;
+    hp->slots[slot] = c;
+
+    // A fresh counter starts at the bottom and may be lighter than its parent,
+    // a replaced one only grew from the root
+    if(t->heap == 0) {
+        sift_down(hp, 0);
+    } else {
+        sift_up(hp, t->heap);
+    }
+}
+
+// Returns the counter holding the key, or TALKER_EMPTY with *slot set to the empty
+// index slot where it belongs
+static uint16_t heap_find(TALKER_HEAP *hp, TALKER_KEY *key, uint32_t hash, uint32_t *slot)
+{
+    uint32_t i;
+    uint16_t c;
+
+    for(i = hash & SLOT_MASK;; i = (i + 1) & SLOT_MASK) {
+        c = hp->slots[i];
+        if(c == TALKER_EMPTY) break;
+        if(hp->counters[c].hash == hash && memcmp(&hp->counters[c].key, key, sizeof(TALKER_KEY)) == 0) return c;
+    }
+    *slot = i;
+    return TALKER_EMPTY;
+}
+
+// Removes a counter from the index, shifting later slots of its probe run back
+static void heap_unindex(TALKER_HEAP *hp, uint16_t c)
+{
+    uint32_t i, j, k;
+
+    for(i = hp->counters[c].hash & SLOT_MASK; hp->slots[i] != c; i = (i + 1) & SLOT_MASK);
+    for(j = i;;) {
+        j = (j + 1) & SLOT_MASK;
+        if(hp->slots[j] == TALKER_EMPTY) break;
+
+        // A slot stays put if its home lies cyclically in (i, j]
+        k = hp->counters[hp->slots[j]].hash & SLOT_MASK;
+        if((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) continue;
+        hp->slots[i] = hp->slots[j];
+        i = j;
+    }
+    hp->slots[i] = TALKER_EMPTY;
+}
+
+static void sift_up(TALKER_HEAP *hp, uint32_t i)
+{
+    TALKER_HEAP_NODE node;
+    uint32_t parent;
+
+    node = hp->heap[i];
+    while(i > 0) {
+        parent = (i - 1) / 2;
+        if(hp->heap[parent].count <= node.count) break;
+        heap_move(hp, i, parent);
+        i = parent;
+    }
+    heap_place(hp, i, &node);
+}
+
+static void sift_down(TALKER_HEAP *hp, uint32_t i)
+{
+    TALKER_HEAP_NODE node;
+    uint32_t child;
+
+    node = hp->heap[i];
+    while((child = i * 2 + 1) < hp->len) {
+        // Picks the lighter child without a branch, which would mispredict half the time
+        child += hp->heap[child + 1].count < hp->heap[child].count;
+        if(node.count <= hp->heap[child].count) break;
+        heap_move(hp, i, child);
+        i = child;
+    }
+    heap_place(hp, i, &node);
+}
+
+// Moves the node at from into the hole at to
+static void heap_move(TALKER_HEAP *hp, uint32_t to, uint32_t from)
+{
+    hp->heap[to] = hp->heap[from];
+    hp->counters[hp->heap[to].counter].heap = to;
+}
+
+static void heap_place(TALKER_HEAP *hp, uint32_t i, TALKER_HEAP_NODE *node)
+{
+    hp->heap[i] = *node;
+    hp->counters[node->counter].heap = i;
+}
+
+// Keeps the TALKER_TOP_MAX heaviest talkers, in no particular order
+static void top_insert(TALKER *top, int *len, TALKER *t)
+{
+    int min = 0;
+
+    if(*len < TALKER_TOP_MAX) {
+        top[(*len)++] = *t;
+        return;
+    }
+    for(int i = 1; i < *len; ++i)
+        if(top[i].count < top[min].count) min = i;
+    if(t->count > top[min].count) top[min] = *t;
+}
+
+// Mixes the key a word at a time, the key is a multiple of eight bytes. The sketch
+// uses both halves of the result, the heaps only the low one
+static uint64_t talker_hash(TALKER_KEY *key)
+{
+    uint64_t words[sizeof(TALKER_KEY) / 8], h = 0;
+
+    memcpy(words, key, sizeof(words));
+    for(size_t i = 0; i < sizeof(words) / 8; ++i) h = (h ^ words[i]) * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 29);
+}
+
+static int compare_count(const void *a, const void *b)
+{
+    const TALKER *ta = a, *tb = b;
+
+    if(ta->count == tb->count) return 0;
+    return (ta->count < tb->count) ? 1 : -1;
+}
@@ -0,0 +1,153 @@
+#include "timing.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void record_gap(TIMING *t, int cls, uint64_t ts_ns);
+static void hist_record(HISTOGRAM *h, uint64_t value);
+static void percentiles(TIMING_PERCENTILES *p, HISTOGRAM *now, HISTOGRAM *prev);
+static uint64_t bucket_value(int i);
+
+TIMING *timing_new(unsigned int burst_packets, unsigned int burst_usecs)
+{
+    TIMING *t;
+
+    t = (TIMING *)malloc(sizeof(TIMING));
+    memset(t, 0, sizeof(TIMING));
+    t->arrivals = (uint64_t *)calloc(burst_packets, sizeof(uint64_t));
+    t->burst_packets = burst_packets;
+    t->burst_usecs = burst_usecs;
+    t->burst_ns = burst_usecs * 1000ULL;
+    return t;
+}
+
+// The slot about to be overwritten holds the arrival burst_packets - 1 frames before
+// this one, so a burst is a single subtraction away
+void timing_update(TIMING *t, int cls, uint64_t ts_ns)
+{
+    uint64_t oldest;
+    unsigned long joined;
+
+    record_gap(t, TIMING_ALL, ts_ns);
+    if(cls != TIMING_ALL) record_gap(t, cls, ts_ns);
+    t->seq++;
+
+    t->arrivals[t->pos] = ts_ns;
+    if(++t->pos == t->burst_packets) t->pos = 0;
+    oldest = t->arrivals[t->pos];
+
+    // Timestamps that went backwards wrap around and never look like a burst
+    if(!oldest || ts_ns - oldest > t->burst_ns) {
+        t->run = 0;
+        return;
+    }
+
+    // The frames before this one join the burst when it starts, bar any the burst
+    // before already counted when the two are less than a window apart
+    joined = t->run ? 1 : t->seq - t->counted;
+    if(joined > t->burst_packets) joined = t->burst_packets;
+    t->counted = t->seq;
+    if(!t->run) STAT_INC(t->bursts);
+    t->run += joined;
+    STAT_ADD(t->burst_frames, joined);
+    if(t->run > t->burst_max) __atomic_store_n(&t->burst_max, t->run, __ATOMIC_RELAXED);
+}
+
+void timing_summary_merge(TIMING_SUMMARY *sum, TIMING *t)
+{
+    unsigned long max;
+
+    for(int c = 0; c < TIMING_CLASSES; ++c) {
+        for(int i = 0; i < HIST_BUCKETS; ++i)
+            sum->gaps[c].counts[i] += __atomic_load_n(&t->gaps[c].counts[i], __ATOMIC_RELAXED);
+        max = __atomic_load_n(&t->gaps[c].max, __ATOMIC_RELAXED);
+        if(max > sum->gaps[c].max) sum->gaps[c].max = max;
+    }
+
+    sum->workers++;
+    sum->burst_packets = t->burst_packets;
+    sum->burst_usecs = t->burst_usecs;
+    sum->bursts += __atomic_load_n(&t->bursts, __ATOMIC_RELAXED);
+    sum->burst_frames += __atomic_load_n(&t->burst_frames, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&t->burst_max, __ATOMIC_RELAXED);
+    if(max > sum->burst_max) sum->burst_max = max;
+}
+
+void timing_stats(TIMING_STATS *stats, TIMING_SUMMARY *now, TIMING_SUMMARY *prev)
+{
+    for(int c = 0; c < TIMING_CLASSES; ++c)
+        percentiles(&stats->gaps[c], &now->gaps[c], prev ? &prev->gaps[c] : NULL);
+    stats->workers = now->workers;
+    stats->burst_packets = now->burst_packets;
+    stats->burst_usecs = now->burst_usecs;
+    stats->bursts = now->bursts;
+    stats->burst_frames = now->burst_frames;
+    stats->burst_max = now->burst_max;
+}
+
+// The first frame of a class has nothing to be measured against
+static void record_gap(TIMING *t, int cls, uint64_t ts_ns)
+{
+    uint64_t last;
+
+    last = t->last_ns[cls];
+    t->last_ns[cls] = ts_ns;
+    if(!last) return;
+    hist_record(&t->gaps[cls], ts_ns > last ? ts_ns - last : 0);
+}
+
+// The bucket is the value's top HIST_SUB_BITS + 1 bits offset by how far they were
+// shifted, small values are shifted by nothing and index themselves
+static void hist_record(HISTOGRAM *h, uint64_t value)
+{
+    int shift;
+    unsigned long *count;
+
+    shift = 63 - __builtin_clzll(value | (HIST_SUBS * 2 - 1)) - HIST_SUB_BITS;
+    count = &h->counts[shift * HIST_SUBS + (value >> shift)];
+    STAT_INC(*count);
+    if(value > h->max) __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+}
+
+// Walks the buckets of the difference once, reporting the highest value of the bucket
+// each rank falls in, but never more than the largest value seen
+static void percentiles(TIMING_PERCENTILES *p, HISTOGRAM *now, HISTOGRAM *prev)
+{
+    static const unsigned long per_10k[3] = { 5000, 9900, 9990 };
+    uint64_t *values[3] = { &p->p50, &p->p99, &p->p999 };
+    unsigned long n = 0, seen = 0, count, rank;
+    int q = 0, top = 0;
+
+    memset(p, 0, sizeof(TIMING_PERCENTILES));
+    for(int i = 0; i < HIST_BUCKETS; ++i) {
+        count = now->counts[i] - (prev ? prev->counts[i] : 0);
+        if(count) top = i;
+        n += count;
+    }
+    if(!n) return;
+
+    p->samples = n;
+    rank = (n * per_10k[0] + 9999) / 10000;
+    for(int i = 0; i <= top && q < 3; ++i) {
+        seen += now->counts[i] - (prev ? prev->counts[i] : 0);
+        while(q < 3 && seen >= rank) {
+            *values[q++] = bucket_value(i);
+            if(q < 3) rank = (n * per_10k[q] + 9999) / 10000;
+        }
+    }
+    p->max = bucket_value(top);
+    for(int i = 0; i < 3; ++i)
+        if(*values[i] > now->max) *values[i] = now->max;
+    if(p->max > now->max) p->max = now->max;
+}
+
+// The highest value that falls in bucket i
+static uint64_t bucket_value(int i)
+{
+    int shift;
+
+    if(i < HIST_SUBS * 2) return i;
+    shift = i / HIST_SUBS - 1;
+    return ((uint64_t)(i - shift * HIST_SUBS + 1) << shift) - 1;
+}
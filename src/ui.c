@@ -1,8 +1,17 @@
 #include "ui.h"
 
-#include <ncurses.h>
+#include "packet.h"
+#include "addrset.h"
 
-#define MIN_STAT_DISPLAY 8
+#include <ncurses.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#define MIN_STAT_DISPLAY 14
 #define MIN_IP_SPACING 23
 #define MIN_MAC_SPACING 20
 #define MAX_MAC_SPACING_FACTOR 0.35
@@ -14,9 +23,42 @@
 #define ARP_TYPES_LINE     2
 #define NETRANS_TYPES_LINE 3
 #define RATE_DISPLAY_LINE  4
-#define ERROR_DISPLAY_LINE 5
-
-#define K 1024
+#define ETHER_RATES_LINE   5
+#define IP_RATES_LINE      6
+#define TIMING_DISPLAY_LINE 7
+#define ETHER_TIMING_LINE  8
+#define ERROR_DISPLAY_LINE 9
+#define DISTINCT_DISPLAY_LINE 10
+#define QUEUE_DISPLAY_LINE 11
+#define VIEW_STATUS_LINE   12
+
+#define PENDING_LINES 256 // Lines buffered between frames, older ones would scroll away anyway
+#define MAX_LINE 40       // Longest string kept for a single display field
+#define MAX_UI_ERROR 255
+#define MAX_ENDPOINT 48   // Longest formatted address and port
+#define MAX_TALKER 96     // Longest formatted address pair
+#define MAX_RATE 16       // Longest formatted rate
+#define MAX_RATE_LINE 256 // Longest line of rates or timings
+#define MAX_DURATION 16   // Longest formatted duration
+#define MAX_VOLUME 16     // Longest formatted host volume
+
+#define FLOW_PROTO_WIDTH 6
+#define FLOW_COUNT_WIDTH 12
+#define TALKER_SHARE_WIDTH 7
+#define HOST_VOLUME_WIDTH 7
+#define SESSION_COUNT_WIDTH 8
+#define SESSION_RATE_WIDTH 11
+#define SESSION_SHARE_WIDTH 6
+#define SESSION_LATENCY_WIDTH 8
+#define SESSION_FIXED_WIDTH (SESSION_COUNT_WIDTH * 3 + SESSION_RATE_WIDTH + SESSION_SHARE_WIDTH + SESSION_LATENCY_WIDTH + 7)
+
+// A packet line waiting to be drawn, the MACs are only formatted if the line is drawn
+typedef struct {
+    uint8_t mac_dest[6];
+    uint8_t mac_src[6];
+    const char *type;
+    const char *type_type;
+} UI_PACKET_LINE;
 
 typedef struct {
 
@@ -30,22 +72,81 @@ typedef struct {
     WINDOW *mac_display;
     int mac_display_width;
     int mac_spacing;
-    int mac_lineno;
 
     // Properties for the IP address display window
     WINDOW *ip_display;
     int ip_display_width;
     int ip_spacing;
-    int ip_lineno;
+
+    // Render thread, everything below is shared with the capture path under lock
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int running;
+    int fps;
+
+    UI_PACKET_LINE packets[PENDING_LINES];
+    int packet_start, packet_len;
+    ui_totals_source totals;
+    ui_hosts_source hosts;
+    ui_flows_source flows;
+    ui_talkers_source talkers;
+    ui_sessions_source sessions;
+    int view;
+    int view_dirty;
+    int host_rank;            // What the address panes are ordered by
+    int host_rank_dirty;
+    RATE rates[RATE_WINDOWS];
+    CAPTURE_STATS kernel[2];  // Totals and the last second, shown with the rates
+    int kernel_shown;
+    unsigned int sample;      // One flow in sample is decoded in full
+    int rates_dirty;
+    HLL_ESTIMATE distinct;
+    int distinct_dirty;
+    TIMING_STATS timing;
+    int timing_dirty;
+    SPSC_STATS queues;
+    int queues_dirty;
+    char error[MAX_UI_ERROR + 1];
+    int error_dirty;
 
 } UI;
 
-static UI ui;
+static UI ui = { .lock = PTHREAD_MUTEX_INITIALIZER };
 
 static void calculate_spacing();
 static void print_headers();
-
-void ui_init()
+static void print_view_header(int view);
+static void print_host_headers(int rank);
+static void *render_thread(void *arg);
+static void render_frame();
+static void draw_packet(UI_PACKET_LINE *line);
+static void format_mac(uint8_t *ma, char *buffer);
+static void format_addr(uint8_t family, uint8_t *a, char *buffer);
+static void draw_hosts(WINDOW *win, int width, HOST_ENTRY *hosts, int len, int rank);
+static char *format_volume(unsigned long volume, char *buffer);
+static void draw_ether_types(NETMON_STATS *totals);
+static void draw_ip_types(NETMON_STATS *totals);
+static void draw_arp_types(NETMON_STATS *totals);
+static void draw_netrans_types(NETMON_STATS *totals);
+static void draw_rate(RATE *rates, CAPTURE_STATS *kernel, unsigned int sample);
+static char *format_rate(double rate, const char *unit, char *buffer);
+static void draw_distinct(HLL_ESTIMATE *distinct);
+static char *format_estimate(double estimate, char *buffer);
+static void draw_timing(TIMING_STATS *timing);
+static void draw_queues(SPSC_STATS *queues);
+static char *format_duration(uint64_t ns, char *buffer);
+static void draw_error(const char *error_msg);
+static void draw_flows(FLOW_SUMMARY *flows);
+static void format_endpoint(FLOW_KEY *key, int dst, char *buffer);
+static void draw_talkers(TALKER_SUMMARY *talkers, int rank);
+static void format_talker(TALKER_KEY *key, int kind, char *buffer);
+static void draw_sessions(NETRANS_SUMMARY *sessions);
+static void format_session(NETRANS_SESSION *s, char *buffer);
+static const char *proto_name(uint8_t proto, char *buffer);
+
+// Sets up the screen and starts the render thread drawing fps frames per second
+void ui_init(int fps, ui_totals_source totals, ui_hosts_source hosts, ui_flows_source flows,
+        ui_talkers_source talkers, ui_sessions_source sessions)
 {
 
     initscr();
@@ -67,30 +168,301 @@ void ui_init()
     wrefresh(ui.packet_display);
     ui.packet_lineno = 0;
 
-    // Initializing mac address display
+    // Initializing mac address display, redrawn whole whenever its hosts change
     ui.mac_display = newwin(LINES - MIN_STAT_DISPLAY - 2, ui.mac_display_width, 
             MIN_STAT_DISPLAY, ui.packet_display_width + 2);
-    scrollok(ui.mac_display, true);
     wrefresh(ui.mac_display);
-    ui.mac_lineno = 0;
 
-    // Initializing mac address display
+    // Initializing ip address display
     ui.ip_display = newwin(LINES - MIN_STAT_DISPLAY - 2, ui.ip_display_width, 
             MIN_STAT_DISPLAY, ui.packet_display_width + ui.mac_display_width + 4);
-    scrollok(ui.ip_display, true);
     wrefresh(ui.ip_display);
-    ui.ip_lineno = 0;
+
+    // From here on only the render thread touches ncurses
+    pthread_mutex_init(&ui.lock, NULL);
+    ui.fps = fps;
+    ui.totals = totals;
+    ui.hosts = hosts;
+    ui.flows = flows;
+    ui.talkers = talkers;
+    ui.sessions = sessions;
+    ui.view = UI_VIEW_PACKETS;
+    ui.running = 1;
+    pthread_create(&ui.thread, NULL, render_thread, NULL);
+}
+
+void ui_shutdown()
+{
+    pthread_mutex_lock(&ui.lock);
+    ui.running = 0;
+    pthread_mutex_unlock(&ui.lock);
+    pthread_join(ui.thread, NULL);
+
+    delwin(ui.packet_display);
+    delwin(ui.mac_display);
+    delwin(ui.ip_display);
+    endwin();
+}
+
+// Queues a packet line for the next frame
+void ui_display_packet(uint8_t *mac_dest, uint8_t *mac_src, const char *type, const char *type_type)
+{
+    UI_PACKET_LINE *line;
+
+    pthread_mutex_lock(&ui.lock);
+    if(ui.packet_len == PENDING_LINES) {
+        ui.packet_start = (ui.packet_start + 1) % PENDING_LINES;
+        ui.packet_len--;
+    }
+    line = &ui.packets[(ui.packet_start + ui.packet_len++) % PENDING_LINES];
+    memcpy(line->mac_dest, mac_dest, 6);
+    memcpy(line->mac_src, mac_src, 6);
+    line->type = type;
+    line->type_type = type_type;
+    pthread_mutex_unlock(&ui.lock);
+}
+
+// Switches the main window between the packet log, the flow table, the talkers and
+// the netrans sessions
+void ui_set_view(int view)
+{
+    pthread_mutex_lock(&ui.lock);
+    if(view == UI_VIEW_FLOWS && !ui.flows) {
+        snprintf(ui.error, sizeof(ui.error), "Flow tracking is disabled");
+        ui.error_dirty = 1;
+    } else if(view != ui.view) {
+        ui.view = view;
+        ui.view_dirty = 1;
+    }
+    pthread_mutex_unlock(&ui.lock);
+}
+
+void ui_next_host_rank()
+{
+    pthread_mutex_lock(&ui.lock);
+    ui.host_rank = (ui.host_rank + 1) % HOST_RANKS;
+    ui.host_rank_dirty = 1;
+    pthread_mutex_unlock(&ui.lock);
 }
 
-void ui_display_packet(char *mac_dest, char *mac_src, char *type, char *type_type)
+void ui_display_rate(RATE *rates, CAPTURE_STATS *kernel, CAPTURE_STATS *last_second, unsigned int sample)
 {
+    pthread_mutex_lock(&ui.lock);
+    memcpy(ui.rates, rates, sizeof(ui.rates));
+    ui.sample = sample;
+    if((ui.kernel_shown = kernel != NULL)) {
+        ui.kernel[0] = *kernel;
+        ui.kernel[1] = *last_second;
+    }
+    ui.rates_dirty = 1;
+    pthread_mutex_unlock(&ui.lock);
+}
+
+void ui_display_distinct(HLL_ESTIMATE *distinct)
+{
+    pthread_mutex_lock(&ui.lock);
+    ui.distinct = *distinct;
+    ui.distinct_dirty = 1;
+    pthread_mutex_unlock(&ui.lock);
+}
+
+void ui_display_timing(TIMING_STATS *timing)
+{
+    pthread_mutex_lock(&ui.lock);
+    ui.timing = *timing;
+    ui.timing_dirty = 1;
+    pthread_mutex_unlock(&ui.lock);
+}
+
+void ui_display_queues(SPSC_STATS *queues)
+{
+    pthread_mutex_lock(&ui.lock);
+    ui.queues = *queues;
+    ui.queues_dirty = 1;
+    pthread_mutex_unlock(&ui.lock);
+}
+
+void ui_display_error(const char *error_msg)
+{
+    pthread_mutex_lock(&ui.lock);
+
+    // Without a display, such as when running headless, errors go to stderr
+    if(!ui.running) {
+        pthread_mutex_unlock(&ui.lock);
+        fprintf(stderr, "Warning: %s.\n", error_msg);
+        return;
+    }
+    snprintf(ui.error, sizeof(ui.error), "%s", error_msg);
+    ui.error_dirty = 1;
+    pthread_mutex_unlock(&ui.lock);
+}
+
+// Draws one frame per tick until ui_shutdown is called
+static void *render_thread(void *arg)
+{
+    struct timespec next;
+    long frame_ns;
+
+    frame_ns = 1000000000L / ui.fps;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    for(;;) {
+        pthread_mutex_lock(&ui.lock);
+        if(!ui.running) {
+            pthread_mutex_unlock(&ui.lock);
+            break;
+        }
+        render_frame();
+
+        next.tv_nsec += frame_ns;
+        if(next.tv_nsec >= 1000000000L) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+
+    return NULL;
+}
+
+// Takes everything queued since the last frame and draws it with a single screen update,
+// called with the lock held and releases it before touching the terminal
+static void render_frame()
+{
+    static UI_PACKET_LINE packets[PENDING_LINES];
+    static NETMON_STATS totals, drawn;
+    static HOST_SUMMARY hosts, drawn_hosts;
+    static FLOW_SUMMARY flows, drawn_flows;
+    static TALKER_SUMMARY talkers, drawn_talkers;
+    static NETRANS_SUMMARY sessions, drawn_sessions;
+    static char error[MAX_UI_ERROR + 1];
+    static HLL_ESTIMATE distinct;
+    static RATE rates[RATE_WINDOWS];
+    static CAPTURE_STATS kernel[2];
+    static TIMING_STATS timing;
+    static SPSC_STATS queues;
+    static unsigned int sample;
+    int packet_start, packet_len, totals_dirty, rates_dirty, kernel_shown = 0, error_dirty, view, view_dirty, flows_dirty = 0;
+    int talkers_dirty = 0, sessions_dirty = 0, distinct_dirty, timing_dirty, queues_dirty, hosts_dirty, host_rank;
+
+    // Copy out the pending state so the capture path is held up as briefly as possible
+    packet_start = ui.packet_start;
+    packet_len = ui.packet_len;
+    for(int i = 0; i < packet_len; ++i)
+        packets[(packet_start + i) % PENDING_LINES] = ui.packets[(packet_start + i) % PENDING_LINES];
+    ui.packet_start = ui.packet_len = 0;
+    rates_dirty = ui.rates_dirty;
+    if(rates_dirty) {
+        memcpy(rates, ui.rates, sizeof(rates));
+        sample = ui.sample;
+        if((kernel_shown = ui.kernel_shown)) memcpy(kernel, ui.kernel, sizeof(kernel));
+    }
+    error_dirty = ui.error_dirty;
+    if(error_dirty) memcpy(error, ui.error, sizeof(error));
+    distinct_dirty = ui.distinct_dirty;
+    if(distinct_dirty) distinct = ui.distinct;
+    timing_dirty = ui.timing_dirty;
+    if(timing_dirty) timing = ui.timing;
+    queues_dirty = ui.queues_dirty;
+    if(queues_dirty) queues = ui.queues;
+    ui.rates_dirty = ui.error_dirty = ui.distinct_dirty = ui.timing_dirty = ui.queues_dirty = 0;
+    view = ui.view;
+    view_dirty = ui.view_dirty;
+    ui.view_dirty = 0;
+    host_rank = ui.host_rank;
+    hosts_dirty = ui.host_rank_dirty;
+    ui.host_rank_dirty = 0;
+    pthread_mutex_unlock(&ui.lock);
+
+    // The counters are pulled rather than pushed, so the capture path never has to publish them
+    ui.totals(&totals);
+    totals_dirty = memcmp(&totals, &drawn, sizeof(NETMON_STATS)) != 0;
+    if(totals_dirty) memcpy(&drawn, &totals, sizeof(NETMON_STATS));
+
+    // The address panes are always on screen
+    memset(&hosts, 0, sizeof(HOST_SUMMARY));
+    ui.hosts(&hosts);
+    hosts_dirty = hosts_dirty || memcmp(&hosts, &drawn_hosts, sizeof(HOST_SUMMARY)) != 0;
+    if(hosts_dirty) memcpy(&drawn_hosts, &hosts, sizeof(HOST_SUMMARY));
+
+    // Flows are only pulled while they are on screen
+    if(view == UI_VIEW_FLOWS) {
+        memset(&flows, 0, sizeof(FLOW_SUMMARY));
+        ui.flows(&flows);
+        flows_dirty = view_dirty || memcmp(&flows, &drawn_flows, sizeof(FLOW_SUMMARY)) != 0;
+        if(flows_dirty) memcpy(&drawn_flows, &flows, sizeof(FLOW_SUMMARY));
+    } else if(view == UI_VIEW_TALKERS_BYTES || view == UI_VIEW_TALKERS_PACKETS) {
+        memset(&talkers, 0, sizeof(TALKER_SUMMARY));
+        ui.talkers(&talkers);
+        talkers_dirty = view_dirty || memcmp(&talkers, &drawn_talkers, sizeof(TALKER_SUMMARY)) != 0;
+        if(talkers_dirty) memcpy(&drawn_talkers, &talkers, sizeof(TALKER_SUMMARY));
+    } else if(view == UI_VIEW_SESSIONS) {
+        memset(&sessions, 0, sizeof(NETRANS_SUMMARY));
+        ui.sessions(&sessions);
+        sessions_dirty = view_dirty || memcmp(&sessions, &drawn_sessions, sizeof(NETRANS_SUMMARY)) != 0;
+        if(sessions_dirty) memcpy(&drawn_sessions, &sessions, sizeof(NETRANS_SUMMARY));
+    }
+
+    if(!packet_len && !hosts_dirty && !totals_dirty && !rates_dirty && !error_dirty &&
+            !view_dirty && !flows_dirty && !talkers_dirty && !sessions_dirty && !distinct_dirty &&
+            !timing_dirty && !queues_dirty) return;
+
+    if(view_dirty) {
+        print_view_header(view);
+        werase(ui.packet_display);
+        ui.packet_lineno = 0;
+        move(VIEW_STATUS_LINE, 1);
+        clrtoeol();
+    }
+    if(view == UI_VIEW_PACKETS) {
+        for(int i = 0; i < packet_len; ++i)
+            draw_packet(&packets[(packet_start + i) % PENDING_LINES]);
+    } else if(flows_dirty) {
+        draw_flows(&flows);
+    } else if(talkers_dirty) {
+        draw_talkers(&talkers, view == UI_VIEW_TALKERS_BYTES ? TALKER_BY_BYTES : TALKER_BY_PACKETS);
+    } else if(sessions_dirty) {
+        draw_sessions(&sessions);
+    }
+    if(hosts_dirty) {
+        print_host_headers(host_rank);
+        draw_hosts(ui.mac_display, ui.mac_display_width, hosts.top[HOST_MAC][host_rank],
+                hosts.len[HOST_MAC][host_rank], host_rank);
+        draw_hosts(ui.ip_display, ui.ip_display_width, hosts.top[HOST_IP][host_rank],
+                hosts.len[HOST_IP][host_rank], host_rank);
+    }
+    if(totals_dirty) {
+        draw_ether_types(&totals);
+        draw_ip_types(&totals);
+        draw_arp_types(&totals);
+        draw_netrans_types(&totals);
+    }
+    if(rates_dirty) draw_rate(rates, kernel_shown ? kernel : NULL, sample);
+    if(distinct_dirty) draw_distinct(&distinct);
+    if(timing_dirty) draw_timing(&timing);
+    if(queues_dirty) draw_queues(&queues);
+    if(error_dirty) draw_error(error);
+
+    wnoutrefresh(stdscr);
+    wnoutrefresh(ui.packet_display);
+    wnoutrefresh(ui.mac_display);
+    wnoutrefresh(ui.ip_display);
+    doupdate();
+}
+
+static void draw_packet(UI_PACKET_LINE *line)
+{
+    char mac_dest[MAX_LINE];
+    char mac_src[MAX_LINE];
+
+    format_mac(line->mac_dest, mac_dest);
+    format_mac(line->mac_src, mac_src);
     wmove(ui.packet_display, ui.packet_lineno, 0);
     wprintw(ui.packet_display, "%-*s %-*s %-*s %-*s", 
            ui.packet_spacing[0], mac_dest, 
            ui.packet_spacing[0], mac_src, 
-           ui.packet_spacing[1], type, 
-           ui.packet_spacing[1], type_type);
-    wrefresh(ui.packet_display);
+           ui.packet_spacing[1], line->type, 
+           ui.packet_spacing[1], line->type_type);
     if(ui.packet_lineno == LINES - MIN_STAT_DISPLAY - 2) {
         scroll(ui.packet_display);
     } else {
@@ -99,99 +471,397 @@ void ui_display_packet(char *mac_dest, char *mac_src, char *type, char *type_typ
         
 }
 
-void ui_display_ip_addr(char *addr)
+static void format_mac(uint8_t *ma, char *buffer)
 {
-    wmove(ui.ip_display, ui.ip_lineno, 1);
-    wprintw(ui.ip_display, "%s", addr);
-    wrefresh(ui.ip_display);
-    if(ui.ip_lineno == LINES - MIN_STAT_DISPLAY - 3) {
-        scroll(ui.ip_display);
+    sprintf(buffer, "%02x:%02x:%02x:%02x:%02x:%02x",
+            ma[0], ma[1], ma[2], ma[3], ma[4], ma[5]);
+}
+
+// IPv6 addresses are shown in full, every group without leading zeros
+static void format_addr(uint8_t family, uint8_t *a, char *buffer)
+{
+    if(family == ADDR_MAC) {
+        format_mac(a, buffer);
+    } else if(family == ADDR_IP4) {
+        sprintf(buffer, "%d.%d.%d.%d", a[0], a[1], a[2], a[3]);
     } else {
-        ui.ip_lineno++;
+        sprintf(buffer, "%x:%x:%x:%x:%x:%x:%x:%x",
+                a[0] << 8 | a[1], a[2] << 8 | a[3], a[4] << 8 | a[5], a[6] << 8 | a[7],
+                a[8] << 8 | a[9], a[10] << 8 | a[11], a[12] << 8 | a[13], a[14] << 8 | a[15]);
     }
 }
 
-void ui_display_ether_types(int arp, int ip4, int ip6, int netrans)
+// Lists a pane's hosts in rank order, each with its packets or, ranked by bytes or last
+// seen, its bytes, sent and received together. The volume is left off a line too narrow for it
+static void draw_hosts(WINDOW *win, int width, HOST_ENTRY *hosts, int len, int rank)
+{
+    char addr[MAX_LINE], volume[MAX_VOLUME];
+    HOST_ENTRY *h;
+    int rows, room;
+
+    werase(win);
+    rows = LINES - MIN_STAT_DISPLAY - 2;
+    room = width - HOST_VOLUME_WIDTH - 2;
+    for(int i = 0; i < len && i < rows; ++i) {
+        h = &hosts[i];
+        format_addr(h->key.family, h->key.addr, addr);
+        format_volume(rank == HOST_BY_PACKETS ? h->tx_packets + h->rx_packets : h->tx_bytes + h->rx_bytes, volume);
+        if((int)strlen(addr) <= room) {
+            mvwprintw(win, i, 1, "%-*s %*s", room, addr, HOST_VOLUME_WIDTH, volume);
+        } else {
+            mvwprintw(win, i, 1, "%.*s", width - 1, addr);
+        }
+    }
+}
+
+// Packets and bytes in at most HOST_VOLUME_WIDTH characters
+static char *format_volume(unsigned long volume, char *buffer)
+{
+    static const char *prefixes = "kMGTPE";
+    double v = volume;
+    int p = -1;
+
+    if(volume < 100000) {
+        sprintf(buffer, "%lu", volume);
+        return buffer;
+    }
+    while(v >= 1000 && p < 5) {
+        v /= 1000;
+        p++;
+    }
+    sprintf(buffer, "%.1f%c", v, prefixes[p]);
+    return buffer;
+}
+
+static void draw_ether_types(NETMON_STATS *totals)
 {
     move(ETHER_TYPES_LINE, 1);
     clrtoeol();
-    printw("ARP: %d    IPv4: %d    IPv6: %d    NETRANS: %d", arp, ip4, ip6, netrans);
-    refresh();
+    printw("ARP: %lu    IPv4: %lu    IPv6: %lu    NETRANS: %lu    VLAN tagged: %lu",
+            totals->arp_total, totals->ip4_total, totals->ip6_total, totals->netrans_total, totals->vlan_total);
 }
 
-void ui_display_ip_types(int tcp, int udp, int igmp, int icmp)
+static void draw_ip_types(NETMON_STATS *totals)
 {
     move(IP_TYPES_LINE, 1);
     clrtoeol();
-    printw("TCP: %d    UDP: %d    IGMP: %d    ICMP: %d", tcp, udp, igmp, icmp);
-    refresh();
+    printw("TCP: %lu    UDP: %lu    IGMP: %lu    ICMP: %lu",
+            totals->tcp_total, totals->udp_total, totals->igmp_total, totals->icmp_total);
 }
 
-void ui_display_arp_types(int reply, int request)
+static void draw_arp_types(NETMON_STATS *totals)
 {
     move(ARP_TYPES_LINE, 1);
     clrtoeol();
-    printw("ARP Request: %d    ARP Reply: %d", request, reply);
-    refresh();
+    printw("ARP Request: %lu    ARP Reply: %lu", totals->request_total, totals->reply_total);
 }
 
-void ui_display_netrans_types(int send_total, int receive_total, int ack_total, int chunk_total)
+static void draw_netrans_types(NETMON_STATS *totals)
 {
     move(NETRANS_TYPES_LINE, 1);
     clrtoeol();
-    printw("NETRANS send: %d    NETRANS receive: %d    NETRANS ack: %d    NETRANS chunk: %d", send_total, receive_total, ack_total, chunk_total);
-    refresh();
+    printw("NETRANS send: %lu    NETRANS receive: %lu    NETRANS ack: %lu    NETRANS chunk: %lu",
+            totals->send_total, totals->receive_total, totals->ack_total, totals->chunk_total);
 }
 
-void ui_display_rate(int volume)
+// All traffic over every window, then each ethertype and IP protocol over the last
+// second. The lines are clipped to the screen rather than wrapping onto the next, so
+// the kernel's drops lead the first line, a rate counted with frames missing is no rate.
+// So does the sampling ratio while overloaded, the flows, talkers and packets shown are a sample
+static void draw_rate(RATE *rates, CAPTURE_STATS *kernel, unsigned int sample)
 {
-    double rate;
+    static const char *names[RATE_CLASSES] = { "", "ARP", "IPv4", "IPv6", "NETRANS", "IGMP", "ICMP", "TCP", "UDP" };
+    char bps[MAX_RATE], pps[MAX_RATE], line[MAX_RATE_LINE];
+    int len;
+
+    len = snprintf(line, sizeof(line), "Rate");
+    if(sample > 1) len += snprintf(line + len, sizeof(line) - len, "   Sampling 1 in %u", sample);
+    if(kernel)
+        len += snprintf(line + len, sizeof(line) - len, "   Dropped: %lu (+%lu/s)  Frozen: %lu (+%lu/s)",
+                kernel[0].drops, kernel[1].drops, kernel[0].freezes, kernel[1].freezes);
+    for(int w = 0; w < RATE_WINDOWS; ++w)
+        len += snprintf(line + len, sizeof(line) - len, "   %s: %s %s", rate_window_names[w],
+                format_rate(rates[w].bps[RATE_ALL], "b/s", bps), format_rate(rates[w].pps[RATE_ALL], "pps", pps));
+    mvprintw(RATE_DISPLAY_LINE, 1, "%.*s", COLS - 2, line);
+    clrtoeol();
 
-    rate = (double)volume;
-    
-    move(RATE_DISPLAY_LINE, 1);
+    len = 0;
+    for(int c = RATE_ARP; c <= RATE_NETRANS; ++c)
+        len += snprintf(line + len, sizeof(line) - len, "%s: %s %s   ", names[c],
+                format_rate(rates[RATE_1S].bps[c], "b/s", bps), format_rate(rates[RATE_1S].pps[c], "pps", pps));
+    mvprintw(ETHER_RATES_LINE, 1, "%.*s", COLS - 2, line);
     clrtoeol();
 
-    if(rate > K) {
-        rate /= K;
-        if(rate > K) {
-            rate /= K;
-            if(rate > K) {
-                rate /= K;
-                printw("Rate: %6.02f  gb/s", rate);
-            } else {
-                printw("Rate: %6.02f  mb/s", rate);
-            }
-        } else {
-            printw("Rate: %6.02f  kb/s", rate);
-        }
+    len = 0;
+    for(int c = RATE_IGMP; c <= RATE_UDP; ++c)
+        len += snprintf(line + len, sizeof(line) - len, "%s: %s %s   ", names[c],
+                format_rate(rates[RATE_1S].bps[c], "b/s", bps), format_rate(rates[RATE_1S].pps[c], "pps", pps));
+    mvprintw(IP_RATES_LINE, 1, "%.*s", COLS - 2, line);
+    clrtoeol();
+}
+
+// Network rates use decimal prefixes
+static char *format_rate(double rate, const char *unit, char *buffer)
+{
+    if(rate >= 1e9) {
+        snprintf(buffer, MAX_RATE, "%5.1f G%s", rate / 1e9, unit);
+    } else if(rate >= 1e6) {
+        snprintf(buffer, MAX_RATE, "%5.1f M%s", rate / 1e6, unit);
+    } else if(rate >= 1e3) {
+        snprintf(buffer, MAX_RATE, "%5.1f k%s", rate / 1e3, unit);
     } else {
-        printw("Rate: %6.02f  b/s", rate);
+        snprintf(buffer, MAX_RATE, "%5.1f %s", rate, unit);
     }
+    return buffer;
+}
 
-    refresh();
+// Estimates of distinct source/destination addresses since the start and over the last minute
+static void draw_distinct(HLL_ESTIMATE *distinct)
+{
+    char b[10][16];
+
+    move(DISTINCT_DISPLAY_LINE, 1);
+    clrtoeol();
+    printw("Distinct MAC: %s  IPv4: %s/%s  IPv6: %s/%s    Last minute MAC: %s  IPv4: %s/%s  IPv6: %s/%s",
+            format_estimate(distinct->total[HLL_MAC], b[0]),
+            format_estimate(distinct->total[HLL_IP4_SRC], b[1]), format_estimate(distinct->total[HLL_IP4_DST], b[2]),
+            format_estimate(distinct->total[HLL_IP6_SRC], b[3]), format_estimate(distinct->total[HLL_IP6_DST], b[4]),
+            format_estimate(distinct->window[HLL_MAC], b[5]),
+            format_estimate(distinct->window[HLL_IP4_SRC], b[6]), format_estimate(distinct->window[HLL_IP4_DST], b[7]),
+            format_estimate(distinct->window[HLL_IP6_SRC], b[8]), format_estimate(distinct->window[HLL_IP6_DST], b[9]));
 }
 
-void ui_display_mac_addr(char *addr)
+// How full the queues between the capture and decode threads are now and have been,
+// a high water mark near the size or any overflows mean decoding is the bottleneck
+static void draw_queues(SPSC_STATS *queues)
 {
-    wmove(ui.mac_display, ui.mac_lineno, 1);
-    wprintw(ui.mac_display, "%s", addr);
-    wrefresh(ui.mac_display);
-    if(ui.mac_lineno == LINES - MIN_STAT_DISPLAY - 3) {
-        scroll(ui.mac_display);
+    move(QUEUE_DISPLAY_LINE, 1);
+    clrtoeol();
+    printw("Queue depth: %lu/%lu  high water: %lu  overflows: %lu",
+            queues->depth, queues->slots, queues->high_water, queues->overflows);
+}
+
+static char *format_estimate(double estimate, char *buffer)
+{
+    if(estimate >= 1e6) {
+        sprintf(buffer, "%.1fM", estimate / 1e6);
+    } else if(estimate >= 1e4) {
+        sprintf(buffer, "%.0fk", estimate / 1e3);
     } else {
-        ui.mac_lineno++;
+        sprintf(buffer, "%.0f", estimate);
     }
+    return buffer;
 }
 
-void ui_display_error(const char *error_msg)
+// Percentiles of the gaps between frames over the last second, for all frames and then
+// each ethertype, with the bursts since the start. Several workers each time their own frames
+static void draw_timing(TIMING_STATS *timing)
+{
+    static const char *names[TIMING_CLASSES] = { "", "ARP", "IPv4", "IPv6", "NETRANS" };
+    char d[4][MAX_DURATION], line[MAX_RATE_LINE];
+    TIMING_PERCENTILES *p;
+    int len;
+
+    p = &timing->gaps[TIMING_ALL];
+    snprintf(line, sizeof(line), "Gaps%s p50: %s  p99: %s  p999: %s  max: %s    Bursts of %u in %uus: %lu  largest: %lu",
+            timing->workers > 1 ? " per worker" : "", format_duration(p->p50, d[0]), format_duration(p->p99, d[1]), format_duration(p->p999, d[2]),
+            format_duration(p->max, d[3]), timing->burst_packets, timing->burst_usecs, timing->bursts, timing->burst_max);
+    mvprintw(TIMING_DISPLAY_LINE, 1, "%.*s", COLS - 2, line);
+    clrtoeol();
+
+    len = 0;
+    for(int c = TIMING_ARP; c < TIMING_CLASSES; ++c) {
+        p = &timing->gaps[c];
+        if(!p->samples) {
+            len += snprintf(line + len, sizeof(line) - len, "%s: -   ", names[c]);
+            continue;
+        }
+        len += snprintf(line + len, sizeof(line) - len, "%s: %s/%s/%s/%s   ", names[c],
+                format_duration(p->p50, d[0]), format_duration(p->p99, d[1]),
+                format_duration(p->p999, d[2]), format_duration(p->max, d[3]));
+    }
+    mvprintw(ETHER_TIMING_LINE, 1, "%.*s", COLS - 2, line);
+    clrtoeol();
+}
+
+static char *format_duration(uint64_t ns, char *buffer)
+{
+    if(ns >= 1000000000ULL) {
+        snprintf(buffer, MAX_DURATION, "%.2fs", ns / 1e9);
+    } else if(ns >= 1000000) {
+        snprintf(buffer, MAX_DURATION, "%.1fms", ns / 1e6);
+    } else if(ns >= 1000) {
+        snprintf(buffer, MAX_DURATION, "%.1fus", ns / 1e3);
+    } else {
+        snprintf(buffer, MAX_DURATION, "%luns", (unsigned long)ns);
+    }
+    return buffer;
+}
+
+static void draw_error(const char *error_msg)
 {
     move(ERROR_DISPLAY_LINE, 1);
     clrtoeol();
     attron(COLOR_PAIR(2));
-    printw(error_msg);
+    printw("%s", error_msg);
     attroff(COLOR_PAIR(2));
-    refresh();
+}
+
+// Lists the busiest flows, replacing whatever the window showed before
+static void draw_flows(FLOW_SUMMARY *flows)
+{
+    char src[MAX_ENDPOINT], dst[MAX_ENDPOINT], proto[8];
+    int rows, width;
+
+    move(VIEW_STATUS_LINE, 1);
+    clrtoeol();
+    printw("Flows: %lu    Evicted: %lu    Expired: %lu", flows->active, flows->evicted, flows->expired);
+
+    werase(ui.packet_display);
+    width = (ui.packet_display_width - FLOW_PROTO_WIDTH - FLOW_COUNT_WIDTH * 2 - 4) / 2;
+    rows = LINES - MIN_STAT_DISPLAY - 1;
+    for(int i = 0; i < flows->len && i < rows; ++i) {
+        format_endpoint(&flows->flows[i].key, 0, src);
+        format_endpoint(&flows->flows[i].key, 1, dst);
+        mvwprintw(ui.packet_display, i, 0, "%-*s %-*.*s %-*.*s %*lu %*lu",
+                FLOW_PROTO_WIDTH, proto_name(flows->flows[i].key.proto, proto),
+                width, width, src, width, width, dst,
+                FLOW_COUNT_WIDTH, flows->flows[i].packets, FLOW_COUNT_WIDTH, flows->flows[i].bytes);
+    }
+}
+
+// Formats one end of a flow as address:port, with IPv6 addresses in brackets
+static void format_endpoint(FLOW_KEY *key, int dst, char *buffer)
+{
+    char addr[INET6_ADDRSTRLEN];
+    uint16_t port;
+
+    inet_ntop(key->family == ADDR_IP6 ? AF_INET6 : AF_INET, dst ? key->dst : key->src, addr, sizeof(addr));
+    port = dst ? key->dport : key->sport;
+    if(key->family == ADDR_IP6) {
+        snprintf(buffer, MAX_ENDPOINT, port ? "[%s]:%u" : "%s", addr, port);
+    } else {
+        snprintf(buffer, MAX_ENDPOINT, port ? "%s:%u" : "%s", addr, port);
+    }
+}
+
+// Lists the heaviest talkers of each kind, a section each, ranked by bytes or packets
+static void draw_talkers(TALKER_SUMMARY *talkers, int rank)
+{
+    static const char *titles[TALKER_KINDS] = { "Source MAC", "Source IP", "IP Pair" };
+    char name[MAX_TALKER];
+    unsigned long bytes, packets;
+    int per, lineno, width;
+    TALKER *t;
+
+    move(VIEW_STATUS_LINE, 1);
+    clrtoeol();
+    printw("Top talkers by %s    Press t for bytes, n for packets",
+            rank == TALKER_BY_BYTES ? "bytes" : "packets");
+
+    werase(ui.packet_display);
+    width = ui.packet_display_width - FLOW_COUNT_WIDTH * 2 - TALKER_SHARE_WIDTH - 3;
+    per = (LINES - MIN_STAT_DISPLAY - 1) / TALKER_KINDS - 1;
+    lineno = 0;
+    for(int k = 0; k < TALKER_KINDS; ++k) {
+        wattron(ui.packet_display, A_BOLD);
+        mvwprintw(ui.packet_display, lineno++, 0, "%s", titles[k]);
+        wattroff(ui.packet_display, A_BOLD);
+        for(int i = 0; i < per; ++i, ++lineno) {
+            if(i >= talkers->len[k][rank]) continue;
+            t = &talkers->top[k][rank][i];
+            bytes = (rank == TALKER_BY_BYTES) ? t->count : t->other;
+            packets = (rank == TALKER_BY_BYTES) ? t->other : t->count;
+            format_talker(&t->key, k, name);
+            mvwprintw(ui.packet_display, lineno, 0, "%-*.*s %*lu %*lu %*.1f%%",
+                    width, width, name, FLOW_COUNT_WIDTH, bytes, FLOW_COUNT_WIDTH, packets,
+                    TALKER_SHARE_WIDTH - 1, talkers->total[k][rank] ? 100.0 * t->count / talkers->total[k][rank] : 0.0);
+        }
+    }
+}
+
+// A pair is shown as source > destination
+static void format_talker(TALKER_KEY *key, int kind, char *buffer)
+{
+    char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+    int af;
+
+    if(key->family == ADDR_MAC) {
+        format_mac(key->addr, buffer);
+        return;
+    }
+    af = (key->family == ADDR_IP6) ? AF_INET6 : AF_INET;
+    inet_ntop(af, key->addr, src, sizeof(src));
+    if(kind == TALKER_IP_PAIR) {
+        inet_ntop(af, key->addr + 16, dst, sizeof(dst));
+        snprintf(buffer, MAX_TALKER, "%s > %s", src, dst);
+    } else {
+        snprintf(buffer, MAX_TALKER, "%s", src);
+    }
+}
+
+// Lists the busiest netrans sessions with the goodput of their chunks over the time
+// they were sent, the share of chunk bytes that were goodput and the mean ACK latency
+static void draw_sessions(NETRANS_SUMMARY *sessions)
+{
+    char name[MAX_TALKER], rate[MAX_RATE], latency[MAX_DURATION];
+    NETRANS_SESSION *s;
+    double secs;
+    int rows, width;
+
+    move(VIEW_STATUS_LINE, 1);
+    clrtoeol();
+    printw("Sessions: %lu    Evicted: %lu    Expired: %lu", sessions->active, sessions->evicted, sessions->expired);
+
+    werase(ui.packet_display);
+    width = ui.packet_display_width - SESSION_FIXED_WIDTH;
+    rows = LINES - MIN_STAT_DISPLAY - 1;
+    for(int i = 0; i < sessions->len && i < rows; ++i) {
+        s = &sessions->sessions[i];
+        format_session(s, name);
+        secs = (s->chunk_last_ns - s->chunk_first_ns) / 1e9;
+        format_rate(secs > 0 ? s->goodput * 8 / secs : 0, "b/s", rate);
+        if(s->acked) {
+            format_duration(s->ack_total_ns / s->acked, latency);
+        } else {
+            snprintf(latency, MAX_DURATION, "-");
+        }
+        mvwprintw(ui.packet_display, i, 0, "%-*.*s %*lu %*s %*.1f%% %*lu %*lu %*s",
+                width, width, name, SESSION_COUNT_WIDTH, s->chunks, SESSION_RATE_WIDTH, rate,
+                SESSION_SHARE_WIDTH - 1, s->chunk_bytes ? 100.0 * s->goodput / s->chunk_bytes : 0.0,
+                SESSION_COUNT_WIDTH, s->duplicates, SESSION_COUNT_WIDTH, s->reordered, SESSION_LATENCY_WIDTH, latency);
+    }
+}
+
+// The sender comes first once a chunk has been seen, as sender > receiver
+static void format_session(NETRANS_SESSION *s, char *buffer)
+{
+    char a[18], b[18];
+    int first;
+
+    first = s->chunks ? s->sender : 0;
+    format_mac(s->key.mac[first], a);
+    format_mac(s->key.mac[!first], b);
+    snprintf(buffer, MAX_TALKER, s->chunks ? "%s/%u > %s/%u" : "%s/%u - %s/%u",
+            a, s->key.id[first], b, s->key.id[!first]);
+}
+
+static const char *proto_name(uint8_t proto, char *buffer)
+{
+    switch(proto) {
+        case IP_PROTOCOL_TCP:
+            return "TCP";
+        case IP_PROTOCOL_UDP:
+            return "UDP";
+        case IP_PROTOCOL_ICMP:
+        case IP_PROTOCOL_IP6ICMP:
+            return "ICMP";
+        case IP_PROTOCOL_IGMP:
+            return "IGMP";
+        default:
+            sprintf(buffer, "%u", proto);
+            return buffer;
+    }
 }
 
 static void calculate_spacing()
@@ -222,31 +892,74 @@ static void print_headers()
 {
     int hoffset = 0;
 
+    print_view_header(UI_VIEW_PACKETS);
     attron(COLOR_PAIR(1));
 
-    // Printing packet display header
-    move(MIN_STAT_DISPLAY - 1, hoffset);
-    printw(" %-*s %-*s %-*s %-*s", 
-            ui.packet_spacing[0], "MAC Destination", 
-            ui.packet_spacing[0], "MAC Source", 
-            ui.packet_spacing[1], "Protocol", 
-            ui.packet_spacing[1] - 1, "Type");
     hoffset += ui.packet_display_width + 1;
     move(MIN_STAT_DISPLAY - 1, hoffset);
     vline(' ', LINES - MIN_STAT_DISPLAY);
 
-    // Printing MAC address display header
-    hoffset++;
-    move(MIN_STAT_DISPLAY - 1, hoffset);
-    printw(" %-*s", ui.mac_spacing, "MAC Addresses");
-    hoffset += ui.mac_display_width + 1;
+    hoffset += ui.mac_display_width + 2;
     move(MIN_STAT_DISPLAY - 1, hoffset);
     vline(' ', LINES - MIN_STAT_DISPLAY);
 
-    // Printing MAC address display header
-    hoffset++;
-    move(MIN_STAT_DISPLAY - 1, hoffset);
-    printw(" %-*s", ui.ip_spacing, "IP Addresses");
+    attroff(COLOR_PAIR(1));
+    print_host_headers(HOST_BY_BYTES);
+}
 
+// Names the address panes along with what they are ordered by
+static void print_host_headers(int rank)
+{
+    static const char *ranks[HOST_RANKS] = { "bytes", "packets", "last seen" };
+    char title[MAX_LINE];
+
+    attron(COLOR_PAIR(1));
+    snprintf(title, sizeof(title), "MAC Addresses by %s", ranks[rank]);
+    mvprintw(MIN_STAT_DISPLAY - 1, ui.packet_display_width + 2, " %-*.*s", ui.mac_spacing, ui.mac_spacing, title);
+    snprintf(title, sizeof(title), "IP Addresses by %s", ranks[rank]);
+    mvprintw(MIN_STAT_DISPLAY - 1, ui.packet_display_width + ui.mac_display_width + 4, " %-*.*s",
+            ui.ip_spacing, ui.ip_spacing, title);
+    attroff(COLOR_PAIR(1));
+}
+
+// The header above the main window depends on what it shows
+static void print_view_header(int view)
+{
+    int width;
+
+    attron(COLOR_PAIR(1));
+    move(MIN_STAT_DISPLAY - 1, 0);
+    if(view == UI_VIEW_PACKETS) {
+        printw(" %-*s %-*s %-*s %-*s",
+                ui.packet_spacing[0], "MAC Destination",
+                ui.packet_spacing[0], "MAC Source",
+                ui.packet_spacing[1], "Protocol",
+                ui.packet_spacing[1] - 1, "Type");
+    } else if(view == UI_VIEW_FLOWS) {
+        width = (ui.packet_display_width - FLOW_PROTO_WIDTH - FLOW_COUNT_WIDTH * 2 - 4) / 2;
+        printw(" %-*s %-*s %-*s %*s %*s",
+                FLOW_PROTO_WIDTH, "Proto",
+                width, "Source",
+                width, "Destination",
+                FLOW_COUNT_WIDTH, "Packets",
+                FLOW_COUNT_WIDTH, "Bytes");
+    } else if(view == UI_VIEW_SESSIONS) {
+        width = ui.packet_display_width - SESSION_FIXED_WIDTH;
+        printw(" %-*s %*s %*s %*s %*s %*s %*s",
+                width, "Session",
+                SESSION_COUNT_WIDTH, "Chunks",
+                SESSION_RATE_WIDTH, "Goodput",
+                SESSION_SHARE_WIDTH, "Eff",
+                SESSION_COUNT_WIDTH, "Dups",
+                SESSION_COUNT_WIDTH, "Reorder",
+                SESSION_LATENCY_WIDTH, "ACK");
+    } else {
+        width = ui.packet_display_width - FLOW_COUNT_WIDTH * 2 - TALKER_SHARE_WIDTH - 3;
+        printw(" %-*s %*s %*s %*s",
+                width, "Talker",
+                FLOW_COUNT_WIDTH, "Bytes",
+                FLOW_COUNT_WIDTH, "Packets",
+                TALKER_SHARE_WIDTH, "Share");
+    }
     attroff(COLOR_PAIR(1));
 }
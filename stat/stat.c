@@ -0,0 +1,171 @@
+#include "shmstats.h"
+#include "errors.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+// Defines the output formats
+#define FORMAT_TEXT 0
+#define FORMAT_JSON 1 // One JSON object per read and line
+
+static const char *ethertypes[SHM_ETHERTYPES] = { "ip4", "ip6", "arp", "netrans" };
+static const char *protocols[SHM_PROTOCOLS] = { "icmp", "igmp", "tcp", "udp" };
+static const char *windows[SHM_RATE_WINDOWS] = { "100ms", "1s", "10s", "60s" };
+static const char *classes[SHM_RATE_CLASSES] = { "all", "arp", "ip4", "ip6", "netrans", "igmp", "icmp", "tcp", "udp" };
+static const char *kinds[SHM_KINDS] = { "mac", "ip4_src", "ip4_dst", "ip6_src", "ip6_dst" };
+
+static void print_text(SHM_STATS *s);
+static void print_json(SHM_STATS *s);
+static double age(SHM_STATS *s);
+static void usage(char *name);
+
+// Reads netmon's shared memory stats, once or every interval, without disturbing netmon
+int main(int argc, char *argv[])
+{
+    SHM_STATS *seg, copy;
+    char *name = DEFAULT_SHM_NAME;
+    double interval = 0;
+    long count = -1;
+    int format = FORMAT_TEXT, opt;
+    char *endptr;
+
+    while((opt = getopt(argc, argv, "n:i:c:o:h")) != -1) {
+        switch(opt) {
+            case 'n':
+                name = optarg;
+                break;
+            case 'i':
+                interval = strtod(optarg, &endptr);
+                if(*endptr != '\0' || interval <= 0) {
+                    sprintf(error_msg, "Invalid interval '%.100s'", optarg);
+                    die(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                count = strtol(optarg, &endptr, 10);
+                if(*endptr != '\0' || count <= 0) {
+                    sprintf(error_msg, "Invalid count '%.100s'", optarg);
+                    die(EXIT_FAILURE);
+                }
+                break;
+            case 'o':
+                if(strcmp(optarg, "text") == 0) {
+                    format = FORMAT_TEXT;
+                } else if(strcmp(optarg, "json") == 0) {
+                    format = FORMAT_JSON;
+                } else {
+                    sprintf(error_msg, "Invalid format '%.100s'", optarg);
+                    die(EXIT_FAILURE);
+                }
+                break;
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    // Without a count, read once, or until interrupted when given an interval
+    if(count == -1) count = interval > 0 ? 0 : 1;
+    if(!(seg = shm_stats_attach(name))) die(EXIT_FAILURE);
+
+    for(long i = 0; count == 0 || i < count; ++i) {
+        if(i) usleep(interval * 1e6);
+        if(shm_stats_read(seg, &copy) == -1) die(EXIT_FAILURE);
+        if(format == FORMAT_JSON) {
+            print_json(&copy);
+        } else {
+            print_text(&copy);
+        }
+        fflush(stdout);
+    }
+
+    shm_stats_detach(seg);
+    return EXIT_SUCCESS;
+}
+
+static void print_text(SHM_STATS *s)
+{
+    printf("netmon %u, update %lu, %.3f seconds ago\n", s->pid, (unsigned long)s->updates, age(s));
+    printf("%-10s %16lu packets %18lu bytes\n", "total", (unsigned long)s->packets, (unsigned long)s->bytes);
+    for(int i = 0; i < SHM_ETHERTYPES; ++i)
+        printf("%-10s %16lu packets %18lu bytes\n", ethertypes[i], (unsigned long)s->ethertype_packets[i],
+                (unsigned long)s->ethertype_bytes[i]);
+    for(int i = 0; i < SHM_PROTOCOLS; ++i)
+        printf("%-10s %16lu packets %18lu bytes\n", protocols[i], (unsigned long)s->protocol_packets[i],
+                (unsigned long)s->protocol_bytes[i]);
+    printf("%-10s %16lu requests %17lu replies\n", "arp", (unsigned long)s->arp_request, (unsigned long)s->arp_reply);
+    printf("%-10s %16lu send %lu receive %lu ack %lu chunk\n", "netrans", (unsigned long)s->netrans_send,
+            (unsigned long)s->netrans_receive, (unsigned long)s->netrans_ack, (unsigned long)s->netrans_chunk);
+    printf("%-10s %16lu packets %16lu drops %lu freezes\n", "kernel", (unsigned long)s->kernel_packets,
+            (unsigned long)s->kernel_drops, (unsigned long)s->kernel_freezes);
+    printf("%-10s %16lu shed, 1 in %lu decoded in full\n", "sampling", (unsigned long)s->shed,
+            (unsigned long)s->sample_ratio);
+    for(int w = 0; w < SHM_RATE_WINDOWS; ++w)
+        printf("rate %-5s %16.0f bps %22.1f pps\n", windows[w], s->bps[w][0], s->pps[w][0]);
+    printf("addresses  %16lu ip %23lu mac\n", (unsigned long)s->ip_addrs, (unsigned long)s->mac_addrs);
+    printf("distinct  ");
+    for(int k = 0; k < SHM_KINDS; ++k)
+        printf(" %s %.0f", kinds[k], s->distinct[k]);
+    printf("\nlast min  ");
+    for(int k = 0; k < SHM_KINDS; ++k)
+        printf(" %s %.0f", kinds[k], s->distinct_window[k]);
+    printf("\n\n");
+}
+
+static void print_json(SHM_STATS *s)
+{
+    printf("{\"pid\":%u,\"update\":%lu,\"age\":%.3f,\"packets\":%lu,\"bytes\":%lu,\"ethertype\":{", s->pid,
+            (unsigned long)s->updates, age(s), (unsigned long)s->packets, (unsigned long)s->bytes);
+    for(int i = 0; i < SHM_ETHERTYPES; ++i)
+        printf("%s\"%s\":{\"packets\":%lu,\"bytes\":%lu}", i ? "," : "", ethertypes[i],
+                (unsigned long)s->ethertype_packets[i], (unsigned long)s->ethertype_bytes[i]);
+    printf("},\"ip_protocol\":{");
+    for(int i = 0; i < SHM_PROTOCOLS; ++i)
+        printf("%s\"%s\":{\"packets\":%lu,\"bytes\":%lu}", i ? "," : "", protocols[i],
+                (unsigned long)s->protocol_packets[i], (unsigned long)s->protocol_bytes[i]);
+    printf("},\"arp\":{\"request\":%lu,\"reply\":%lu},\"netrans\":{\"send\":%lu,\"receive\":%lu,\"ack\":%lu,\"chunk\":%lu},",
+            (unsigned long)s->arp_request, (unsigned long)s->arp_reply, (unsigned long)s->netrans_send,
+            (unsigned long)s->netrans_receive, (unsigned long)s->netrans_ack, (unsigned long)s->netrans_chunk);
+    printf("\"kernel\":{\"packets\":%lu,\"drops\":%lu,\"freezes\":%lu},", (unsigned long)s->kernel_packets,
+            (unsigned long)s->kernel_drops, (unsigned long)s->kernel_freezes);
+    printf("\"sampling\":{\"shed\":%lu,\"ratio\":%lu},", (unsigned long)s->shed, (unsigned long)s->sample_ratio);
+    printf("\"addresses\":{\"ip\":%lu,\"mac\":%lu},\"distinct\":{", (unsigned long)s->ip_addrs, (unsigned long)s->mac_addrs);
+    for(int k = 0; k < SHM_KINDS; ++k)
+        printf("%s\"%s\":%.0f", k ? "," : "", kinds[k], s->distinct[k]);
+    printf(",\"window\":{");
+    for(int k = 0; k < SHM_KINDS; ++k)
+        printf("%s\"%s\":%.0f", k ? "," : "", kinds[k], s->distinct_window[k]);
+    printf("}},\"rates\":{");
+    for(int w = 0; w < SHM_RATE_WINDOWS; ++w) {
+        printf("%s\"%s\":{", w ? "," : "", windows[w]);
+        for(int c = 0; c < SHM_RATE_CLASSES; ++c)
+            printf("%s\"%s\":{\"bps\":%.0f,\"pps\":%.1f}", c ? "," : "", classes[c], s->bps[w][c], s->pps[w][c]);
+        printf("}");
+    }
+    printf("}}\n");
+}
+
+// Seconds since the writer last updated the segment, a stopped netmon shows up as a growing age
+static double age(SHM_STATS *s)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return ((double)now.tv_sec * 1e9 + now.tv_nsec - (double)s->updated_ns) / 1e9;
+}
+
+static void usage(char *name)
+{
+    fprintf(stderr, "Usage: %s [-n <name>] [-i <seconds> [-c <count>]] [-o <format>]\n", name);
+    fprintf(stderr, "%-16s %s\n", "-n <name>", "Shared memory netmon publishes in with --shm (default /netmon)");
+    fprintf(stderr, "%-16s %s\n", "-i <seconds>", "Read again every interval, may be fractional, until interrupted");
+    fprintf(stderr, "%-16s %s\n", "-c <count>", "Stop after this many reads (default 1, or unlimited with -i)");
+    fprintf(stderr, "%-16s %s\n", "-o <format>", "Output format, 'text' (default) or 'json' (one object per line)");
+}
@@ -0,0 +1,112 @@
+#include "test.h"
+#include "decode.h"
+#include "packet.h"
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#define UDP_FRAME_LEN (sizeof(PACKET_ETH_HDR) + sizeof(PACKET_IP4_HDR) + 8)
+
+static int ip4_udp_frame(char *frame, uint8_t vers_ihl);
+static void test_ip4_ports();
+static void test_ip4_options();
+static void test_ip4_short_ihl();
+static void test_ip4_wrong_version();
+static void test_ip4_ihl_past_capture();
+
+void decode_tests()
+{
+    test_ip4_ports();
+    test_ip4_options();
+    test_ip4_short_ihl();
+    test_ip4_wrong_version();
+    test_ip4_ihl_past_capture();
+}
+
+// Builds an ethernet frame of an IPv4 UDP datagram from 10.0.0.1:1000 to 10.0.0.2:2000,
+// with its first header byte set to vers_ihl. Returns the frame's length
+static int ip4_udp_frame(char *frame, uint8_t vers_ihl)
+{
+    PACKET_ETH_HDR *eth = (PACKET_ETH_HDR *)frame;
+    PACKET_IP4_HDR *ip4 = (PACKET_IP4_HDR *)(frame + sizeof(PACKET_ETH_HDR));
+    uint16_t ports[2] = { htons(1000), htons(2000) };
+
+    memset(frame, 0, UDP_FRAME_LEN);
+    eth->eth_type = htons(ETH_TYPE_IP4);
+    ip4->ip4_vers_ihl = vers_ihl;
+    ip4->ip4_protocol = IP_PROTOCOL_UDP;
+    memcpy(ip4->ip4_src, "\x0a\x00\x00\x01", 4);
+    memcpy(ip4->ip4_dest, "\x0a\x00\x00\x02", 4);
+    memcpy(frame + sizeof(PACKET_ETH_HDR) + sizeof(PACKET_IP4_HDR), ports, sizeof(ports));
+    return UDP_FRAME_LEN;
+}
+
+static void test_ip4_ports()
+{
+    char frame[UDP_FRAME_LEN];
+    PACKET_VIEW v;
+    int len = ip4_udp_frame(frame, 0x45);
+
+    CHECK(decode_parse(&v, frame, len, len, 1) == 0);
+    CHECK(!v.truncated && !v.malformed);
+    CHECK(v.family == ADDR_IP4);
+    CHECK(v.l4 == (int)(sizeof(PACKET_ETH_HDR) + sizeof(PACKET_IP4_HDR)));
+    CHECK(v.sport == 1000 && v.dport == 2000);
+}
+
+// The ports follow the options
+static void test_ip4_options()
+{
+    char frame[UDP_FRAME_LEN + 4];
+    PACKET_VIEW v;
+    int len;
+
+    ip4_udp_frame(frame, 0x46);
+    memset(frame + sizeof(PACKET_ETH_HDR) + sizeof(PACKET_IP4_HDR), 0, 4);
+    memcpy(frame + sizeof(PACKET_ETH_HDR) + sizeof(PACKET_IP4_HDR) + 4, "\x00\x07\x00\x08", 4);
+    len = sizeof(frame);
+
+    CHECK(decode_parse(&v, frame, len, len, 1) == 0);
+    CHECK(!v.truncated && !v.malformed);
+    CHECK(v.l4 == (int)(sizeof(PACKET_ETH_HDR) + sizeof(PACKET_IP4_HDR) + 4));
+    CHECK(v.sport == 7 && v.dport == 8);
+}
+
+// A header length under 20 bytes would put the transport header inside the IP header
+static void test_ip4_short_ihl()
+{
+    char frame[UDP_FRAME_LEN];
+    PACKET_VIEW v;
+    int len = ip4_udp_frame(frame, 0x41);
+
+    CHECK(decode_parse(&v, frame, len, len, 1) == 0);
+    CHECK(v.malformed);
+    CHECK(v.l4 == 0);
+    CHECK(v.ip_src == NULL);
+    CHECK(v.sport == 0 && v.dport == 0);
+}
+
+static void test_ip4_wrong_version()
+{
+    char frame[UDP_FRAME_LEN];
+    PACKET_VIEW v;
+    int len = ip4_udp_frame(frame, 0x65);
+
+    CHECK(decode_parse(&v, frame, len, len, 1) == 0);
+    CHECK(v.malformed);
+    CHECK(v.sport == 0 && v.dport == 0);
+}
+
+// A header length reaching past what was captured is never read behind
+static void test_ip4_ihl_past_capture()
+{
+    char frame[UDP_FRAME_LEN];
+    PACKET_VIEW v;
+    int len = ip4_udp_frame(frame, 0x4f);
+
+    CHECK(decode_parse(&v, frame, len, len, 1) == 0);
+    CHECK(v.truncated);
+    CHECK(!v.malformed);
+    CHECK(v.l4 == 0);
+    CHECK(v.sport == 0 && v.dport == 0);
+}
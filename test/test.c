@@ -0,0 +1,16 @@
+#include "test.h"
+
+int test_failures = 0;
+
+int main(int argc, char *argv[])
+{
+    timing_tests();
+    decode_tests();
+
+    if(test_failures) {
+        fprintf(stderr, "%d checks failed\n", test_failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
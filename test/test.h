@@ -0,0 +1,21 @@
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <stdio.h>
+
+// Checks that failed, across every test run so far
+extern int test_failures;
+
+// Reports a check that does not hold and carries on with the test
+#define CHECK(cond) do { \
+    if(!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        test_failures++; \
+    } \
+} while(0)
+
+// The tests of each module, run in turn by test.c
+extern void timing_tests();
+extern void decode_tests();
+
+#endif
@@ -0,0 +1,83 @@
+#include "test.h"
+#include "timing.h"
+
+#include <stdlib.h>
+
+#define USEC 1000ULL
+
+static TIMING *replay(unsigned int burst_packets, unsigned int burst_usecs, uint64_t *arrivals, int count);
+static void test_single_burst();
+static void test_overlapping_bursts();
+static void test_merged_workers();
+
+void timing_tests()
+{
+    test_single_burst();
+    test_overlapping_bursts();
+    test_merged_workers();
+}
+
+// Times count frames arriving at the given microseconds
+static TIMING *replay(unsigned int burst_packets, unsigned int burst_usecs, uint64_t *arrivals, int count)
+{
+    TIMING *t;
+    int i;
+
+    t = timing_new(burst_packets, burst_usecs);
+    for(i = 0; i < count; i++)
+        timing_update(t, TIMING_ALL, 1000000 * USEC + arrivals[i] * USEC);
+    return t;
+}
+
+// A run of frames closer together than the window is one burst of all of them
+static void test_single_burst()
+{
+    uint64_t arrivals[] = { 0, 10, 20, 30, 40, 50, 500 };
+    TIMING *t;
+
+    t = replay(4, 100, arrivals, 7);
+    CHECK(t->bursts == 1);
+    CHECK(t->burst_frames == 6);
+    CHECK(t->burst_max == 6);
+    free(t->arrivals);
+    free(t);
+}
+
+// A burst that starts while frames of the one before are still in the window must
+// only count the frames after them
+static void test_overlapping_bursts()
+{
+    uint64_t arrivals[] = { 0, 10, 20, 30, 125, 126, 127 };
+    TIMING *t;
+
+    t = replay(4, 100, arrivals, 7);
+    CHECK(t->bursts == 2);
+    CHECK(t->burst_frames == 7);
+    CHECK(t->burst_frames <= 7);
+    CHECK(t->burst_max == 4);
+    free(t->arrivals);
+    free(t);
+}
+
+// Merged summaries say how many workers each timed their own frames
+static void test_merged_workers()
+{
+    uint64_t arrivals[] = { 0, 10, 20, 30 };
+    TIMING_SUMMARY sum = { 0 };
+    TIMING_STATS stats;
+    TIMING *a, *b;
+
+    a = replay(4, 100, arrivals, 4);
+    b = replay(4, 100, arrivals, 4);
+    timing_summary_merge(&sum, a);
+    timing_summary_merge(&sum, b);
+    timing_stats(&stats, &sum, NULL);
+    CHECK(stats.workers == 2);
+    CHECK(stats.bursts == 2);
+    CHECK(stats.burst_frames == 8);
+    CHECK(stats.gaps[TIMING_ALL].samples == 6);
+    free(a->arrivals);
+    free(a);
+    free(b->arrivals);
+    free(b);
+}